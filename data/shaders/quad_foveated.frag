@@ -0,0 +1,58 @@
+#version 430 core
+
+// Foveated frames: the focus and its blend band at full resolution, the
+// periphery at one texel per coarse pixel square with its representative
+// depth, negative where empty. Matches RayMarcher::composeFoveated.
+uniform sampler2D source_texture_in;
+uniform sampler2D periphery_texture_in;
+uniform sampler2D periphery_depth_in;
+uniform vec2 focus_center;
+uniform float focus_radius;
+uniform float blend_band;
+uniform float upsample_tolerance;
+
+in vec2 texture_coordinates;
+out vec4 fragment_color;
+
+void main() {
+	vec2 pixel = texture_coordinates * vec2(textureSize(source_texture_in, 0));
+	float focusDistance = length(pixel - focus_center);
+	vec4 focus = texture(source_texture_in, texture_coordinates);
+	if (focusDistance <= focus_radius) {
+		fragment_color = focus;
+		return;
+	}
+
+	// Bilinear taps, leaving out those whose depth differs from that of the
+	// nearest one by more than upsample_tolerance of it
+	ivec2 peripheryDims = textureSize(periphery_texture_in, 0);
+	vec2 p = texture_coordinates * vec2(peripheryDims) - 0.5;
+	ivec2 i0 = clamp(ivec2(floor(p)), ivec2(0), peripheryDims - 1);
+	ivec2 i1 = min(i0 + 1, peripheryDims - 1);
+	vec2 f = clamp(p - vec2(i0), 0.0, 1.0);
+	ivec2 taps[4] = ivec2[4](i0, ivec2(i1.x, i0.y), ivec2(i0.x, i1.y), i1);
+	float weights[4] = float[4]((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+	int nearest = 0;
+	for (int k = 1; k < 4; k++) {
+		if (weights[k] > weights[nearest]) {
+			nearest = k;
+		}
+	}
+	float reference = texelFetch(periphery_depth_in, taps[nearest], 0).r;
+	vec4 color = vec4(0.0);
+	float sum = 0.0;
+	for (int k = 0; k < 4; k++) {
+		float d = texelFetch(periphery_depth_in, taps[k], 0).r;
+		if ((d < 0.0) == (reference < 0.0) && abs(d - reference) <= upsample_tolerance * max(reference, 0.0)) {
+			color += weights[k] * texelFetch(periphery_texture_in, taps[k], 0);
+			sum += weights[k];
+		}
+	}
+	color /= sum;
+
+	// Across the band the traced focus fades into the periphery
+	if (focusDistance < focus_radius + blend_band) {
+		color = mix(focus, color, (focusDistance - focus_radius) / blend_band);
+	}
+	fragment_color = vec4(color.rgb, 1.0);
+}
@@ -0,0 +1,83 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  async_reader.h
+
+  Asynchronous file reader declaration. Requests are queued without blocking
+  and completions are collected by polling, so a frame loop can drive disk I/O
+  without ever waiting on it. Backends are io_uring (raw syscalls, no liburing
+  needed) and a pread thread pool fallback. With direct I/O, reads go through
+  aligned bounce buffers so callers need not care about O_DIRECT alignment.
+
+  November 2019
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  enum class IoBackend { IoUring, Pread };
+
+  IoBackend parseIoBackend(const std::string &str);
+  const char *toString(IoBackend backend);
+
+  struct ReadRequest {
+    uint64_t offset;
+    uint32_t size;
+    std::byte *dst;
+    uint64_t tag;
+  };
+
+  struct ReadCompletion {
+    uint64_t tag;
+    int64_t result; // Bytes read, or -errno
+  };
+
+  class AsyncReader {
+  public:
+    virtual ~AsyncReader() = default;
+
+    // Queues a batch of reads with a single submission; at most the queue
+    // depth is in flight at any time, the rest waits in a queue
+    virtual void submit(const std::vector<ReadRequest> &requests) = 0;
+
+    // Appends finished reads to completions; with wait, blocks until at least
+    // one read finished if any are pending
+    virtual void poll(std::vector<ReadCompletion> &completions, bool wait = false) = 0;
+
+    // Requests queued or in flight
+    virtual size_t getPending() const = 0;
+    virtual IoBackend getBackend() const = 0;
+
+    // Falls back to the pread backend if io_uring is unavailable
+    static std::unique_ptr<AsyncReader> create(IoBackend backend,
+                                               const std::string &filePath,
+                                               unsigned queueDepth = 32,
+                                               bool direct = false);
+  };
+} // namespace CUDAVol
@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  bounded_queue.h
+
+  Bounded blocking queue declaration and definition. Producers block while the
+  queue is full, which gives multi-stage pipelines back-pressure and bounds the
+  memory held between stages.
+
+  November 2019
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace CUDAVol {
+  template <typename T>
+  class BoundedQueue {
+  private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+  public:
+    BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1), closed(false) {}
+
+    // Returns false if the queue was closed before the item could be pushed
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+      if (closed) {
+        return false;
+      }
+      items.push_back(std::move(item));
+      notEmpty.notify_one();
+      return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T &item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+      if (items.empty()) {
+        return false;
+      }
+      item = std::move(items.front());
+      items.pop_front();
+      notFull.notify_one();
+      return true;
+    }
+
+    // Wakes all waiters; remaining items can still be popped
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      notFull.notify_all();
+      notEmpty.notify_all();
+    }
+
+    // Drops remaining items as well, used to abort a pipeline
+    void cancel() {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      items.clear();
+      notFull.notify_all();
+      notEmpty.notify_all();
+    }
+  };
+} // namespace CUDAVol
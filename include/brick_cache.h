@@ -0,0 +1,148 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_cache.h
+
+  Brick cache declaration. Keeps decoded bricks of a BrickedVolume resident
+  within a fixed byte budget, so volumes larger than host memory can be
+  sampled. Eviction uses the CLOCK algorithm over a flat slot array, and a
+  per-brick slot index makes lookups O(1) for millions of bricks. Bricks in use
+  are pinned through BrickRef handles and are never evicted.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "bricked_volume.h"
+#include "memory_map.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CUDAVol {
+  class BrickCache;
+
+  struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t inserts = 0;
+  };
+
+  // Pins a resident brick for as long as it lives
+  class BrickRef {
+  private:
+    BrickCache *cache;
+    uint32_t slot;
+    const std::byte *data;
+
+    friend class BrickCache;
+    BrickRef(BrickCache *cache, uint32_t slot, const std::byte *data);
+
+  public:
+    BrickRef();
+    ~BrickRef();
+
+    BrickRef(BrickRef &&other) noexcept;
+    BrickRef &operator=(BrickRef &&other) noexcept;
+    BrickRef(const BrickRef &) = delete;
+    BrickRef &operator=(const BrickRef &) = delete;
+
+    explicit operator bool() const {
+      return data != nullptr;
+    }
+
+    const std::byte *getData() const {
+      return data;
+    }
+
+    template <typename T>
+    const T *as() const {
+      return reinterpret_cast<const T *>(data);
+    }
+  };
+
+  class BrickCache {
+  private:
+    static constexpr uint32_t loadingBit = 1u << 31;
+    static constexpr uint32_t noBrick = UINT32_MAX;
+
+    struct Slot {
+      std::atomic<uint32_t> pins{0}; // Pin count, loadingBit while (re)filled
+      std::atomic<uint32_t> brick{noBrick};
+      std::atomic<bool> referenced{false};
+    };
+
+    const BrickedVolume &volume;
+    size_t brickBytes;
+    size_t slotCount;
+    MemoryMap storage;
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<std::atomic<int32_t>[]> brickSlots;
+    std::mutex mutex;
+    std::condition_variable loaded;
+    size_t hand;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+    std::atomic<uint64_t> inserts;
+
+    friend class BrickRef;
+    BrickRef tryPin(uint32_t brick);
+    bool claimVictim(uint32_t &slot);
+    std::byte *assign(uint32_t slot, uint32_t brick);
+    void finish(uint32_t slot, uint32_t brick, bool success, bool pin);
+    void release(uint32_t slot);
+
+  public:
+    BrickCache(const BrickedVolume &volume, size_t budgetBytes);
+
+    BrickCache(const BrickCache &) = delete;
+    BrickCache &operator=(const BrickCache &) = delete;
+
+    // Returns a pinned brick, decoding it on a miss
+    BrickRef acquire(uint32_t brick);
+
+    // Returns a pinned brick if resident, an empty ref otherwise
+    BrickRef tryAcquire(uint32_t brick);
+
+    // Fills an unpinned slot for a brick fetched elsewhere, e.g. by async I/O.
+    // Returns false if the brick is resident or loading, or if every slot is
+    // pinned right now.
+    bool insert(uint32_t brick, const std::function<void(std::byte *)> &fill);
+
+    // True if resident or being loaded
+    bool isResident(uint32_t brick) const;
+
+    const BrickedVolume &getVolume() const;
+    size_t getCapacity() const;
+    size_t getBudget() const;
+    CacheStats getStats() const;
+    void resetStats();
+  };
+} // namespace CUDAVol
@@ -0,0 +1,88 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_format.h
+
+  Bricked volume file format (.cvb) declaration. A file holds a header, a
+  table with one entry per brick and the individually compressed bricks. Every
+  brick stores its core voxels plus a halo on each side, clamped at the volume
+  border, so trilinear filtering never needs a neighbouring brick. Values are
+  stored in the byte order of the writing host.
+
+  November 2019
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  enum class BrickCodec : uint32_t { None = 0, Deflate = 1, LZ4 = 2, Zstd = 3 };
+
+  BrickCodec parseBrickCodec(const std::string &str);
+  const char *toString(BrickCodec codec);
+  bool isCodecAvailable(BrickCodec codec);
+  BrickCodec getDefaultCodec();
+
+  struct BrickFileHeader {
+    char magic[8];         // "CVBRICK\0"
+    uint32_t version;      // BrickFileHeader::currentVersion
+    uint32_t voxelType;    // VoxelType
+    int32_t dims[3];       // Volume dimensions in voxels
+    float spacing[3];      // Voxel spacing
+    uint32_t brickSize;    // Core voxels per brick side
+    uint32_t halo;         // Extra voxels stored on each brick side
+    uint32_t codec;        // BrickCodec
+    uint32_t brickCount;   // Entries in the brick table
+    int32_t brickGrid[3];  // Bricks per axis
+    float valueRange[2];   // Minimum and maximum voxel value
+    uint32_t reserved;
+    uint64_t tableOffset;  // Byte offset of the brick table
+
+    static constexpr uint32_t currentVersion = 1;
+  };
+
+  struct BrickEntry {
+    uint64_t offset;         // Byte offset of the compressed brick
+    uint32_t size;           // Compressed size; 0 means every voxel equals min
+    uint32_t reserved;
+    float min;               // Value range over the stored voxels, halo included
+    float max;
+  };
+
+  static_assert(sizeof(BrickFileHeader) == 88, "BrickFileHeader layout changed");
+  static_assert(sizeof(BrickEntry) == 24, "BrickEntry layout changed");
+
+  std::vector<std::byte> compressBrick(BrickCodec codec,
+                                       const std::byte *src,
+                                       size_t srcSize,
+                                       int level);
+  bool decompressBrick(BrickCodec codec,
+                       const std::byte *src,
+                       size_t srcSize,
+                       std::byte *dst,
+                       size_t dstSize);
+} // namespace CUDAVol
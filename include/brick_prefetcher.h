@@ -0,0 +1,83 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_prefetcher.h
+
+  Brick prefetcher declaration. Fetches compressed bricks through an
+  AsyncReader and decodes them into a BrickCache on a thread pool. update() is
+  meant to be called once per frame; it only collects finished reads and never
+  waits on disk.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "async_reader.h"
+#include "brick_cache.h"
+#include "thread_pool.h"
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace CUDAVol {
+  struct PrefetchStats {
+    uint64_t requested = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t dropped = 0; // Decoded, but already resident or all slots pinned
+  };
+
+  class BrickPrefetcher {
+  private:
+    BrickCache &cache;
+    ThreadPool &pool;
+    std::unordered_map<uint32_t, std::vector<std::byte>> inFlight;
+    std::vector<std::future<bool>> decodes;
+    std::vector<ReadCompletion> completions;
+    std::unique_ptr<AsyncReader> reader;
+    PrefetchStats stats;
+
+    void decode(uint32_t brick, std::vector<std::byte> compressed);
+
+  public:
+    BrickPrefetcher(BrickCache &cache,
+                    ThreadPool &pool,
+                    IoBackend backend = IoBackend::IoUring,
+                    unsigned queueDepth = 32,
+                    bool direct = false);
+    ~BrickPrefetcher();
+
+    // Requests bricks not resident or in flight yet, as one batch
+    void request(const std::vector<uint32_t> &bricks);
+
+    // Collects finished reads and hands them to the pool for decoding
+    void update();
+
+    size_t getPending() const;
+    PrefetchStats getStats() const;
+    IoBackend getBackend() const;
+  };
+} // namespace CUDAVol
@@ -0,0 +1,100 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_sampler.h
+
+  Brick sampler declaration and definition. Samples a bricked volume through
+  a BrickCache, keeping the current brick pinned between samples so that a ray
+  only touches the cache when it crosses into another brick. One sampler per
+  thread.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "brick_cache.h"
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+#include <cstdint>
+
+namespace CUDAVol {
+  template <typename T>
+  class BrickSampler {
+  private:
+    BrickCache &cache;
+    glm::ivec3 dims;
+    glm::ivec3 grid;
+    int brickSize;
+    int halo;
+    int storedSize;
+    uint32_t currentIndex;
+    BrickRef current;
+
+  public:
+    BrickSampler(BrickCache &cache)
+      : cache(cache),
+        dims(cache.getVolume().getDims()),
+        grid(cache.getVolume().getBrickGrid()),
+        brickSize(cache.getVolume().getBrickSize()),
+        halo(cache.getVolume().getHalo()),
+        storedSize(cache.getVolume().getStoredBrickSize()),
+        currentIndex(UINT32_MAX) {}
+
+    // Trilinear sample at p in voxel coordinates, voxel centers at integers.
+    // Neighbours come from the brick's halo; with halo 0, samples on brick
+    // borders clamp to the brick instead.
+    float sample(glm::vec3 p) {
+      p = glm::clamp(p, glm::vec3(0.f), glm::vec3(dims - 1));
+      const glm::ivec3 i(p);
+      const glm::vec3 f = p - glm::vec3(i);
+      const glm::ivec3 b = glm::min(i / brickSize, grid - 1);
+
+      const uint32_t index = static_cast<uint32_t>(b.x + grid.x * (b.y + grid.y * b.z));
+      if (index != currentIndex) {
+        current = BrickRef(); // Unpin before pinning, a budget may be tiny
+        current = cache.acquire(index);
+        currentIndex = index;
+      }
+
+      const glm::ivec3 l0 = i - b * brickSize + halo;
+      const glm::ivec3 l1 = glm::min(l0 + 1, glm::ivec3(storedSize - 1));
+      const T *data = current.template as<T>();
+      auto at = [&](int x, int y, int z) {
+        return static_cast<float>(data[x + storedSize * (y + storedSize * z)]);
+      };
+
+      float c00 = glm::mix(at(l0.x, l0.y, l0.z), at(l1.x, l0.y, l0.z), f.x);
+      float c10 = glm::mix(at(l0.x, l1.y, l0.z), at(l1.x, l1.y, l0.z), f.x);
+      float c01 = glm::mix(at(l0.x, l0.y, l1.z), at(l1.x, l0.y, l1.z), f.x);
+      float c11 = glm::mix(at(l0.x, l1.y, l1.z), at(l1.x, l1.y, l1.z), f.x);
+      return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+    }
+
+    // Drops the pin on the current brick, e.g. at the end of a ray batch
+    void release() {
+      current = BrickRef();
+      currentIndex = UINT32_MAX;
+    }
+  };
+} // namespace CUDAVol
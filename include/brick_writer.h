@@ -0,0 +1,58 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_writer.h
+
+  Brick writer declaration. Cuts a volume into halo padded bricks, computes
+  their value ranges and compresses them in parallel into a .cvb file.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "brick_format.h"
+#include "thread_pool.h"
+#include "volume.h"
+#include <string>
+
+namespace CUDAVol {
+  class BrickWriter {
+  private:
+    ThreadPool &pool;
+    int brickSize;
+    int halo;
+    BrickCodec codec;
+    int level;
+
+  public:
+    BrickWriter(ThreadPool &pool,
+                int brickSize = 32,
+                int halo = 1,
+                BrickCodec codec = getDefaultCodec(),
+                int level = 0);
+
+    // Returns the number of bytes written
+    size_t write(const VolumeView &volume, const std::string &filePath);
+  };
+} // namespace CUDAVol
@@ -0,0 +1,83 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  bricked_volume.h
+
+  Bricked volume declaration. Opens a .cvb file, keeps its brick table in
+  memory and decodes any single brick on demand with one pread, so access cost
+  does not depend on file size.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "brick_format.h"
+#include "volume.h"
+#include "glm/vec2.hpp"
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  class BrickedVolume {
+  private:
+    int fd;
+    std::string filePath;
+    BrickFileHeader header;
+    std::vector<BrickEntry> table;
+
+  public:
+    BrickedVolume(const std::string &filePath);
+    ~BrickedVolume();
+
+    BrickedVolume(BrickedVolume &&other) noexcept;
+    BrickedVolume &operator=(BrickedVolume &&other) noexcept;
+    BrickedVolume(const BrickedVolume &) = delete;
+    BrickedVolume &operator=(const BrickedVolume &) = delete;
+
+    // Reads and decodes a brick into dst, which holds getBrickBytes() bytes.
+    // Thread safe.
+    void readBrick(size_t index, std::byte *dst) const;
+
+    // Decodes a brick whose compressed bytes were fetched by the caller
+    void decodeBrick(size_t index, const std::byte *src, std::byte *dst) const;
+
+    size_t getBrickIndex(glm::ivec3 brick) const;
+    glm::ivec3 getBrickCoord(size_t index) const;
+    const BrickEntry &getBrickEntry(size_t index) const;
+    size_t getBrickCount() const;
+    size_t getBrickBytes() const;
+
+    glm::ivec3 getDims() const;
+    glm::ivec3 getBrickGrid() const;
+    int getBrickSize() const;
+    int getHalo() const;
+    int getStoredBrickSize() const;
+    VoxelType getType() const;
+    glm::vec3 getSpacing() const;
+    glm::vec2 getValueRange() const;
+    BrickCodec getCodec() const;
+    const std::string &getFilePath() const;
+    int getFileDescriptor() const;
+  };
+} // namespace CUDAVol
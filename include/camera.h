@@ -0,0 +1,75 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  camera.h
+
+  Camera declaration. Orbit camera around a target point, producing view and
+  projection matrices and primary rays. Holds no window state; input is
+  applied by the renderer.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "glm/mat4x4.hpp"
+#include "glm/trigonometric.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+
+namespace CUDAVol {
+  class Camera {
+  private:
+    glm::vec3 target;
+    float yaw;
+    float pitch;
+    float distance;
+    float fieldOfView;
+
+  public:
+    Camera(glm::vec3 target = glm::vec3(0.f),
+           float distance = 2.f,
+           float fieldOfView = glm::radians(45.f));
+
+    // Angles in radians; pitch stops just short of the poles
+    void orbit(float deltaYaw, float deltaPitch);
+    void zoom(float factor);
+
+    // Moves back until a box of the given extent, centered on the target, fits
+    void frame(glm::vec3 extent);
+
+    // View direction and the image plane axes at unit distance, spanning ndc
+    // in [-1, 1]^2, y up
+    void getBasis(float aspect, glm::vec3 &forward, glm::vec3 &right, glm::vec3 &up) const;
+
+    // Primary ray through ndc; dir is normalized
+    void getRay(glm::vec2 ndc, float aspect, glm::vec3 &origin, glm::vec3 &dir) const;
+
+    glm::vec3 getPosition() const;
+    glm::vec3 getTarget() const;
+    float getDistance() const;
+    float getFieldOfView() const;
+    glm::mat4 getViewMatrix() const;
+    glm::mat4 getProjectionMatrix(float aspect, float nearPlane, float farPlane) const;
+  };
+} // namespace CUDAVol
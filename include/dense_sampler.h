@@ -0,0 +1,79 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  dense_sampler.h
+
+  Dense sampler declaration and definition. Samples an in-memory volume
+  view with the same interface as BrickSampler and SparseSampler, so the ray
+  marcher can be written once for every storage. Templated on the voxel
+  layout, see voxel_layout.h.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "volume.h"
+#include "voxel_layout.h"
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+
+namespace CUDAVol {
+  template <typename T, typename Layout = LinearLayout>
+  class DenseSampler {
+  private:
+    const T *data;
+    glm::ivec3 dims;
+    Layout layout;
+
+  public:
+    DenseSampler(const T *data, const Layout &layout)
+      : data(data), dims(layout.dims), layout(layout) {}
+
+    DenseSampler(const VolumeView &volume)
+      : DenseSampler(volume.as<T>(), Layout(volume.dims)) {}
+
+    // Trilinear sample at p in voxel coordinates, voxel centers at integers
+    float sample(glm::vec3 p) {
+      p = glm::clamp(p, glm::vec3(0.f), glm::vec3(dims - 1));
+      const glm::ivec3 i0(p);
+      const glm::ivec3 i1 = glm::min(i0 + 1, dims - 1);
+      const glm::vec3 f = p - glm::vec3(i0);
+      const size_t x0 = layout.offsetX(i0.x), x1 = layout.offsetX(i1.x);
+      const size_t y0 = layout.offsetY(i0.y), y1 = layout.offsetY(i1.y);
+      const size_t z0 = layout.offsetZ(i0.z), z1 = layout.offsetZ(i1.z);
+      auto at = [&](size_t x, size_t y, size_t z) {
+        return static_cast<float>(data[x + y + z]);
+      };
+
+      float c00 = glm::mix(at(x0, y0, z0), at(x1, y0, z0), f.x);
+      float c10 = glm::mix(at(x0, y1, z0), at(x1, y1, z0), f.x);
+      float c01 = glm::mix(at(x0, y0, z1), at(x1, y0, z1), f.x);
+      float c11 = glm::mix(at(x0, y1, z1), at(x1, y1, z1), f.x);
+      return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+    }
+
+    // Nothing is held between samples
+    void release() {}
+  };
+} // namespace CUDAVol
@@ -0,0 +1,138 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  gradient_volume.h
+
+  Gradient volume class header. Precomputed central difference gradients of
+  a dense volume, 32 bits per voxel: an octahedral encoded direction in
+  2 x 12 bits and the magnitude in 8 bits, square root companded. Sampling
+  decodes eight voxels instead of taking six extra trilinear samples.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "morton_volume.h"
+#include "thread_pool.h"
+#include "volume.h"
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CUDAVol {
+  class GradientVolume {
+  public:
+    static constexpr int directionBits = 12;
+    static constexpr uint32_t directionMax = (1u << directionBits) - 1;
+
+  private:
+    glm::ivec3 dims;
+    std::vector<uint32_t> data;               // x fastest
+    float maxMagnitude;
+
+  public:
+    GradientVolume();
+
+    // World space gradients, voxel differences over spacing, one sided at
+    // the borders; two passes over the volume in parallel, the first for the
+    // largest magnitude
+    GradientVolume(ThreadPool &pool, const VolumeView &volume);
+    GradientVolume(ThreadPool &pool, const MortonVolume &volume);
+
+    static size_t getMemorySize(glm::ivec3 dims);
+
+    static uint32_t encode(glm::vec3 gradient, float maxMagnitude) {
+      const float magnitude = glm::length(gradient);
+      if (magnitude <= 0.f || maxMagnitude <= 0.f) {
+        return 0;
+      }
+
+      // Octahedral map of the unit direction to [-1, 1]^2, lower half folded out
+      const glm::vec3 n = gradient / (std::abs(gradient.x) + std::abs(gradient.y) + std::abs(gradient.z));
+      glm::vec2 p(n.x, n.y);
+      if (n.z < 0.f) {
+        p = (1.f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+      }
+      const glm::uvec2 q(glm::round((p * 0.5f + 0.5f) * float(directionMax)));
+      const uint32_t m = static_cast<uint32_t>(std::round(255.f * std::sqrt(glm::min(magnitude / maxMagnitude, 1.f))));
+      return q.x | q.y << directionBits | m << (2 * directionBits);
+    }
+
+    // Octahedron point of the direction, |x| + |y| + |z| = 1, times the
+    // magnitude; between 1/sqrt(3) and 1 times the gradient's length
+    static glm::vec3 decodeUnnormalized(uint32_t code, float maxMagnitude) {
+      const float m = static_cast<float>(code >> (2 * directionBits)) / 255.f;
+      const glm::vec2 p = glm::vec2(static_cast<float>(code & directionMax),
+                                    static_cast<float>((code >> directionBits) & directionMax)) *
+                              (2.f / directionMax) - 1.f;
+      glm::vec3 n(p.x, p.y, 1.f - std::abs(p.x) - std::abs(p.y));
+      const float t = glm::max(-n.z, 0.f);
+      n.x -= std::copysign(t, n.x);
+      n.y -= std::copysign(t, n.y);
+      return n * (m * m * maxMagnitude);
+    }
+
+    static glm::vec3 decode(uint32_t code, float maxMagnitude) {
+      const glm::vec3 g = decodeUnnormalized(code, maxMagnitude);
+      const float m = static_cast<float>(code >> (2 * directionBits)) / 255.f;
+      return m > 0.f ? glm::normalize(g) * (m * m * maxMagnitude) : glm::vec3(0.f);
+    }
+
+    // Voxel coordinates, voxel centers at integers, clamped to the volume.
+    // Trilinear blends the eight nearest gradients without normalizing their
+    // directions first, which shifts the blend towards the axes by a few
+    // degrees at most; nearest reads a single gradient.
+    glm::vec3 sample(glm::vec3 p) const {
+      p = glm::clamp(p, glm::vec3(0.f), glm::vec3(dims - 1));
+      const glm::ivec3 i0 = glm::min(glm::ivec3(p), dims - 2);
+      const glm::ivec3 i = glm::max(i0, glm::ivec3(0));
+      const glm::vec3 f = p - glm::vec3(i);
+      const glm::ivec3 step(dims.x > 1 ? 1 : 0, dims.y > 1 ? dims.x : 0,
+                            dims.z > 1 ? dims.x * dims.y : 0);
+      const uint32_t *c = data.data() + i.x + dims.x * (static_cast<size_t>(i.y) + static_cast<size_t>(dims.y) * i.z);
+      auto at = [&](int dx, int dy, int dz) {
+        return decodeUnnormalized(c[dx * step.x + dy * step.y + dz * step.z], maxMagnitude);
+      };
+      const glm::vec3 y0 = glm::mix(glm::mix(at(0, 0, 0), at(1, 0, 0), f.x), glm::mix(at(0, 1, 0), at(1, 1, 0), f.x), f.y);
+      const glm::vec3 y1 = glm::mix(glm::mix(at(0, 0, 1), at(1, 0, 1), f.x), glm::mix(at(0, 1, 1), at(1, 1, 1), f.x), f.y);
+      return glm::mix(y0, y1, f.z);
+    }
+
+    glm::vec3 sampleNearest(glm::vec3 p) const {
+      p = glm::clamp(p, glm::vec3(0.f), glm::vec3(dims - 1));
+      const glm::ivec3 i(p + 0.5f);
+      return decode(data[i.x + dims.x * (static_cast<size_t>(i.y) + static_cast<size_t>(dims.y) * i.z)], maxMagnitude);
+    }
+
+    bool isEmpty() const;
+    glm::ivec3 getDims() const;
+    float getMaxMagnitude() const;
+    size_t getMemorySize() const;
+  };
+} // namespace CUDAVol
@@ -0,0 +1,97 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  grid_walk.h
+
+  Grid walk declaration and definition. Visits the cells of a uniform grid
+  pierced by a ray in front-to-back order (3D DDA).
+
+  November 2019
+*/
+
+#pragma once
+
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace CUDAVol {
+  // Calls f(cell, t0, t1) for every cell in [lo, hi) of a grid with cells of
+  // cellSize, in the order the ray origin + t * dir enters them between tMin
+  // and tMax. Cell c covers [c * cellSize, (c + 1) * cellSize). Returning
+  // false from f stops the walk.
+  template <typename F>
+  void walkGrid(glm::vec3 origin,
+                glm::vec3 dir,
+                float tMin,
+                float tMax,
+                glm::ivec3 lo,
+                glm::ivec3 hi,
+                float cellSize,
+                F &&f) {
+    // Huge instead of infinite reciprocals keep 0 * inv finite
+    glm::vec3 inv;
+    for (int i = 0; i < 3; i++) {
+      inv[i] = dir[i] != 0.f ? 1.f / dir[i] : std::copysign(1e30f, dir[i]);
+    }
+
+    // Clip to the grid bounds
+    const glm::vec3 ta = (glm::vec3(lo) * cellSize - origin) * inv;
+    const glm::vec3 tb = (glm::vec3(hi) * cellSize - origin) * inv;
+    const glm::vec3 tNear = glm::min(ta, tb), tFar = glm::max(ta, tb);
+    tMin = std::max({tMin, tNear.x, tNear.y, tNear.z});
+    tMax = std::min({tMax, tFar.x, tFar.y, tFar.z});
+    if (!(tMin < tMax)) {
+      return;
+    }
+
+    const glm::vec3 entry = origin + dir * tMin;
+    glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(entry / cellSize)), lo, hi - 1);
+    glm::ivec3 step;
+    glm::vec3 tNext, tDelta;
+    for (int i = 0; i < 3; i++) {
+      step[i] = dir[i] < 0.f ? -1 : 1;
+      tDelta[i] = std::abs(cellSize * inv[i]);
+      tNext[i] = (static_cast<float>(cell[i] + (step[i] > 0)) * cellSize - origin[i]) * inv[i];
+    }
+
+    float t = tMin;
+    while (true) {
+      const int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+      const float tExit = std::min(tNext[axis], tMax);
+      if (tExit > t && !f(cell, t, tExit)) {
+        return;
+      }
+      if (tExit >= tMax) {
+        return;
+      }
+      t = tExit;
+      cell[axis] += step[axis];
+      if (cell[axis] < lo[axis] || cell[axis] >= hi[axis]) {
+        return;
+      }
+      tNext[axis] += tDelta[axis];
+    }
+  }
+} // namespace CUDAVol
@@ -0,0 +1,162 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  light_volume.h
+
+  Light volume class header. Transmittance of a directional light through the
+  volume on a coarser grid, swept slice by slice away from the light and
+  updated from the first slice a transfer function edit affects.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "thread_pool.h"
+#include "transfer_function.h"
+#include "glm/common.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace CUDAVol {
+  // Light voxel q covers volume voxels [q * scale, (q + 1) * scale) and holds
+  // their mean value, as a transfer function table coordinate, and the
+  // fraction of light reaching its center. Slices across the axis the light
+  // travels most along are swept away from the light: every light voxel
+  // attenuates the transmittance found one slice back towards the light,
+  // bilinearly, by the extinction along the way, so a sweep costs one pass
+  // over the grid regardless of the light direction. Voxels are stored in
+  // sweep order, slice by slice from the light, so sweeps read and write
+  // memory in order.
+  class LightVolume {
+  private:
+    glm::ivec3 dims;                          // Light voxels
+    int scale;                                // Volume voxels per light voxel side
+    glm::vec3 voxelSize;                      // World units per light voxel
+    glm::ivec3 order;                         // Axes of u, v and the slices; u fastest
+    bool flip;                                // Slices run from the high end of the slice axis
+    std::vector<float> values;                // Sweep order
+    std::vector<float> transmittance;
+    std::vector<float> source;                // Table opacities the transmittance was swept with
+    float referenceLength;
+    glm::vec3 direction;                      // Towards the light
+    std::vector<glm::vec2> sliceRanges;       // Value range of every slice
+
+    glm::ivec3 getSweepDims() const;
+
+    // Reorders the values for sweeps along axis, from its high end if flip
+    void setOrder(ThreadPool &pool, int axis, bool flip);
+
+    // Sweeps slices first onwards and stops after lastAffected at the first
+    // slice that comes out unchanged. Returns the number of slices swept.
+    size_t sweep(ThreadPool &pool, int first, int lastAffected);
+
+  public:
+    LightVolume();
+
+    // Box filters volume voxels down by scale, a power of two, through
+    // samplers from makeSampler, sample(p) at voxel coordinates p with voxel
+    // centers at integers; toTable maps values to table coordinates. No
+    // light is swept until update.
+    template <typename MakeSampler, typename ToTable>
+    LightVolume(ThreadPool &pool,
+                glm::ivec3 volumeDims,
+                glm::vec3 spacing,
+                int scale,
+                MakeSampler &&makeSampler,
+                ToTable &&toTable)
+      : dims((volumeDims + scale - 1) / scale),
+        scale(scale),
+        voxelSize(spacing * float(scale)),
+        order(0, 1, 2),
+        flip(false),
+        values(static_cast<size_t>(dims.x) * dims.y * dims.z),
+        referenceLength(0.f),
+        direction(0.f) {
+      // Trilinear samples halfway between voxel pairs average all eight
+      // voxels around them, so (scale / 2)^3 of them average the whole cell
+      const int taps = std::max(scale / 2, 1);
+      const float first = scale > 1 ? 0.5f : 0.f;
+      pool.parallelFor(0, static_cast<size_t>(dims.z), 1, [&](size_t lo, size_t hi) {
+        auto sampler = makeSampler();
+        for (int z = static_cast<int>(lo); z < static_cast<int>(hi); z++) {
+          for (int y = 0; y < dims.y; y++) {
+            for (int x = 0; x < dims.x; x++) {
+              const glm::vec3 origin = glm::vec3(x, y, z) * float(scale) + first;
+              float sum = 0.f;
+              for (int k = 0; k < taps; k++) {
+                for (int j = 0; j < taps; j++) {
+                  for (int i = 0; i < taps; i++) {
+                    sum += sampler.sample(origin + 2.f * glm::vec3(i, j, k));
+                  }
+                }
+              }
+              values[x + dims.x * (static_cast<size_t>(y) + static_cast<size_t>(dims.y) * z)] =
+                  toTable(sum / static_cast<float>(taps * taps * taps));
+            }
+          }
+        }
+        sampler.release();
+      });
+    }
+
+    // Direction towards the light in world space; opacity is given per
+    // referenceLength of distance, as for the transfer function. A new light
+    // direction sweeps every slice again, from the stored values; a transfer
+    // function edit only the slices from the first holding a value whose
+    // opacity changed, until the change has died out behind the last one.
+    // Returns the number of slices swept.
+    size_t update(ThreadPool &pool,
+                  const TransferFunction &transferFunction,
+                  float referenceLength,
+                  glm::vec3 direction);
+
+    // Transmittance at p in volume voxel coordinates, trilinear
+    float sample(glm::vec3 p) const {
+      const glm::vec3 q = glm::clamp((p + 0.5f) / float(scale) - 0.5f, glm::vec3(0.f), glm::vec3(dims - 1));
+      const glm::ivec3 n = getSweepDims();
+      const glm::vec3 r(q[order.x], q[order.y], flip ? static_cast<float>(n.z - 1) - q[order.z] : q[order.z]);
+      const glm::ivec3 i0(r);
+      const glm::ivec3 i1 = glm::min(i0 + 1, n - 1);
+      const glm::vec3 f = r - glm::vec3(i0);
+      auto at = [&](int u, int v, int s) {
+        return transmittance[u + n.x * (static_cast<size_t>(v) + static_cast<size_t>(n.y) * s)];
+      };
+      const float c00 = glm::mix(at(i0.x, i0.y, i0.z), at(i1.x, i0.y, i0.z), f.x);
+      const float c10 = glm::mix(at(i0.x, i1.y, i0.z), at(i1.x, i1.y, i0.z), f.x);
+      const float c01 = glm::mix(at(i0.x, i0.y, i1.z), at(i1.x, i0.y, i1.z), f.x);
+      const float c11 = glm::mix(at(i0.x, i1.y, i1.z), at(i1.x, i1.y, i1.z), f.x);
+      return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+    }
+
+    bool isEmpty() const;
+    bool isSwept() const;
+    glm::ivec3 getDims() const;
+    int getScale() const;
+    int getSliceCount() const;
+    size_t getMemorySize() const;
+  };
+} // namespace CUDAVol
@@ -0,0 +1,201 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  macrocell_grid.h
+
+  Macrocell grid class header. Coarse grid of per-cell voxel value ranges
+  over dense or bricked volumes. Cells whose whole range the transfer
+  function maps to zero opacity are empty, and rays skip them with a 3D DDA.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "bricked_volume.h"
+#include "grid_walk.h"
+#include "morton_volume.h"
+#include "thread_pool.h"
+#include "transfer_function.h"
+#include "volume.h"
+#include "glm/common.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+#include "glm/vector_relational.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CUDAVol {
+  // Voxel coordinate p, voxel centers at integers, lies in cell
+  // floor((p + 0.5) / cellSize). A cell's range covers every voxel a
+  // trilinear sample inside it reads, and so also samples up to half a voxel
+  // outside it, which keeps rounding at cell faces harmless.
+  class MacrocellGrid {
+  public:
+    static constexpr int defaultCellSize = 8;
+    static constexpr int maxDistance = 32;
+
+  private:
+    glm::ivec3 grid;
+    int cellSize;
+    std::vector<glm::vec2> ranges;
+    std::vector<float> occupancy;             // 1 for cells that may be visible, 0 for empty ones
+    size_t occupiedCount;
+    glm::vec2 valueRange;
+    std::vector<uint8_t> visible;             // Transfer function entries with nonzero opacity
+    std::vector<float> distances;             // Chebyshev distance to an occupied cell, 0 inside one
+    std::vector<float> majorants;             // Largest extinction per unit length within each cell
+
+  public:
+    MacrocellGrid();
+
+    // Scans the voxels once, in parallel
+    MacrocellGrid(ThreadPool &pool, const VolumeView &volume, int cellSize = defaultCellSize);
+    MacrocellGrid(ThreadPool &pool, const MortonVolume &volume, int cellSize = defaultCellSize);
+
+    // One cell per brick from the ranges in the brick table; no voxels are read
+    MacrocellGrid(const BrickedVolume &volume);
+
+    // Recomputes which cells are empty. Only cells whose range overlaps table
+    // entries that changed visibility since the last call are revisited, and
+    // no voxels are read, so editing the transfer function stays cheap. Values
+    // in valueRange map to [0, 1] of the transfer function.
+    void classify(const TransferFunction &transferFunction, glm::vec2 valueRange);
+
+    // Chebyshev distance in cells from every cell to the nearest occupied
+    // one, capped at maxDistance: one exact pass per axis, each over
+    // independent lines in parallel. Cleared when classify changes a cell.
+    void buildDistances(ThreadPool &pool);
+
+    // Largest extinction any sample in each cell can take, per unit length
+    // with opacity given per referenceLength: the maximum over the table
+    // entries the cell's range covers, with the margin classify uses, as
+    // samples interpolate extinction between entries.
+    void buildMajorants(const TransferFunction &transferFunction, glm::vec2 valueRange, float referenceLength);
+
+    // Calls f(t0, t1, majorant) for the cells the ray crosses, in voxel
+    // coordinates with voxel centers at integers, front to back, skipping
+    // cells with a majorant of zero. Returning false from f stops the walk.
+    template <typename F>
+    void forEachMajorant(glm::vec3 origin, glm::vec3 dir, float tMin, float tMax, F &&f) const {
+      walkGrid(origin + 0.5f, dir, tMin, tMax, glm::ivec3(0), grid, float(cellSize),
+               [&](glm::ivec3 cell, float t0, float t1) {
+        const float majorant = majorants[cell.x + grid.x * (static_cast<size_t>(cell.y) + grid.y * cell.z)];
+        return majorant <= 0.f || f(t0, t1, majorant);
+      });
+    }
+
+    // Calls f(t0, t1, homogeneous) for the parts of the ray, in voxel
+    // coordinates with voxel centers at integers, that cross occupied cells.
+    // Spans come front to back and are merged while homogeneity, a value
+    // spread of at most maxSpread (negative for never), stays the same; a
+    // span touching either end of the ray is extended to tMin or tMax. With
+    // leap and distances built, empty cells further than one cell from
+    // occupied ones jump past all cells closer than their distance. Returns
+    // the number of cells visited.
+    template <typename F>
+    size_t forEachSpan(glm::vec3 origin, glm::vec3 dir, float tMin, float tMax, bool leap, float maxSpread,
+                       F &&f) const {
+      origin += 0.5f;
+      leap = leap && hasDistances();
+      glm::vec3 inv;
+      for (int i = 0; i < 3; i++) {
+        inv[i] = dir[i] != 0.f ? 1.f / dir[i] : std::copysign(1e30f, dir[i]);
+      }
+
+      float begin = 0.f, end = -1.f, t = tMin, restart;
+      bool first = true, occupied = false, homogeneous = false;
+      size_t steps = 0;
+      auto visit = [&](glm::ivec3 cell, float t0, float t1) {
+        const size_t index = cell.x + grid.x * (static_cast<size_t>(cell.y) + grid.y * cell.z);
+        occupied = occupancy[index] != 0.f;
+        steps++;
+        if (occupied) {
+          if (first) {
+            t0 = tMin;
+          }
+          const bool cellHomogeneous = ranges[index].y - ranges[index].x <= maxSpread;
+          if (t0 <= end && cellHomogeneous == homogeneous) {
+            end = t1;
+          } else {
+            if (end > begin) {
+              f(begin, end, homogeneous);
+            }
+            begin = std::max(t0, end);
+            end = t1;
+            homogeneous = cellHomogeneous;
+          }
+        } else if (leap && distances[index] > 1.f) {
+          // Exit of the empty cube of cells around this one; the walk
+          // restarts there unless that is no further than the cell's own exit
+          const float radius = distances[index] - 1.f;
+          const glm::vec3 lo = (glm::vec3(cell) - radius) * float(cellSize);
+          const glm::vec3 hi = (glm::vec3(cell) + radius + 1.f) * float(cellSize);
+          const glm::vec3 tAxis = (glm::mix(lo, hi, glm::greaterThan(dir, glm::vec3(0.f))) - origin) * inv;
+          const float exit = std::min({tAxis.x, tAxis.y, tAxis.z});
+          if (exit > t1) {
+            restart = exit;
+            first = false;
+            return false;
+          }
+        }
+        first = false;
+        return true;
+      };
+      do {
+        restart = -1.f;
+        walkGrid(origin, dir, t, tMax, glm::ivec3(0), grid, float(cellSize), visit);
+      } while (restart > t && (t = restart) < tMax);
+
+      if (first) {
+        // Grazing rays the walk clipped away entirely
+        f(tMin, tMax, false);
+        return steps;
+      }
+      if (occupied) {
+        end = tMax;
+      }
+      if (end > begin) {
+        f(begin, end, homogeneous);
+      }
+      return steps;
+    }
+
+    bool isEmpty() const;
+    bool hasDistances() const;
+    bool hasMajorants() const;
+    glm::ivec3 getGrid() const;
+    int getCellSize() const;
+    const float *getOccupancy() const;
+    const glm::vec2 *getRanges() const;
+    const float *getDistances() const;
+    const float *getMajorants() const;
+    glm::vec2 getValueRange() const;
+    size_t getCellCount() const;
+    size_t getOccupiedCount() const;
+    size_t getMemorySize() const;
+  };
+} // namespace CUDAVol
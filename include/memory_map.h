@@ -0,0 +1,66 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  memory_map.h
+
+  Memory mapped file/buffer declaration. Wraps mmap/madvise so large volumes
+  can be accessed without copying them into process memory first.
+
+  November 2019
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace CUDAVol {
+  class MemoryMap {
+  public:
+    // Access pattern hints, forwarded to madvise
+    enum class Access { Normal, Sequential, Random, WillNeed, DontNeed };
+
+  private:
+    void *object;
+    size_t size;
+    bool writable;
+
+  public:
+    MemoryMap();
+    MemoryMap(const std::string &filePath, Access access = Access::Normal);
+    MemoryMap(size_t size);
+    ~MemoryMap();
+
+    MemoryMap(MemoryMap &&other) noexcept;
+    MemoryMap &operator=(MemoryMap &&other) noexcept;
+    MemoryMap(const MemoryMap &) = delete;
+    MemoryMap &operator=(const MemoryMap &) = delete;
+
+    void advise(Access access, size_t offset = 0, size_t length = 0) const;
+
+    const std::byte *getData() const;
+    std::byte *getMutableData();
+    size_t getSize() const;
+    bool isWritable() const;
+  };
+} // namespace CUDAVol
@@ -0,0 +1,72 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  mip_builder.h
+
+  Mip builder class header. Builds a multi-resolution pyramid of a volume
+  by repeated 2x downsampling, and names/opens the per-level bricked files.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "bricked_volume.h"
+#include "thread_pool.h"
+#include "volume.h"
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  // Both filters are cell-centered: output voxel i covers input voxels 2i and 2i+1
+  enum class MipFilter { Box, Gaussian };
+
+  MipFilter parseMipFilter(const std::string &str);
+  const char *toString(MipFilter filter);
+
+  // Level 0 is filePath itself, level n is "<stem>.L<n><extension>" next to it
+  std::string getMipLevelPath(const std::string &filePath, int level);
+
+  // Opens filePath followed by every consecutive coarser level found beside it
+  std::vector<BrickedVolume> openMipLevels(const std::string &filePath);
+
+  // Picks the level whose voxels best match a footprint given in full
+  // resolution voxels per pixel
+  int selectMipLevel(float voxelsPerPixel, int levelCount);
+
+  class MipBuilder {
+  private:
+    ThreadPool &pool;
+    MipFilter filter;
+
+  public:
+    MipBuilder(ThreadPool &pool, MipFilter filter = MipFilter::Box);
+
+    // Returns a volume of half the resolution (rounded up) covering the same extent
+    Volume downsample(const VolumeView &volume) const;
+
+    // Returns the coarser levels 1..levels-1; levels = 0 continues until the
+    // volume fits in a single brick of minSize voxels
+    std::vector<Volume> build(const VolumeView &volume, int levels = 0, int minSize = 32) const;
+  };
+} // namespace CUDAVol
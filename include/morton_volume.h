@@ -0,0 +1,66 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  morton_volume.h
+
+  Morton volume declaration. In-memory copy of a volume in MortonLayout:
+  16^3 bricks with Morton ordered voxels, so that neighbourhoods along every
+  axis share cache lines and pages.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "memory_map.h"
+#include "thread_pool.h"
+#include "volume.h"
+#include "voxel_layout.h"
+#include "glm/vec3.hpp"
+#include <cstddef>
+
+namespace CUDAVol {
+  class MortonVolume {
+  private:
+    MemoryMap storage;
+    MortonLayout layout;
+    VoxelType type;
+    glm::vec3 spacing;
+
+  public:
+    MortonVolume();
+
+    // Swizzles a linear volume brick by brick in parallel; padding is zero
+    MortonVolume(ThreadPool &pool, const VolumeView &volume);
+
+    MortonVolume(MortonVolume &&other) noexcept = default;
+    MortonVolume &operator=(MortonVolume &&other) noexcept = default;
+
+    const std::byte *getData() const;
+    const MortonLayout &getLayout() const;
+    glm::ivec3 getDims() const;
+    VoxelType getType() const;
+    glm::vec3 getSpacing() const;
+    size_t getSize() const;
+  };
+} // namespace CUDAVol
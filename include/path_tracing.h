@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  path_tracing.h
+
+  Path tracing helpers. A small counter based random number generator with
+  independent streams, and sampling of the Henyey-Greenstein phase function.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "glm/geometric.hpp"
+#include "glm/vec3.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace CUDAVol {
+  // PCG32: 64 bit linear congruential state, permuted 32 bit output. Every
+  // odd increment gives an independent stream, so a stream per pixel and a
+  // seed per pass make paths independent of which thread traces them.
+  class PathRandom {
+  private:
+    uint64_t state;
+    uint64_t increment;
+
+  public:
+    PathRandom(uint64_t stream, uint64_t seed) : state(0), increment(stream << 1 | 1) {
+      next();
+      state += seed;
+      next();
+    }
+
+    uint32_t next() {
+      const uint64_t old = state;
+      state = old * 6364136223846793005ull + increment;
+      const uint32_t shifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+      const uint32_t rotation = static_cast<uint32_t>(old >> 59);
+      return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+    }
+
+    // Uniform in [0, 1)
+    float uniform() {
+      return static_cast<float>(next() >> 8) * (1.f / 16777216.f);
+    }
+  };
+
+  // Henyey-Greenstein phase function of the angle between the direction of
+  // travel before and after scattering, anisotropy g in (-1, 1)
+  inline float evalHenyeyGreenstein(float cosTheta, float g) {
+    const float denominator = 1.f + g * g - 2.f * g * cosTheta;
+    return (1.f - g * g) / (4.f * 3.14159265f * denominator * std::sqrt(denominator));
+  }
+
+  // New direction of travel for dir, importance sampled from two uniforms
+  inline glm::vec3 sampleHenyeyGreenstein(glm::vec3 dir, float g, float u1, float u2) {
+    float cosTheta;
+    if (std::abs(g) < 1e-3f) {
+      cosTheta = 1.f - 2.f * u1;
+    } else {
+      const float s = (1.f - g * g) / (1.f - g + 2.f * g * u1);
+      cosTheta = (1.f + g * g - s * s) / (2.f * g);
+    }
+    const float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta));
+    const float phi = 2.f * 3.14159265f * u2;
+
+    // Orthonormal basis around dir
+    const glm::vec3 helper = std::abs(dir.x) > 0.9f ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(1.f, 0.f, 0.f);
+    const glm::vec3 t = glm::normalize(glm::cross(helper, dir));
+    const glm::vec3 b = glm::cross(dir, t);
+    return glm::normalize(sinTheta * std::cos(phi) * t + sinTheta * std::sin(phi) * b + cosTheta * dir);
+  }
+} // namespace CUDAVol
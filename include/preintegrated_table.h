@@ -0,0 +1,92 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  preintegrated_table.h
+
+  Pre-integrated classification class header. A 2D table indexed by the
+  values at the front and back of a ray segment, holding the color and
+  opacity of the whole segment, so long steps keep thin features and sharp
+  transfer function peaks that point sampling would miss.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "thread_pool.h"
+#include "transfer_function.h"
+#include "glm/common.hpp"
+#include "glm/vec4.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace CUDAVol {
+  // Entry (front, back) is the premultiplied color and opacity of a segment
+  // of fixed length along which the value runs linearly from front to back.
+  // Extinction and extinction weighted color are integrated over the value
+  // once, as prefix sums, so every entry costs two differences; the color
+  // neglects attenuation within the segment, which is exact for constant
+  // segments and close for short ones.
+  class PreintegratedTable {
+  public:
+    static constexpr int size = TransferFunction::tableSize;
+
+  private:
+    std::vector<glm::vec4> source;            // Transfer function table the entries were built from
+    float referenceLength;
+    float length;
+    std::vector<float> channels[4];           // size * size entries per channel, front major
+
+    // Recomputes columns [lo, hi] of every row, clipped to the entries
+    // whose segment covers a changed table entry in [lo, hi]
+    size_t buildRows(ThreadPool &pool, int lo, int hi);
+
+  public:
+    PreintegratedTable();
+
+    // Opacity is given per referenceLength of distance, as for the transfer
+    // function; length is the segment length in the same unit. When only the
+    // transfer function changed, entries whose segment misses the changed
+    // part of its table are kept. Returns the number of entries recomputed.
+    size_t update(ThreadPool &pool, const TransferFunction &transferFunction, float referenceLength, float length);
+
+    // Table coordinates in [0, size - 1], bilinear
+    glm::vec4 lookup(float front, float back) const {
+      const int i = std::min(static_cast<int>(front), size - 2);
+      const int j = std::min(static_cast<int>(back), size - 2);
+      const float fi = front - static_cast<float>(i), fj = back - static_cast<float>(j);
+      const size_t e = static_cast<size_t>(i) * size + j;
+      glm::vec4 c;
+      for (int k = 0; k < 4; k++) {
+        const float *t = channels[k].data();
+        c[k] = glm::mix(glm::mix(t[e], t[e + 1], fj), glm::mix(t[e + size], t[e + size + 1], fj), fi);
+      }
+      return c;
+    }
+
+    bool isEmpty() const;
+    const float *getChannel(int c) const;
+    size_t getMemorySize() const;
+  };
+} // namespace CUDAVol
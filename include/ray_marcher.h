@@ -0,0 +1,309 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_marcher.h
+
+  Ray marcher declaration. Multi-threaded CPU volume ray marcher: splits the
+  image into tiles rendered across the thread pool, marching every ray front
+  to back through dense (linear or Morton), bricked or sparse volumes with
+  emission-absorption compositing. Serves as the reference for other backends.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "brick_cache.h"
+#include "camera.h"
+#include "gradient_volume.h"
+#include "light_volume.h"
+#include "macrocell_grid.h"
+#include "morton_volume.h"
+#include "preintegrated_table.h"
+#include "ray_packet.h"
+#include "sparse_volume.h"
+#include "thread_pool.h"
+#include "transfer_function.h"
+#include "volume.h"
+#include "glm/mat4x4.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CUDAVol {
+  struct RenderSettings {
+    float stepSize = 0.5f;                     // Sample distance in voxels
+    int tileSize = 16;                         // Tile side in pixels
+    bool hilbertTiles = true;                  // Seed threads with tiles along a Hilbert curve, else row by row
+    glm::vec3 background = glm::vec3(0.f);
+    SimdIsa isa = detectSimdIsa();             // Packets for dense volumes, scalar otherwise
+    bool fixedPoint = true;                    // Packets interpolate 8 and 16 bit voxels with integer weights
+    bool skipEmptySpace = true;                // Macrocells for dense and bricked volumes
+    bool leapEmptySpace = true;                // Leap several empty macrocells by Chebyshev distance
+
+    // Rays end once this opaque. The default stops where the remaining
+    // samples cannot change an 8 bit channel by half a step; above 1 rays
+    // always cross the whole volume.
+    float opacityThreshold = 1.f - 1.f / 512.f;
+
+    // Adaptive steps of up to 2^maxStepLevel * stepSize, opacity corrected
+    // per length. Steps take the largest length within macrocells whose value
+    // spread is at most stepVariation of the value range, and double with
+    // every doubling of camera distance beyond stepDistance, in world units
+    // (0 disables).
+    // A level of 0 keeps every step at stepSize.
+    int maxStepLevel = 0;
+    float stepDistance = 0.f;
+    float stepVariation = 0.01f;
+
+    // Coarsest level of progressive refinement in the viewer: one ray per
+    // 2^level pixel square and steps 2^level times as long, halved per frame
+    int refinementLevels = 2;
+
+    // Classify segments between consecutive samples through a pre-integrated
+    // table rather than single samples, so long steps keep their quality.
+    // Replaces adaptive steps.
+    bool preintegrate = false;
+
+    // Headlight shading from the value gradient: ambient plus two sided
+    // diffuse and specular terms. Dense and Morton volumes read gradients
+    // from a precomputed gradient volume while it fits gradientBudget, other
+    // volumes take central differences, six extra samples, at every visible
+    // sample. Shaded frames march scalar. Precomputed gradients are filtered
+    // trilinearly, or with filterGradients off read from the nearest voxel,
+    // faster but faceted.
+    bool shading = false;
+    float ambient = 0.3f;
+    float specular = 0.4f;
+    float shininess = 32.f;
+    bool precomputeGradients = true;
+    size_t gradientBudget = size_t(1) << 30;   // Bytes
+    bool filterGradients = true;
+
+    // Shadows for shading from a directional light, lightDirection pointing
+    // towards it in world space, through a light volume of one voxel per
+    // lightScale^3 volume voxels. The volume is swept on the first shaded
+    // frame; light and transfer function edits update it on the next.
+    bool shadows = false;
+    glm::vec3 lightDirection = glm::vec3(0.3f, 1.f, 0.5f);
+    int lightScale = 2;                        // Power of two
+
+    // Path traced multiple scattering instead of marching: the transfer
+    // function gives extinction, from its opacity, and single scattering
+    // albedo, from its color. Free paths are sampled by delta tracking and
+    // light by ratio tracking against per macrocell majorants. Every render
+    // adds one path per pixel to the image, up to maxPathPasses, until the
+    // view, volume, transfer function or settings change.
+    bool pathTrace = false;
+    int maxBounces = 16;
+    float anisotropy = 0.f;                    // Henyey-Greenstein g
+    float lightIntensity = 3.f;                // Directional light towards lightDirection
+    glm::vec3 environment = glm::vec3(0.2f);   // Radiance reaching paths that leave the volume
+    int maxPathPasses = 1024;
+
+    // Reuse the previous full resolution frame when the view changes: its
+    // pixels move to where their representative depth, the opacity weighted
+    // mean distance, lands in the new view. Holes, pixels where surfaces
+    // further apart than reprojectionTolerance of their distance meet, one
+    // row in 16 per frame, in bit reversed order, and pixels reused for 16
+    // frames are traced again; with the view unchanged every reused pixel is.
+    bool temporalReuse = false;
+    float reprojectionTolerance = 0.02f;
+
+    // Variable rate: full pixel density and step rate within focusRadius,
+    // a fraction of the image height, of focus, in [0, 1]^2 image coordinates
+    // with y up. The periphery traces one ray per 2^peripheryLevel pixel
+    // square with steps as much longer and is upsampled bilinearly, leaving
+    // out samples whose depth differs by more than upsampleTolerance of the
+    // nearest one's. Replaces temporal reuse.
+    bool foveated = false;
+    glm::vec2 focus = glm::vec2(0.5f);
+    float focusRadius = 0.25f;
+    int peripheryLevel = 2;
+    float upsampleTolerance = 0.05f;
+  };
+
+  struct RenderStats {
+    double time = 0.0;                         // Milliseconds for the last frame
+    size_t samples = 0;
+    size_t rays = 0;                           // Rays entering the volume
+    size_t tiles = 0;
+    size_t cellSteps = 0;                      // Macrocell lookups: per ray when scalar, per packet otherwise
+    double utilization = 0.0;                  // Share of thread time spent on tiles
+    size_t steals = 0;                         // Tile ranges stolen between threads
+    size_t preintegratedEntries = 0;           // Pre-integrated table entries rebuilt
+    bool precomputedGradients = false;
+    size_t lightSlices = 0;                    // Light volume slices swept
+    int pathPasses = 0;                        // Paths per pixel in the image
+    size_t reusedPixels = 0;                   // Pixels taken from the previous frame
+    size_t stalePixels = 0;                    // Pixels not traced since the view last changed
+    int coarseLevel = 0;
+    bool cancelled = false;                    // Tiles were skipped; the image is incomplete
+
+    double getSamplesPerRay() const;
+  };
+
+  // Smallest and largest voxel value, scanned in parallel
+  glm::vec2 computeValueRange(ThreadPool &pool, const VolumeView &volume);
+
+  class RayMarcher {
+  public:
+    static constexpr int maxStepLevels = 6;    // Step levels 0 to 5, up to 32 * stepSize
+    static constexpr int maxCoarseLevel = 4;   // Up to 16 x 16 pixels per ray
+
+  private:
+    ThreadPool &pool;
+    RenderSettings settings;
+    TransferFunction transferFunction;
+    VolumeView denseVolume;
+    BrickCache *brickCache;
+    const SparseVolume *sparseVolume;
+    const MortonVolume *mortonVolume;
+    glm::ivec3 dims;
+    VoxelType type;
+    glm::vec3 extent;
+    float referenceLength;
+    glm::vec2 valueRange;
+    MacrocellGrid macrocells;
+    PreintegratedTable preintegrated[maxCoarseLevel + 1];  // One per step scale, so levels keep their own
+    GradientVolume gradients;
+    LightVolume light;
+    glm::ivec2 imageDims;
+    float imageAspect;
+    float stepScale;
+    const std::atomic<bool> *cancel;           // Set while a render may be cancelled
+    std::vector<uint32_t> image;
+    std::vector<uint32_t> coarseImage;
+    std::vector<uint32_t> peripheryImage;      // Color per coarse pixel of the foveated periphery
+    std::vector<float> peripheryDepth;         // Depth per coarse pixel of the foveated periphery
+    glm::ivec2 peripheryDims;
+    std::vector<glm::vec3> accumulation;       // Radiance summed over path passes
+    int pathPasses;
+    glm::mat4 pathView;
+    bool pathsValid;                           // Cleared by any change the image depends on
+    std::vector<float> depth;                  // Representative depth per pixel for temporal reuse
+    std::vector<uint8_t> traceMask;            // Pixels to trace, or empty for all
+    std::vector<uint8_t> age;                  // Frames since each pixel was traced
+    std::vector<uint32_t> historyImage;        // Last full resolution frame with temporal reuse
+    std::vector<float> historyDepth;
+    std::vector<uint8_t> historyAge;
+    Camera historyCamera;
+    glm::ivec2 historyDims;
+    bool historyValid;                         // Cleared by any change the image depends on
+    uint32_t historyFrame;                     // Selects the pixels of the refresh pattern
+    std::vector<uint32_t> tileOrder;           // Tile index per scheduled position
+    glm::ivec2 tileOrderTiles;
+    bool tileOrderHilbert;
+    RenderStats stats;
+
+    void setGeometry(glm::ivec3 dims, VoxelType type, glm::vec3 spacing, float referenceLength);
+    float getStepLength() const;
+    int getStepScaleLevel() const;
+    int getMaxStepLevel() const;
+    float getMaxSpread() const;
+
+    // Tables of tableSize entries for steps of dt, 2 * dt, ... up to the
+    // largest step level, back to back
+    std::vector<glm::vec4> getClassification(float dt) const;
+    glm::ivec2 getTileCount() const;
+    void updateTileOrder();
+    bool isCancelled() const;
+    void expandCoarseImage(glm::ivec2 dims, int level);
+
+    // Pixels of the tile scheduled at position i
+    void getTileBounds(size_t i, glm::ivec2 &lo, glm::ivec2 &hi) const;
+    void updateMacrocells();
+    void updateGradients();
+    void updateLight();
+    bool canUsePackets() const;
+
+    // Marches the pixels of imageDims in traceMask, or all, at stepScale
+    void march(const Camera &camera);
+    void renderPackets(const Camera &camera);
+    void renderFoveated(const Camera &camera, glm::ivec2 fullDims);
+    void renderPaths(const Camera &camera);
+
+    // Fills the image with reprojected history and the trace mask with the
+    // pixels left to trace; afterwards the traced frame becomes the history
+    void reprojectHistory(const Camera &camera);
+    void updateHistory(const Camera &camera);
+
+    template <typename MakeSampler, typename ForEachSpan>
+    void renderTiles(const Camera &camera, MakeSampler &&makeSampler, ForEachSpan &&forEachSpan);
+
+    template <typename MakeSampler, typename ForEachMajorant>
+    void tracePaths(const Camera &camera, MakeSampler &&makeSampler, ForEachMajorant &&forEachMajorant);
+
+  public:
+    RayMarcher(ThreadPool &pool);
+
+    // The volume is centered on the origin with its physical extent,
+    // dims * spacing. Values in valueRange map to [0, 1] of the transfer
+    // function, whose opacity is given per referenceLength of distance;
+    // 0 means the smallest voxel spacing. Non-owning.
+    void setVolume(const VolumeView &volume, glm::vec2 valueRange, float referenceLength = 0.f);
+    void setVolume(BrickCache &cache, glm::vec2 valueRange, float referenceLength = 0.f);
+    void setVolume(const SparseVolume &volume, glm::vec2 valueRange, float referenceLength = 0.f);
+    void setVolume(const MortonVolume &volume, glm::vec2 valueRange, float referenceLength = 0.f);
+    void clearVolume();
+    bool hasVolume() const;
+
+    // Reclassifies the macrocells incrementally, without reading voxels
+    void setTransferFunction(const TransferFunction &transferFunction);
+    void setSettings(const RenderSettings &settings);
+
+    // Renders into the image, resized to dims; an empty volume renders
+    // background. A coarse level above 0 traces one ray per 2^level pixel
+    // square, with steps 2^level times as long, and fills the square with it;
+    // path tracing ignores it, and temporal reuse applies at level 0 only.
+    // Setting cancel from another thread skips the tiles not yet started.
+    void render(const Camera &camera, glm::ivec2 dims, int coarseLevel = 0, const std::atomic<bool> *cancel = nullptr);
+
+    // RGBA8 pixels packed as 0xAABBGGRR, bottom row first as OpenGL expects
+    const std::vector<uint32_t> &getImage() const;
+    glm::ivec2 getImageDims() const;
+
+    // Periphery of the last render when it was foveated, otherwise empty:
+    // one color and representative depth per 2^getPeripheryLevel() pixel
+    // square. The image then holds only the focus and its blend band; the
+    // viewer's present pass upsamples the periphery around them.
+    const std::vector<uint32_t> &getPeripheryImage() const;
+    const std::vector<float> &getPeripheryDepth() const;
+    glm::ivec2 getPeripheryDims() const;
+    int getPeripheryLevel() const;
+
+    // The image with the periphery upsampled on the CPU, as the present pass
+    // does, for use without a window
+    std::vector<uint32_t> composeFoveated() const;
+    const RenderSettings &getSettings() const;
+    const TransferFunction &getTransferFunction() const;
+    RenderStats getStats() const;
+
+    // Built on the first render with skipEmptySpace after setVolume
+    const MacrocellGrid &getMacrocells() const;
+  };
+} // namespace CUDAVol
@@ -0,0 +1,94 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_packet.h
+
+  Packet ray marching declaration. Marches a row of 4, 8 or 16 rays per SIMD
+  register through a dense volume, with gathers for trilinear sampling and
+  classification and per-lane masks for rays that left the volume or
+  saturated. One kernel per instruction set, chosen at startup via CPUID.
+
+  November 2019
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace CUDAVol {
+  enum class SimdIsa { Scalar, Sse4, Avx2, Avx512 };
+
+  // Widest instruction set both the CPU and OS support, and this build has kernels for
+  SimdIsa detectSimdIsa();
+  SimdIsa parseSimdIsa(const std::string &str);
+  const char *toString(SimdIsa isa);
+  int getPacketWidth(SimdIsa isa);
+
+  // Plain data for the kernels, which are compiled with different target
+  // flags and so share no inline code with the rest of the program
+  struct PacketFrame {
+    const std::byte *data;
+    int voxelType;              // VoxelType as int
+    int fixedPoint;             // 8 and 16 bit voxels interpolate with integer weights
+    int dims[3];                // At least 2 per axis
+    int maxPairOffset;          // Largest byte offset a 4 byte gather may start at
+    float boxMax[3];            // Volume box is [-boxMax, boxMax] in world space
+    float toVoxel[3];           // World to voxel space: p * toVoxel + voxelOffset
+    float voxelOffset[3];
+    float eye[3];
+    float forward[3];           // Camera basis, right and up scaled by the image plane
+    float right[3];
+    float up[3];
+    float dt;
+    float valueOffset;          // Table coordinate: value * valueScale + valueOffset
+    float valueScale;
+    const float *table[4];      // Premultiplied classification, one array per channel
+    int tableSize;              // Entries per step level; level l starts at l * tableSize
+    const float *segmentTable[4]; // Pre-integrated tableSize^2, front major, or nullptr
+    float opacityThreshold;     // Lanes stop once their opacity reaches this
+    int maxStepLevel;           // Steps of up to 2^maxStepLevel * dt; 0 keeps them at dt
+    float stepDistance;         // Camera distance beyond which steps double per doubling, or 0
+    const float *occupancy;     // Macrocells, x fastest, nonzero unless empty; nullptr marches every step
+    const float *distances;     // Chebyshev distance to an occupied macrocell, or nullptr
+    const float *ranges;        // Value range per macrocell, two floats each
+    float maxSpread;            // Cells with a range no wider take the largest step; negative for none
+    int cellGrid[3];
+    float cellSize;             // Voxel p lies in cell (p + 0.5) / cellSize
+    float background[3];
+    int imageDims[2];
+    uint32_t *image;
+    const uint8_t *traceMask;   // Nonzero for pixels to trace, the others kept; nullptr traces all
+    float *depth;               // Representative depth per traced pixel, or nullptr
+  };
+
+  struct PacketCounts {
+    size_t samples;
+    size_t rays;                // Rays entering the volume
+    size_t cellSteps;           // Macrocell lookups, one per packet
+  };
+
+  // Renders pixels [x0, x1) x [y0, y1)
+  PacketCounts marchPackets(SimdIsa isa, const PacketFrame &frame, int x0, int y0, int x1, int y1);
+} // namespace CUDAVol
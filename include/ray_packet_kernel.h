@@ -0,0 +1,409 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_packet_kernel.h
+
+  Packet ray marching kernel definition, included only by the per-ISA
+  translation units. Written against a traits type S providing the vector
+  types and operations, so each unit instantiates it for its own instruction
+  set. Uses no inline functions from other headers, which could otherwise be
+  emitted with wider instructions than the rest of the program may run.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "ray_packet.h"
+
+namespace CUDAVol {
+  // Trilinear sample at p in voxel coordinates; the lower corner is kept one
+  // voxel from the upper border so that x + 1 is always a valid neighbour
+  template <typename S, typename T>
+  typename S::F samplePacket(const PacketFrame &fr,
+                             typename S::F px,
+                             typename S::F py,
+                             typename S::F pz) {
+    using F = typename S::F;
+    using I = typename S::I;
+    const F zero = S::set(0.f);
+    px = S::min(S::max(px, zero), S::set(static_cast<float>(fr.dims[0] - 1)));
+    py = S::min(S::max(py, zero), S::set(static_cast<float>(fr.dims[1] - 1)));
+    pz = S::min(S::max(pz, zero), S::set(static_cast<float>(fr.dims[2] - 1)));
+    const I ix = S::mini(S::toInt(px), S::seti(fr.dims[0] - 2));
+    const I iy = S::mini(S::toInt(py), S::seti(fr.dims[1] - 2));
+    const I iz = S::mini(S::toInt(pz), S::seti(fr.dims[2] - 2));
+    const F fx = S::sub(px, S::toFloat(ix));
+    const F fy = S::sub(py, S::toFloat(iy));
+    const F fz = S::sub(pz, S::toFloat(iz));
+
+    const I row = S::seti(fr.dims[0]);
+    const I slice = S::seti(fr.dims[0] * fr.dims[1]);
+    const I i00 = S::addi(ix, S::addi(S::muli(iy, row), S::muli(iz, slice)));
+    const I i10 = S::addi(i00, row);
+    const I i01 = S::addi(i00, slice);
+    const I i11 = S::addi(i01, row);
+
+    F lo, hi;
+    S::template loadPair<T>(fr, i00, lo, hi);
+    const F c00 = S::lerp(lo, hi, fx);
+    S::template loadPair<T>(fr, i10, lo, hi);
+    const F c10 = S::lerp(lo, hi, fx);
+    S::template loadPair<T>(fr, i01, lo, hi);
+    const F c01 = S::lerp(lo, hi, fx);
+    S::template loadPair<T>(fr, i11, lo, hi);
+    const F c11 = S::lerp(lo, hi, fx);
+    return S::lerp(S::lerp(c00, c10, fy), S::lerp(c01, c11, fy), fz);
+  }
+
+  // Trilinear sample of 8 or 16 bit voxels with integer weights. Both voxels
+  // of a pair are weighted along x in one 16 bit multiply-add, with 8 bit
+  // weights; y and z follow on 32 bit lanes with weightBits, fewer for 16 bit
+  // voxels so differences times weights stay within 31 bits. Returns the value
+  // times 256, scaled back only with the table coordinate.
+  template <typename S, typename T>
+  typename S::F samplePacketFixed(const PacketFrame &fr,
+                                  typename S::F px,
+                                  typename S::F py,
+                                  typename S::F pz) {
+    using F = typename S::F;
+    using I = typename S::I;
+    constexpr int weightBits = sizeof(T) == 1 ? 8 : 7;
+    const F zero = S::set(0.f);
+    const F half = S::set(0.5f);
+    px = S::min(S::max(px, zero), S::set(static_cast<float>(fr.dims[0] - 1)));
+    py = S::min(S::max(py, zero), S::set(static_cast<float>(fr.dims[1] - 1)));
+    pz = S::min(S::max(pz, zero), S::set(static_cast<float>(fr.dims[2] - 1)));
+    const I ix = S::mini(S::toInt(px), S::seti(fr.dims[0] - 2));
+    const I iy = S::mini(S::toInt(py), S::seti(fr.dims[1] - 2));
+    const I iz = S::mini(S::toInt(pz), S::seti(fr.dims[2] - 2));
+    const I wx = S::toInt(S::add(S::mul(S::sub(px, S::toFloat(ix)), S::set(256.f)), half));
+    const I wy = S::toInt(S::add(S::mul(S::sub(py, S::toFloat(iy)), S::set(1 << weightBits)), half));
+    const I wz = S::toInt(S::add(S::mul(S::sub(pz, S::toFloat(iz)), S::set(1 << weightBits)), half));
+    const I weights = S::addi(S::subi(S::seti(256), wx), S::template slli<16>(wx));
+
+    const I row = S::seti(fr.dims[0]);
+    const I slice = S::seti(fr.dims[0] * fr.dims[1]);
+    const I i00 = S::addi(ix, S::addi(S::muli(iy, row), S::muli(iz, slice)));
+    const I i10 = S::addi(i00, row);
+    const I i01 = S::addi(i00, slice);
+    const I i11 = S::addi(i01, row);
+
+    auto lerp = [](I a, I b, I w) {
+      return S::addi(a, S::template srai<weightBits>(S::muli(S::subi(b, a), w)));
+    };
+    const I c00 = S::template lerpPairFixed<T>(fr, i00, weights);
+    const I c10 = S::template lerpPairFixed<T>(fr, i10, weights);
+    const I c01 = S::template lerpPairFixed<T>(fr, i01, weights);
+    const I c11 = S::template lerpPairFixed<T>(fr, i11, weights);
+    return S::toFloat(lerp(lerp(c00, c10, wy), lerp(c01, c11, wy), wz));
+  }
+
+  // Step of the first sample at which an active lane leaves the cube of
+  // cells within radius of its macrocell; until then every lane stays in its
+  // occupied cell, or among empty ones
+  template <typename S>
+  int getCellExitStep(const PacketFrame &fr,
+                      int k,
+                      typename S::M active,
+                      const typename S::F *p,
+                      const typename S::I *cell,
+                      typename S::F radius,
+                      const typename S::F *invDir) {
+    using F = typename S::F;
+    constexpr int W = S::width;
+    const F zero = S::set(0.f);
+    const F one = S::set(1.f);
+    const F never = S::set(static_cast<float>(1 << 29));
+    F tCell = S::set(3.4e38f);
+    for (int c = 0; c < 3; c++) {
+      const F side = S::select(S::lt(zero, invDir[c]), S::add(radius, one), S::sub(zero, radius));
+      const F boundary = S::mul(S::add(S::toFloat(cell[c]), side), S::set(fr.cellSize));
+      tCell = S::min(tCell, S::mul(S::sub(boundary, S::add(p[c], S::set(0.5f))), invDir[c]));
+    }
+
+    // Whole steps to the exit, at least one; inactive lanes never limit
+    const F steps = S::min(S::div(tCell, S::set(fr.dt)), never);
+    F whole = S::toFloat(S::toInt(S::max(steps, one)));
+    whole = S::add(whole, S::select(S::lt(whole, steps), one, zero));
+    alignas(64) float lanes[W];
+    S::store(lanes, S::select(active, whole, never));
+    float next = lanes[0];
+    for (int l = 1; l < W; l++) {
+      next = lanes[l] < next ? lanes[l] : next;
+    }
+    return k + static_cast<int>(next);
+  }
+
+  template <typename S, typename T, bool Fixed>
+  PacketCounts marchPacketRows(const PacketFrame &fr, int x0, int y0, int x1, int y1) {
+    using F = typename S::F;
+    using I = typename S::I;
+    using M = typename S::M;
+    constexpr int W = S::width;
+
+    const F zero = S::set(0.f);
+    const F one = S::set(1.f);
+    const F lane = S::laneIndex();
+    const F pixelScale = S::set(2.f / fr.imageDims[0]);
+    const F dt = S::set(fr.dt);
+    const F valueScale = S::set(Fixed ? fr.valueScale / 256.f : fr.valueScale);
+    const F tableMax = S::set(static_cast<float>(fr.tableSize - 1));
+    const I tableLast = S::seti(fr.tableSize - 2);
+    const F threshold = S::set(fr.opacityThreshold);
+    const F half = S::set(0.5f);
+    const F invCellSize = S::set(1.f / fr.cellSize);
+    I cellLast[3];
+    for (int c = 0; c < 3; c++) {
+      cellLast[c] = S::seti(fr.cellGrid[c] - 1);
+    }
+    float origin[3];
+    for (int c = 0; c < 3; c++) {
+      origin[c] = fr.eye[c] * fr.toVoxel[c] + fr.voxelOffset[c];
+    }
+
+    PacketCounts counts = {0, 0, 0};
+    alignas(64) float out[4][W];
+    for (int y = y0; y < y1; y++) {
+      const float ndcY = (y + 0.5f) * 2.f / fr.imageDims[1] - 1.f;
+      for (int x = x0; x < x1; x += W) {
+        const int n = x1 - x < W ? x1 - x : W;
+        const size_t pixel = static_cast<size_t>(y) * fr.imageDims[0] + x;
+
+        // Packets without a pixel in the trace mask are skipped whole
+        alignas(64) float traced[W];
+        if (fr.traceMask) {
+          bool any = false;
+          for (int l = 0; l < W; l++) {
+            traced[l] = l < n && fr.traceMask[pixel + l] ? 1.f : 0.f;
+            any = any || traced[l] != 0.f;
+          }
+          if (!any) {
+            continue;
+          }
+        }
+        const F ndcX = S::sub(S::mul(S::add(S::add(S::set(static_cast<float>(x)), lane), S::set(0.5f)), pixelScale), one);
+
+        // Primary rays and their slab test against the volume box
+        F d[3];
+        for (int c = 0; c < 3; c++) {
+          d[c] = S::add(S::mul(ndcX, S::set(fr.right[c])), S::set(fr.forward[c] + ndcY * fr.up[c]));
+        }
+        const F length = S::sqrt(S::add(S::add(S::mul(d[0], d[0]), S::mul(d[1], d[1])), S::mul(d[2], d[2])));
+        F tEnter = zero, tExit = S::set(3.4e38f);
+        F voxelDir[3], invDir[3];
+        for (int c = 0; c < 3; c++) {
+          d[c] = S::div(d[c], length);
+          const F inv = S::div(one, d[c]);
+          const F t0 = S::mul(S::set(-fr.boxMax[c] - fr.eye[c]), inv);
+          const F t1 = S::mul(S::set(fr.boxMax[c] - fr.eye[c]), inv);
+          tEnter = S::max(tEnter, S::min(t0, t1));
+          tExit = S::min(tExit, S::max(t0, t1));
+          voxelDir[c] = S::mul(d[c], S::set(fr.toVoxel[c]));
+          invDir[c] = S::max(S::min(S::div(one, voxelDir[c]), S::set(1e30f)), S::set(-1e30f));
+        }
+
+        // March every lane in step; finished lanes are masked out and the
+        // packet ends when none is left
+        M active = S::andm(S::firstLanes(n), S::lt(tEnter, tExit));
+        if (fr.traceMask) {
+          active = S::andm(active, S::lt(zero, S::load(traced)));
+        }
+        F r = zero, g = zero, b = zero, a = zero, depthSum = zero;
+        int cellExit = 0, cellLevel = 0;
+        F front = zero;
+        bool fresh = true;              // No previous sample to start a segment from
+        counts.rays += S::count(active);
+
+        // Distance based step levels follow the nearest lane, so no lane
+        // steps further than its own distance allows
+        alignas(64) float enter[W];
+        S::store(enter, S::select(active, tEnter, S::set(3.4e38f)));
+        float minEnter = enter[0];
+        for (int l = 1; l < W; l++) {
+          minEnter = enter[l] < minEnter ? enter[l] : minEnter;
+        }
+
+        for (int k = 0;;) {
+          const F t = S::add(tEnter, S::mul(S::set(static_cast<float>(k)), dt));
+          active = S::andm(active, S::le(t, tExit));
+          if (!S::any(active)) {
+            break;
+          }
+          F p[3];
+          for (int c = 0; c < 3; c++) {
+            p[c] = S::add(S::set(origin[c]), S::mul(t, voxelDir[c]));
+          }
+
+          // Once any lane enters another macrocell: jump to the next crossing
+          // when every active lane is in an empty cell, else march on to it.
+          // Samples in empty cells read only voxels mapped to zero opacity.
+          // Cells at Chebyshev distance d from occupied ones lie in an empty
+          // cube of radius d - 1, and crossings of that cube suffice.
+          if (fr.occupancy && k >= cellExit) {
+            I cell[3];
+            for (int c = 0; c < 3; c++) {
+              cell[c] = S::mini(S::toInt(S::mul(S::max(S::add(p[c], half), zero), invCellSize)), cellLast[c]);
+            }
+            const I index = S::addi(cell[0], S::muli(S::addi(cell[1], S::muli(cell[2], S::seti(fr.cellGrid[1]))),
+                                                     S::seti(fr.cellGrid[0])));
+            const F radius = fr.distances ? S::max(S::sub(S::gather(fr.distances, index), one), zero) : zero;
+            cellExit = getCellExitStep<S>(fr, k, active, p, cell, radius, invDir);
+            counts.cellSteps++;
+            const M occupied = S::andm(active, S::lt(zero, S::gather(fr.occupancy, index)));
+            if (!S::any(occupied)) {
+              k = cellExit;
+              fresh = true;
+              continue;
+            }
+
+            // Largest steps while every occupied cell is near constant; the
+            // step is cut short at the next crossing below
+            cellLevel = 0;
+            if (fr.maxStepLevel > 0 && fr.ranges) {
+              const I first = S::addi(index, index);
+              const F spread = S::sub(S::gather(fr.ranges, S::addi(first, S::seti(1))), S::gather(fr.ranges, first));
+              cellLevel = S::any(S::andm(occupied, S::lt(S::set(fr.maxSpread), spread))) ? 0 : fr.maxStepLevel;
+            }
+          }
+
+          // Step level: the larger of the distance and cell levels, the latter
+          // never stepping past the next macrocell crossing
+          int level = 0;
+          if (fr.stepDistance > 0.f) {
+            const float tNear = minEnter + static_cast<float>(k) * fr.dt;
+            while (level < fr.maxStepLevel && tNear >= fr.stepDistance * static_cast<float>(2 << level)) {
+              level++;
+            }
+          }
+          if (fr.occupancy) {
+            int bounded = cellLevel;
+            while (bounded > 0 && k + (1 << bounded) > cellExit) {
+              bounded--;
+            }
+            level = bounded > level ? bounded : level;
+          }
+          F v;
+          if constexpr (Fixed) {
+            v = samplePacketFixed<S, T>(fr, p[0], p[1], p[2]);
+          } else {
+            v = samplePacket<S, T>(fr, p[0], p[1], p[2]);
+          }
+
+          // Classify through the premultiplied table for the step length
+          const F u = S::min(S::max(S::add(S::mul(v, valueScale), S::set(fr.valueOffset)), zero), tableMax);
+          const I i0 = S::mini(S::toInt(u), tableLast);
+          const F f = S::sub(u, S::toFloat(i0));
+          F c[4];
+          if (fr.segmentTable[0]) {
+            // Segment from the previous sample, bilinear in the 2D table
+            if (fresh) {
+              front = u;
+              fresh = false;
+            }
+            const I j0 = S::mini(S::toInt(front), tableLast);
+            const F fj = S::sub(front, S::toFloat(j0));
+            const I e00 = S::addi(S::muli(j0, S::seti(fr.tableSize)), i0);
+            const I e01 = S::addi(e00, S::seti(1));
+            const I e10 = S::addi(e00, S::seti(fr.tableSize));
+            const I e11 = S::addi(e10, S::seti(1));
+            for (int ch = 0; ch < 4; ch++) {
+              const float *t = fr.segmentTable[ch];
+              c[ch] = S::lerp(S::lerp(S::gather(t, e00), S::gather(t, e01), f),
+                              S::lerp(S::gather(t, e10), S::gather(t, e11), f), fj);
+            }
+            front = u;
+          } else {
+            const I i = S::addi(i0, S::seti(level * fr.tableSize));
+            const I i1 = S::addi(i, S::seti(1));
+            for (int ch = 0; ch < 4; ch++) {
+              c[ch] = S::lerp(S::gather(fr.table[ch], i), S::gather(fr.table[ch], i1), f);
+            }
+          }
+          const F w = S::select(active, S::sub(one, a), zero);
+          r = S::add(r, S::mul(w, c[0]));
+          g = S::add(g, S::mul(w, c[1]));
+          b = S::add(b, S::mul(w, c[2]));
+          if (fr.depth) {
+            depthSum = S::add(depthSum, S::mul(S::mul(w, c[3]), t));
+          }
+          a = S::add(a, S::mul(w, c[3]));
+          counts.samples += S::count(active);
+          active = S::andm(active, S::lt(a, threshold));
+          k += 1 << level;
+        }
+
+        // Composite over the background and pack
+        const F rest = S::sub(one, a);
+        S::store(out[0], S::add(r, S::mul(rest, S::set(fr.background[0]))));
+        S::store(out[1], S::add(g, S::mul(rest, S::set(fr.background[1]))));
+        S::store(out[2], S::add(b, S::mul(rest, S::set(fr.background[2]))));
+        for (int l = 0; l < n; l++) {
+          if (fr.traceMask && traced[l] == 0.f) {
+            continue;
+          }
+          uint32_t color = 0xff000000u;
+          for (int c = 0; c < 3; c++) {
+            const float value = out[c][l] < 0.f ? 0.f : out[c][l] > 1.f ? 1.f : out[c][l];
+            color |= static_cast<uint32_t>(value * 255.f + 0.5f) << (8 * c);
+          }
+          fr.image[pixel + l] = color;
+        }
+
+        // Opacity weighted mean distance, the middle of the box for rays
+        // through nothing visible, and -1 for rays missing it
+        if (fr.depth) {
+          alignas(64) float enterBox[W], exitBox[W], opacity[W], weighted[W];
+          S::store(enterBox, tEnter);
+          S::store(exitBox, tExit);
+          S::store(opacity, a);
+          S::store(weighted, depthSum);
+          for (int l = 0; l < n; l++) {
+            if (fr.traceMask && traced[l] == 0.f) {
+              continue;
+            }
+            fr.depth[pixel + l] = opacity[l] > 1e-3f ? weighted[l] / opacity[l]
+                                  : enterBox[l] < exitBox[l] ? 0.5f * (enterBox[l] + exitBox[l]) : -1.f;
+          }
+        }
+      }
+    }
+    return counts;
+  }
+
+  // Dispatches on the voxel type, 0 UInt8, 1 UInt16, 2 Float32 as in
+  // VoxelType, and fixed point sampling for the integer types
+  template <typename S>
+  PacketCounts marchPacketTile(const PacketFrame &fr, int x0, int y0, int x1, int y1) {
+    switch (fr.voxelType) {
+    case 0:
+      return fr.fixedPoint ? marchPacketRows<S, uint8_t, true>(fr, x0, y0, x1, y1)
+                           : marchPacketRows<S, uint8_t, false>(fr, x0, y0, x1, y1);
+    case 1:
+      return fr.fixedPoint ? marchPacketRows<S, uint16_t, true>(fr, x0, y0, x1, y1)
+                           : marchPacketRows<S, uint16_t, false>(fr, x0, y0, x1, y1);
+    default:
+      return marchPacketRows<S, float, false>(fr, x0, y0, x1, y1);
+    }
+  }
+} // namespace CUDAVol
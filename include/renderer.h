@@ -29,20 +29,77 @@
 */
 
 #pragma once
+#include "brick_cache.h"
+#include "brick_prefetcher.h"
+#include "camera.h"
 #include "program.h"
+#include "ray_marcher.h"
+#include "sparse_volume.h"
+#include "thread_pool.h"
+#include "volume.h"
 #include "window.h"
+#include "glm/mat4x4.hpp"
+#include "glm/vec2.hpp"
+#include <atomic>
+#include <future>
+#include <memory>
+#include <vector>
 
 namespace CUDAVol {
   class Renderer {
   private:
     Program windowDrawPrg;
+    Program foveatedDrawPrg;                   // Upsamples the periphery of foveated frames
     GLuint quadVAO;
+    GLuint frameTexture;
+    GLuint peripheryTextures[2];               // Color and depth of the foveated periphery
+    glm::ivec2 textureDims;
+    bool foveatedFrame;                        // Uploaded frame has a periphery
     const Window &window;
+    ThreadPool &pool;
+    VolumeView volume;
+    glm::vec2 valueRange;
+    const SparseVolume *sparseVolume;
+    const std::vector<BrickedVolume> *brickedLevels;
+    size_t brickedLevel;
+    size_t cacheBytes;
+    std::unique_ptr<BrickCache> brickCache;
+    std::unique_ptr<BrickPrefetcher> brickPrefetcher;
+    RayMarcher rayMarcher;
+    Camera camera;
+    glm::dvec2 cursor;
+    bool focusKeyDown;
+
+    // Progressive refinement: the level shown, the view it shows, and the
+    // pass refining it in the background
+    int shownLevel;
+    glm::mat4 shownView;
+    glm::ivec2 shownDims;
+    std::future<void> refinement;
+    std::shared_ptr<std::atomic<bool>> refinementCancel;
+
+    void restartRefinement();
+    void uploadImage();
+    void resetVolume(glm::ivec3 dims, VoxelType type, glm::vec3 spacing);
+    size_t selectLevel() const;
+    void useLevel(size_t level);
+    void handleInput();
 
   public:
-    Renderer(const Window &window);
+    Renderer(const Window &window, ThreadPool &pool);
     ~Renderer();
 
+    void setVolume(const VolumeView &volume);
+    void setVolume(const std::vector<BrickedVolume> &levels, size_t cacheBytes);
+    void setVolume(const SparseVolume &volume);
+    void setTransferFunction(const TransferFunction &transferFunction);
+    void setSettings(const RenderSettings &settings);
+
+    // Waits for the background pass, which reads the volume, to stop; call
+    // before the memory behind the current volume changes
+    void stopRefinement();
     void update();
+
+    const RayMarcher &getRayMarcher() const;
   };
 } // namespace CUDAVol
@@ -0,0 +1,71 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  slice_loader.h
+
+  Slice stack loader declaration. Assembles a volume from a directory of 2D
+  TIFF/PNG slices through a bounded read -> decode -> convert/place pipeline,
+  each stage running on its own set of threads.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "volume.h"
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  // Busy time per stage summed over that stage's threads, and total wall
+  // clock time, in milliseconds
+  struct SliceTimings {
+    double read = 0.0;
+    double decode = 0.0;
+    double convert = 0.0;
+    double total = 0.0;
+  };
+
+  class SliceLoader {
+  private:
+    unsigned readThreads;
+    unsigned decodeThreads;
+    unsigned convertThreads;
+    size_t queueCapacity;
+    SliceTimings timings;
+
+  public:
+    // Zero picks a default based on the hardware thread count
+    SliceLoader(unsigned readThreads = 2,
+                unsigned decodeThreads = 0,
+                unsigned convertThreads = 0,
+                size_t queueCapacity = 0);
+
+    // Loads all .png/.tif/.tiff files in a directory, in natural sort order
+    Volume load(const std::string &directory, glm::vec3 spacing = glm::vec3(1.f));
+    Volume load(const std::vector<std::string> &filePaths,
+                glm::vec3 spacing = glm::vec3(1.f));
+
+    const SliceTimings &getTimings() const;
+  };
+} // namespace CUDAVol
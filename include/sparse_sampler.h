@@ -0,0 +1,94 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  sparse_sampler.h
+
+  Sparse sampler declaration and definition. Samples a sparse volume,
+  keeping the last leaf visited so neighbouring samples skip the tree walk.
+  One sampler per thread.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "sparse_volume.h"
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+
+namespace CUDAVol {
+  template <typename T>
+  class SparseSampler {
+  private:
+    const SparseVolume &volume;
+    glm::ivec3 dims;
+    glm::ivec3 shift;
+    glm::ivec3 leafOrigin;
+    const T *leaf;
+    float tile;
+
+    float fetch(glm::ivec3 p) {
+      const glm::ivec3 q = p + shift;
+      const glm::ivec3 origin = q & ~(SparseVolume::leafDim - 1);
+      if (origin != leafOrigin) {
+        leaf = reinterpret_cast<const T *>(volume.probeLeaf(q, tile));
+        leafOrigin = origin;
+      }
+      if (!leaf) {
+        return tile;
+      }
+      const glm::ivec3 l = q - origin;
+      return static_cast<float>(
+          leaf[l.x + SparseVolume::leafDim * (l.y + SparseVolume::leafDim * l.z)]);
+    }
+
+  public:
+    SparseSampler(const SparseVolume &volume)
+      : volume(volume),
+        dims(volume.getDims()),
+        shift(volume.getShift()),
+        leafOrigin(-1),
+        leaf(nullptr),
+        tile(volume.getBackground()) {}
+
+    // Trilinear sample at p in voxel coordinates, voxel centers at integers
+    float sample(glm::vec3 p) {
+      p = glm::clamp(p, glm::vec3(0.f), glm::vec3(dims - 1));
+      const glm::ivec3 i0(p);
+      const glm::ivec3 i1 = glm::min(i0 + 1, dims - 1);
+      const glm::vec3 f = p - glm::vec3(i0);
+
+      float c00 = glm::mix(fetch({i0.x, i0.y, i0.z}), fetch({i1.x, i0.y, i0.z}), f.x);
+      float c10 = glm::mix(fetch({i0.x, i1.y, i0.z}), fetch({i1.x, i1.y, i0.z}), f.x);
+      float c01 = glm::mix(fetch({i0.x, i0.y, i1.z}), fetch({i1.x, i0.y, i1.z}), f.x);
+      float c11 = glm::mix(fetch({i0.x, i1.y, i1.z}), fetch({i1.x, i1.y, i1.z}), f.x);
+      return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+    }
+
+    // Forgets the cached leaf, for interface parity with BrickSampler
+    void release() {
+      leafOrigin = glm::ivec3(-1);
+      leaf = nullptr;
+    }
+  };
+} // namespace CUDAVol
@@ -0,0 +1,174 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  sparse_volume.h
+
+  Sparse volume class header. A shallow tree over mostly empty volumes: a
+  dense root grid of nodes, each node 16^3 slots holding a dense 8^3 leaf or a
+  constant tile, with active masks per voxel and per tile. Memory grows with
+  the occupied region rather than the bounding box.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "grid_walk.h"
+#include "thread_pool.h"
+#include "volume.h"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CUDAVol {
+  class SparseVolume {
+  public:
+    static constexpr int leafLog2 = 3;
+    static constexpr int nodeLog2 = 4;
+    static constexpr int leafDim = 1 << leafLog2;               // Voxels per leaf side
+    static constexpr int nodeDim = 1 << (leafLog2 + nodeLog2);  // Voxels per node side
+    static constexpr int leafVoxels = leafDim * leafDim * leafDim;
+    static constexpr int nodeSlots = 1 << (3 * nodeLog2);
+    static constexpr uint32_t noChild = UINT32_MAX;
+
+    struct Node {
+      uint32_t leaves[nodeSlots];             // Leaf per slot, or noChild for a tile
+      float tiles[nodeSlots];                 // Value of slots without a leaf
+      uint64_t activeTiles[nodeSlots / 64];
+    };
+
+  private:
+    glm::ivec3 dims;
+    glm::ivec3 shift;
+    VoxelType type;
+    glm::vec3 spacing;
+    float background;
+    glm::ivec3 rootGrid;
+    std::vector<uint32_t> rootNodes;          // Node per root cell, or noChild for a tile
+    std::vector<float> rootTiles;
+    std::vector<uint8_t> rootActive;
+    std::vector<Node> nodes;
+    std::vector<std::byte> leafData;          // leafVoxels values per leaf, x fastest
+    std::vector<uint64_t> leafMasks;          // leafVoxels / 64 words per leaf
+
+    size_t getRootIndex(glm::ivec3 q) const;
+    static size_t getSlotIndex(glm::ivec3 q);
+    uint32_t getNode(glm::ivec3 q);
+
+    // Whether the node or leaf sized cell, or one of its 26 neighbours, holds
+    // a child, an active tile or a tile other than background
+    bool isOccupied(glm::ivec3 cell, int size) const;
+    bool isNearOccupied(glm::ivec3 cell, int size) const;
+
+  public:
+    SparseVolume();
+
+    // Tree coordinates are voxel coordinates plus shift, so imported trees
+    // keep their node alignment
+    SparseVolume(glm::ivec3 dims,
+                 VoxelType type,
+                 glm::vec3 spacing = glm::vec3(1.f),
+                 float background = 0.f,
+                 glm::ivec3 shift = glm::ivec3(0));
+
+    // Keeps the leaves holding any voxel other than background; voxels other
+    // than background are active
+    static SparseVolume fromDense(ThreadPool &pool, const VolumeView &volume, float background = 0.f);
+
+    // Construction, in tree coordinates aligned to the leaf or node size.
+    // New leaves and nodes take over the value and state of the tile they replace.
+    uint32_t addLeaf(glm::ivec3 origin);
+    void setLeafTile(glm::ivec3 origin, float value, bool active);
+    void setNodeTile(glm::ivec3 origin, float value, bool active);
+    std::byte *getLeafData(uint32_t leaf);
+    uint64_t *getLeafMask(uint32_t leaf);
+
+    // Leaf containing tree coordinate q, or nullptr with the tile value in tile
+    const std::byte *probeLeaf(glm::ivec3 q, float &tile) const;
+
+    // Voxel coordinates
+    float getValue(glm::ivec3 p) const;
+    bool isActive(glm::ivec3 p) const;
+
+    // Calls f(t0, t1) for the parts of the ray, in voxel coordinates with
+    // voxel centers at integers, where trilinear samples may differ from
+    // background: within half a voxel of leaves, active tiles or tiles other
+    // than background. Spans come front to back and are merged.
+    template <typename F>
+    void forEachSpan(glm::vec3 origin, glm::vec3 dir, float tMin, float tMax, F &&f) const {
+      // In tree space voxel q covers [q, q + 1); a sample reads the voxels
+      // within half a voxel, so cells next to occupied ones count as occupied
+      origin += glm::vec3(shift) + 0.5f;
+      float begin = 0.f, end = -1.f;
+      auto emit = [&](float t0, float t1) {
+        if (t0 <= end) {
+          end = std::max(end, t1);
+        } else {
+          if (end > begin) {
+            f(begin, end);
+          }
+          begin = t0;
+          end = t1;
+        }
+      };
+
+      walkGrid(origin, dir, tMin, tMax, glm::ivec3(0), rootGrid, float(nodeDim),
+               [&](glm::ivec3 cell, float t0, float t1) {
+        if (!isNearOccupied(cell, nodeDim)) {
+          return true;
+        }
+        const size_t r = cell.x + rootGrid.x * (static_cast<size_t>(cell.y) + rootGrid.y * cell.z);
+        if (rootNodes[r] == noChild && isOccupied(cell, nodeDim)) {
+          emit(t0, t1);
+          return true;
+        }
+        const glm::ivec3 lo = cell * (1 << nodeLog2);
+        walkGrid(origin, dir, t0, t1, lo, lo + (1 << nodeLog2), float(leafDim),
+                 [&](glm::ivec3 leafCell, float s0, float s1) {
+          if (isNearOccupied(leafCell, leafDim)) {
+            emit(s0, s1);
+          }
+          return true;
+        });
+        return true;
+      });
+      if (end > begin) {
+        f(begin, end);
+      }
+    }
+
+    glm::ivec3 getDims() const;
+    glm::ivec3 getShift() const;
+    VoxelType getType() const;
+    glm::vec3 getSpacing() const;
+    float getBackground() const;
+    glm::vec2 getValueRange() const;
+    size_t getNodeCount() const;
+    size_t getLeafCount() const;
+    size_t getActiveVoxelCount() const;
+    size_t getMemorySize() const;
+  };
+} // namespace CUDAVol
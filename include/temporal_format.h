@@ -0,0 +1,89 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  temporal_format.h
+
+  Temporal volume file format (.cvt) declaration. A file holds a header,
+  a frame table with one entry per timestep and the frames themselves. Each
+  frame stores only the bricks that changed since the previous timestep, as
+  compressed per-voxel deltas, followed by an index: a bitmask of the stored
+  bricks and their compressed sizes. Keyframes store every brick against zero
+  so playback can start from them. Bricks have no halo and are cut off at the
+  volume border. Values are stored in the byte order of the writing host.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "brick_format.h"
+#include "volume.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace CUDAVol {
+  struct TemporalFileHeader {
+    char magic[8];            // "CVTEMPO\0"
+    uint32_t version;         // TemporalFileHeader::currentVersion
+    uint32_t voxelType;       // VoxelType
+    int32_t dims[3];          // Volume dimensions in voxels
+    float spacing[3];         // Voxel spacing
+    uint32_t brickSize;       // Voxels per brick side
+    uint32_t codec;           // BrickCodec
+    uint32_t brickCount;      // Bricks per timestep
+    int32_t brickGrid[3];     // Bricks per axis
+    uint32_t timestepCount;   // Entries in the frame table
+    uint32_t keyframeInterval;
+    uint64_t tableOffset;     // Byte offset of the frame table
+
+    static constexpr uint32_t currentVersion = 1;
+  };
+
+  struct TemporalFrame {
+    uint64_t offset;          // Byte offset of the first stored brick
+    uint64_t indexOffset;     // Byte offset of the bitmask and size table
+    uint32_t changed;         // Bricks stored in this frame
+    uint32_t flags;           // TemporalFrame::keyframe
+
+    static constexpr uint32_t keyframe = 1;
+  };
+
+  // The index holds getMaskWords(brickCount) 64-bit words, bit i set when
+  // brick i is stored, then one uint32_t compressed size per stored brick in
+  // brick order. A size of 0 means the stored deltas are all zero.
+  inline size_t getMaskWords(size_t brickCount) {
+    return (brickCount + 63) / 64;
+  }
+
+  static_assert(sizeof(TemporalFileHeader) == 80, "TemporalFileHeader layout changed");
+  static_assert(sizeof(TemporalFrame) == 24, "TemporalFrame layout changed");
+
+  // Deltas wrap around for integer voxels and xor the bit patterns of float
+  // voxels, so they are exact and unchanged voxels always encode as zero
+  void encodeDelta(VoxelType type,
+                   const std::byte *current,
+                   const std::byte *previous,
+                   std::byte *delta,
+                   size_t count);
+  void applyDelta(VoxelType type, const std::byte *delta, std::byte *voxels, size_t count);
+} // namespace CUDAVol
@@ -0,0 +1,83 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  temporal_volume.h
+
+  Temporal volume class header. Plays back a temporal volume file (.cvt)
+  by applying the changed bricks of each timestep to the previous one.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "temporal_format.h"
+#include "thread_pool.h"
+#include "time_series.h"
+#include "volume.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  class TemporalVolume : public TimestepSource {
+  private:
+    ThreadPool &pool;
+    int fd;
+    std::string filePath;
+    TemporalFileHeader header;
+    std::vector<TemporalFrame> frames;
+    std::atomic<size_t> decodedBricks;
+
+  public:
+    TemporalVolume(ThreadPool &pool, const std::string &filePath);
+    ~TemporalVolume() override;
+
+    TemporalVolume(const TemporalVolume &) = delete;
+    TemporalVolume &operator=(const TemporalVolume &) = delete;
+
+    // Applies the bricks stored for timestep to volume, which must hold
+    // timestep - 1 unless timestep is a keyframe. Sets changed[brick] for
+    // every brick touched, if given. Thread safe for distinct volumes.
+    void applyFrame(size_t timestep, Volume &volume, std::vector<uint8_t> *changed = nullptr);
+
+    // Applies frames from previous + 1 when possible, otherwise from the
+    // last keyframe at or before timestep
+    void load(size_t timestep, size_t previous, Volume &volume) override;
+
+    size_t getTimestepCount() const override;
+    size_t getKeyframe(size_t timestep) const;
+    bool isKeyframe(size_t timestep) const;
+    size_t getChangedBricks(size_t timestep) const;
+    size_t getDecodedBricks() const;
+
+    glm::ivec3 getDims() const;
+    glm::ivec3 getBrickGrid() const;
+    int getBrickSize() const;
+    size_t getBrickCount() const;
+    VoxelType getType() const;
+    glm::vec3 getSpacing() const;
+    BrickCodec getCodec() const;
+    const std::string &getFilePath() const;
+  };
+} // namespace CUDAVol
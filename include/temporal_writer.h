@@ -0,0 +1,72 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  temporal_writer.h
+
+  Temporal writer class header. Encodes a sequence of timesteps into a
+  temporal volume file (.cvt), storing only the bricks that changed.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "brick_format.h"
+#include "temporal_format.h"
+#include "thread_pool.h"
+#include "volume.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  class TemporalWriter {
+  private:
+    ThreadPool &pool;
+    std::string filePath;
+    std::ofstream ofs;
+    int brickSize;
+    int keyframeInterval;
+    BrickCodec codec;
+    int level;
+    TemporalFileHeader header;
+    std::vector<TemporalFrame> frames;
+    Volume previous;
+    uint64_t offset;
+
+  public:
+    TemporalWriter(ThreadPool &pool,
+                   const std::string &filePath,
+                   int brickSize = 32,
+                   int keyframeInterval = 16,
+                   BrickCodec codec = getDefaultCodec(),
+                   int level = 0);
+
+    // Appends the next timestep, which must match the first in size and
+    // type; returns the number of bricks stored for it
+    size_t append(const VolumeView &volume);
+
+    // Writes the frame table and header; returns the number of bytes written
+    size_t finish();
+  };
+} // namespace CUDAVol
@@ -0,0 +1,108 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  thread_pool.h
+
+  Thread pool declaration. Fixed set of work stealing worker threads shared by
+  the renderer, loaders and preprocessing passes. Every worker keeps its own
+  deque of tasks and idle workers steal from the others; parallelFor seeds
+  each participant with a contiguous range of chunks and lets the calling
+  thread participate, so it is safe to call from within a task.
+
+  November 2019
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace CUDAVol {
+  // Load balance of one parallelFor
+  struct ParallelStats {
+    double time = 0.0;                        // Milliseconds from start to the last chunk done
+    double busyTime = 0.0;                    // Milliseconds spent in chunks, summed over participants
+    unsigned participants = 0;                // Caller and helpers
+    size_t chunks = 0;
+    size_t steals = 0;                        // Ranges taken from another participant
+
+    // Share of the participants' time spent in chunks
+    double getUtilization() const;
+  };
+
+  class ThreadPool {
+  private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;   // One per worker
+    std::deque<std::function<void()>> tasks;      // Submitted from outside the pool
+    std::atomic<size_t> pending;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+
+    void enqueue(std::function<void()> task);
+    bool pop(size_t worker, std::function<void()> &task);
+    void work(size_t worker);
+
+  public:
+    ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    template <typename F>
+    auto submit(F &&f) -> std::future<std::invoke_result_t<F>> {
+      using R = std::invoke_result_t<F>;
+      auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+      auto future = task->get_future();
+      enqueue([task]() { (*task)(); });
+      return future;
+    }
+
+    // Splits [begin, end) into chunks of at most grain and calls f(first, last)
+    // for each; blocks until all chunks are done. Participants start on equal
+    // contiguous ranges of chunks, in order, so neighbouring indices stay on
+    // one thread; one that runs dry steals the back half of the largest range left.
+    ParallelStats parallelFor(size_t begin,
+                              size_t end,
+                              size_t grain,
+                              const std::function<void(size_t, size_t)> &f);
+
+    unsigned getThreadCount() const;
+  };
+} // namespace CUDAVol
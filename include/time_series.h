@@ -0,0 +1,118 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  time_series.h
+
+  Time series class header. Plays back a sequence of volume timesteps,
+  decoding the next ones in the background while the current one is shown.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "thread_pool.h"
+#include "volume.h"
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace CUDAVol {
+  // Produces the volume of a timestep on demand; called from pool threads,
+  // but never concurrently for the same destination volume
+  class TimestepSource {
+  public:
+    static constexpr size_t noTimestep = std::numeric_limits<size_t>::max();
+
+    virtual ~TimestepSource() = default;
+
+    // Decodes timestep into volume, which currently holds timestep previous
+    // (or noTimestep), so sources may reuse its storage or contents
+    virtual void load(size_t timestep, size_t previous, Volume &volume) = 0;
+
+    virtual size_t getTimestepCount() const = 0;
+
+    // One timestep per NRRD/MetaImage file, in the given order
+    static std::unique_ptr<TimestepSource> openFiles(ThreadPool &pool,
+                                                     const std::vector<std::string> &filePaths);
+
+    // Every NRRD/MetaImage file in a directory, in natural order
+    static std::unique_ptr<TimestepSource> openDirectory(ThreadPool &pool,
+                                                         const std::string &directory);
+  };
+
+  struct PlaybackStats {
+    size_t swaps = 0;     // Timesteps shown
+    size_t stalls = 0;    // Frames that kept the old timestep as the next wasn't ready
+    double loadTime = 0;  // Mean decode time per timestep, in milliseconds
+  };
+
+  class TimeSeries {
+  private:
+    struct Buffer {
+      Volume volume;
+      size_t timestep = TimestepSource::noTimestep;  // Decoded contents
+      size_t target = TimestepSource::noTimestep;    // Contents once pending is done
+      std::future<double> pending;
+    };
+
+    ThreadPool &pool;
+    std::unique_ptr<TimestepSource> source;
+    std::vector<Buffer> buffers;
+    size_t front;
+    size_t timestep;
+    size_t loads;
+    PlaybackStats stats;
+
+    void schedule(Buffer &buffer, size_t timestep);
+    void collect(Buffer &buffer, bool wait);
+    void prefetch();
+
+  public:
+    // Keeps lookahead timesteps decoding ahead of the one shown, in as many
+    // extra buffers; playback loops at the end
+    TimeSeries(ThreadPool &pool, std::unique_ptr<TimestepSource> source, int lookahead = 1);
+    ~TimeSeries();
+
+    TimeSeries(const TimeSeries &) = delete;
+    TimeSeries &operator=(const TimeSeries &) = delete;
+
+    // Blocks until timestep is decoded and shown
+    void seek(size_t timestep);
+
+    // Swaps in the next timestep if it is decoded and returns true, otherwise
+    // keeps the current one; never blocks. The buffer swapped out is refilled
+    // in the background straight away, so beforeSwap runs first to stop
+    // anything still reading it; hand getCurrent() to the renderer after.
+    bool advance(const std::function<void()> &beforeSwap = {});
+
+    const Volume &getCurrent() const;
+    size_t getTimestep() const;
+    size_t getTimestepCount() const;
+    PlaybackStats getStats() const;
+  };
+} // namespace CUDAVol
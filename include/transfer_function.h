@@ -0,0 +1,69 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  transfer_function.h
+
+  Transfer function declaration. Maps normalized scalar values to color and
+  opacity through a lookup table resampled from piecewise linear control
+  points. Opacity is given per unit of length, see RayMarcher.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "glm/common.hpp"
+#include "glm/vec4.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace CUDAVol {
+  struct ControlPoint {
+    float value;        // Normalized to [0, 1]
+    glm::vec4 color;    // Straight (not premultiplied) color and opacity
+  };
+
+  class TransferFunction {
+  public:
+    static constexpr int tableSize = 256;
+
+  private:
+    std::vector<ControlPoint> points;
+    std::vector<glm::vec4> table;
+
+  public:
+    // Default ramp: transparent low values, increasingly opaque bright high values
+    TransferFunction();
+    TransferFunction(std::vector<ControlPoint> points);
+
+    // Linearly interpolated table entry for normalized value v, clamped
+    glm::vec4 lookup(float v) const {
+      const float x = glm::clamp(v, 0.f, 1.f) * (tableSize - 1);
+      const int i = std::min(static_cast<int>(x), tableSize - 2);
+      return glm::mix(table[i], table[i + 1], x - static_cast<float>(i));
+    }
+
+    const std::vector<ControlPoint> &getControlPoints() const;
+    const std::vector<glm::vec4> &getTable() const;
+  };
+} // namespace CUDAVol
@@ -0,0 +1,52 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  vdb_reader.h
+
+  VDB reader declaration. Imports a scalar grid from an OpenVDB file into a
+  sparse volume. Supported is the subset written by OpenVDB 3 and later:
+
+  - file format version 222 or newer, with grid offsets (any file written by
+    openvdb::io::File; not streamed archives)
+  - float and double grids (Tree_float_5_4_3, Tree_double_5_4_3), including
+    float grids saved as half; values are imported as float
+  - uncompressed or zlib compressed grids, with or without active mask
+    compression; Blosc is not supported, re-save with zip compression
+  - scale, translation and affine transforms, of which only the voxel size is
+    used, as spacing
+  - no grid instancing
+
+  The imported volume spans the bounding box of all leaves and active tiles.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "sparse_volume.h"
+#include <string>
+
+namespace CUDAVol {
+  // Reads the grid named gridName, or the first supported grid if empty
+  SparseVolume readVdb(const std::string &filePath, const std::string &gridName = "");
+} // namespace CUDAVol
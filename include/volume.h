@@ -0,0 +1,126 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  volume.h
+
+  Volume declaration. A volume is a dense grid of voxels, either mapped
+  directly from a raw file on disk or backed by anonymous memory that a
+  loader decodes into. Renderer only ever receives a read-only VolumeView.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "glm/vec3.hpp"
+#include "memory_map.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace CUDAVol {
+  enum class VoxelType { UInt8, UInt16, Float32 };
+
+  size_t getVoxelSize(VoxelType type);
+  VoxelType parseVoxelType(const std::string &str);
+  const char *toString(VoxelType type);
+
+  // Calls f with a default constructed value of the C++ type matching type,
+  // so type-generic code can be written once as a generic lambda
+  template <typename F>
+  decltype(auto) visitVoxelType(VoxelType type, F &&f) {
+    switch (type) {
+    case VoxelType::UInt8:
+      return f(uint8_t());
+    case VoxelType::UInt16:
+      return f(uint16_t());
+    default:
+      return f(float());
+    }
+  }
+
+  // Resolves relative paths against the working directory first, then against
+  // DATA_DIR/volumes
+  std::string resolveVolumePath(const std::string &filePath);
+
+  // Orders "slice2" before "slice10"
+  bool naturalLess(const std::string &a, const std::string &b);
+
+  // Non-owning, read-only view over voxel data, x-fastest layout
+  struct VolumeView {
+    const std::byte *data = nullptr;
+    glm::ivec3 dims = glm::ivec3(0);
+    VoxelType type = VoxelType::UInt8;
+    glm::vec3 spacing = glm::vec3(1.f);
+
+    bool isEmpty() const {
+      return data == nullptr;
+    }
+
+    size_t getVoxelCount() const {
+      return static_cast<size_t>(dims.x) * static_cast<size_t>(dims.y) *
+             static_cast<size_t>(dims.z);
+    }
+
+    size_t getSize() const {
+      return getVoxelCount() * getVoxelSize(type);
+    }
+
+    template <typename T>
+    const T *as() const {
+      return reinterpret_cast<const T *>(data);
+    }
+  };
+
+  class Volume {
+  private:
+    MemoryMap storage;
+    size_t offset;
+    glm::ivec3 dims;
+    VoxelType type;
+    glm::vec3 spacing;
+
+  public:
+    Volume();
+    Volume(const std::string &filePath,
+           glm::ivec3 dims,
+           VoxelType type,
+           glm::vec3 spacing = glm::vec3(1.f),
+           size_t headerSize = 0,
+           MemoryMap::Access access = MemoryMap::Access::Normal);
+    Volume(glm::ivec3 dims, VoxelType type, glm::vec3 spacing = glm::vec3(1.f));
+
+    Volume(Volume &&other) noexcept = default;
+    Volume &operator=(Volume &&other) noexcept = default;
+
+    void advise(MemoryMap::Access access) const;
+
+    VolumeView getView() const;
+    const std::byte *getData() const;
+    std::byte *getMutableData();
+    glm::ivec3 getDims() const;
+    VoxelType getType() const;
+    glm::vec3 getSpacing() const;
+    size_t getSize() const;
+  };
+} // namespace CUDAVol
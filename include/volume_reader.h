@@ -0,0 +1,59 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  volume_reader.h
+
+  Volume reader declaration. Parses NRRD (.nrrd/.nhdr) and MetaImage
+  (.mhd/.mha) headers and decodes raw or gzip/zlib encoded payloads on a
+  thread pool. Uncompressed, natively typed payloads are mapped, not read.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "thread_pool.h"
+#include "volume.h"
+#include <string>
+
+namespace CUDAVol {
+  // Wall clock time per stage, in milliseconds
+  struct ReadTimings {
+    double read = 0.0;
+    double inflate = 0.0;
+    double convert = 0.0;
+  };
+
+  class VolumeReader {
+  private:
+    ThreadPool &pool;
+    ReadTimings timings;
+
+  public:
+    VolumeReader(ThreadPool &pool);
+
+    Volume read(const std::string &filePath);
+
+    const ReadTimings &getTimings() const;
+  };
+} // namespace CUDAVol
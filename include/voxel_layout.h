@@ -0,0 +1,126 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  voxel_layout.h
+
+  Voxel layout declaration and definition. Maps voxel coordinates to storage
+  offsets for x-fastest linear storage and for Morton (Z-order) voxels inside
+  16^3 bricks. Both split the offset into a sum of per-axis terms, so a sampler
+  computes six terms per trilinear sample rather than eight full indices.
+
+  November 2019
+*/
+
+#pragma once
+
+#include "glm/vec3.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace CUDAVol {
+  // Spreads the low 10 bits of v to every third bit, 0b111 -> 0b001001001
+  inline uint32_t spreadBits3(uint32_t v) {
+    v &= 0x3ffu;
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+  }
+
+  // Inverse of spreadBits3
+  inline uint32_t compactBits3(uint32_t v) {
+    v &= 0x09249249u;
+    v = (v | (v >> 2)) & 0x030c30c3u;
+    v = (v | (v >> 4)) & 0x0300f00fu;
+    v = (v | (v >> 8)) & 0x030000ffu;
+    v = (v | (v >> 16)) & 0x3ffu;
+    return v;
+  }
+
+  inline uint32_t mortonEncode(uint32_t x, uint32_t y, uint32_t z) {
+    return spreadBits3(x) | (spreadBits3(y) << 1) | (spreadBits3(z) << 2);
+  }
+
+  inline glm::ivec3 mortonDecode(uint32_t m) {
+    return glm::ivec3(compactBits3(m), compactBits3(m >> 1), compactBits3(m >> 2));
+  }
+
+  struct LinearLayout {
+    glm::ivec3 dims;
+
+    LinearLayout(glm::ivec3 dims) : dims(dims) {}
+
+    size_t offsetX(int x) const {
+      return static_cast<size_t>(x);
+    }
+
+    size_t offsetY(int y) const {
+      return static_cast<size_t>(y) * dims.x;
+    }
+
+    size_t offsetZ(int z) const {
+      return static_cast<size_t>(z) * dims.x * dims.y;
+    }
+
+    size_t getVoxelCount() const {
+      return static_cast<size_t>(dims.x) * dims.y * dims.z;
+    }
+  };
+
+  // Bricks in x-fastest order, Morton order inside each brick. A brick of
+  // 8 bit voxels fills one 4 KiB page.
+  struct MortonLayout {
+    static constexpr int brickLog2 = 4;
+    static constexpr int brickSize = 1 << brickLog2;
+    static constexpr size_t brickVoxels = size_t(1) << (3 * brickLog2);
+
+    glm::ivec3 dims;
+    glm::ivec3 grid;
+    uint32_t spread[brickSize];   // spreadBits3 of every local coordinate
+
+    MortonLayout(glm::ivec3 dims) : dims(dims), grid((dims + brickSize - 1) / brickSize) {
+      for (int i = 0; i < brickSize; i++) {
+        spread[i] = spreadBits3(static_cast<uint32_t>(i));
+      }
+    }
+
+    size_t offsetX(int x) const {
+      return static_cast<size_t>(x >> brickLog2) * brickVoxels + spread[x & (brickSize - 1)];
+    }
+
+    size_t offsetY(int y) const {
+      return static_cast<size_t>(y >> brickLog2) * grid.x * brickVoxels + (spread[y & (brickSize - 1)] << 1);
+    }
+
+    size_t offsetZ(int z) const {
+      return static_cast<size_t>(z >> brickLog2) * grid.x * grid.y * brickVoxels +
+             (spread[z & (brickSize - 1)] << 2);
+    }
+
+    // Including the padding of partial bricks
+    size_t getVoxelCount() const {
+      return static_cast<size_t>(grid.x) * grid.y * grid.z * brickVoxels;
+    }
+  };
+} // namespace CUDAVol
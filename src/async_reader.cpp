@@ -0,0 +1,437 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  async_reader.cpp
+
+  Asynchronous file reader definition.
+
+  November 2019
+*/
+
+#include "async_reader.h"
+#include "thread_pool.h"
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+namespace CUDAVol {
+  // Conservative O_DIRECT alignment for offsets, sizes and buffers
+  static constexpr uint64_t directAlignment = 4096;
+
+  IoBackend parseIoBackend(const std::string &str) {
+    if (str == "io_uring" || str == "uring") {
+      return IoBackend::IoUring;
+    } else if (str == "pread") {
+      return IoBackend::Pread;
+    }
+    std::cerr << "Unknown I/O backend " << str << std::endl;
+    throw std::runtime_error("parseIoBackend: unknown backend");
+  }
+
+  const char *toString(IoBackend backend) {
+    return backend == IoBackend::IoUring ? "io_uring" : "pread";
+  }
+
+  static int openFile(const std::string &filePath, bool direct) {
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+    if (fd < 0) {
+      std::cerr << "Error opening " << filePath << ": " << std::strerror(errno) << std::endl;
+      throw std::runtime_error("AsyncReader: open failed");
+    }
+    return fd;
+  }
+
+  // Aligned superset of a request, read into a bounce buffer under O_DIRECT
+  struct AlignedRead {
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    std::byte *buffer = nullptr;
+
+    AlignedRead(const ReadRequest &request, bool direct) {
+      if (!direct) {
+        offset = request.offset;
+        size = request.size;
+        buffer = request.dst;
+        return;
+      }
+      offset = request.offset & ~(directAlignment - 1);
+      uint64_t end = (request.offset + request.size + directAlignment - 1) & ~(directAlignment - 1);
+      size = static_cast<uint32_t>(end - offset);
+      buffer = static_cast<std::byte *>(std::aligned_alloc(directAlignment, size));
+    }
+
+    // Copies the requested range out of the bounce buffer, returns its size
+    int64_t finish(const ReadRequest &request, int64_t result) {
+      if (buffer == request.dst) {
+        return result;
+      }
+      int64_t skip = static_cast<int64_t>(request.offset - offset);
+      int64_t n = result < 0 ? result : std::clamp<int64_t>(result - skip, 0, request.size);
+      if (n > 0) {
+        std::memcpy(request.dst, buffer + skip, static_cast<size_t>(n));
+      }
+      std::free(buffer);
+      buffer = nullptr;
+      return n;
+    }
+  };
+
+  class PreadReader : public AsyncReader {
+  private:
+    int fd;
+    bool direct;
+    unsigned queueDepth;
+    std::deque<ReadRequest> queued;
+    std::vector<ReadCompletion> completed;
+    size_t inFlight;
+    mutable std::mutex mutex;
+    std::condition_variable finished;
+    ThreadPool pool; // Last, so its workers are joined first
+
+    // Requires lock held
+    void dispatch(const ReadRequest &request) {
+      inFlight++;
+      pool.submit([this, request]() {
+        AlignedRead read(request, direct);
+        int64_t done = 0;
+        while (done < read.size) {
+          auto n = pread(fd, read.buffer + done, read.size - done,
+                         static_cast<off_t>(read.offset + done));
+          if (n < 0 && errno == EINTR) {
+            continue;
+          } else if (n < 0) {
+            done = -errno;
+            break;
+          } else if (n == 0) {
+            break;
+          }
+          done += n;
+        }
+        ReadCompletion completion{request.tag, read.finish(request, done)};
+
+        std::lock_guard<std::mutex> lock(mutex);
+        completed.push_back(completion);
+        inFlight--;
+        if (!queued.empty()) {
+          auto next = queued.front();
+          queued.pop_front();
+          dispatch(next);
+        }
+        finished.notify_all();
+      });
+    }
+
+  public:
+    PreadReader(const std::string &filePath, unsigned queueDepth, bool direct)
+      : fd(openFile(filePath, direct)),
+        direct(direct),
+        queueDepth(std::max(1u, queueDepth)),
+        inFlight(0),
+        pool(std::max(1u, queueDepth)) {}
+
+    ~PreadReader() override {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.clear();
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      finished.wait(lock, [this] { return inFlight == 0; });
+      close(fd);
+    }
+
+    void submit(const std::vector<ReadRequest> &requests) override {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const auto &request : requests) {
+        if (inFlight < queueDepth) {
+          dispatch(request);
+        } else {
+          queued.push_back(request);
+        }
+      }
+    }
+
+    void poll(std::vector<ReadCompletion> &completions, bool wait) override {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (wait) {
+        finished.wait(lock, [this] {
+          return !completed.empty() || (inFlight == 0 && queued.empty());
+        });
+      }
+      completions.insert(completions.end(), completed.begin(), completed.end());
+      completed.clear();
+    }
+
+    size_t getPending() const override {
+      std::lock_guard<std::mutex> lock(mutex);
+      return inFlight + queued.size();
+    }
+
+    IoBackend getBackend() const override {
+      return IoBackend::Pread;
+    }
+  };
+
+  class IoUringReader : public AsyncReader {
+  private:
+    struct InFlight {
+      ReadRequest request;
+      AlignedRead read;
+      uint32_t done;
+    };
+
+    int fd;
+    int ring;
+    bool direct;
+    unsigned queueDepth;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+    std::deque<ReadRequest> queued;
+    std::vector<InFlight> slots;
+    std::vector<uint32_t> freeSlots;
+    unsigned toSubmit;
+
+    static int enter(int ring, unsigned submit, unsigned complete, unsigned flags) {
+      return static_cast<int>(syscall(__NR_io_uring_enter, ring, submit, complete, flags, nullptr, 0));
+    }
+
+    void push(uint32_t slot) {
+      auto &s = slots[slot];
+      unsigned tail = *sqTail;
+      unsigned index = tail & *sqMask;
+      io_uring_sqe *sqe = &sqes[index];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = fd;
+      sqe->addr = reinterpret_cast<uint64_t>(s.read.buffer + s.done);
+      sqe->len = s.read.size - s.done;
+      sqe->off = s.read.offset + s.done;
+      sqe->user_data = slot;
+      sqArray[index] = index;
+      __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+      toSubmit++;
+    }
+
+    void flush() {
+      while (!freeSlots.empty() && !queued.empty()) {
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        slots[slot].request = queued.front();
+        slots[slot].read = AlignedRead(queued.front(), direct);
+        slots[slot].done = 0;
+        queued.pop_front();
+        push(slot);
+      }
+      while (toSubmit > 0) {
+        int n = enter(ring, toSubmit, 0, 0);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        } else if (n < 0) {
+          std::cerr << "io_uring_enter failed: " << std::strerror(errno) << std::endl;
+          throw std::runtime_error("IoUringReader: submit failed");
+        }
+        toSubmit -= static_cast<unsigned>(n);
+      }
+    }
+
+    // Waits for a completion, submitting continued short reads in the same
+    // call, since the one awaited may be among them. Returns false on error.
+    bool waitCompletion() {
+      int n = enter(ring, toSubmit, 1, IORING_ENTER_GETEVENTS);
+      if (n < 0) {
+        return errno == EINTR;
+      }
+      toSubmit -= static_cast<unsigned>(n);
+      return true;
+    }
+
+    size_t reap(std::vector<ReadCompletion> &completions) {
+      size_t count = 0;
+      unsigned head = *cqHead;
+      unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        const io_uring_cqe &cqe = cqes[head & *cqMask];
+        uint32_t slot = static_cast<uint32_t>(cqe.user_data);
+        auto &s = slots[slot];
+
+        // Short reads are continued, except at end of file
+        if (cqe.res > 0 && s.done + static_cast<uint32_t>(cqe.res) < s.read.size) {
+          s.done += static_cast<uint32_t>(cqe.res);
+          push(slot);
+          continue;
+        }
+        int64_t result = cqe.res < 0 ? cqe.res : static_cast<int64_t>(s.done) + cqe.res;
+        completions.push_back({s.request.tag, s.read.finish(s.request, result)});
+        freeSlots.push_back(slot);
+        count++;
+      }
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+      return count;
+    }
+
+    void release() {
+      if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+      }
+      if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+      }
+      if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+      }
+      if (ring >= 0) {
+        close(ring);
+      }
+      close(fd);
+    }
+
+  public:
+    IoUringReader(const std::string &filePath, unsigned queueDepth, bool direct)
+      : fd(openFile(filePath, direct)),
+        ring(-1),
+        direct(direct),
+        queueDepth(std::max(1u, queueDepth)),
+        sqRing(MAP_FAILED),
+        cqRing(MAP_FAILED),
+        sqes(static_cast<io_uring_sqe *>(MAP_FAILED)),
+        toSubmit(0) {
+      io_uring_params params = {};
+      ring = static_cast<int>(syscall(__NR_io_uring_setup, this->queueDepth, &params));
+      if (ring < 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error(std::string("io_uring_setup: ") + std::strerror(err));
+      }
+
+      // Map submission and completion rings, and the submission entries
+      sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+      }
+      sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring, IORING_OFF_SQ_RING);
+      cqRing = (params.features & IORING_FEAT_SINGLE_MMAP)
+                   ? sqRing
+                   : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+      sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+      sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES));
+      if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        int err = errno;
+        release();
+        throw std::runtime_error(std::string("io_uring mmap: ") + std::strerror(err));
+      }
+
+      auto sq = static_cast<char *>(sqRing), cq = static_cast<char *>(cqRing);
+      sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+      sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+      sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+      cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+      cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+      cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+      cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+      // Never more in flight than submission entries, so rings cannot overflow
+      this->queueDepth = std::min(this->queueDepth, params.sq_entries);
+      slots.resize(this->queueDepth, InFlight{{}, AlignedRead({}, false), 0});
+      for (uint32_t i = 0; i < this->queueDepth; i++) {
+        freeSlots.push_back(this->queueDepth - 1 - i);
+      }
+    }
+
+    ~IoUringReader() override {
+      // Drain so the kernel never writes into freed buffers
+      queued.clear();
+      std::vector<ReadCompletion> ignored;
+      while (freeSlots.size() < slots.size()) {
+        if (reap(ignored) == 0 && !waitCompletion()) {
+          std::cerr << "io_uring_enter failed while draining: " << std::strerror(errno) << std::endl;
+          break;
+        }
+      }
+      release();
+    }
+
+    void submit(const std::vector<ReadRequest> &requests) override {
+      queued.insert(queued.end(), requests.begin(), requests.end());
+      flush();
+    }
+
+    void poll(std::vector<ReadCompletion> &completions, bool wait) override {
+      size_t count = reap(completions);
+      if (wait && count == 0 && freeSlots.size() < slots.size()) {
+        if (!waitCompletion()) {
+          std::cerr << "io_uring_enter failed: " << std::strerror(errno) << std::endl;
+          throw std::runtime_error("IoUringReader: wait failed");
+        }
+        reap(completions);
+      }
+      flush();
+    }
+
+    size_t getPending() const override {
+      return queued.size() + (slots.size() - freeSlots.size());
+    }
+
+    IoBackend getBackend() const override {
+      return IoBackend::IoUring;
+    }
+  };
+
+  std::unique_ptr<AsyncReader> AsyncReader::create(IoBackend backend,
+                                                   const std::string &filePath,
+                                                   unsigned queueDepth,
+                                                   bool direct) {
+    if (backend == IoBackend::IoUring) {
+      try {
+        return std::make_unique<IoUringReader>(filePath, queueDepth, direct);
+      } catch (const std::exception &e) {
+        std::cerr << "io_uring unavailable (" << e.what() << "), using pread" << std::endl;
+      }
+    }
+    return std::make_unique<PreadReader>(filePath, queueDepth, direct);
+  }
+} // namespace CUDAVol
@@ -0,0 +1,1223 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  bench.cpp
+
+  Benchmark tool source file. Compares alternative implementations of the
+  performance critical paths on the same input.
+
+  November 2019
+*/
+
+#include "async_reader.h"
+#include "brick_cache.h"
+#include "bricked_volume.h"
+#include "gradient_volume.h"
+#include "morton_volume.h"
+#include "ray_marcher.h"
+#include "sparse_volume.h"
+#include "vdb_reader.h"
+#include "volume_reader.h"
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+static void printUsage(const char *name) {
+  std::cerr << "Usage: " << name << " <benchmark> [args]\n\n"
+            << "  io <file.cvb> [--depth n] [--direct] [--count n]\n"
+            << "      random brick reads: blocking pread vs. pread pool vs. io_uring\n"
+            << "  render <volume> [--size WxH] [--frames n] [--step s] [--isa name] [--out image.ppm]\n"
+            << "      CPU ray marcher frame time, no window or GPU needed\n"
+            << "  packets <volume> [--size WxH] [--frames n] [--step s]\n"
+            << "      scalar vs. SSE4/AVX2/AVX-512 packet ray marching, same camera\n"
+            << "  layout <volume> [--size WxH] [--frames n] [--step s]\n"
+            << "      linear vs. Morton voxel order for axis aligned and oblique views\n"
+            << "  skip <volume> [--size WxH] [--frames n] [--step s] [--isa name]\n"
+            << "      empty space skipping off vs. macrocell DDA vs. distance leaping, and edit cost\n"
+            << "  adaptive <volume> [--size WxH] [--frames n] [--step s] [--isa name] [--threshold a]\n"
+            << "           [--max-step-level n] [--step-distance d] [--variation v]\n"
+            << "      full rays vs. early termination vs. adaptive steps, samples per ray and error\n"
+            << "  tiles <volume> [--size WxH] [--frames n] [--step s] [--isa name]\n"
+            << "      row order vs. Hilbert order tile seeding for several tile sizes, thread utilization\n"
+            << "  progressive <volume> [--size WxH] [--frames n] [--step s] [--isa name]\n"
+            << "      progressive refinement pass times and error, and cancellation latency\n"
+            << "  preintegrate <volume> [--size WxH] [--frames n] [--isa name]\n"
+            << "      point sampled vs. pre-integrated classification over step sizes, and edit cost\n"
+            << "  gradients <volume> [--size WxH] [--frames n] [--step s]\n"
+            << "      shading with on the fly vs. precomputed quantized gradients, trilinear and nearest\n"
+            << "  fixed <volume> [--size WxH] [--frames n] [--step s] [--isa name]\n"
+            << "      8/16 bit voxels with fixed point vs. float weights vs. a float32 copy, memory and error\n"
+            << "  shadows <volume> [--size WxH] [--frames n] [--step s] [--light-scale n]\n"
+            << "      shading with and without light volume shadows, light and transfer function edit cost\n"
+            << "  pathtrace <volume> [--size WxH] [--frames passes] [--bounces n] [--out image.ppm]\n"
+            << "      path tracing pass time, paths per second, convergence and thread independence\n"
+            << "  temporal <volume> [--size WxH] [--frames n] [--step s] [--isa name]\n"
+            << "      slow orbit fully traced vs. reprojecting the previous frame, rays per frame and error\n"
+            << "  foveated <volume> [--size WxH] [--frames n] [--step s] [--isa name] [--focus-radius r]\n"
+            << "           [--periphery-level n]\n"
+            << "      full frames vs. variable rate with a central focus, rays per frame and error\n\n"
+            << "  render, packets, layout and skip also take the adaptive options, --preintegrate, --shading,\n"
+            << "  --shadows, --path-trace, --temporal, --foveated and --float-weights\n";
+}
+
+static int benchIo(int argc, char **argv) {
+  if (argc < 1) {
+    return -1;
+  }
+  CUDAVol::BrickedVolume volume(argv[0]);
+  unsigned depth = 32;
+  bool direct = false;
+  size_t count = 4096;
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--depth") && i + 1 < argc) {
+      depth = static_cast<unsigned>(std::stoul(argv[++i]));
+    } else if (!std::strcmp(argv[i], "--direct")) {
+      direct = true;
+    } else if (!std::strcmp(argv[i], "--count") && i + 1 < argc) {
+      count = std::stoull(argv[++i]);
+    } else {
+      return -1;
+    }
+  }
+
+  // Same random selection of stored (non-constant) bricks for every backend
+  std::vector<uint32_t> bricks;
+  for (uint32_t i = 0; i < volume.getBrickCount(); i++) {
+    if (volume.getBrickEntry(i).size > 0) {
+      bricks.push_back(i);
+    }
+  }
+  std::shuffle(bricks.begin(), bricks.end(), std::mt19937(1));
+  bricks.resize(std::min(bricks.size(), count));
+  if (bricks.empty()) {
+    std::cerr << "No stored bricks in " << argv[0] << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::vector<std::byte>> buffers(bricks.size());
+  std::vector<CUDAVol::ReadRequest> requests;
+  size_t bytes = 0;
+  for (size_t i = 0; i < bricks.size(); i++) {
+    const auto &entry = volume.getBrickEntry(bricks[i]);
+    buffers[i].resize(entry.size);
+    requests.push_back({entry.offset, entry.size, buffers[i].data(), i});
+    bytes += entry.size;
+  }
+
+  std::cout << bricks.size() << " bricks, " << bytes / double(1 << 20) << " MiB, depth "
+            << depth << (direct ? ", O_DIRECT" : ", page cache (use --direct for cold reads)")
+            << std::endl;
+  auto report = [&](const std::string &name, double ms) {
+    std::cout << "  " << name << ": " << ms << " ms, " << bytes / double(1 << 20) / (ms / 1e3)
+              << " MiB/s, " << bricks.size() / (ms / 1e3) << " IOPS" << std::endl;
+  };
+
+  // Baseline: one blocking pread after another
+  {
+    int fd = open(volume.getFilePath().c_str(), O_RDONLY | O_CLOEXEC);
+    auto start = Clock::now();
+    for (const auto &r : requests) {
+      if (pread(fd, r.dst, r.size, static_cast<off_t>(r.offset)) != static_cast<ssize_t>(r.size)) {
+        std::cerr << "Short read" << std::endl;
+      }
+    }
+    report("blocking pread", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    close(fd);
+  }
+
+  for (auto backend : {CUDAVol::IoBackend::Pread, CUDAVol::IoBackend::IoUring}) {
+    auto reader = CUDAVol::AsyncReader::create(backend, volume.getFilePath(), depth, direct);
+    std::vector<CUDAVol::ReadCompletion> completions;
+    size_t failed = 0;
+    auto start = Clock::now();
+    reader->submit(requests);
+    while (reader->getPending() > 0) {
+      completions.clear();
+      reader->poll(completions, true);
+      for (const auto &c : completions) {
+        failed += c.result != static_cast<int64_t>(requests[c.tag].size);
+      }
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    report(CUDAVol::toString(reader->getBackend()), ms);
+    if (failed) {
+      std::cerr << "  " << failed << " reads failed" << std::endl;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+static void writePpm(const std::string &filePath, const std::vector<uint32_t> &image, glm::ivec2 dims) {
+  // Top row first, image rows are bottom first
+  std::ofstream ofs(filePath, std::ios::out | std::ios::binary);
+  ofs << "P6\n" << dims.x << " " << dims.y << "\n255\n";
+  std::vector<char> row(3 * static_cast<size_t>(dims.x));
+  for (int y = dims.y - 1; y >= 0; y--) {
+    for (int x = 0; x < dims.x; x++) {
+      const uint32_t c = image[static_cast<size_t>(y) * dims.x + x];
+      row[3 * x] = static_cast<char>(c & 0xff);
+      row[3 * x + 1] = static_cast<char>((c >> 8) & 0xff);
+      row[3 * x + 2] = static_cast<char>((c >> 16) & 0xff);
+    }
+    ofs.write(row.data(), static_cast<std::streamsize>(row.size()));
+  }
+}
+
+// Volume of any supported format, bound to a ray marcher
+struct BenchVolume {
+  CUDAVol::Volume volume;
+  std::unique_ptr<CUDAVol::BrickedVolume> bricked;
+  std::unique_ptr<CUDAVol::BrickCache> cache;
+  std::unique_ptr<CUDAVol::SparseVolume> sparse;
+  glm::vec3 extent;
+
+  BenchVolume(CUDAVol::ThreadPool &pool, const std::string &filePath, CUDAVol::RayMarcher &marcher) {
+    const auto extension = std::filesystem::path(filePath).extension();
+    if (extension == ".cvb") {
+      bricked = std::make_unique<CUDAVol::BrickedVolume>(filePath);
+      cache = std::make_unique<CUDAVol::BrickCache>(*bricked, size_t(1) << 30);
+      marcher.setVolume(*cache, bricked->getValueRange());
+      extent = glm::vec3(bricked->getDims()) * bricked->getSpacing();
+    } else if (extension == ".vdb") {
+      sparse = std::make_unique<CUDAVol::SparseVolume>(CUDAVol::readVdb(filePath));
+      marcher.setVolume(*sparse, sparse->getValueRange());
+      extent = glm::vec3(sparse->getDims()) * sparse->getSpacing();
+    } else {
+      volume = CUDAVol::VolumeReader(pool).read(filePath);
+      marcher.setVolume(volume.getView(), CUDAVol::computeValueRange(pool, volume.getView()));
+      extent = glm::vec3(volume.getDims()) * volume.getSpacing();
+    }
+  }
+
+  CUDAVol::Camera getCamera() const {
+    CUDAVol::Camera camera;
+    camera.frame(extent);
+    camera.orbit(glm::radians(30.f), glm::radians(20.f));
+    return camera;
+  }
+};
+
+// Average frame time in ms and samples per frame; the first frame warms
+// caches and is not counted
+static std::pair<double, size_t> timeFrames(CUDAVol::RayMarcher &marcher,
+                                            const CUDAVol::Camera &camera,
+                                            glm::ivec2 size,
+                                            int frames) {
+  marcher.render(camera, size);
+  double time = 0.0;
+  size_t samples = 0;
+  for (int i = 0; i < frames; i++) {
+    marcher.render(camera, size);
+    time += marcher.getStats().time;
+    samples += marcher.getStats().samples;
+  }
+  return {time / frames, samples / frames};
+}
+
+// Largest difference in any color channel between two images
+static int getMaxDifference(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+  int difference = 0;
+  for (size_t i = 0; i < std::min(a.size(), b.size()); i++) {
+    for (int c = 0; c < 3; c++) {
+      const int x = (a[i] >> (8 * c)) & 0xff, y = (b[i] >> (8 * c)) & 0xff;
+      difference = std::max(difference, std::abs(x - y));
+    }
+  }
+  return difference;
+}
+
+// Mean difference over all color channels between two images
+static double getMeanDifference(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+  double sum = 0.0;
+  const size_t count = std::min(a.size(), b.size());
+  for (size_t i = 0; i < count; i++) {
+    for (int c = 0; c < 3; c++) {
+      sum += std::abs(static_cast<int>((a[i] >> (8 * c)) & 0xff) - static_cast<int>((b[i] >> (8 * c)) & 0xff));
+    }
+  }
+  return count ? sum / (3.0 * count) : 0.0;
+}
+
+// Options shared by the rendering benchmarks; returns false on unknown ones
+static bool parseRenderOptions(int argc,
+                               char **argv,
+                               glm::ivec2 &size,
+                               int &frames,
+                               CUDAVol::RenderSettings &settings,
+                               std::string &outPath) {
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--size") && i + 1 < argc) {
+      if (std::sscanf(argv[++i], "%dx%d", &size.x, &size.y) != 2) {
+        return false;
+      }
+    } else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc) {
+      frames = std::max(std::stoi(argv[++i]), 1);
+    } else if (!std::strcmp(argv[i], "--step") && i + 1 < argc) {
+      settings.stepSize = std::stof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--isa") && i + 1 < argc) {
+      settings.isa = CUDAVol::parseSimdIsa(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--threshold") && i + 1 < argc) {
+      settings.opacityThreshold = std::stof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--max-step-level") && i + 1 < argc) {
+      settings.maxStepLevel = std::stoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--step-distance") && i + 1 < argc) {
+      settings.stepDistance = std::stof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--variation") && i + 1 < argc) {
+      settings.stepVariation = std::stof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--preintegrate")) {
+      settings.preintegrate = true;
+    } else if (!std::strcmp(argv[i], "--shading")) {
+      settings.shading = true;
+    } else if (!std::strcmp(argv[i], "--shadows")) {
+      settings.shading = true;
+      settings.shadows = true;
+    } else if (!std::strcmp(argv[i], "--light-scale") && i + 1 < argc) {
+      settings.lightScale = std::stoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--path-trace")) {
+      settings.pathTrace = true;
+    } else if (!std::strcmp(argv[i], "--bounces") && i + 1 < argc) {
+      settings.maxBounces = std::max(std::stoi(argv[++i]), 1);
+    } else if (!std::strcmp(argv[i], "--temporal")) {
+      settings.temporalReuse = true;
+    } else if (!std::strcmp(argv[i], "--foveated")) {
+      settings.foveated = true;
+    } else if (!std::strcmp(argv[i], "--focus-radius") && i + 1 < argc) {
+      settings.focusRadius = std::stof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--periphery-level") && i + 1 < argc) {
+      settings.peripheryLevel = std::stoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--float-weights")) {
+      settings.fixedPoint = false;
+    } else if (!std::strcmp(argv[i], "--out") && i + 1 < argc) {
+      outPath = argv[++i];
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int benchRender(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath)) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  marcher.setSettings(settings);
+
+  auto [time, samples] = timeFrames(marcher, volume.getCamera(), size, frames);
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", "
+            << CUDAVol::toString(settings.isa) << ": " << time << " ms per frame, "
+            << samples / (time * 1e3) << " Msamples/s, " << marcher.getStats().getSamplesPerRay()
+            << " samples per ray, " << 100.0 * marcher.getStats().utilization << "% thread utilization"
+            << std::endl;
+  if (!outPath.empty()) {
+    writePpm(outPath, marcher.composeFoveated(), marcher.getImageDims());
+  }
+  return EXIT_SUCCESS;
+}
+
+static int benchPackets(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  if (!volume.volume.getData()) {
+    std::cerr << "Packets only apply to dense volumes; " << argv[0] << " renders scalar" << std::endl;
+  }
+
+  // Scalar reference first, then every supported instruction set against it
+  std::vector<uint32_t> reference;
+  double referenceTime = 0.0;
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", best "
+            << CUDAVol::toString(CUDAVol::detectSimdIsa()) << std::endl;
+  for (auto isa : {CUDAVol::SimdIsa::Scalar, CUDAVol::SimdIsa::Sse4, CUDAVol::SimdIsa::Avx2,
+                   CUDAVol::SimdIsa::Avx512}) {
+    if (static_cast<int>(isa) > static_cast<int>(CUDAVol::detectSimdIsa())) {
+      break;
+    }
+    settings.isa = isa;
+    marcher.setSettings(settings);
+    auto [time, samples] = timeFrames(marcher, camera, size, frames);
+    std::cout << "  " << CUDAVol::toString(isa) << " (" << CUDAVol::getPacketWidth(isa)
+              << " wide): " << time << " ms per frame, " << samples / (time * 1e3) << " Msamples/s";
+    if (isa == CUDAVol::SimdIsa::Scalar) {
+      reference = marcher.getImage();
+      referenceTime = time;
+    } else {
+      // Differences to the scalar image come from rounding
+      std::cout << ", " << referenceTime / time << "x, max difference "
+                << getMaxDifference(reference, marcher.getImage());
+    }
+    std::cout << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int benchSkip(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", "
+            << CUDAVol::toString(settings.isa) << std::endl;
+
+  settings.skipEmptySpace = false;
+  marcher.setSettings(settings);
+  auto [referenceTime, referenceSamples] = timeFrames(marcher, camera, size, frames);
+  const std::vector<uint32_t> reference = marcher.getImage();
+  std::cout << "  off: " << referenceTime << " ms per frame, " << referenceSamples << " samples" << std::endl;
+
+  // The first frame builds the grid; leaping adds the distance field
+  settings.skipEmptySpace = true;
+  double ddaSteps = 0.0;
+  for (bool leap : {false, true}) {
+    settings.leapEmptySpace = leap;
+    marcher.setSettings(settings);
+    auto start = Clock::now();
+    marcher.render(camera, size);
+    const double firstTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    auto [time, samples] = timeFrames(marcher, camera, size, frames);
+    const size_t steps = marcher.getStats().cellSteps;
+    std::cout << "  " << (leap ? "leap" : "dda") << ": " << time << " ms per frame, " << samples
+              << " samples, " << steps << " cell steps";
+    if (leap) {
+      std::cout << " (" << 100.0 * (1.0 - steps / std::max(ddaSteps, 1.0)) << "% fewer)";
+    } else {
+      ddaSteps = static_cast<double>(steps);
+    }
+    std::cout << ", " << referenceTime / time << "x, max difference "
+              << getMaxDifference(reference, marcher.getImage()) << ", first frame " << firstTime
+              << " ms" << std::endl;
+  }
+  const CUDAVol::MacrocellGrid &cells = marcher.getMacrocells();
+  std::cout << "  " << cells.getCellSize() << "^3 cells, " << cells.getOccupiedCount() << " of "
+            << cells.getCellCount() << " occupied, " << cells.getMemorySize() / double(1 << 10) << " KiB"
+            << std::endl;
+  if (cells.isEmpty()) {
+    return EXIT_SUCCESS;
+  }
+
+  // A narrow opaque band swept across the value range, as when editing; the
+  // distances are rebuilt whenever occupancy changes
+  CUDAVol::MacrocellGrid edited = cells;
+  const int edits = 64;
+  double classifyTime = 0.0, distanceTime = 0.0, editMax = 0.0;
+  for (int i = 0; i < edits; i++) {
+    const float center = (i + 0.5f) / edits;
+    const CUDAVol::TransferFunction band({{0.f, glm::vec4(0.f)},
+                                          {center - 0.05f, glm::vec4(0.f)},
+                                          {center, glm::vec4(1.f, 0.8f, 0.6f, 0.5f)},
+                                          {center + 0.05f, glm::vec4(0.f)},
+                                          {1.f, glm::vec4(0.f)}});
+    auto start = Clock::now();
+    edited.classify(band, edited.getValueRange());
+    auto mid = Clock::now();
+    if (!edited.hasDistances()) {
+      edited.buildDistances(pool);
+    }
+    auto end = Clock::now();
+    classifyTime += std::chrono::duration<double, std::milli>(mid - start).count();
+    distanceTime += std::chrono::duration<double, std::milli>(end - mid).count();
+    editMax = std::max(editMax, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  std::cout << "  transfer function edit: " << classifyTime / edits << " ms classify + "
+            << distanceTime / edits << " ms distances average, " << editMax << " ms worst over "
+            << edits << " edits" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+// User space last level cache and data TLB read misses of this process and
+// the threads it starts afterwards. Inherited counts only reach the parent
+// when those threads exit, so read after joining them. Unavailable without
+// perf_event_open access, e.g. in containers or with perf_event_paranoid > 2.
+class PerfCounters {
+private:
+  int fds[2];
+
+  static int open(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+public:
+  PerfCounters() {
+    fds[0] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[1] = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  }
+
+  ~PerfCounters() {
+    for (int fd : fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  // Count per frame, or "n/a"
+  std::string format(int counter, int frames) const {
+    uint64_t count;
+    if (fds[counter] < 0 || read(fds[counter], &count, sizeof(count)) != sizeof(count)) {
+      return "n/a";
+    }
+    return std::to_string(count / frames);
+  }
+};
+
+static int benchLayout(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+  const auto extension = std::filesystem::path(argv[0]).extension();
+  if (extension == ".cvb" || extension == ".vdb") {
+    std::cerr << "Layouts only apply to dense volumes" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  CUDAVol::Volume volume;
+  CUDAVol::MortonVolume morton;
+  glm::vec2 valueRange;
+  {
+    CUDAVol::ThreadPool pool;
+    volume = CUDAVol::VolumeReader(pool).read(argv[0]);
+    valueRange = CUDAVol::computeValueRange(pool, volume.getView());
+    auto start = Clock::now();
+    morton = CUDAVol::MortonVolume(pool, volume.getView());
+    std::cout << "Morton copy: " << std::chrono::duration<double, std::milli>(Clock::now() - start).count()
+              << " ms, " << morton.getSize() / double(1 << 20) << " MiB ("
+              << volume.getView().getSize() / double(1 << 20) << " MiB linear)" << std::endl;
+  }
+
+  // Packets gather from the linear layout, so both sides march scalar
+  settings.isa = CUDAVol::SimdIsa::Scalar;
+  const glm::vec3 extent = glm::vec3(volume.getDims()) * volume.getSpacing();
+  const std::pair<const char *, glm::vec2> views[] = {
+      {"along x", {glm::radians(90.f), 0.f}},
+      {"along z", {0.f, 0.f}},
+      {"oblique", {glm::radians(30.f), glm::radians(20.f)}},
+  };
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize
+            << ", scalar; cache and dTLB misses per frame" << std::endl;
+  for (const auto &[name, angles] : views) {
+    CUDAVol::Camera camera;
+    camera.frame(extent);
+    camera.orbit(angles.x, angles.y);
+
+    std::vector<uint32_t> reference;
+    double referenceTime = 0.0;
+    for (bool useMorton : {false, true}) {
+      // Fresh threads per run so the counters cover the whole render
+      PerfCounters counters;
+      double time;
+      std::vector<uint32_t> image;
+      {
+        CUDAVol::ThreadPool pool;
+        CUDAVol::RayMarcher marcher(pool);
+        if (useMorton) {
+          marcher.setVolume(morton, valueRange);
+        } else {
+          marcher.setVolume(volume.getView(), valueRange);
+        }
+        marcher.setSettings(settings);
+        time = timeFrames(marcher, camera, size, frames).first;
+        image = marcher.getImage();
+      }
+      std::cout << "  " << name << ", " << (useMorton ? "morton" : "linear") << ": " << time
+                << " ms per frame, cache misses " << counters.format(0, frames + 1)
+                << ", dTLB misses " << counters.format(1, frames + 1);
+      if (useMorton) {
+        std::cout << ", " << referenceTime / time << "x, max difference "
+                  << getMaxDifference(reference, image);
+      } else {
+        reference = std::move(image);
+        referenceTime = time;
+      }
+      std::cout << std::endl;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+static int benchAdaptive(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+
+  // Unless given, steps grow by up to 8x, first doubling at the volume center
+  CUDAVol::RenderSettings adaptive = settings;
+  if (adaptive.maxStepLevel == 0) {
+    adaptive.maxStepLevel = 3;
+  }
+  if (adaptive.stepDistance == 0.f) {
+    adaptive.stepDistance = camera.getDistance() / 2.f;
+  }
+  CUDAVol::RenderSettings full = settings;
+  full.opacityThreshold = 2.f;
+  full.maxStepLevel = 0;
+  CUDAVol::RenderSettings early = settings;
+  early.maxStepLevel = 0;
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", "
+            << CUDAVol::toString(settings.isa) << ", threshold " << settings.opacityThreshold
+            << ", up to " << (1 << std::min(adaptive.maxStepLevel, CUDAVol::RayMarcher::maxStepLevels - 1))
+            << "x steps beyond " << adaptive.stepDistance << " or below " << adaptive.stepVariation
+            << " variation" << std::endl;
+
+  // Rays crossing the whole volume at fixed steps are the reference
+  std::vector<uint32_t> reference;
+  double referenceTime = 0.0;
+  const std::pair<const char *, const CUDAVol::RenderSettings *> runs[] = {
+      {"full", &full},
+      {"early termination", &early},
+      {"adaptive", &adaptive},
+  };
+  for (const auto &[name, runSettings] : runs) {
+    marcher.setSettings(*runSettings);
+    const double time = timeFrames(marcher, camera, size, frames).first;
+    std::cout << "  " << name << ": " << time << " ms per frame, " << marcher.getStats().getSamplesPerRay()
+              << " samples per ray";
+    if (reference.empty()) {
+      reference = marcher.getImage();
+      referenceTime = time;
+    } else {
+      std::cout << ", " << referenceTime / time << "x, max difference "
+                << getMaxDifference(reference, marcher.getImage());
+    }
+    std::cout << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int benchTiles(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", "
+            << CUDAVol::toString(settings.isa) << ", " << pool.getThreadCount() << " threads" << std::endl;
+
+  // Utilization and steals are averaged over the timed frames
+  for (int tileSize : {8, 16, 32, 64}) {
+    for (bool hilbert : {false, true}) {
+      settings.tileSize = tileSize;
+      settings.hilbertTiles = hilbert;
+      marcher.setSettings(settings);
+      marcher.render(camera, size);
+      double time = 0.0, utilization = 0.0, steals = 0.0;
+      for (int i = 0; i < frames; i++) {
+        marcher.render(camera, size);
+        time += marcher.getStats().time;
+        utilization += marcher.getStats().utilization;
+        steals += static_cast<double>(marcher.getStats().steals);
+      }
+      std::cout << "  " << tileSize << "^2 tiles, " << (hilbert ? "hilbert" : "rows") << ": " << time / frames
+                << " ms per frame, " << marcher.getStats().tiles << " tiles, " << 100.0 * utilization / frames
+                << "% utilization, " << steals / frames << " steals" << std::endl;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+static int benchProgressive(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  marcher.setSettings(settings);
+  const CUDAVol::Camera camera = volume.getCamera();
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", "
+            << CUDAVol::toString(settings.isa) << std::endl;
+
+  // Passes as the viewer runs them, coarsest first, against the full image
+  marcher.render(camera, size);
+  const std::vector<uint32_t> reference = marcher.getImage();
+  const int levels = std::clamp(settings.refinementLevels, 0, CUDAVol::RayMarcher::maxCoarseLevel);
+  double fullTime = 0.0;
+  for (int level = levels; level >= 0; level--) {
+    double time = 0.0;
+    for (int i = 0; i < frames; i++) {
+      marcher.render(camera, size, level);
+      time += marcher.getStats().time;
+    }
+    time /= frames;
+    fullTime = time;
+    std::cout << "  level " << level << " (" << (1 << level) << "x" << (1 << level) << " pixels per ray): " << time
+              << " ms, max difference " << getMaxDifference(reference, marcher.getImage()) << std::endl;
+  }
+
+  // A full quality pass cancelled a quarter of the way in, as when the
+  // camera moves during refinement
+  double latency = 0.0;
+  size_t skipped = 0;
+  for (int i = 0; i < frames; i++) {
+    std::atomic<bool> cancel(false);
+    auto pass = pool.submit([&] { marcher.render(camera, size, 0, &cancel); });
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(fullTime / 4.0));
+    auto start = Clock::now();
+    cancel.store(true);
+    pass.get();
+    latency += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    skipped += marcher.getStats().cancelled;
+  }
+  std::cout << "  cancellation: " << latency / frames << " ms from cancel to return, " << skipped << " of "
+            << frames << " passes cut short" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+static int benchPreintegrate(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  // A narrow opaque band, which long point sampled steps step over
+  const CUDAVol::TransferFunction band({{0.f, glm::vec4(0.f)},
+                                        {0.47f, glm::vec4(0.f)},
+                                        {0.5f, glm::vec4(1.f, 0.8f, 0.6f, 0.6f)},
+                                        {0.53f, glm::vec4(0.f)},
+                                        {1.f, glm::vec4(0.f)}});
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  marcher.setTransferFunction(band);
+  const CUDAVol::Camera camera = volume.getCamera();
+  std::cout << size.x << "x" << size.y << ", " << CUDAVol::toString(settings.isa)
+            << ", narrow band transfer function" << std::endl;
+
+  // Point sampling at a quarter voxel is the reference
+  settings.stepSize = 0.25f;
+  marcher.setSettings(settings);
+  marcher.render(camera, size);
+  const std::vector<uint32_t> reference = marcher.getImage();
+  for (float step : {0.5f, 1.f, 2.f, 4.f}) {
+    for (bool preintegrate : {false, true}) {
+      settings.stepSize = step;
+      settings.preintegrate = preintegrate;
+      marcher.setSettings(settings);
+      const double time = timeFrames(marcher, camera, size, frames).first;
+      std::cout << "  step " << step << ", " << (preintegrate ? "pre-integrated" : "point sampled") << ": " << time
+                << " ms per frame, " << marcher.getStats().getSamplesPerRay() << " samples per ray, mean difference "
+                << getMeanDifference(reference, marcher.getImage()) << ", max "
+                << getMaxDifference(reference, marcher.getImage()) << std::endl;
+    }
+  }
+
+  // The band swept across the value range, as when editing; each edit
+  // rebuilds only the entries whose segment covers the changed values
+  CUDAVol::PreintegratedTable table;
+  auto start = Clock::now();
+  table.update(pool, band, 1.f, 1.f);
+  const double fullTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  const int edits = 64;
+  double editTime = 0.0;
+  size_t entries = 0;
+  for (int i = 0; i < edits; i++) {
+    const float center = 0.3f + 0.4f * i / edits;
+    const CUDAVol::TransferFunction moved({{0.f, glm::vec4(0.f)},
+                                           {center - 0.03f, glm::vec4(0.f)},
+                                           {center, glm::vec4(1.f, 0.8f, 0.6f, 0.6f)},
+                                           {center + 0.03f, glm::vec4(0.f)},
+                                           {1.f, glm::vec4(0.f)}});
+    start = Clock::now();
+    entries += table.update(pool, moved, 1.f, 1.f);
+    editTime += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+  const size_t tableEntries = static_cast<size_t>(CUDAVol::PreintegratedTable::size) * CUDAVol::PreintegratedTable::size;
+  std::cout << "  table: " << table.getMemorySize() / double(1 << 20) << " MiB, full build " << fullTime
+            << " ms, edit " << editTime / edits << " ms rebuilding " << 100.0 * entries / (edits * tableEntries)
+            << "% of entries on average" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+static int benchGradients(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  if (!volume.volume.getData()) {
+    std::cerr << "Gradient volumes only apply to dense volumes" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const CUDAVol::VolumeView view = volume.volume.getView();
+  auto start = Clock::now();
+  const CUDAVol::GradientVolume gradients(pool, view);
+  const double buildTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", scalar; volume "
+            << view.getSize() / double(1 << 20) << " MiB, gradients " << gradients.getMemorySize() / double(1 << 20)
+            << " MiB built in " << buildTime << " ms" << std::endl;
+
+  // Unshaded for scale, then a budget one byte short of the gradient volume
+  // against one that fits, filtered and nearest
+  settings.isa = CUDAVol::SimdIsa::Scalar;
+  marcher.setSettings(settings);
+  std::cout << "  unshaded: " << timeFrames(marcher, camera, size, frames).first << " ms per frame" << std::endl;
+  settings.shading = true;
+  settings.gradientBudget = gradients.getMemorySize() - 1;
+  marcher.setSettings(settings);
+  const double referenceTime = timeFrames(marcher, camera, size, frames).first;
+  const std::vector<uint32_t> reference = marcher.getImage();
+  std::cout << "  on the fly: " << referenceTime << " ms per frame" << std::endl;
+  settings.gradientBudget = gradients.getMemorySize();
+  for (bool filter : {true, false}) {
+    settings.filterGradients = filter;
+    marcher.setSettings(settings);
+    const double time = timeFrames(marcher, camera, size, frames).first;
+    std::cout << "  precomputed, " << (filter ? "trilinear" : "nearest") << ": " << time << " ms per frame, "
+              << referenceTime / time << "x, +" << gradients.getMemorySize() / double(1 << 20)
+              << " MiB, mean difference " << getMeanDifference(reference, marcher.getImage()) << ", max "
+              << getMaxDifference(reference, marcher.getImage()) << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int benchFixed(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+  if (settings.isa == CUDAVol::SimdIsa::Scalar) {
+    std::cerr << "Fixed point sampling only applies to packets" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  const CUDAVol::VolumeView view = volume.volume.getView();
+  if (!volume.volume.getData() || view.type == CUDAVol::VoxelType::Float32) {
+    std::cerr << "Fixed point sampling only applies to dense 8 and 16 bit volumes" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // The same voxels as float32, the reference
+  CUDAVol::Volume copy(view.dims, CUDAVol::VoxelType::Float32, view.spacing);
+  float *dst = reinterpret_cast<float *>(copy.getMutableData());
+  CUDAVol::visitVoxelType(view.type, [&](auto t) {
+    using T = decltype(t);
+    const T *src = view.as<T>();
+    pool.parallelFor(0, view.getVoxelCount(), 1 << 16, [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; i++) {
+        dst[i] = static_cast<float>(src[i]);
+      }
+    });
+  });
+  const glm::vec2 valueRange = CUDAVol::computeValueRange(pool, view);
+
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", " << CUDAVol::toString(settings.isa)
+            << ", " << CUDAVol::toString(view.type) << std::endl;
+  marcher.setVolume(copy.getView(), valueRange);
+  marcher.setSettings(settings);
+  const double referenceTime = timeFrames(marcher, camera, size, frames).first;
+  const std::vector<uint32_t> reference = marcher.getImage();
+  std::cout << "  float32 copy: " << copy.getSize() / double(1 << 20) << " MiB, " << referenceTime
+            << " ms per frame" << std::endl;
+
+  marcher.setVolume(view, valueRange);
+  for (bool fixedPoint : {false, true}) {
+    settings.fixedPoint = fixedPoint;
+    marcher.setSettings(settings);
+    const double time = timeFrames(marcher, camera, size, frames).first;
+    std::cout << "  " << CUDAVol::toString(view.type) << ", " << (fixedPoint ? "fixed point" : "float")
+              << " weights: " << view.getSize() / double(1 << 20) << " MiB, " << time << " ms per frame, "
+              << referenceTime / time << "x, mean difference " << getMeanDifference(reference, marcher.getImage())
+              << ", max " << getMaxDifference(reference, marcher.getImage()) << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int benchShadows(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 10;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", light scale " << settings.lightScale
+            << std::endl;
+
+  // Headlight shading for scale, then the first shadowed frame, which
+  // resamples and sweeps the light volume, then shadowed frames
+  settings.shading = true;
+  marcher.setSettings(settings);
+  const double shadedTime = timeFrames(marcher, camera, size, frames).first;
+  std::cout << "  shaded: " << shadedTime << " ms per frame" << std::endl;
+  settings.shadows = true;
+  marcher.setSettings(settings);
+  marcher.render(camera, size);
+  std::cout << "  first shadowed frame: " << marcher.getStats().time << " ms, " << marcher.getStats().lightSlices
+            << " slices swept" << std::endl;
+  const double shadowedTime = timeFrames(marcher, camera, size, frames).first;
+  std::cout << "  shadowed: " << shadowedTime << " ms per frame, " << shadowedTime / shadedTime
+            << "x the shaded time" << std::endl;
+
+  // The light circling the volume sweeps every slice; a narrow opacity
+  // bump moving over the values sweeps from the first slice it reaches
+  auto timeEdits = [&](const char *name, auto &&edit) {
+    const int edits = 16;
+    double time = 0.0;
+    size_t slices = 0;
+    for (int i = 0; i < edits; i++) {
+      edit(i, edits);
+      marcher.render(camera, size);
+      time += marcher.getStats().time;
+      slices += marcher.getStats().lightSlices;
+    }
+    std::cout << "  " << name << ": " << time / edits << " ms per frame, " << double(slices) / edits
+              << " slices swept" << std::endl;
+  };
+  timeEdits("light edits", [&](int i, int edits) {
+    const float angle = 6.2831853f * static_cast<float>(i) / edits;
+    settings.lightDirection = glm::vec3(std::cos(angle), 1.f, std::sin(angle));
+    marcher.setSettings(settings);
+  });
+  const CUDAVol::TransferFunction base;
+  timeEdits("transfer function edits", [&](int i, int edits) {
+    const float center = 0.5f + 0.4f * static_cast<float>(i) / edits;
+    std::vector<CUDAVol::ControlPoint> bumped = base.getControlPoints();
+    const glm::vec4 peak = base.lookup(center);
+    bumped.push_back({center - 0.05f, base.lookup(center - 0.05f)});
+    bumped.push_back({center, glm::vec4(glm::vec3(peak), std::min(peak.a * 2.f, 1.f))});
+    bumped.push_back({center + 0.05f, base.lookup(center + 0.05f)});
+    marcher.setTransferFunction(CUDAVol::TransferFunction(bumped));
+  });
+  return EXIT_SUCCESS;
+}
+
+static int benchPathTrace(int argc, char **argv) {
+  glm::ivec2 size(512, 384);
+  int passes = 64;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, passes, settings, outPath)) {
+    return -1;
+  }
+  settings.pathTrace = true;
+  settings.maxPathPasses = std::max(settings.maxPathPasses, passes);
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  marcher.setSettings(settings);
+  std::cout << size.x << "x" << size.y << ", " << passes << " passes, up to " << settings.maxBounces << " bounces"
+            << std::endl;
+
+  // Passes accumulate into one image; the images after a few passes and
+  // after half of them are kept for the checks below
+  const int checkPasses = std::min(passes, 4);
+  std::vector<uint32_t> checkImage, halfImage;
+  double time = 0.0;
+  size_t rays = 0, samples = 0;
+  for (int i = 1; i <= passes; i++) {
+    marcher.render(camera, size);
+    time += marcher.getStats().time;
+    rays += marcher.getStats().rays;
+    samples += marcher.getStats().samples;
+    if (i == checkPasses) {
+      checkImage = marcher.getImage();
+    }
+    if (i == std::max(passes / 2, 1)) {
+      halfImage = marcher.getImage();
+    }
+  }
+  const double paths = static_cast<double>(size.x) * size.y * passes;
+  std::cout << "  " << time / passes << " ms per pass, " << paths / (time / 1e3) / 1e6 << " M paths/s, "
+            << rays / paths << " rays per path, " << double(samples) / std::max(rays, size_t(1))
+            << " tracking samples per ray" << std::endl;
+  std::cout << "  " << marcher.getStats().pathPasses << " vs. " << std::max(passes / 2, 1)
+            << " passes: mean difference " << getMeanDifference(halfImage, marcher.getImage()) << ", max "
+            << getMaxDifference(halfImage, marcher.getImage()) << std::endl;
+  if (!outPath.empty()) {
+    writePpm(outPath, marcher.getImage(), marcher.getImageDims());
+  }
+
+  // Every pixel draws from its own random stream, so a single thread must
+  // produce the same image as the whole pool
+  CUDAVol::ThreadPool single(1);
+  CUDAVol::RayMarcher serial(single);
+  BenchVolume serialVolume(single, argv[0], serial);
+  serial.setSettings(settings);
+  for (int i = 0; i < checkPasses; i++) {
+    serial.render(camera, size);
+  }
+  std::cout << "  " << checkPasses << " passes on 1 vs. " << pool.getThreadCount()
+            << " threads: max difference " << getMaxDifference(checkImage, serial.getImage()) << std::endl;
+  return EXIT_SUCCESS;
+}
+
+static int benchTemporal(int argc, char **argv) {
+  glm::ivec2 size(1024, 768);
+  int frames = 32;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath) ||
+      !outPath.empty()) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  const float step = glm::radians(0.5f);
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", " << frames
+            << " frames orbiting 0.5 degrees each" << std::endl;
+
+  // The same orbit fully traced, which is the reference, then reprojecting
+  // each frame from the one before; the first frame of each is not counted
+  CUDAVol::Camera orbit;
+  auto runOrbit = [&](bool temporal, auto &&onFrame) {
+    settings.temporalReuse = temporal;
+    marcher.setSettings(settings);
+    orbit = camera;
+    marcher.render(orbit, size);
+    double time = 0.0;
+    size_t rays = 0;
+    for (int i = 0; i < frames; i++) {
+      orbit.orbit(step, 0.f);
+      marcher.render(orbit, size);
+      time += marcher.getStats().time;
+      rays += marcher.getStats().rays;
+      onFrame(i);
+    }
+    return std::make_pair(time / frames, rays / frames);
+  };
+  std::vector<std::vector<uint32_t>> reference;
+  const auto full = runOrbit(false, [&](int) {
+    reference.push_back(marcher.getImage());
+  });
+  std::cout << "  full: " << full.first << " ms per frame, " << full.second << " rays per frame" << std::endl;
+  double meanDifference = 0.0;
+  int maxDifference = 0;
+  size_t reused = 0;
+  const auto temporal = runOrbit(true, [&](int i) {
+    reused += marcher.getStats().reusedPixels;
+    meanDifference += getMeanDifference(reference[i], marcher.getImage()) / frames;
+    maxDifference = std::max(maxDifference, getMaxDifference(reference[i], marcher.getImage()));
+  });
+  std::cout << "  temporal: " << temporal.first << " ms per frame, " << temporal.second << " rays per frame, "
+            << 100.0 * reused / (static_cast<double>(size.x) * size.y * frames) << "% of pixels reused, "
+            << full.first / temporal.first << "x, mean difference " << meanDifference << ", max " << maxDifference
+            << std::endl;
+
+  // Once the view stops, one frame retraces every reused pixel
+  marcher.render(orbit, size);
+  std::cout << "  stopped: " << marcher.getStats().time << " ms, " << marcher.getStats().stalePixels
+            << " stale pixels left, max difference " << getMaxDifference(reference.back(), marcher.getImage())
+            << std::endl;
+  return EXIT_SUCCESS;
+}
+
+static int benchFoveated(int argc, char **argv) {
+  glm::ivec2 size(1920, 1080);
+  int frames = 4;
+  CUDAVol::RenderSettings settings;
+  std::string outPath;
+  if (argc < 1 || !parseRenderOptions(argc, argv, size, frames, settings, outPath)) {
+    return -1;
+  }
+
+  CUDAVol::ThreadPool pool;
+  CUDAVol::RayMarcher marcher(pool);
+  BenchVolume volume(pool, argv[0], marcher);
+  const CUDAVol::Camera camera = volume.getCamera();
+  std::cout << size.x << "x" << size.y << ", step " << settings.stepSize << ", focus radius "
+            << settings.focusRadius << " of the height, periphery level " << settings.peripheryLevel << std::endl;
+
+  settings.foveated = false;
+  marcher.setSettings(settings);
+  const double fullTime = timeFrames(marcher, camera, size, frames).first;
+  const size_t fullRays = marcher.getStats().rays;
+  const std::vector<uint32_t> reference = marcher.getImage();
+  std::cout << "  full: " << fullTime << " ms per frame, " << fullRays << " rays" << std::endl;
+
+  // The focus must match the full frame exactly; the periphery is compared
+  // as a whole
+  settings.foveated = true;
+  marcher.setSettings(settings);
+  const double time = timeFrames(marcher, camera, size, frames).first;
+  const std::vector<uint32_t> image = marcher.composeFoveated();
+  const glm::vec2 center = settings.focus * glm::vec2(size);
+  const float radius = settings.focusRadius * static_cast<float>(size.y);
+  std::vector<uint32_t> focusReference, focusImage;
+  for (int y = 0; y < size.y; y++) {
+    for (int x = 0; x < size.x; x++) {
+      if (glm::length(glm::vec2(x, y) + 0.5f - center) <= radius) {
+        focusReference.push_back(reference[static_cast<size_t>(y) * size.x + x]);
+        focusImage.push_back(image[static_cast<size_t>(y) * size.x + x]);
+      }
+    }
+  }
+  std::cout << "  foveated: " << time << " ms per frame, " << marcher.getStats().rays << " rays, "
+            << fullTime / time << "x, mean difference " << getMeanDifference(reference, image) << ", max "
+            << getMaxDifference(reference, image) << ", max in focus " << getMaxDifference(focusReference, focusImage)
+            << std::endl;
+  if (!outPath.empty()) {
+    writePpm(outPath, image, marcher.getImageDims());
+  }
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  const std::map<std::string, std::function<int(int, char **)>> benchmarks = {
+      {"io", benchIo},
+      {"render", benchRender},
+      {"packets", benchPackets},
+      {"layout", benchLayout},
+      {"skip", benchSkip},
+      {"adaptive", benchAdaptive},
+      {"tiles", benchTiles},
+      {"progressive", benchProgressive},
+      {"preintegrate", benchPreintegrate},
+      {"gradients", benchGradients},
+      {"fixed", benchFixed},
+      {"shadows", benchShadows},
+      {"pathtrace", benchPathTrace},
+      {"temporal", benchTemporal},
+      {"foveated", benchFoveated},
+  };
+
+  if (argc < 2 || !benchmarks.count(argv[1])) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  int result = benchmarks.at(argv[1])(argc - 2, argv + 2);
+  if (result < 0) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  return result;
+}
@@ -0,0 +1,255 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_cache.cpp
+
+  Brick cache definition.
+
+  November 2019
+*/
+
+#include "brick_cache.h"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace CUDAVol {
+  BrickRef::BrickRef() : cache(nullptr), slot(0), data(nullptr) {}
+
+  BrickRef::BrickRef(BrickCache *cache, uint32_t slot, const std::byte *data)
+    : cache(cache), slot(slot), data(data) {}
+
+  BrickRef::~BrickRef() {
+    if (cache) {
+      cache->release(slot);
+    }
+  }
+
+  BrickRef::BrickRef(BrickRef &&other) noexcept
+    : cache(std::exchange(other.cache, nullptr)),
+      slot(other.slot),
+      data(std::exchange(other.data, nullptr)) {}
+
+  BrickRef &BrickRef::operator=(BrickRef &&other) noexcept {
+    if (this != &other) {
+      if (cache) {
+        cache->release(slot);
+      }
+      cache = std::exchange(other.cache, nullptr);
+      slot = other.slot;
+      data = std::exchange(other.data, nullptr);
+    }
+    return *this;
+  }
+
+  BrickCache::BrickCache(const BrickedVolume &volume, size_t budgetBytes)
+    : volume(volume),
+      brickBytes(volume.getBrickBytes()),
+      slotCount(std::clamp<size_t>(budgetBytes / volume.getBrickBytes(), 1,
+                                   std::max<size_t>(volume.getBrickCount(), 1))),
+      storage(slotCount * brickBytes),
+      slots(new Slot[slotCount]),
+      brickSlots(new std::atomic<int32_t>[volume.getBrickCount()]),
+      hand(0),
+      hits(0),
+      misses(0),
+      evictions(0),
+      inserts(0) {
+    if (slotCount > static_cast<size_t>(INT32_MAX)) {
+      std::cerr << "Brick cache budget of " << budgetBytes << " bytes is too large" << std::endl;
+      throw std::runtime_error("BrickCache: budget too large");
+    }
+    for (size_t i = 0; i < volume.getBrickCount(); i++) {
+      brickSlots[i].store(-1, std::memory_order_relaxed);
+    }
+  }
+
+  BrickRef BrickCache::tryPin(uint32_t brick) {
+    int32_t s = brickSlots[brick].load();
+    if (s < 0) {
+      return BrickRef();
+    }
+
+    // Once pinned, a slot cannot be claimed for eviction; a pin taken while
+    // the slot is being refilled, or after it was reassigned, is backed out
+    Slot &slot = slots[s];
+    uint32_t old = slot.pins.fetch_add(1);
+    if (!(old & loadingBit) && slot.brick.load() == brick) {
+      slot.referenced.store(true, std::memory_order_relaxed);
+      return BrickRef(this, static_cast<uint32_t>(s), storage.getData() + s * brickBytes);
+    }
+    slot.pins.fetch_sub(1);
+    return BrickRef();
+  }
+
+  bool BrickCache::claimVictim(uint32_t &victim) {
+    // CLOCK: skip pinned slots, give referenced slots a second chance
+    for (size_t i = 0; i < 2 * slotCount; i++) {
+      Slot &slot = slots[hand];
+      uint32_t index = static_cast<uint32_t>(hand);
+      hand = hand + 1 == slotCount ? 0 : hand + 1;
+
+      if (slot.pins.load() != 0 || slot.referenced.exchange(false)) {
+        continue;
+      }
+      uint32_t expected = 0;
+      if (slot.pins.compare_exchange_strong(expected, loadingBit)) {
+        victim = index;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void BrickCache::release(uint32_t slot) {
+    slots[slot].pins.fetch_sub(1);
+  }
+
+  BrickRef BrickCache::acquire(uint32_t brick) {
+    if (auto ref = tryPin(brick)) {
+      hits.fetch_add(1, std::memory_order_relaxed);
+      return ref;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      // Resident or being loaded by another thread
+      if (int32_t s = brickSlots[brick].load(); s >= 0) {
+        if (auto ref = tryPin(brick)) {
+          hits.fetch_add(1, std::memory_order_relaxed);
+          return ref;
+        }
+        loaded.wait(lock);
+        continue;
+      }
+
+      // Every slot pinned; wait for a ray to let go of one
+      uint32_t victim;
+      if (!claimVictim(victim)) {
+        lock.unlock();
+        std::this_thread::yield();
+        lock.lock();
+        continue;
+      }
+
+      misses.fetch_add(1, std::memory_order_relaxed);
+      std::byte *data = assign(victim, brick);
+
+      // Decode outside the lock; other threads asking for this brick wait
+      lock.unlock();
+      try {
+        volume.readBrick(brick, data);
+      } catch (...) {
+        lock.lock();
+        finish(victim, brick, false, false);
+        throw;
+      }
+      lock.lock();
+      finish(victim, brick, true, true);
+      return BrickRef(this, victim, data);
+    }
+  }
+
+  bool BrickCache::insert(uint32_t brick, const std::function<void(std::byte *)> &fill) {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint32_t victim;
+    if (brickSlots[brick].load() >= 0 || !claimVictim(victim)) {
+      return false;
+    }
+    std::byte *data = assign(victim, brick);
+
+    lock.unlock();
+    try {
+      fill(data);
+    } catch (...) {
+      lock.lock();
+      finish(victim, brick, false, false);
+      throw;
+    }
+    lock.lock();
+    finish(victim, brick, true, false);
+    inserts.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool BrickCache::isResident(uint32_t brick) const {
+    return brickSlots[brick].load() >= 0;
+  }
+
+  std::byte *BrickCache::assign(uint32_t victim, uint32_t brick) {
+    Slot &slot = slots[victim];
+    if (uint32_t old = slot.brick.load(); old != noBrick) {
+      brickSlots[old].store(-1);
+      evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    slot.brick.store(brick);
+    brickSlots[brick].store(static_cast<int32_t>(victim));
+    return storage.getMutableData() + victim * brickBytes;
+  }
+
+  void BrickCache::finish(uint32_t victim, uint32_t brick, bool success, bool pin) {
+    Slot &slot = slots[victim];
+    if (success) {
+      // Clear loading state, optionally keeping one pin for the caller
+      slot.referenced.store(true);
+      slot.pins.fetch_sub(pin ? loadingBit - 1 : loadingBit);
+    } else {
+      brickSlots[brick].store(-1);
+      slot.brick.store(noBrick);
+      slot.pins.fetch_sub(loadingBit);
+    }
+    loaded.notify_all();
+  }
+
+  BrickRef BrickCache::tryAcquire(uint32_t brick) {
+    auto ref = tryPin(brick);
+    (ref ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+    return ref;
+  }
+
+  const BrickedVolume &BrickCache::getVolume() const {
+    return volume;
+  }
+
+  size_t BrickCache::getCapacity() const {
+    return slotCount;
+  }
+
+  size_t BrickCache::getBudget() const {
+    return slotCount * brickBytes;
+  }
+
+  CacheStats BrickCache::getStats() const {
+    return {hits.load(), misses.load(), evictions.load(), inserts.load()};
+  }
+
+  void BrickCache::resetStats() {
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    inserts = 0;
+  }
+} // namespace CUDAVol
@@ -0,0 +1,198 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_format.cpp
+
+  Bricked volume file format definition; per-brick codecs.
+
+  November 2019
+*/
+
+#include "brick_format.h"
+#include <zlib.h>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#ifdef CUDAVOL_HAS_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef CUDAVOL_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+namespace CUDAVol {
+  BrickCodec parseBrickCodec(const std::string &str) {
+    BrickCodec codec;
+    if (str == "none") {
+      codec = BrickCodec::None;
+    } else if (str == "deflate" || str == "zlib") {
+      codec = BrickCodec::Deflate;
+    } else if (str == "lz4") {
+      codec = BrickCodec::LZ4;
+    } else if (str == "zstd") {
+      codec = BrickCodec::Zstd;
+    } else {
+      std::cerr << "Unknown brick codec " << str << std::endl;
+      throw std::runtime_error("parseBrickCodec: unknown codec");
+    }
+    if (!isCodecAvailable(codec)) {
+      std::cerr << "Brick codec " << str << " is not compiled in" << std::endl;
+      throw std::runtime_error("parseBrickCodec: codec unavailable");
+    }
+    return codec;
+  }
+
+  const char *toString(BrickCodec codec) {
+    switch (codec) {
+    case BrickCodec::None:
+      return "none";
+    case BrickCodec::Deflate:
+      return "deflate";
+    case BrickCodec::LZ4:
+      return "lz4";
+    case BrickCodec::Zstd:
+      return "zstd";
+    }
+    return "unknown";
+  }
+
+  bool isCodecAvailable(BrickCodec codec) {
+    switch (codec) {
+    case BrickCodec::None:
+    case BrickCodec::Deflate:
+      return true;
+#ifdef CUDAVOL_HAS_LZ4
+    case BrickCodec::LZ4:
+      return true;
+#endif
+#ifdef CUDAVOL_HAS_ZSTD
+    case BrickCodec::Zstd:
+      return true;
+#endif
+    default:
+      return false;
+    }
+  }
+
+  BrickCodec getDefaultCodec() {
+    if (isCodecAvailable(BrickCodec::Zstd)) {
+      return BrickCodec::Zstd;
+    } else if (isCodecAvailable(BrickCodec::LZ4)) {
+      return BrickCodec::LZ4;
+    }
+    return BrickCodec::Deflate;
+  }
+
+  std::vector<std::byte> compressBrick(BrickCodec codec,
+                                       const std::byte *src,
+                                       size_t srcSize,
+                                       int level) {
+    std::vector<std::byte> dst;
+    switch (codec) {
+    case BrickCodec::None:
+      dst.assign(src, src + srcSize);
+      break;
+    case BrickCodec::Deflate: {
+      uLongf size = compressBound(static_cast<uLong>(srcSize));
+      dst.resize(size);
+      const int result = compress2(reinterpret_cast<Bytef *>(dst.data()), &size,
+                                   reinterpret_cast<const Bytef *>(src), static_cast<uLong>(srcSize),
+                                   level > 0 ? level : Z_DEFAULT_COMPRESSION);
+      if (result != Z_OK) {
+        std::cerr << "Deflate compression failed: " << zError(result) << std::endl;
+        throw std::runtime_error("compressBrick: deflate failed");
+      }
+      dst.resize(size);
+      break;
+    }
+#ifdef CUDAVOL_HAS_LZ4
+    case BrickCodec::LZ4: {
+      dst.resize(LZ4_compressBound(static_cast<int>(srcSize)));
+      auto s = reinterpret_cast<const char *>(src);
+      auto d = reinterpret_cast<char *>(dst.data());
+      int size = level > 1
+                     ? LZ4_compress_HC(s, d, static_cast<int>(srcSize), static_cast<int>(dst.size()), level)
+                     : LZ4_compress_default(s, d, static_cast<int>(srcSize), static_cast<int>(dst.size()));
+      if (size <= 0) {
+        std::cerr << "LZ4 compression of " << srcSize << " bytes failed" << std::endl;
+        throw std::runtime_error("compressBrick: LZ4 failed");
+      }
+      dst.resize(size);
+      break;
+    }
+#endif
+#ifdef CUDAVOL_HAS_ZSTD
+    case BrickCodec::Zstd: {
+      dst.resize(ZSTD_compressBound(srcSize));
+      size_t size = ZSTD_compress(dst.data(), dst.size(), src, srcSize, level > 0 ? level : 3);
+      if (ZSTD_isError(size)) {
+        std::cerr << "Zstd compression failed: " << ZSTD_getErrorName(size) << std::endl;
+        throw std::runtime_error("compressBrick: zstd failed");
+      }
+      dst.resize(size);
+      break;
+    }
+#endif
+    default:
+      std::cerr << "Brick codec " << toString(codec) << " is not compiled in" << std::endl;
+      throw std::runtime_error("compressBrick: codec unavailable");
+    }
+    return dst;
+  }
+
+  bool decompressBrick(BrickCodec codec,
+                       const std::byte *src,
+                       size_t srcSize,
+                       std::byte *dst,
+                       size_t dstSize) {
+    switch (codec) {
+    case BrickCodec::None:
+      if (srcSize != dstSize) {
+        return false;
+      }
+      std::memcpy(dst, src, dstSize);
+      return true;
+    case BrickCodec::Deflate: {
+      uLongf size = static_cast<uLongf>(dstSize);
+      return uncompress(reinterpret_cast<Bytef *>(dst), &size,
+                        reinterpret_cast<const Bytef *>(src),
+                        static_cast<uLong>(srcSize)) == Z_OK &&
+             size == dstSize;
+    }
+#ifdef CUDAVOL_HAS_LZ4
+    case BrickCodec::LZ4:
+      return LZ4_decompress_safe(reinterpret_cast<const char *>(src),
+                                 reinterpret_cast<char *>(dst),
+                                 static_cast<int>(srcSize),
+                                 static_cast<int>(dstSize)) == static_cast<int>(dstSize);
+#endif
+#ifdef CUDAVOL_HAS_ZSTD
+    case BrickCodec::Zstd:
+      return ZSTD_decompress(dst, dstSize, src, srcSize) == dstSize;
+#endif
+    default:
+      return false;
+    }
+  }
+} // namespace CUDAVol
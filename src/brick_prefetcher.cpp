@@ -0,0 +1,126 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_prefetcher.cpp
+
+  Brick prefetcher definition.
+
+  November 2019
+*/
+
+#include "brick_prefetcher.h"
+#include <algorithm>
+#include <chrono>
+
+namespace CUDAVol {
+  BrickPrefetcher::BrickPrefetcher(BrickCache &cache,
+                                   ThreadPool &pool,
+                                   IoBackend backend,
+                                   unsigned queueDepth,
+                                   bool direct)
+    : cache(cache),
+      pool(pool),
+      reader(AsyncReader::create(backend, cache.getVolume().getFilePath(), queueDepth, direct)) {}
+
+  BrickPrefetcher::~BrickPrefetcher() {
+    reader.reset(); // Drains reads still in flight
+    for (auto &f : decodes) {
+      f.wait();
+    }
+  }
+
+  void BrickPrefetcher::decode(uint32_t brick, std::vector<std::byte> compressed) {
+    decodes.push_back(pool.submit([this, brick, compressed = std::move(compressed)]() {
+      const auto &volume = cache.getVolume();
+      return cache.insert(brick, [&](std::byte *dst) {
+        volume.decodeBrick(brick, compressed.empty() ? nullptr : compressed.data(), dst);
+      });
+    }));
+  }
+
+  void BrickPrefetcher::request(const std::vector<uint32_t> &bricks) {
+    const auto &volume = cache.getVolume();
+    std::vector<ReadRequest> batch;
+    for (uint32_t brick : bricks) {
+      if (cache.isResident(brick) || inFlight.count(brick)) {
+        continue;
+      }
+      stats.requested++;
+
+      // Constant bricks have no payload to read
+      const auto &entry = volume.getBrickEntry(brick);
+      if (entry.size == 0) {
+        decode(brick, {});
+        continue;
+      }
+      auto &buffer = inFlight[brick];
+      buffer.resize(entry.size);
+      batch.push_back({entry.offset, entry.size, buffer.data(), brick});
+    }
+    if (!batch.empty()) {
+      reader->submit(batch);
+    }
+  }
+
+  void BrickPrefetcher::update() {
+    completions.clear();
+    reader->poll(completions, false);
+    for (const auto &completion : completions) {
+      auto it = inFlight.find(static_cast<uint32_t>(completion.tag));
+      if (it == inFlight.end()) {
+        continue;
+      }
+      if (completion.result == static_cast<int64_t>(it->second.size())) {
+        decode(it->first, std::move(it->second));
+      } else {
+        stats.failed++;
+      }
+      inFlight.erase(it);
+    }
+
+    // Retire finished decodes
+    auto done = std::partition(decodes.begin(), decodes.end(), [](std::future<bool> &f) {
+      return f.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    });
+    for (auto it = done; it != decodes.end(); ++it) {
+      try {
+        (it->get() ? stats.completed : stats.dropped)++;
+      } catch (...) {
+        stats.failed++;
+      }
+    }
+    decodes.erase(done, decodes.end());
+  }
+
+  size_t BrickPrefetcher::getPending() const {
+    return inFlight.size() + decodes.size();
+  }
+
+  PrefetchStats BrickPrefetcher::getStats() const {
+    return stats;
+  }
+
+  IoBackend BrickPrefetcher::getBackend() const {
+    return reader->getBackend();
+  }
+} // namespace CUDAVol
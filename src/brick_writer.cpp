@@ -0,0 +1,169 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  brick_writer.cpp
+
+  Brick writer definition.
+
+  November 2019
+*/
+
+#include "brick_writer.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace CUDAVol {
+  struct EncodedBrick {
+    std::vector<std::byte> data;
+    float min, max;
+    bool uniform;            // Every voxel has the bit pattern of the first
+  };
+
+  // Copies one halo padded brick out of the volume, clamping at the borders.
+  // The value range skips NaN, so uniformity is tracked on the bits instead.
+  template <typename T>
+  static void extractBrick(const VolumeView &volume,
+                           glm::ivec3 origin,
+                           int storedSize,
+                           T *dst,
+                           float &min,
+                           float &max,
+                           bool &uniform) {
+    const T *src = volume.as<T>();
+    const glm::ivec3 d = volume.dims;
+    const T *first = dst;
+    T lo = std::numeric_limits<T>::max(), hi = std::numeric_limits<T>::lowest();
+    uniform = true;
+    for (int z = 0; z < storedSize; z++) {
+      const size_t sz = std::clamp(origin.z + z, 0, d.z - 1);
+      for (int y = 0; y < storedSize; y++) {
+        const size_t sy = std::clamp(origin.y + y, 0, d.y - 1);
+        const T *row = src + (sz * d.y + sy) * d.x;
+        for (int x = 0; x < storedSize; x++) {
+          T v = row[std::clamp(origin.x + x, 0, d.x - 1)];
+          lo = std::min(lo, v);
+          hi = std::max(hi, v);
+          uniform = uniform && (dst == first || std::memcmp(&v, first, sizeof(T)) == 0);
+          *dst++ = v;
+        }
+      }
+    }
+    min = static_cast<float>(lo);
+    max = static_cast<float>(hi);
+  }
+
+  BrickWriter::BrickWriter(ThreadPool &pool, int brickSize, int halo, BrickCodec codec, int level)
+    : pool(pool), brickSize(brickSize), halo(halo), codec(codec), level(level) {
+    if (brickSize < 1 || halo < 0 || halo > brickSize) {
+      std::cerr << "Invalid brick size " << brickSize << " with halo " << halo << std::endl;
+      throw std::runtime_error("BrickWriter: invalid brick size");
+    }
+  }
+
+  size_t BrickWriter::write(const VolumeView &volume, const std::string &filePath) {
+    std::ofstream ofs(filePath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!ofs.is_open()) {
+      std::cerr << "Error opening " << filePath << " for writing" << std::endl;
+      throw std::runtime_error("BrickWriter: open failed");
+    }
+
+    const glm::ivec3 grid = (volume.dims + brickSize - 1) / brickSize;
+    const size_t brickCount = static_cast<size_t>(grid.x) * grid.y * grid.z;
+    const int storedSize = brickSize + 2 * halo;
+    const size_t brickBytes = static_cast<size_t>(storedSize) * storedSize * storedSize *
+                              getVoxelSize(volume.type);
+    if (brickCount > std::numeric_limits<uint32_t>::max()) {
+      std::cerr << "Too many bricks for " << filePath << std::endl;
+      throw std::runtime_error("BrickWriter: too many bricks");
+    }
+
+    BrickFileHeader header = {};
+    std::memcpy(header.magic, "CVBRICK", 8);
+    header.version = BrickFileHeader::currentVersion;
+    header.voxelType = static_cast<uint32_t>(volume.type);
+    for (int i = 0; i < 3; i++) {
+      header.dims[i] = volume.dims[i];
+      header.spacing[i] = volume.spacing[i];
+      header.brickGrid[i] = grid[i];
+    }
+    header.brickSize = static_cast<uint32_t>(brickSize);
+    header.halo = static_cast<uint32_t>(halo);
+    header.codec = static_cast<uint32_t>(codec);
+    header.brickCount = static_cast<uint32_t>(brickCount);
+    header.valueRange[0] = std::numeric_limits<float>::max();
+    header.valueRange[1] = std::numeric_limits<float>::lowest();
+    header.tableOffset = sizeof(BrickFileHeader);
+
+    // Table follows the header; bricks follow the table
+    std::vector<BrickEntry> table(brickCount);
+    uint64_t offset = header.tableOffset + brickCount * sizeof(BrickEntry);
+    ofs.seekp(static_cast<std::streamoff>(offset));
+
+    // Encode in batches so memory stays bounded, write each batch in order
+    const size_t batchSize = 4 * static_cast<size_t>(pool.getThreadCount());
+    std::vector<EncodedBrick> batch(batchSize);
+    for (size_t first = 0; first < brickCount; first += batchSize) {
+      const size_t last = std::min(brickCount, first + batchSize);
+      pool.parallelFor(first, last, 1, [&](size_t begin, size_t end) {
+        std::vector<std::byte> raw(brickBytes);
+        for (size_t i = begin; i < end; i++) {
+          const glm::ivec3 brick(i % grid.x, (i / grid.x) % grid.y, i / (size_t(grid.x) * grid.y));
+          auto &encoded = batch[i - first];
+          visitVoxelType(volume.type, [&](auto t) {
+            using T = decltype(t);
+            extractBrick<T>(volume, brick * brickSize - halo, storedSize,
+                            reinterpret_cast<T *>(raw.data()), encoded.min, encoded.max, encoded.uniform);
+          });
+          // A brick of one NaN has no value range to decode from, keep it
+          encoded.data = encoded.uniform && encoded.min == encoded.max
+                             ? std::vector<std::byte>()
+                             : compressBrick(codec, raw.data(), raw.size(), level);
+        }
+      });
+
+      for (size_t i = first; i < last; i++) {
+        auto &encoded = batch[i - first];
+        table[i] = {offset, static_cast<uint32_t>(encoded.data.size()), 0, encoded.min, encoded.max};
+        header.valueRange[0] = std::min(header.valueRange[0], encoded.min);
+        header.valueRange[1] = std::max(header.valueRange[1], encoded.max);
+        ofs.write(reinterpret_cast<const char *>(encoded.data.data()), encoded.data.size());
+        offset += encoded.data.size();
+        encoded.data = std::vector<std::byte>();
+      }
+    }
+
+    ofs.seekp(0);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(BrickEntry));
+    if (!ofs) {
+      std::cerr << "Error writing " << filePath << std::endl;
+      throw std::runtime_error("BrickWriter: write failed");
+    }
+    return static_cast<size_t>(offset);
+  }
+} // namespace CUDAVol
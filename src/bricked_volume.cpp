@@ -0,0 +1,232 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  bricked_volume.cpp
+
+  Bricked volume definition.
+
+  November 2019
+*/
+
+#include "bricked_volume.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+namespace CUDAVol {
+  [[noreturn]] static void fail(const std::string &filePath, const std::string &msg) {
+    std::cerr << "Error reading bricked volume " << filePath << ": " << msg << std::endl;
+    throw std::runtime_error("BrickedVolume: " + msg);
+  }
+
+  static void preadAll(int fd, std::byte *dst, size_t size, uint64_t offset, const std::string &filePath) {
+    while (size > 0) {
+      auto n = pread(fd, dst, size, static_cast<off_t>(offset));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n <= 0) {
+        fail(filePath, "short read");
+      }
+      dst += n;
+      size -= static_cast<size_t>(n);
+      offset += static_cast<uint64_t>(n);
+    }
+  }
+
+  // Whether grid covers dims with bricks of brickSize, with no brick left over
+  static bool isGridConsistent(const int32_t dims[3], uint32_t brickSize, const int32_t grid[3], uint32_t count) {
+    for (int i = 0; i < 3; i++) {
+      if (grid[i] != (static_cast<int64_t>(dims[i]) + brickSize - 1) / brickSize) {
+        return false;
+      }
+    }
+    return static_cast<size_t>(grid[0]) * grid[1] * grid[2] == count;
+  }
+
+  BrickedVolume::BrickedVolume(const std::string &filePath)
+    : fd(-1), filePath(resolveVolumePath(filePath)), header() {
+    fd = open(this->filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fail(this->filePath, std::strerror(errno));
+    }
+
+    try {
+      preadAll(fd, reinterpret_cast<std::byte *>(&header), sizeof(header), 0, this->filePath);
+      if (std::memcmp(header.magic, "CVBRICK", 8) != 0) {
+        fail(this->filePath, "not a bricked volume");
+      } else if (header.version != BrickFileHeader::currentVersion) {
+        fail(this->filePath, "unsupported version " + std::to_string(header.version));
+      } else if (header.voxelType > static_cast<uint32_t>(VoxelType::Float32)) {
+        fail(this->filePath, "unknown voxel type " + std::to_string(header.voxelType));
+      } else if (header.codec > static_cast<uint32_t>(BrickCodec::Zstd)) {
+        fail(this->filePath, "unknown codec " + std::to_string(header.codec));
+      } else if (!isCodecAvailable(static_cast<BrickCodec>(header.codec))) {
+        fail(this->filePath, std::string("codec ") +
+                                 toString(static_cast<BrickCodec>(header.codec)) +
+                                 " is not compiled in");
+      } else if (header.dims[0] <= 0 || header.dims[1] <= 0 || header.dims[2] <= 0) {
+        fail(this->filePath, "invalid dimensions");
+      } else if (header.brickSize == 0 || header.halo > header.brickSize) {
+        fail(this->filePath, "invalid brick size " + std::to_string(header.brickSize) +
+                                 " with halo " + std::to_string(header.halo));
+      } else if (!isGridConsistent(header.dims, header.brickSize, header.brickGrid, header.brickCount)) {
+        fail(this->filePath, "inconsistent brick grid");
+      }
+
+      table.resize(header.brickCount);
+      preadAll(fd, reinterpret_cast<std::byte *>(table.data()),
+               table.size() * sizeof(BrickEntry), header.tableOffset, this->filePath);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  }
+
+  BrickedVolume::~BrickedVolume() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  BrickedVolume::BrickedVolume(BrickedVolume &&other) noexcept
+    : fd(std::exchange(other.fd, -1)),
+      filePath(std::move(other.filePath)),
+      header(other.header),
+      table(std::move(other.table)) {}
+
+  BrickedVolume &BrickedVolume::operator=(BrickedVolume &&other) noexcept {
+    if (this != &other) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      fd = std::exchange(other.fd, -1);
+      filePath = std::move(other.filePath);
+      header = other.header;
+      table = std::move(other.table);
+    }
+    return *this;
+  }
+
+  void BrickedVolume::readBrick(size_t index, std::byte *dst) const {
+    const auto &entry = table.at(index);
+    if (entry.size == 0) {
+      decodeBrick(index, nullptr, dst);
+      return;
+    }
+    thread_local std::vector<std::byte> buffer;
+    buffer.resize(entry.size);
+    preadAll(fd, buffer.data(), entry.size, entry.offset, filePath);
+    decodeBrick(index, buffer.data(), dst);
+  }
+
+  void BrickedVolume::decodeBrick(size_t index, const std::byte *src, std::byte *dst) const {
+    const auto &entry = table.at(index);
+    const size_t count = getBrickBytes() / getVoxelSize(getType());
+
+    // Constant bricks carry no payload
+    if (entry.size == 0) {
+      visitVoxelType(getType(), [&](auto t) {
+        using T = decltype(t);
+        std::fill_n(reinterpret_cast<T *>(dst), count, static_cast<T>(entry.min));
+      });
+      return;
+    }
+    if (!decompressBrick(getCodec(), src, entry.size, dst, getBrickBytes())) {
+      fail(filePath, "corrupt brick " + std::to_string(index));
+    }
+  }
+
+  size_t BrickedVolume::getBrickIndex(glm::ivec3 brick) const {
+    return static_cast<size_t>(brick.x) +
+           static_cast<size_t>(header.brickGrid[0]) *
+               (static_cast<size_t>(brick.y) +
+                static_cast<size_t>(header.brickGrid[1]) * static_cast<size_t>(brick.z));
+  }
+
+  glm::ivec3 BrickedVolume::getBrickCoord(size_t index) const {
+    const size_t gx = header.brickGrid[0], gy = header.brickGrid[1];
+    return glm::ivec3(index % gx, (index / gx) % gy, index / (gx * gy));
+  }
+
+  const BrickEntry &BrickedVolume::getBrickEntry(size_t index) const {
+    return table[index];
+  }
+
+  size_t BrickedVolume::getBrickCount() const {
+    return table.size();
+  }
+
+  size_t BrickedVolume::getBrickBytes() const {
+    const size_t s = getStoredBrickSize();
+    return s * s * s * getVoxelSize(getType());
+  }
+
+  glm::ivec3 BrickedVolume::getDims() const {
+    return glm::ivec3(header.dims[0], header.dims[1], header.dims[2]);
+  }
+
+  glm::ivec3 BrickedVolume::getBrickGrid() const {
+    return glm::ivec3(header.brickGrid[0], header.brickGrid[1], header.brickGrid[2]);
+  }
+
+  int BrickedVolume::getBrickSize() const {
+    return static_cast<int>(header.brickSize);
+  }
+
+  int BrickedVolume::getHalo() const {
+    return static_cast<int>(header.halo);
+  }
+
+  int BrickedVolume::getStoredBrickSize() const {
+    return static_cast<int>(header.brickSize + 2 * header.halo);
+  }
+
+  VoxelType BrickedVolume::getType() const {
+    return static_cast<VoxelType>(header.voxelType);
+  }
+
+  glm::vec3 BrickedVolume::getSpacing() const {
+    return glm::vec3(header.spacing[0], header.spacing[1], header.spacing[2]);
+  }
+
+  glm::vec2 BrickedVolume::getValueRange() const {
+    return glm::vec2(header.valueRange[0], header.valueRange[1]);
+  }
+
+  BrickCodec BrickedVolume::getCodec() const {
+    return static_cast<BrickCodec>(header.codec);
+  }
+
+  const std::string &BrickedVolume::getFilePath() const {
+    return filePath;
+  }
+
+  int BrickedVolume::getFileDescriptor() const {
+    return fd;
+  }
+} // namespace CUDAVol
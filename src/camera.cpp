@@ -0,0 +1,98 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  camera.cpp
+
+  Camera definition.
+
+  November 2019
+*/
+
+#include "camera.h"
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace CUDAVol {
+  Camera::Camera(glm::vec3 target, float distance, float fieldOfView)
+    : target(target), yaw(0.f), pitch(0.f), distance(distance), fieldOfView(fieldOfView) {}
+
+  void Camera::orbit(float deltaYaw, float deltaPitch) {
+    const float limit = glm::radians(89.f);
+    yaw = std::remainder(yaw + deltaYaw, glm::radians(360.f));
+    pitch = glm::clamp(pitch + deltaPitch, -limit, limit);
+  }
+
+  void Camera::zoom(float factor) {
+    distance = std::max(distance * factor, 1e-3f);
+  }
+
+  void Camera::frame(glm::vec3 extent) {
+    // Bounding sphere fits the vertical field of view
+    distance = 0.5f * glm::length(extent) / std::sin(0.5f * fieldOfView);
+  }
+
+  glm::vec3 Camera::getPosition() const {
+    const glm::vec3 offset(std::cos(pitch) * std::sin(yaw), std::sin(pitch),
+                           std::cos(pitch) * std::cos(yaw));
+    return target + distance * offset;
+  }
+
+  void Camera::getBasis(float aspect, glm::vec3 &forward, glm::vec3 &right, glm::vec3 &up) const {
+    forward = glm::normalize(target - getPosition());
+    right = glm::normalize(glm::cross(forward, glm::vec3(0.f, 1.f, 0.f)));
+    up = glm::cross(right, forward);
+    const float h = std::tan(0.5f * fieldOfView);
+    right *= h * aspect;
+    up *= h;
+  }
+
+  void Camera::getRay(glm::vec2 ndc, float aspect, glm::vec3 &origin, glm::vec3 &dir) const {
+    glm::vec3 forward, right, up;
+    getBasis(aspect, forward, right, up);
+    origin = getPosition();
+    dir = glm::normalize(forward + ndc.x * right + ndc.y * up);
+  }
+
+  glm::vec3 Camera::getTarget() const {
+    return target;
+  }
+
+  float Camera::getDistance() const {
+    return distance;
+  }
+
+  float Camera::getFieldOfView() const {
+    return fieldOfView;
+  }
+
+  glm::mat4 Camera::getViewMatrix() const {
+    return glm::lookAt(getPosition(), target, glm::vec3(0.f, 1.f, 0.f));
+  }
+
+  glm::mat4 Camera::getProjectionMatrix(float aspect, float nearPlane, float farPlane) const {
+    return glm::perspective(fieldOfView, aspect, nearPlane, farPlane);
+  }
+} // namespace CUDAVol
@@ -0,0 +1,204 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  convert.cpp
+
+  Converter tool source file. Reads any supported volume and writes it as a
+  bricked .cvb file.
+
+  November 2019
+*/
+
+#include "brick_writer.h"
+#include "mip_builder.h"
+#include "slice_loader.h"
+#include "temporal_writer.h"
+#include "thread_pool.h"
+#include "time_series.h"
+#include "volume.h"
+#include "volume_reader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+static void printUsage(const char *name) {
+  std::cerr << "Usage: " << name << " <input> <output.cvb> [options]\n"
+            << "       " << name << " <timestep directory> <output.cvt> [options]\n"
+            << "  input is a .nrrd/.nhdr/.mhd/.mha file, a directory of slices,\n"
+            << "  or a raw file when --raw is given; a .cvt output takes a directory\n"
+            << "  with one .nrrd/.nhdr/.mhd/.mha file per timestep\n\n"
+            << "  --raw <x> <y> <z> <type>  raw input dimensions and voxel type\n"
+            << "  --spacing <x> <y> <z>     voxel spacing for raw input and slices\n"
+            << "  --brick <n>               core brick size (default 32)\n"
+            << "  --halo <n>                halo voxels per side (default 1)\n"
+            << "  --codec <c>               none, deflate, lz4 or zstd (default "
+            << CUDAVol::toString(CUDAVol::getDefaultCodec()) << ")\n"
+            << "  --level <n>               codec compression level\n"
+            << "  --levels <n>              resolution levels incl. full resolution,\n"
+            << "                            0 halves down to a single brick (default 1)\n"
+            << "  --filter <f>              box or gaussian downsampling (default box)\n"
+            << "  --keyframe <n>            timesteps per keyframe in .cvt output (default 16)\n\n"
+            << "  coarser levels are written next to the output as <name>.L<n>.cvb\n";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const std::string input = argv[1], output = argv[2];
+  glm::ivec3 rawDims(0);
+  CUDAVol::VoxelType rawType = CUDAVol::VoxelType::UInt8;
+  glm::vec3 spacing(1.f);
+  int brickSize = 32, halo = 1, level = 0, levels = 1, keyframeInterval = 16;
+  CUDAVol::BrickCodec codec = CUDAVol::getDefaultCodec();
+  CUDAVol::MipFilter filter = CUDAVol::MipFilter::Box;
+
+  for (int i = 3; i < argc; i++) {
+    auto arg = [&](int n) {
+      if (i + n >= argc) {
+        printUsage(argv[0]);
+        std::exit(EXIT_FAILURE);
+      }
+      return std::string(argv[i + n]);
+    };
+    if (!std::strcmp(argv[i], "--raw")) {
+      rawDims = glm::ivec3(std::stoi(arg(1)), std::stoi(arg(2)), std::stoi(arg(3)));
+      rawType = CUDAVol::parseVoxelType(arg(4));
+      i += 4;
+    } else if (!std::strcmp(argv[i], "--spacing")) {
+      spacing = glm::vec3(std::stof(arg(1)), std::stof(arg(2)), std::stof(arg(3)));
+      i += 3;
+    } else if (!std::strcmp(argv[i], "--brick")) {
+      brickSize = std::stoi(arg(1));
+      i += 1;
+    } else if (!std::strcmp(argv[i], "--halo")) {
+      halo = std::stoi(arg(1));
+      i += 1;
+    } else if (!std::strcmp(argv[i], "--codec")) {
+      codec = CUDAVol::parseBrickCodec(arg(1));
+      i += 1;
+    } else if (!std::strcmp(argv[i], "--level")) {
+      level = std::stoi(arg(1));
+      i += 1;
+    } else if (!std::strcmp(argv[i], "--levels")) {
+      levels = std::stoi(arg(1));
+      i += 1;
+    } else if (!std::strcmp(argv[i], "--filter")) {
+      filter = CUDAVol::parseMipFilter(arg(1));
+      i += 1;
+    } else if (!std::strcmp(argv[i], "--keyframe")) {
+      keyframeInterval = std::stoi(arg(1));
+      i += 1;
+    } else {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  CUDAVol::ThreadPool pool;
+  auto start = std::chrono::high_resolution_clock::now();
+  auto elapsed = [&]() {
+    auto now = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(now - start).count();
+  };
+
+  // Time series: encode timestep by timestep while the next one loads
+  if (std::filesystem::path(output).extension() == ".cvt") {
+    CUDAVol::TimeSeries series(pool, CUDAVol::TimestepSource::openDirectory(pool, input));
+    CUDAVol::TemporalWriter writer(pool, output, brickSize, keyframeInterval, codec, level);
+    size_t inputSize = 0, stored = 0;
+    for (size_t t = 0; t < series.getTimestepCount(); t++) {
+      series.seek(t);
+      inputSize += series.getCurrent().getSize();
+      stored += writer.append(series.getCurrent().getView());
+    }
+    size_t size = writer.finish();
+    auto dims = series.getCurrent().getDims();
+    const size_t bricksPerStep = static_cast<size_t>((dims.x + brickSize - 1) / brickSize) *
+                                 ((dims.y + brickSize - 1) / brickSize) *
+                                 ((dims.z + brickSize - 1) / brickSize);
+    std::cout << "Wrote " << output << " (" << series.getTimestepCount() << " timesteps, "
+              << brickSize << "^3 bricks, keyframe every " << keyframeInterval << ", "
+              << CUDAVol::toString(codec) << ") in " << elapsed() << " ms: " << size
+              << " bytes, ratio " << static_cast<double>(inputSize) / static_cast<double>(size)
+              << ", " << 100.0 * stored / (bricksPerStep * series.getTimestepCount())
+              << "% of bricks stored" << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  // Load input
+  CUDAVol::Volume volume;
+  if (rawDims.x > 0) {
+    volume = CUDAVol::Volume(input, rawDims, rawType, spacing, 0,
+                             CUDAVol::MemoryMap::Access::Sequential);
+  } else if (std::filesystem::is_directory(input)) {
+    volume = CUDAVol::SliceLoader().load(input, spacing);
+  } else {
+    volume = CUDAVol::VolumeReader(pool).read(input);
+  }
+  auto dims = volume.getDims();
+  std::cout << "Loaded " << input << " (" << dims.x << "x" << dims.y << "x" << dims.z
+            << " " << CUDAVol::toString(volume.getType()) << ") in " << elapsed()
+            << " ms" << std::endl;
+
+  // Write bricks
+  start = std::chrono::high_resolution_clock::now();
+  CUDAVol::BrickWriter writer(pool, brickSize, halo, codec, level);
+  size_t size = writer.write(volume.getView(), output);
+  std::cout << "Wrote " << output << " (" << brickSize << "^3 bricks, halo " << halo
+            << ", " << CUDAVol::toString(codec) << ") in " << elapsed() << " ms: "
+            << size << " bytes, ratio "
+            << static_cast<double>(volume.getSize()) / static_cast<double>(size)
+            << std::endl;
+
+  // Downsample and write coarser levels, one level in memory at a time
+  CUDAVol::MipBuilder builder(pool, filter);
+  CUDAVol::Volume coarser;
+  int i = 1;
+  for (; levels > 0 ? i < levels : std::max({dims.x, dims.y, dims.z}) > brickSize; i++) {
+    if (dims == glm::ivec3(1)) {
+      break;
+    }
+    start = std::chrono::high_resolution_clock::now();
+    coarser = builder.downsample(i == 1 ? volume.getView() : coarser.getView());
+    dims = coarser.getDims();
+    double downsampleTime = elapsed();
+    auto path = CUDAVol::getMipLevelPath(output, i);
+    size += writer.write(coarser.getView(), path);
+    std::cout << "Wrote " << path << " (" << dims.x << "x" << dims.y << "x" << dims.z
+              << ", " << CUDAVol::toString(filter) << ") in " << elapsed()
+              << " ms, downsample " << downsampleTime << " ms" << std::endl;
+  }
+
+  // Levels left over from an earlier conversion would be opened as ours
+  while (std::filesystem::remove(CUDAVol::getMipLevelPath(output, i))) {
+    i++;
+  }
+
+  return EXIT_SUCCESS;
+}
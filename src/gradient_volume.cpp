@@ -0,0 +1,127 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  gradient_volume.cpp
+
+  Gradient volume class definition.
+
+  November 2019
+*/
+
+#include "gradient_volume.h"
+#include "voxel_layout.h"
+#include <algorithm>
+#include <mutex>
+
+namespace CUDAVol {
+  // Central differences of the voxels at p, one sided at the borders, in
+  // world units; one pass finds the largest magnitude, the next encodes
+  template <typename T, typename Layout>
+  static void buildGradients(ThreadPool &pool,
+                             const T *data,
+                             const Layout &layout,
+                             glm::vec3 spacing,
+                             std::vector<uint32_t> &out,
+                             float &maxMagnitude) {
+    const glm::ivec3 dims = layout.dims;
+    auto gradient = [&](int x, int y, int z) {
+      auto at = [&](int px, int py, int pz) {
+        return static_cast<float>(data[layout.offsetX(px) + layout.offsetY(py) + layout.offsetZ(pz)]);
+      };
+      auto axis = [&](int c, int lo, int hi, auto fetch) {
+        return (fetch(hi) - fetch(lo)) / (static_cast<float>(hi - lo) * spacing[c]);
+      };
+      return glm::vec3(
+          axis(0, std::max(x - 1, 0), std::min(x + 1, dims.x - 1), [&](int i) { return at(i, y, z); }),
+          axis(1, std::max(y - 1, 0), std::min(y + 1, dims.y - 1), [&](int i) { return at(x, i, z); }),
+          axis(2, std::max(z - 1, 0), std::min(z + 1, dims.z - 1), [&](int i) { return at(x, y, i); }));
+    };
+
+    std::mutex mutex;
+    maxMagnitude = 0.f;
+    pool.parallelFor(0, static_cast<size_t>(dims.z), 1, [&](size_t first, size_t last) {
+      float localMax = 0.f;
+      for (int z = static_cast<int>(first); z < static_cast<int>(last); z++) {
+        for (int y = 0; y < dims.y; y++) {
+          for (int x = 0; x < dims.x; x++) {
+            localMax = std::max(localMax, glm::length(gradient(x, y, z)));
+          }
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      maxMagnitude = std::max(maxMagnitude, localMax);
+    });
+
+    pool.parallelFor(0, static_cast<size_t>(dims.z), 1, [&](size_t first, size_t last) {
+      for (int z = static_cast<int>(first); z < static_cast<int>(last); z++) {
+        for (int y = 0; y < dims.y; y++) {
+          uint32_t *row = out.data() + dims.x * (static_cast<size_t>(y) + static_cast<size_t>(dims.y) * z);
+          for (int x = 0; x < dims.x; x++) {
+            row[x] = GradientVolume::encode(gradient(x, y, z), maxMagnitude);
+          }
+        }
+      }
+    });
+  }
+
+  GradientVolume::GradientVolume() : dims(0), maxMagnitude(0.f) {}
+
+  GradientVolume::GradientVolume(ThreadPool &pool, const VolumeView &volume)
+    : dims(volume.dims), data(volume.getVoxelCount()), maxMagnitude(0.f) {
+    visitVoxelType(volume.type, [&](auto t) {
+      using T = decltype(t);
+      buildGradients(pool, volume.as<T>(), LinearLayout(volume.dims), volume.spacing, data, maxMagnitude);
+    });
+  }
+
+  GradientVolume::GradientVolume(ThreadPool &pool, const MortonVolume &volume)
+    : dims(volume.getDims()),
+      data(static_cast<size_t>(dims.x) * dims.y * dims.z),
+      maxMagnitude(0.f) {
+    visitVoxelType(volume.getType(), [&](auto t) {
+      using T = decltype(t);
+      buildGradients(pool, reinterpret_cast<const T *>(volume.getData()), volume.getLayout(), volume.getSpacing(),
+                     data, maxMagnitude);
+    });
+  }
+
+  size_t GradientVolume::getMemorySize(glm::ivec3 dims) {
+    return static_cast<size_t>(dims.x) * dims.y * dims.z * sizeof(uint32_t);
+  }
+
+  bool GradientVolume::isEmpty() const {
+    return data.empty();
+  }
+
+  glm::ivec3 GradientVolume::getDims() const {
+    return dims;
+  }
+
+  float GradientVolume::getMaxMagnitude() const {
+    return maxMagnitude;
+  }
+
+  size_t GradientVolume::getMemorySize() const {
+    return data.size() * sizeof(uint32_t);
+  }
+} // namespace CUDAVol
@@ -0,0 +1,246 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  light_volume.cpp
+
+  Light volume class implementation.
+
+  November 2019
+*/
+
+#include "light_volume.h"
+#include "glm/geometric.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace CUDAVol {
+  LightVolume::LightVolume()
+    : dims(0),
+      scale(1),
+      voxelSize(1.f),
+      order(0, 1, 2),
+      flip(false),
+      referenceLength(0.f),
+      direction(0.f) {}
+
+  glm::ivec3 LightVolume::getSweepDims() const {
+    return glm::ivec3(dims[order.x], dims[order.y], dims[order.z]);
+  }
+
+  void LightVolume::setOrder(ThreadPool &pool, int axis, bool flip) {
+    const glm::ivec3 newOrder((axis + 1) % 3, (axis + 2) % 3, axis);
+    if (newOrder == order && flip == this->flip) {
+      return;
+    }
+
+    // Light voxel q of the old order to the new one, slice by slice
+    const glm::ivec3 from = getSweepDims();
+    const glm::ivec3 to(dims[newOrder.x], dims[newOrder.y], dims[newOrder.z]);
+    std::vector<float> reordered(values.size());
+    pool.parallelFor(0, static_cast<size_t>(to.z), 1, [&](size_t lo, size_t hi) {
+      for (int s = static_cast<int>(lo); s < static_cast<int>(hi); s++) {
+        for (int v = 0; v < to.y; v++) {
+          for (int u = 0; u < to.x; u++) {
+            glm::ivec3 q;
+            q[newOrder.x] = u;
+            q[newOrder.y] = v;
+            q[newOrder.z] = flip ? to.z - 1 - s : s;
+            const int t = this->flip ? from.z - 1 - q[order.z] : q[order.z];
+            reordered[u + to.x * (static_cast<size_t>(v) + static_cast<size_t>(to.y) * s)] =
+                values[q[order.x] + from.x * (static_cast<size_t>(q[order.y]) + static_cast<size_t>(from.y) * t)];
+          }
+        }
+      }
+    });
+    values = std::move(reordered);
+    order = newOrder;
+    this->flip = flip;
+  }
+
+  size_t LightVolume::sweep(ThreadPool &pool, int first, int lastAffected) {
+    const glm::ivec3 n = getSweepDims();
+    const size_t area = static_cast<size_t>(n.x) * n.y;
+
+    // Every step reaches the previous slice, shifted sideways by the same
+    // fraction of a light voxel everywhere
+    const float length = voxelSize[order.z] / std::abs(direction[order.z]);
+    const glm::vec3 delta = direction * length / voxelSize;
+    const int du = static_cast<int>(std::floor(delta[order.x])), dv = static_cast<int>(std::floor(delta[order.y]));
+    const float fu = delta[order.x] - static_cast<float>(du), fv = delta[order.y] - static_cast<float>(dv);
+
+    // Attenuation over half a step per table entry, opacity clamped so that
+    // extinction stays finite; a step attenuates by the product of its ends,
+    // the trapezoid rule
+    constexpr float maxAlpha = 1.f - 1e-6f;
+    const int size = TransferFunction::tableSize;
+    std::vector<float> attenuation(size);
+    for (int i = 0; i < size; i++) {
+      const float kappa = -std::log(1.f - glm::clamp(source[i], 0.f, maxAlpha)) / referenceLength;
+      attenuation[i] = std::exp(-0.5f * kappa * length);
+    }
+    auto getAttenuation = [&](float x) {
+      const int i = std::min(static_cast<int>(x), size - 2);
+      return glm::mix(attenuation[i], attenuation[i + 1], x - static_cast<float>(i));
+    };
+
+    // Transmittance and attenuation of the previous slice, in a border of
+    // ones wide enough for every shifted read, so light enters unattenuated
+    // from outside the grid
+    const int pad = std::max({std::abs(du), std::abs(du + 1), std::abs(dv), std::abs(dv + 1)});
+    const int width = n.x + 2 * pad;
+    const size_t padded = static_cast<size_t>(width) * (n.y + 2 * pad);
+    std::vector<float> previousLight(padded, 1.f), previousAttenuation(padded, 1.f);
+    std::vector<float> currentLight(padded, 1.f), currentAttenuation(padded, 1.f);
+    if (first > 0) {
+      const size_t slice = (first - 1) * area;
+      for (int v = 0; v < n.y; v++) {
+        for (int u = 0; u < n.x; u++) {
+          const size_t i = (v + pad) * static_cast<size_t>(width) + pad + u;
+          previousLight[i] = transmittance[slice + u + static_cast<size_t>(n.x) * v];
+          previousAttenuation[i] = getAttenuation(values[slice + u + static_cast<size_t>(n.x) * v]);
+        }
+      }
+    }
+
+    size_t count = 0;
+    for (int s = first; s < n.z; s++) {
+      std::atomic<bool> changed(false);
+      pool.parallelFor(0, static_cast<size_t>(n.y), 8, [&](size_t lo, size_t hi) {
+        bool rowsChanged = false;
+        for (int v = static_cast<int>(lo); v < static_cast<int>(hi); v++) {
+          const size_t row = (v + dv + pad) * static_cast<size_t>(width) + pad + du;
+          const float *l0 = previousLight.data() + row, *l1 = l0 + width;
+          const float *a0 = previousAttenuation.data() + row, *a1 = a0 + width;
+          float *light = currentLight.data() + (v + pad) * static_cast<size_t>(width) + pad;
+          float *attenuated = currentAttenuation.data() + (v + pad) * static_cast<size_t>(width) + pad;
+          const float *value = values.data() + s * area + static_cast<size_t>(n.x) * v;
+          float *out = transmittance.data() + s * area + static_cast<size_t>(n.x) * v;
+          for (int u = 0; u < n.x; u++) {
+            const float a = getAttenuation(value[u]);
+            const float before = glm::mix(glm::mix(l0[u], l0[u + 1], fu), glm::mix(l1[u], l1[u + 1], fu), fv) *
+                                 glm::mix(glm::mix(a0[u], a0[u + 1], fu), glm::mix(a1[u], a1[u + 1], fu), fv);
+            const float t = before * a;
+            rowsChanged = rowsChanged || std::abs(t - out[u]) > 1e-6f;
+            out[u] = t;
+            light[u] = t;
+            attenuated[u] = a;
+          }
+        }
+        if (rowsChanged) {
+          changed.store(true, std::memory_order_relaxed);
+        }
+      });
+      count++;
+      if (s > lastAffected && !changed.load()) {
+        break;
+      }
+      std::swap(previousLight, currentLight);
+      std::swap(previousAttenuation, currentAttenuation);
+    }
+    return count;
+  }
+
+  size_t LightVolume::update(ThreadPool &pool,
+                             const TransferFunction &transferFunction,
+                             float referenceLength,
+                             glm::vec3 direction) {
+    if (isEmpty()) {
+      return 0;
+    }
+    direction = glm::normalize(direction);
+    const int size = TransferFunction::tableSize;
+    std::vector<float> opacities(size);
+    for (int i = 0; i < size; i++) {
+      opacities[i] = transferFunction.getTable()[i].a;
+    }
+
+    if (!isSwept() || referenceLength != this->referenceLength || direction != this->direction) {
+      source = opacities;
+      this->referenceLength = referenceLength;
+      this->direction = direction;
+      const glm::vec3 a = glm::abs(direction);
+      const int axis = a.x >= a.y && a.x >= a.z ? 0 : a.y >= a.z ? 1 : 2;
+      setOrder(pool, axis, direction[axis] > 0.f);
+
+      // Value ranges per slice, for edits to find the slices they affect
+      const glm::ivec3 n = getSweepDims();
+      const size_t area = static_cast<size_t>(n.x) * n.y;
+      sliceRanges.resize(n.z);
+      pool.parallelFor(0, static_cast<size_t>(n.z), 1, [&](size_t lo, size_t hi) {
+        for (size_t s = lo; s < hi; s++) {
+          auto [min, max] = std::minmax_element(values.begin() + s * area, values.begin() + (s + 1) * area);
+          sliceRanges[s] = glm::vec2(*min, *max);
+        }
+      });
+      transmittance.assign(values.size(), 1.f);
+      return sweep(pool, 0, n.z - 1);
+    }
+
+    // Changed part of the opacities; values within one entry of it
+    // interpolate a changed entry
+    int lo = 0, hi = size - 1;
+    while (lo < size && opacities[lo] == source[lo]) {
+      lo++;
+    }
+    if (lo == size) {
+      return 0;
+    }
+    while (opacities[hi] == source[hi]) {
+      hi--;
+    }
+    source = opacities;
+    int first = -1, last = -1;
+    for (int s = 0; s < static_cast<int>(sliceRanges.size()); s++) {
+      if (sliceRanges[s].y > static_cast<float>(lo - 1) && sliceRanges[s].x < static_cast<float>(hi + 1)) {
+        first = first < 0 ? s : first;
+        last = s;
+      }
+    }
+    return first < 0 ? 0 : sweep(pool, first, last);
+  }
+
+  bool LightVolume::isEmpty() const {
+    return values.empty();
+  }
+
+  bool LightVolume::isSwept() const {
+    return !transmittance.empty();
+  }
+
+  glm::ivec3 LightVolume::getDims() const {
+    return dims;
+  }
+
+  int LightVolume::getScale() const {
+    return scale;
+  }
+
+  int LightVolume::getSliceCount() const {
+    return getSweepDims().z;
+  }
+
+  size_t LightVolume::getMemorySize() const {
+    return (values.size() + transmittance.size()) * sizeof(float);
+  }
+} // namespace CUDAVol
@@ -0,0 +1,304 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  macrocell_grid.cpp
+
+  Macrocell grid class definition.
+
+  November 2019
+*/
+
+#include "macrocell_grid.h"
+#include "glm/common.hpp"
+#include <cmath>
+#include <limits>
+
+namespace CUDAVol {
+  // Ranges over voxels [c * cellSize - 1, (c + 1) * cellSize] per axis,
+  // clamped to the volume; one task per row of cells along x
+  template <typename T, typename Layout>
+  static void scanRanges(ThreadPool &pool,
+                         const T *data,
+                         const Layout &layout,
+                         int cellSize,
+                         glm::ivec3 grid,
+                         std::vector<glm::vec2> &ranges) {
+    const glm::ivec3 dims = layout.dims;
+    auto footprint = [&](int cell, int axis, int &lo, int &hi) {
+      lo = std::max(cell * cellSize - 1, 0);
+      hi = std::min((cell + 1) * cellSize, dims[axis] - 1);
+    };
+    pool.parallelFor(0, static_cast<size_t>(grid.y) * grid.z, 1, [&](size_t first, size_t last) {
+      for (size_t row = first; row < last; row++) {
+        glm::vec2 *out = ranges.data() + row * grid.x;
+        std::fill_n(out, grid.x, glm::vec2(std::numeric_limits<float>::max(),
+                                           std::numeric_limits<float>::lowest()));
+        int y0, y1, z0, z1;
+        footprint(static_cast<int>(row % grid.y), 1, y0, y1);
+        footprint(static_cast<int>(row / grid.y), 2, z0, z1);
+        for (int z = z0; z <= z1; z++) {
+          for (int y = y0; y <= y1; y++) {
+            const size_t base = layout.offsetY(y) + layout.offsetZ(z);
+            for (int c = 0; c < grid.x; c++) {
+              int x0, x1;
+              footprint(c, 0, x0, x1);
+              T lo = data[base + layout.offsetX(x0)], hi = lo;
+              for (int x = x0 + 1; x <= x1; x++) {
+                const T v = data[base + layout.offsetX(x)];
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+              }
+              out[c] = glm::vec2(std::min(out[c].x, static_cast<float>(lo)),
+                                 std::max(out[c].y, static_cast<float>(hi)));
+            }
+          }
+        }
+      }
+    });
+  }
+
+  MacrocellGrid::MacrocellGrid() : grid(0), cellSize(defaultCellSize), occupiedCount(0), valueRange(0.f) {}
+
+  MacrocellGrid::MacrocellGrid(ThreadPool &pool, const VolumeView &volume, int cellSize)
+    : grid((volume.dims + cellSize - 1) / cellSize), cellSize(cellSize), occupiedCount(0), valueRange(0.f) {
+    ranges.resize(getCellCount());
+    visitVoxelType(volume.type, [&](auto t) {
+      using T = decltype(t);
+      scanRanges(pool, volume.as<T>(), LinearLayout(volume.dims), cellSize, grid, ranges);
+    });
+  }
+
+  MacrocellGrid::MacrocellGrid(ThreadPool &pool, const MortonVolume &volume, int cellSize)
+    : grid((volume.getDims() + cellSize - 1) / cellSize), cellSize(cellSize), occupiedCount(0), valueRange(0.f) {
+    ranges.resize(getCellCount());
+    visitVoxelType(volume.getType(), [&](auto t) {
+      using T = decltype(t);
+      scanRanges(pool, reinterpret_cast<const T *>(volume.getData()), volume.getLayout(), cellSize, grid, ranges);
+    });
+  }
+
+  MacrocellGrid::MacrocellGrid(const BrickedVolume &volume)
+    : grid(volume.getBrickGrid()), cellSize(volume.getBrickSize()), occupiedCount(0), valueRange(0.f) {
+    ranges.resize(getCellCount());
+    for (size_t i = 0; i < ranges.size(); i++) {
+      const BrickEntry &entry = volume.getBrickEntry(i);
+      ranges[i] = glm::vec2(entry.min, entry.max);
+    }
+    if (volume.getHalo() > 0) {
+      return;
+    }
+
+    // Without a halo a brick's range misses the neighbours its samples read
+    const std::vector<glm::vec2> own = ranges;
+    for (int z = 0; z < grid.z; z++) {
+      for (int y = 0; y < grid.y; y++) {
+        for (int x = 0; x < grid.x; x++) {
+          const glm::ivec3 lo = glm::max(glm::ivec3(x, y, z) - 1, 0);
+          const glm::ivec3 hi = glm::min(glm::ivec3(x, y, z) + 1, grid - 1);
+          glm::vec2 &range = ranges[volume.getBrickIndex(glm::ivec3(x, y, z))];
+          for (int k = lo.z; k <= hi.z; k++) {
+            for (int j = lo.y; j <= hi.y; j++) {
+              for (int i = lo.x; i <= hi.x; i++) {
+                const glm::vec2 other = own[volume.getBrickIndex(glm::ivec3(i, j, k))];
+                range = glm::vec2(std::min(range.x, other.x), std::max(range.y, other.y));
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  void MacrocellGrid::classify(const TransferFunction &transferFunction, glm::vec2 valueRange) {
+    const int tableSize = TransferFunction::tableSize;
+    std::vector<uint8_t> visible(tableSize);
+    for (int i = 0; i < tableSize; i++) {
+      visible[i] = transferFunction.getTable()[i].a > 0.f;
+    }
+
+    // Entries whose visibility changed; everything on the first call or when
+    // the value mapping moves
+    int changedLo = 0, changedHi = tableSize - 1;
+    if (occupancy.size() == ranges.size() && valueRange == this->valueRange) {
+      changedLo = tableSize;
+      changedHi = -1;
+      for (int i = 0; i < tableSize; i++) {
+        if (visible[i] != this->visible[i]) {
+          changedLo = std::min(changedLo, i);
+          changedHi = i;
+        }
+      }
+      if (changedLo > changedHi) {
+        return;
+      }
+    } else {
+      occupancy.assign(ranges.size(), 0.f);
+      occupiedCount = 0;
+      distances.clear();
+    }
+    this->visible = visible;
+    this->valueRange = valueRange;
+
+    // Visible entries before each entry, so a range of entries is tested in O(1)
+    std::vector<int> visibleBefore(tableSize + 1, 0);
+    for (int i = 0; i < tableSize; i++) {
+      visibleBefore[i + 1] = visibleBefore[i] + visible[i];
+    }
+
+    // Samples interpolate between the entries around their value; one more
+    // entry on either side absorbs rounding in the trilinear weights
+    const float scale = (tableSize - 1) / std::max(valueRange.y - valueRange.x, 1e-20f);
+    auto getEntry = [&](float v, int offset) {
+      const float x = glm::clamp((v - valueRange.x) * scale, 0.f, float(tableSize - 1));
+      return glm::clamp(static_cast<int>(x) + offset, 0, tableSize - 1);
+    };
+    for (size_t i = 0; i < ranges.size(); i++) {
+      const int lo = getEntry(ranges[i].x, -1), hi = getEntry(ranges[i].y, 2);
+      if (hi < changedLo || lo > changedHi) {
+        continue;
+      }
+      const float value = visibleBefore[hi + 1] > visibleBefore[lo] ? 1.f : 0.f;
+      if (value != occupancy[i]) {
+        occupancy[i] = value;
+        distances.clear();
+        if (value != 0.f) {
+          occupiedCount++;
+        } else {
+          occupiedCount--;
+        }
+      }
+    }
+  }
+
+  void MacrocellGrid::buildMajorants(const TransferFunction &transferFunction,
+                                     glm::vec2 valueRange,
+                                     float referenceLength) {
+    constexpr float maxAlpha = 1.f - 1e-6f;
+    const int tableSize = TransferFunction::tableSize;
+    std::vector<float> extinction(tableSize);
+    for (int i = 0; i < tableSize; i++) {
+      extinction[i] = -std::log(1.f - glm::clamp(transferFunction.getTable()[i].a, 0.f, maxAlpha)) / referenceLength;
+    }
+    const float scale = (tableSize - 1) / std::max(valueRange.y - valueRange.x, 1e-20f);
+    auto getEntry = [&](float v, int offset) {
+      const float x = glm::clamp((v - valueRange.x) * scale, 0.f, float(tableSize - 1));
+      return glm::clamp(static_cast<int>(x) + offset, 0, tableSize - 1);
+    };
+    majorants.resize(ranges.size());
+    for (size_t i = 0; i < ranges.size(); i++) {
+      const int lo = getEntry(ranges[i].x, -1), hi = getEntry(ranges[i].y, 2);
+      majorants[i] = *std::max_element(extinction.begin() + lo, extinction.begin() + hi + 1);
+    }
+  }
+
+  void MacrocellGrid::buildDistances(ThreadPool &pool) {
+    distances.resize(occupancy.size());
+    for (size_t i = 0; i < occupancy.size(); i++) {
+      distances[i] = occupancy[i] != 0.f ? 0.f : float(maxDistance);
+    }
+
+    // The distance is min over cells of max(|dx|, |dy|, |dz|, 0 or inf), so
+    // it separates into passes computing min_j max(|i - j|, d(j)) per line
+    const size_t strides[3] = {1, static_cast<size_t>(grid.x), static_cast<size_t>(grid.x) * grid.y};
+    for (int axis = 0; axis < 3; axis++) {
+      const int length = grid[axis];
+      const size_t lines = getCellCount() / length;
+      const size_t stride = strides[axis];
+      pool.parallelFor(0, lines, 64, [&](size_t first, size_t last) {
+        std::vector<float> line(length);
+        for (size_t l = first; l < last; l++) {
+          // Line l starts at the cell with coordinate 0 along the axis
+          const size_t base = (l / stride) * stride * length + l % stride;
+          for (int i = 0; i < length; i++) {
+            line[i] = distances[base + i * stride];
+          }
+          for (int i = 0; i < length; i++) {
+            // Cells r away can only lower the distance below r
+            float d = line[i];
+            for (int r = 1; r < d; r++) {
+              if (i >= r) {
+                d = std::min(d, std::max(float(r), line[i - r]));
+              }
+              if (i + r < length) {
+                d = std::min(d, std::max(float(r), line[i + r]));
+              }
+            }
+            distances[base + i * stride] = d;
+          }
+        }
+      });
+    }
+  }
+
+  bool MacrocellGrid::isEmpty() const {
+    return ranges.empty();
+  }
+
+  bool MacrocellGrid::hasDistances() const {
+    return !distances.empty();
+  }
+
+  glm::ivec3 MacrocellGrid::getGrid() const {
+    return grid;
+  }
+
+  int MacrocellGrid::getCellSize() const {
+    return cellSize;
+  }
+
+  const float *MacrocellGrid::getOccupancy() const {
+    return occupancy.data();
+  }
+
+  const glm::vec2 *MacrocellGrid::getRanges() const {
+    return ranges.data();
+  }
+
+  bool MacrocellGrid::hasMajorants() const {
+    return !majorants.empty() && majorants.size() == ranges.size();
+  }
+
+  const float *MacrocellGrid::getMajorants() const {
+    return majorants.data();
+  }
+
+  const float *MacrocellGrid::getDistances() const {
+    return distances.data();
+  }
+
+  glm::vec2 MacrocellGrid::getValueRange() const {
+    return valueRange;
+  }
+
+  size_t MacrocellGrid::getCellCount() const {
+    return static_cast<size_t>(grid.x) * grid.y * grid.z;
+  }
+
+  size_t MacrocellGrid::getOccupiedCount() const {
+    return occupiedCount;
+  }
+
+  size_t MacrocellGrid::getMemorySize() const {
+    return ranges.size() * sizeof(glm::vec2) + (occupancy.size() + distances.size() + majorants.size()) * sizeof(float);
+  }
+} // namespace CUDAVol
@@ -28,19 +28,164 @@
   October 2019
 */
 
+#include "bricked_volume.h"
+#include "mip_builder.h"
 #include "renderer.h"
+#include "slice_loader.h"
+#include "sparse_volume.h"
+#include "temporal_volume.h"
+#include "thread_pool.h"
+#include "time_series.h"
+#include "vdb_reader.h"
+#include "volume.h"
+#include "volume_reader.h"
 #include "window.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
 int main(int argc, char **argv) {
+  CUDAVol::ThreadPool pool;
+  CUDAVol::Volume volume;
+  std::future<CUDAVol::Volume> pendingVolume;
+  std::vector<CUDAVol::BrickedVolume> brickedLevels;
+  std::unique_ptr<CUDAVol::TimeSeries> series;
+  std::unique_ptr<CUDAVol::SparseVolume> sparseVolume;
+  size_t cacheBytes = size_t(1) << 30;
+
+  if (argc >= 3 && !std::strcmp(argv[1], "--series")) {
+    // Time series: a .cvt file, a directory of timesteps or a list of files,
+    // played back while the next timestep decodes in the background
+    std::vector<std::string> filePaths(argv + 2, argv + argc);
+    std::unique_ptr<CUDAVol::TimestepSource> source;
+    if (filePaths.size() == 1 && std::filesystem::path(filePaths[0]).extension() == ".cvt") {
+      source = std::make_unique<CUDAVol::TemporalVolume>(pool, filePaths[0]);
+    } else if (filePaths.size() == 1 && std::filesystem::is_directory(filePaths[0])) {
+      source = CUDAVol::TimestepSource::openDirectory(pool, filePaths[0]);
+    } else {
+      source = CUDAVol::TimestepSource::openFiles(pool, filePaths);
+    }
+    series = std::make_unique<CUDAVol::TimeSeries>(pool, std::move(source));
+    std::cout << "Playing " << series->getTimestepCount() << " timesteps" << std::endl;
+  } else if (argc >= 5) {
+    // Map raw volume: <file> <x> <y> <z> [type] [sx sy sz]
+    auto start = std::chrono::high_resolution_clock::now();
+    glm::ivec3 dims(std::stoi(argv[2]), std::stoi(argv[3]), std::stoi(argv[4]));
+    auto type = argc >= 6 ? CUDAVol::parseVoxelType(argv[5])
+                          : CUDAVol::VoxelType::UInt8;
+    glm::vec3 spacing(1.f);
+    if (argc >= 9) {
+      spacing = glm::vec3(std::stof(argv[6]), std::stof(argv[7]), std::stof(argv[8]));
+    }
+    volume = CUDAVol::Volume(argv[1], dims, type, spacing, 0,
+                             CUDAVol::MemoryMap::Access::WillNeed);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Mapped " << argv[1] << " (" << volume.getSize() << " bytes) in "
+              << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms" << std::endl;
+  } else if ((argc == 2 || argc == 3) &&
+             std::filesystem::path(argv[1]).extension() == ".cvb") {
+    // Bricked volume and its coarser levels, sampled out-of-core:
+    // <file.cvb> [cache budget in MB]
+    brickedLevels = CUDAVol::openMipLevels(argv[1]);
+    if (argc == 3) {
+      cacheBytes = std::stoull(argv[2]) << 20;
+    }
+    auto dims = brickedLevels.front().getDims();
+    std::cout << "Opened " << argv[1] << " (" << dims.x << "x" << dims.y << "x"
+              << dims.z << ", " << brickedLevels.front().getBrickCount() << " bricks, "
+              << brickedLevels.size() << " levels)" << std::endl;
+  } else if ((argc == 2 || argc == 3) &&
+             std::filesystem::path(argv[1]).extension() == ".vdb") {
+    // Sparse OpenVDB grid: <file.vdb> [grid name]
+    auto start = std::chrono::high_resolution_clock::now();
+    sparseVolume = std::make_unique<CUDAVol::SparseVolume>(
+        CUDAVol::readVdb(argv[1], argc == 3 ? argv[2] : ""));
+    auto end = std::chrono::high_resolution_clock::now();
+    auto dims = sparseVolume->getDims();
+    std::cout << "Read " << argv[1] << " (" << dims.x << "x" << dims.y << "x" << dims.z
+              << ", " << sparseVolume->getLeafCount() << " leaves, "
+              << sparseVolume->getMemorySize() << " bytes) in "
+              << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms" << std::endl;
+  } else if (argc == 2 && std::filesystem::is_directory(argv[1])) {
+    // Assemble slice stack in the background while the window comes up
+    std::string directory = argv[1];
+    pendingVolume = pool.submit([directory]() {
+      CUDAVol::SliceLoader loader;
+      auto volume = loader.load(directory);
+      const auto &t = loader.getTimings();
+      std::cout << "Loaded " << volume.getDims().z << " slices from " << directory
+                << " in " << t.total << " ms (busy: read " << t.read
+                << " ms, decode " << t.decode << " ms, convert " << t.convert
+                << " ms)" << std::endl;
+      return volume;
+    });
+  } else if (argc == 2) {
+    // Decode NRRD/MetaImage in the background while the window comes up
+    std::string filePath = argv[1];
+    pendingVolume = pool.submit([&pool, filePath]() {
+      CUDAVol::VolumeReader reader(pool);
+      auto volume = reader.read(filePath);
+      const auto &t = reader.getTimings();
+      std::cout << "Loaded " << filePath << " (" << volume.getSize()
+                << " bytes): read " << t.read << " ms, inflate " << t.inflate
+                << " ms, convert " << t.convert << " ms" << std::endl;
+      return volume;
+    });
+  } else if (argc > 1) {
+    std::cerr << "Usage: " << argv[0] << " <file.nrrd|file.mhd|slice directory>"
+              << std::endl;
+    std::cerr << "       " << argv[0] << " <file.cvb> [cache budget in MB]" << std::endl;
+    std::cerr << "       " << argv[0] << " <file.vdb> [grid name]" << std::endl;
+    std::cerr << "       " << argv[0] << " --series <file.cvt|directory|files...>" << std::endl;
+    std::cerr << "       " << argv[0] << " <file> <x> <y> <z> [type] [sx sy sz]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
   // Initialize components
   CUDAVol::Window window(glm::ivec2(1024, 768), "CUDAVol");
-  CUDAVol::Renderer renderer(window);
+  CUDAVol::Renderer renderer(window, pool);
+  if (!brickedLevels.empty()) {
+    renderer.setVolume(brickedLevels, cacheBytes);
+  } else if (sparseVolume) {
+    renderer.setVolume(*sparseVolume);
+  } else if (series) {
+    renderer.setVolume(series->getCurrent().getView());
+  } else {
+    renderer.setVolume(volume.getView());
+  }
 
   // Start rendering loop
   while (window.update()) {
+    // Hand over background loaded volume at a frame boundary
+    if (pendingVolume.valid() &&
+        pendingVolume.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      volume = pendingVolume.get();
+      renderer.setVolume(volume.getView());
+    }
+
+    // Show the next timestep once decoded; a late timestep keeps the current
+    // one on screen instead of stalling the frame. The background pass still
+    // reads the current one, whose buffer is reloaded on the swap.
+    if (series && series->advance([&] { renderer.stopRefinement(); })) {
+      renderer.setVolume(series->getCurrent().getView());
+    }
     renderer.update();
   }
 
+  if (series) {
+    auto stats = series->getStats();
+    std::cout << "Played " << stats.swaps << " timesteps, " << stats.stalls
+              << " frames waited on decoding, " << stats.loadTime << " ms per timestep"
+              << std::endl;
+  }
+
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,158 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  memory_map.cpp
+
+  Memory mapped file/buffer definition.
+
+  November 2019
+*/
+
+#include "memory_map.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+namespace CUDAVol {
+  static int toAdvice(MemoryMap::Access access) {
+    switch (access) {
+    case MemoryMap::Access::Sequential:
+      return MADV_SEQUENTIAL;
+    case MemoryMap::Access::Random:
+      return MADV_RANDOM;
+    case MemoryMap::Access::WillNeed:
+      return MADV_WILLNEED;
+    case MemoryMap::Access::DontNeed:
+      return MADV_DONTNEED;
+    default:
+      return MADV_NORMAL;
+    }
+  }
+
+  MemoryMap::MemoryMap() : object(nullptr), size(0), writable(false) {}
+
+  MemoryMap::MemoryMap(const std::string &filePath, Access access)
+    : object(nullptr), size(0), writable(false) {
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      std::cerr << "Error opening file " << filePath << ": "
+                << std::strerror(errno) << std::endl;
+      throw std::runtime_error("MemoryMap: open failed");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      std::cerr << "Error mapping file " << filePath << ": empty or unreadable"
+                << std::endl;
+      throw std::runtime_error("MemoryMap: empty file");
+    }
+    size = static_cast<size_t>(st.st_size);
+
+    // Private read-only mapping; pages are faulted in lazily on first access,
+    // so opening is O(1) regardless of file size
+    object = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (object == MAP_FAILED) {
+      object = nullptr;
+      std::cerr << "Error mapping file " << filePath << ": "
+                << std::strerror(errno) << std::endl;
+      throw std::runtime_error("MemoryMap: mmap failed");
+    }
+
+    advise(access);
+  }
+
+  MemoryMap::MemoryMap(size_t size) : object(nullptr), size(size), writable(true) {
+    if (size == 0) {
+      return;
+    }
+
+    // Anonymous mapping for decoded data; zero-filled and page aligned
+    object = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (object == MAP_FAILED) {
+      object = nullptr;
+      std::cerr << "Error allocating " << size << " bytes: "
+                << std::strerror(errno) << std::endl;
+      throw std::runtime_error("MemoryMap: anonymous mmap failed");
+    }
+  }
+
+  MemoryMap::~MemoryMap() {
+    if (object) {
+      munmap(object, size);
+    }
+  }
+
+  MemoryMap::MemoryMap(MemoryMap &&other) noexcept
+    : object(std::exchange(other.object, nullptr)),
+      size(std::exchange(other.size, 0)),
+      writable(std::exchange(other.writable, false)) {}
+
+  MemoryMap &MemoryMap::operator=(MemoryMap &&other) noexcept {
+    if (this != &other) {
+      if (object) {
+        munmap(object, size);
+      }
+      object = std::exchange(other.object, nullptr);
+      size = std::exchange(other.size, 0);
+      writable = std::exchange(other.writable, false);
+    }
+    return *this;
+  }
+
+  void MemoryMap::advise(Access access, size_t offset, size_t length) const {
+    if (!object || offset >= size) {
+      return;
+    }
+
+    // madvise requires a page aligned start address
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = offset - offset % pageSize;
+    size_t end = (length == 0 || offset + length > size) ? size : offset + length;
+    madvise(static_cast<char *>(object) + begin, end - begin, toAdvice(access));
+  }
+
+  const std::byte *MemoryMap::getData() const {
+    return static_cast<const std::byte *>(object);
+  }
+
+  std::byte *MemoryMap::getMutableData() {
+    return writable ? static_cast<std::byte *>(object) : nullptr;
+  }
+
+  size_t MemoryMap::getSize() const {
+    return size;
+  }
+
+  bool MemoryMap::isWritable() const {
+    return writable;
+  }
+} // namespace CUDAVol
@@ -0,0 +1,280 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  mip_builder.cpp
+
+  Mip builder class definition.
+
+  November 2019
+*/
+
+#include "mip_builder.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace CUDAVol {
+  // Separable kernel: output i = sum_k weights[k] * input[2i + offset + k]
+  struct MipKernel {
+    int offset;
+    int taps;
+    float weights[4];
+  };
+
+  // Clamped voxels kept left of each padded row
+  static constexpr int rowPad = 1;
+
+  static MipKernel getKernel(MipFilter filter) {
+    if (filter == MipFilter::Gaussian) {
+      return {-1, 4, {0.125f, 0.375f, 0.375f, 0.125f}};
+    }
+    return {0, 2, {0.5f, 0.5f, 0.f, 0.f}};
+  }
+
+  MipFilter parseMipFilter(const std::string &str) {
+    if (str == "box") {
+      return MipFilter::Box;
+    } else if (str == "gaussian") {
+      return MipFilter::Gaussian;
+    }
+    std::cerr << "Unknown mip filter " << str << std::endl;
+    throw std::runtime_error("parseMipFilter: unknown filter");
+  }
+
+  const char *toString(MipFilter filter) {
+    switch (filter) {
+    case MipFilter::Box:
+      return "box";
+    case MipFilter::Gaussian:
+      return "gaussian";
+    }
+    return "unknown";
+  }
+
+  std::string getMipLevelPath(const std::string &filePath, int level) {
+    if (level == 0) {
+      return filePath;
+    }
+    std::filesystem::path path(filePath);
+    auto name = path.stem().string() + ".L" + std::to_string(level) + path.extension().string();
+    return (path.parent_path() / name).string();
+  }
+
+  std::vector<BrickedVolume> openMipLevels(const std::string &filePath) {
+    std::vector<BrickedVolume> levels;
+    levels.emplace_back(filePath);
+    const std::string base = levels.front().getFilePath();
+    for (int level = 1;; level++) {
+      auto path = getMipLevelPath(base, level);
+      if (!std::filesystem::exists(path)) {
+        break;
+      }
+      BrickedVolume next(path);
+      if (next.getDims() != (levels.back().getDims() + 1) / 2) {
+        std::cerr << "Ignoring " << path << ": not a level of " << base << std::endl;
+        break;
+      }
+      levels.push_back(std::move(next));
+    }
+    return levels;
+  }
+
+  int selectMipLevel(float voxelsPerPixel, int levelCount) {
+    if (levelCount <= 1 || !(voxelsPerPixel > 1.f)) {
+      return 0;
+    }
+    return std::min(static_cast<int>(std::log2(voxelsPerPixel)), levelCount - 1);
+  }
+
+  // Converts a row to float with clamped padding: dst[m] = src[m - rowPad]
+  template <typename T>
+  static void loadRow(const T *src, int size, float *dst, int length) {
+    const int last = std::min(length, size + rowPad);
+    int m = 0;
+    for (; m < rowPad; m++) {
+      dst[m] = static_cast<float>(src[0]);
+    }
+    for (; m < last; m++) {
+      dst[m] = static_cast<float>(src[m - rowPad]);
+    }
+    for (; m < length; m++) {
+      dst[m] = static_cast<float>(src[size - 1]);
+    }
+  }
+
+  // Filters and decimates a padded row along x
+  static void reduceRow(const float *src, float *dst, int count, const MipKernel &kernel) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4) {
+      __m128 sum = _mm_setzero_ps();
+      for (int k = 0; k < kernel.taps; k++) {
+        // Every other element of 8 consecutive inputs
+        const float *p = src + 2 * i + kernel.offset + k + rowPad;
+        __m128 even = _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _MM_SHUFFLE(2, 0, 2, 0));
+        sum = _mm_add_ps(sum, _mm_mul_ps(even, _mm_set1_ps(kernel.weights[k])));
+      }
+      _mm_storeu_ps(dst + i, sum);
+    }
+#endif
+    for (; i < count; i++) {
+      float sum = 0.f;
+      for (int k = 0; k < kernel.taps; k++) {
+        sum += kernel.weights[k] * src[2 * i + kernel.offset + k + rowPad];
+      }
+      dst[i] = sum;
+    }
+  }
+
+  // Weighted sum of kernel.taps rows, used along y and z
+  static void combineRows(const float *const *rows, float *dst, int count, const MipKernel &kernel) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4) {
+      __m128 sum = _mm_setzero_ps();
+      for (int k = 0; k < kernel.taps; k++) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i),
+                                         _mm_set1_ps(kernel.weights[k])));
+      }
+      _mm_storeu_ps(dst + i, sum);
+    }
+#endif
+    for (; i < count; i++) {
+      float sum = 0.f;
+      for (int k = 0; k < kernel.taps; k++) {
+        sum += kernel.weights[k] * rows[k][i];
+      }
+      dst[i] = sum;
+    }
+  }
+
+  template <typename T>
+  static void storeRow(const float *src, T *dst, int count) {
+    for (int i = 0; i < count; i++) {
+      if constexpr (std::is_integral_v<T>) {
+        dst[i] = static_cast<T>(src[i] + 0.5f);
+      } else {
+        dst[i] = src[i];
+      }
+    }
+  }
+
+  // Reduces output slices [first, last); input slices are reduced in x and y
+  // once each and kept in a small ring for the z pass
+  template <typename T>
+  static void reduceSlices(const VolumeView &src,
+                           T *dst,
+                           glm::ivec3 dims,
+                           const MipKernel &kernel,
+                           size_t first,
+                           size_t last) {
+    const glm::ivec3 d = src.dims;
+    const size_t sliceSize = static_cast<size_t>(dims.x) * dims.y;
+    std::vector<float> padded(2 * dims.x + 4);
+    std::vector<float> rows(static_cast<size_t>(dims.x) * d.y);
+    std::vector<float> ring(kernel.taps * sliceSize);
+    std::vector<int> ringSlice(kernel.taps, -1);
+    std::vector<float> row(dims.x);
+    const float *taps[4];
+
+    auto getSlice = [&](int z) -> const float * {
+      auto it = std::find(ringSlice.begin(), ringSlice.end(), z);
+      if (it == ringSlice.end()) {
+        // Inputs are visited in increasing order; the lowest slice is done
+        it = std::min_element(ringSlice.begin(), ringSlice.end());
+        *it = z;
+        float *slice = ring.data() + (it - ringSlice.begin()) * sliceSize;
+        for (int y = 0; y < d.y; y++) {
+          loadRow(src.as<T>() + (static_cast<size_t>(z) * d.y + y) * d.x, d.x,
+                  padded.data(), static_cast<int>(padded.size()));
+          reduceRow(padded.data(), rows.data() + static_cast<size_t>(y) * dims.x, dims.x, kernel);
+        }
+        for (int y = 0; y < dims.y; y++) {
+          for (int k = 0; k < kernel.taps; k++) {
+            taps[k] = rows.data() +
+                      static_cast<size_t>(std::clamp(2 * y + kernel.offset + k, 0, d.y - 1)) * dims.x;
+          }
+          combineRows(taps, slice + static_cast<size_t>(y) * dims.x, dims.x, kernel);
+        }
+      }
+      return ring.data() + (it - ringSlice.begin()) * sliceSize;
+    };
+
+    for (size_t z = first; z < last; z++) {
+      const float *slices[4];
+      for (int k = 0; k < kernel.taps; k++) {
+        slices[k] = getSlice(std::clamp(2 * static_cast<int>(z) + kernel.offset + k, 0, d.z - 1));
+      }
+      for (int y = 0; y < dims.y; y++) {
+        for (int k = 0; k < kernel.taps; k++) {
+          taps[k] = slices[k] + static_cast<size_t>(y) * dims.x;
+        }
+        combineRows(taps, row.data(), dims.x, kernel);
+        storeRow(row.data(), dst + z * sliceSize + static_cast<size_t>(y) * dims.x, dims.x);
+      }
+    }
+  }
+
+  MipBuilder::MipBuilder(ThreadPool &pool, MipFilter filter) : pool(pool), filter(filter) {}
+
+  Volume MipBuilder::downsample(const VolumeView &volume) const {
+    if (volume.isEmpty()) {
+      std::cerr << "Cannot downsample an empty volume" << std::endl;
+      throw std::runtime_error("MipBuilder: empty volume");
+    }
+    const glm::ivec3 dims = (volume.dims + 1) / 2;
+    const glm::vec3 spacing = volume.spacing * glm::vec3(volume.dims) / glm::vec3(dims);
+    Volume result(dims, volume.type, spacing);
+    const MipKernel kernel = getKernel(filter);
+
+    // Contiguous runs of output slices per task, so input slices are shared
+    const size_t grain = std::max<size_t>(1, dims.z / (4 * pool.getThreadCount()));
+    visitVoxelType(volume.type, [&](auto t) {
+      using T = decltype(t);
+      T *dst = reinterpret_cast<T *>(result.getMutableData());
+      pool.parallelFor(0, dims.z, grain, [&](size_t first, size_t last) {
+        reduceSlices<T>(volume, dst, dims, kernel, first, last);
+      });
+    });
+    return result;
+  }
+
+  std::vector<Volume> MipBuilder::build(const VolumeView &volume, int levels, int minSize) const {
+    std::vector<Volume> result;
+    VolumeView current = volume;
+    auto extent = [&]() { return std::max({current.dims.x, current.dims.y, current.dims.z}); };
+    while (extent() > 1 && (levels > 0 ? static_cast<int>(result.size()) + 1 < levels
+                                       : extent() > minSize)) {
+      result.push_back(downsample(current));
+      current = result.back().getView();
+    }
+    return result;
+  }
+} // namespace CUDAVol
@@ -0,0 +1,91 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  morton_volume.cpp
+
+  Morton volume definition.
+
+  November 2019
+*/
+
+#include "morton_volume.h"
+#include "glm/common.hpp"
+
+namespace CUDAVol {
+  MortonVolume::MortonVolume() : layout(glm::ivec3(0)), type(VoxelType::UInt8), spacing(1.f) {}
+
+  MortonVolume::MortonVolume(ThreadPool &pool, const VolumeView &volume)
+    : layout(volume.dims), type(volume.type), spacing(volume.spacing) {
+    storage = MemoryMap(layout.getVoxelCount() * getVoxelSize(type));
+    const glm::ivec3 grid = layout.grid;
+    const size_t brickCount = static_cast<size_t>(grid.x) * grid.y * grid.z;
+
+    visitVoxelType(type, [&](auto t) {
+      using T = decltype(t);
+      const T *src = volume.as<T>();
+      T *dst = reinterpret_cast<T *>(storage.getMutableData());
+      const LinearLayout linear(volume.dims);
+      pool.parallelFor(0, brickCount, 1, [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; b++) {
+          // Reads rows of the source, writes one brick
+          const glm::ivec3 lo = glm::ivec3(b % grid.x, (b / grid.x) % grid.y, b / (size_t(grid.x) * grid.y)) *
+                                MortonLayout::brickSize;
+          const glm::ivec3 hi = glm::min(lo + MortonLayout::brickSize, volume.dims);
+          for (int z = lo.z; z < hi.z; z++) {
+            for (int y = lo.y; y < hi.y; y++) {
+              const size_t row = linear.offsetY(y) + linear.offsetZ(z);
+              const size_t brick = layout.offsetY(y) + layout.offsetZ(z);
+              for (int x = lo.x; x < hi.x; x++) {
+                dst[brick + layout.offsetX(x)] = src[row + x];
+              }
+            }
+          }
+        }
+      });
+    });
+  }
+
+  const std::byte *MortonVolume::getData() const {
+    return storage.getData();
+  }
+
+  const MortonLayout &MortonVolume::getLayout() const {
+    return layout;
+  }
+
+  glm::ivec3 MortonVolume::getDims() const {
+    return layout.dims;
+  }
+
+  VoxelType MortonVolume::getType() const {
+    return type;
+  }
+
+  glm::vec3 MortonVolume::getSpacing() const {
+    return spacing;
+  }
+
+  size_t MortonVolume::getSize() const {
+    return storage.getSize();
+  }
+} // namespace CUDAVol
@@ -0,0 +1,137 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  preintegrated_table.cpp
+
+  Pre-integrated classification class definition.
+
+  November 2019
+*/
+
+#include "preintegrated_table.h"
+#include "glm/vec3.hpp"
+#include <atomic>
+#include <cmath>
+
+namespace CUDAVol {
+  PreintegratedTable::PreintegratedTable() : referenceLength(0.f), length(0.f) {}
+
+  size_t PreintegratedTable::buildRows(ThreadPool &pool, int lo, int hi) {
+    // Extinction per unit length at every table entry, opacity clamped so
+    // that it stays finite, and prefix sums by the trapezoid rule in double
+    // precision over [0, i]
+    constexpr float maxAlpha = 1.f - 1e-6f;
+    std::vector<double> extinction(size, 0.0);
+    std::vector<glm::dvec3> emission(size, glm::dvec3(0.0));
+    for (int i = 0; i < size; i++) {
+      const glm::vec4 c = source[i];
+      const double kappa = -std::log(1.0 - glm::clamp(c.a, 0.f, maxAlpha)) / referenceLength;
+      extinction[i] = kappa;
+      emission[i] = glm::dvec3(glm::clamp(glm::vec3(c), 0.f, 1.f)) * kappa;
+    }
+    std::vector<double> sumExtinction(size, 0.0);
+    std::vector<glm::dvec3> sumEmission(size, glm::dvec3(0.0));
+    for (int i = 1; i < size; i++) {
+      sumExtinction[i] = sumExtinction[i - 1] + 0.5 * (extinction[i - 1] + extinction[i]);
+      sumEmission[i] = sumEmission[i - 1] + 0.5 * (emission[i - 1] + emission[i]);
+    }
+
+    // Entry (i, j) integrates table entries min(i, j) to max(i, j), so only
+    // those whose range overlaps [lo, hi] change
+    std::atomic<size_t> count(0);
+    pool.parallelFor(0, size, 8, [&](size_t first, size_t last) {
+      size_t rowCount = 0;
+      for (size_t row = first; row < last; row++) {
+        const int i = static_cast<int>(row);
+        const int j0 = i < lo ? lo : 0;
+        const int j1 = i > hi ? hi : size - 1;
+        for (int j = j0; j <= j1; j++) {
+          double kappa;
+          glm::dvec3 color;
+          if (i == j) {
+            kappa = extinction[i];
+            color = emission[i];
+          } else {
+            const double span = std::abs(j - i);
+            kappa = std::abs(sumExtinction[j] - sumExtinction[i]) / span;
+            color = glm::abs(sumEmission[j] - sumEmission[i]) / span;
+          }
+
+          // Mean color weighted by extinction, times the segment opacity
+          const double alpha = 1.0 - std::exp(-kappa * length);
+          color = kappa > 0.0 ? color / kappa * alpha : glm::dvec3(0.0);
+          const size_t e = row * size + j;
+          channels[0][e] = static_cast<float>(color.x);
+          channels[1][e] = static_cast<float>(color.y);
+          channels[2][e] = static_cast<float>(color.z);
+          channels[3][e] = static_cast<float>(alpha);
+        }
+        rowCount += static_cast<size_t>(j1 - j0 + 1);
+      }
+      count.fetch_add(rowCount, std::memory_order_relaxed);
+    });
+    return count.load();
+  }
+
+  size_t PreintegratedTable::update(ThreadPool &pool,
+                                    const TransferFunction &transferFunction,
+                                    float referenceLength,
+                                    float length) {
+    const std::vector<glm::vec4> &table = transferFunction.getTable();
+    if (isEmpty() || referenceLength != this->referenceLength || length != this->length) {
+      source = table;
+      this->referenceLength = referenceLength;
+      this->length = length;
+      for (auto &channel : channels) {
+        channel.assign(static_cast<size_t>(size) * size, 0.f);
+      }
+      return buildRows(pool, 0, size - 1);
+    }
+
+    // Changed part of the transfer function table
+    int lo = 0, hi = size - 1;
+    while (lo < size && table[lo] == source[lo]) {
+      lo++;
+    }
+    if (lo == size) {
+      return 0;
+    }
+    while (table[hi] == source[hi]) {
+      hi--;
+    }
+    source = table;
+    return buildRows(pool, lo, hi);
+  }
+
+  bool PreintegratedTable::isEmpty() const {
+    return channels[0].empty();
+  }
+
+  const float *PreintegratedTable::getChannel(int c) const {
+    return channels[c].data();
+  }
+
+  size_t PreintegratedTable::getMemorySize() const {
+    return 4 * channels[0].size() * sizeof(float);
+  }
+} // namespace CUDAVol
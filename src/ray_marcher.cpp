@@ -0,0 +1,1236 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_marcher.cpp
+
+  Ray marcher definition.
+
+  November 2019
+*/
+
+#include "ray_marcher.h"
+#include "brick_sampler.h"
+#include "dense_sampler.h"
+#include "path_tracing.h"
+#include "sparse_sampler.h"
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/vec4.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+namespace CUDAVol {
+  static uint32_t packColor(glm::vec3 rgb) {
+    const glm::uvec3 c(glm::clamp(rgb, 0.f, 1.f) * 255.f + 0.5f);
+    return c.r | c.g << 8 | c.b << 16 | 0xff000000u;
+  }
+
+  double RenderStats::getSamplesPerRay() const {
+    return rays ? static_cast<double>(samples) / static_cast<double>(rays) : 0.0;
+  }
+
+  glm::vec2 computeValueRange(ThreadPool &pool, const VolumeView &volume) {
+    if (volume.isEmpty()) {
+      return glm::vec2(0.f, 1.f);
+    }
+    return visitVoxelType(volume.type, [&](auto t) {
+      using T = decltype(t);
+      const T *data = volume.as<T>();
+      std::mutex mutex;
+      glm::vec2 range(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+      pool.parallelFor(0, volume.getVoxelCount(), size_t(1) << 22, [&](size_t first, size_t last) {
+        auto [lo, hi] = std::minmax_element(data + first, data + last);
+        std::lock_guard<std::mutex> lock(mutex);
+        range = glm::vec2(std::min(range.x, static_cast<float>(*lo)),
+                          std::max(range.y, static_cast<float>(*hi)));
+      });
+      return range;
+    });
+  }
+
+  RayMarcher::RayMarcher(ThreadPool &pool)
+    : pool(pool),
+      brickCache(nullptr),
+      sparseVolume(nullptr),
+      mortonVolume(nullptr),
+      dims(0),
+      type(VoxelType::UInt8),
+      extent(0.f),
+      referenceLength(1.f),
+      valueRange(0.f, 1.f),
+      imageDims(0),
+      imageAspect(1.f),
+      stepScale(1.f),
+      cancel(nullptr),
+      peripheryDims(0),
+      pathPasses(0),
+      pathView(0.f),
+      pathsValid(false),
+      historyDims(0),
+      historyValid(false),
+      historyFrame(0),
+      tileOrderTiles(0),
+      tileOrderHilbert(false) {}
+
+  void RayMarcher::setGeometry(glm::ivec3 dims, VoxelType type, glm::vec3 spacing, float referenceLength) {
+    this->dims = dims;
+    this->type = type;
+    this->extent = glm::vec3(dims) * spacing;
+    this->referenceLength = referenceLength > 0.f ? referenceLength
+                                                  : std::min({spacing.x, spacing.y, spacing.z});
+  }
+
+  void RayMarcher::setVolume(const VolumeView &volume, glm::vec2 valueRange, float referenceLength) {
+    clearVolume();
+    denseVolume = volume;
+    this->valueRange = valueRange;
+    setGeometry(volume.dims, volume.type, volume.spacing, referenceLength);
+  }
+
+  void RayMarcher::setVolume(BrickCache &cache, glm::vec2 valueRange, float referenceLength) {
+    clearVolume();
+    brickCache = &cache;
+    this->valueRange = valueRange;
+    const BrickedVolume &volume = cache.getVolume();
+    setGeometry(volume.getDims(), volume.getType(), volume.getSpacing(), referenceLength);
+  }
+
+  void RayMarcher::setVolume(const SparseVolume &volume, glm::vec2 valueRange, float referenceLength) {
+    clearVolume();
+    sparseVolume = &volume;
+    this->valueRange = valueRange;
+    setGeometry(volume.getDims(), volume.getType(), volume.getSpacing(), referenceLength);
+  }
+
+  void RayMarcher::setVolume(const MortonVolume &volume, glm::vec2 valueRange, float referenceLength) {
+    clearVolume();
+    mortonVolume = &volume;
+    this->valueRange = valueRange;
+    setGeometry(volume.getDims(), volume.getType(), volume.getSpacing(), referenceLength);
+  }
+
+  void RayMarcher::clearVolume() {
+    denseVolume = VolumeView();
+    brickCache = nullptr;
+    sparseVolume = nullptr;
+    mortonVolume = nullptr;
+    macrocells = MacrocellGrid();
+    gradients = GradientVolume();
+    light = LightVolume();
+    pathsValid = false;
+    historyValid = false;
+    dims = glm::ivec3(0);
+  }
+
+  bool RayMarcher::hasVolume() const {
+    return !denseVolume.isEmpty() || brickCache || sparseVolume || mortonVolume;
+  }
+
+  void RayMarcher::setTransferFunction(const TransferFunction &transferFunction) {
+    this->transferFunction = transferFunction;
+    pathsValid = false;
+    historyValid = false;
+    if (!macrocells.isEmpty()) {
+      macrocells.classify(transferFunction, valueRange);
+    }
+  }
+
+  void RayMarcher::setSettings(const RenderSettings &settings) {
+    this->settings = settings;
+    pathsValid = false;
+    historyValid = false;
+  }
+
+  float RayMarcher::getStepLength() const {
+    return stepScale * settings.stepSize * std::min({extent.x / dims.x, extent.y / dims.y, extent.z / dims.z});
+  }
+
+  int RayMarcher::getStepScaleLevel() const {
+    // Step scales are powers of two up to 2^maxCoarseLevel
+    return glm::clamp(std::ilogb(stepScale), 0, maxCoarseLevel);
+  }
+
+  int RayMarcher::getMaxStepLevel() const {
+    // Pre-integrated segments all have the base length
+    return settings.preintegrate ? 0 : glm::clamp(settings.maxStepLevel, 0, maxStepLevels - 1);
+  }
+
+  std::vector<glm::vec4> RayMarcher::getClassification(float dt) const {
+    // Opacity corrected for the step length, color premultiplied; one table
+    // per step level
+    const int size = TransferFunction::tableSize;
+    std::vector<glm::vec4> table(static_cast<size_t>(getMaxStepLevel() + 1) * size);
+    for (int level = 0; level <= getMaxStepLevel(); level++) {
+      const float exponent = dt * static_cast<float>(1 << level) / referenceLength;
+      for (int i = 0; i < size; i++) {
+        const glm::vec4 c = transferFunction.getTable()[i];
+        const float a = 1.f - std::pow(1.f - glm::clamp(c.a, 0.f, 1.f), exponent);
+        table[level * size + i] = glm::vec4(glm::vec3(c) * a, a);
+      }
+    }
+    return table;
+  }
+
+  float RayMarcher::getMaxSpread() const {
+    // Negative when no macrocell may take larger steps
+    return getMaxStepLevel() > 0 ? settings.stepVariation * (valueRange.y - valueRange.x) : -1.f;
+  }
+
+  glm::ivec2 RayMarcher::getTileCount() const {
+    const int tileSize = std::max(settings.tileSize, 1);
+    return (imageDims + tileSize - 1) / tileSize;
+  }
+
+  void RayMarcher::updateTileOrder() {
+    const glm::ivec2 tiles = getTileCount();
+    const size_t count = static_cast<size_t>(tiles.x) * tiles.y;
+    if (tiles == tileOrderTiles && settings.hilbertTiles == tileOrderHilbert && tileOrder.size() == count) {
+      return;
+    }
+    tileOrder.clear();
+    tileOrderTiles = tiles;
+    tileOrderHilbert = settings.hilbertTiles;
+    if (!settings.hilbertTiles) {
+      for (uint32_t i = 0; i < count; i++) {
+        tileOrder.push_back(i);
+      }
+      return;
+    }
+
+    // Hilbert curve over the enclosing power of two square, skipping tiles
+    // outside the image; consecutive tiles stay neighbours, so each thread's
+    // share of the sequence is a compact region
+    int side = 1;
+    while (side < std::max(tiles.x, tiles.y)) {
+      side *= 2;
+    }
+    for (size_t d = 0; d < static_cast<size_t>(side) * side; d++) {
+      int x = 0, y = 0;
+      size_t rest = d;
+      for (int s = 1; s < side; s *= 2) {
+        const int rx = 1 & static_cast<int>(rest / 2);
+        const int ry = 1 & static_cast<int>(rest ^ static_cast<size_t>(rx));
+        if (ry == 0) {
+          if (rx == 1) {
+            x = s - 1 - x;
+            y = s - 1 - y;
+          }
+          std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        rest /= 4;
+      }
+      if (x < tiles.x && y < tiles.y) {
+        tileOrder.push_back(static_cast<uint32_t>(x + tiles.x * y));
+      }
+    }
+  }
+
+  bool RayMarcher::isCancelled() const {
+    return cancel && cancel->load(std::memory_order_relaxed);
+  }
+
+  void RayMarcher::expandCoarseImage(glm::ivec2 dims, int level) {
+    // Every coarse pixel fills its square of the full image
+    std::swap(image, coarseImage);
+    image.resize(static_cast<size_t>(dims.x) * dims.y);
+    pool.parallelFor(0, static_cast<size_t>(dims.y), 16, [&](size_t first, size_t last) {
+      for (size_t y = first; y < last; y++) {
+        const uint32_t *src = &coarseImage[(y >> level) * imageDims.x];
+        uint32_t *dst = &image[y * dims.x];
+        for (int x = 0; x < dims.x; x++) {
+          dst[x] = src[x >> level];
+        }
+      }
+    });
+    imageDims = dims;
+  }
+
+  void RayMarcher::getTileBounds(size_t i, glm::ivec2 &lo, glm::ivec2 &hi) const {
+    const int tileSize = std::max(settings.tileSize, 1);
+    const int tilesX = getTileCount().x;
+    const size_t tile = tileOrder[i];
+    lo = glm::ivec2(tile % tilesX, tile / tilesX) * tileSize;
+    hi = glm::min(lo + tileSize, imageDims);
+  }
+
+  template <typename MakeSampler, typename ForEachSpan>
+  void RayMarcher::renderTiles(const Camera &camera, MakeSampler &&makeSampler, ForEachSpan &&forEachSpan) {
+    // Rays are traced in world space, the volume box centered on the origin,
+    // and sampled in voxel space, voxel centers at integers
+    const glm::vec3 boxMax = 0.5f * extent;
+    const glm::vec3 toVoxel = glm::vec3(dims) / extent;
+    const glm::vec3 voxelOffset = 0.5f * glm::vec3(dims) - 0.5f;
+    const float dt = getStepLength();
+    const float aspect = imageAspect;
+
+    const std::vector<glm::vec4> table = getClassification(dt);
+    const PreintegratedTable &segments = preintegrated[getStepScaleLevel()];
+    const float valueScale = (TransferFunction::tableSize - 1) / std::max(valueRange.y - valueRange.x, 1e-20f);
+    auto toTable = [&](float v) {
+      return glm::clamp((v - valueRange.x) * valueScale, 0.f, float(TransferFunction::tableSize - 1));
+    };
+    auto classify = [&](float x, int level) {
+      const int i = std::min(static_cast<int>(x), TransferFunction::tableSize - 2);
+      const glm::vec4 *entries = &table[static_cast<size_t>(level) * TransferFunction::tableSize];
+      return glm::mix(entries[i], entries[i + 1], x - static_cast<float>(i));
+    };
+
+    // Two sided headlight, so the half vector is the view direction too, or
+    // the shadowed directional light. Flat regions, without a gradient
+    // direction, stay unshaded.
+    const glm::vec3 spacing = extent / glm::vec3(dims);
+    const bool useGradientVolume = !gradients.isEmpty();
+    const bool filterGradients = settings.filterGradients;
+    const bool shadowed = settings.shadows && light.isSwept();
+    const glm::vec3 toLight = glm::normalize(settings.lightDirection);
+    auto shade = [&](auto &sampler, glm::vec3 p, glm::vec3 dir, glm::vec4 c) {
+      glm::vec3 g;
+      if (useGradientVolume) {
+        g = filterGradients ? gradients.sample(p) : gradients.sampleNearest(p);
+      } else {
+        for (int i = 0; i < 3; i++) {
+          glm::vec3 h(0.f);
+          h[i] = 1.f;
+          g[i] = (sampler.sample(p + h) - sampler.sample(p - h)) / (2.f * spacing[i]);
+        }
+      }
+      const float length = glm::length(g);
+      if (length <= 0.f) {
+        return c;
+      }
+      if (shadowed) {
+        const float transmittance = light.sample(p);
+        const float d = std::abs(glm::dot(g, toLight)) / length;
+        const float h = std::abs(glm::dot(g, glm::normalize(toLight - dir))) / length;
+        const float lit = settings.ambient + (1.f - settings.ambient) * d * transmittance;
+        return glm::vec4(glm::vec3(c) * lit + settings.specular * std::pow(h, settings.shininess) * transmittance * c.a,
+                         c.a);
+      }
+      const float d = std::abs(glm::dot(g, dir)) / length;
+      const float lit = settings.ambient + (1.f - settings.ambient) * d;
+      return glm::vec4(glm::vec3(c) * lit + settings.specular * std::pow(d, settings.shininess) * c.a, c.a);
+    };
+
+    // Step level from the distance to the camera: the pixel footprint grows
+    // with it, so the step may double with every doubling of distance
+    const int maxLevel = getMaxStepLevel();
+    const int distanceLevels = settings.stepDistance > 0.f ? maxLevel : 0;
+    auto getDistanceLevel = [&](float t) {
+      int level = 0;
+      while (level < distanceLevels && t >= settings.stepDistance * static_cast<float>(2 << level)) {
+        level++;
+      }
+      return level;
+    };
+
+    const glm::ivec2 tiles = getTileCount();
+    std::atomic<size_t> samples(0), rays(0), cellSteps(0);
+    const ParallelStats schedule = pool.parallelFor(0, tileOrder.size(), 1, [&](size_t first, size_t last) {
+      auto sampler = makeSampler();
+      size_t tileSamples = 0, tileRays = 0, tileCellSteps = 0;
+      for (size_t tile = first; tile < last && !isCancelled(); tile++) {
+        glm::ivec2 lo, hi;
+        getTileBounds(tile, lo, hi);
+        for (int y = lo.y; y < hi.y; y++) {
+          for (int x = lo.x; x < hi.x; x++) {
+            const size_t index = static_cast<size_t>(y) * imageDims.x + x;
+            if (!traceMask.empty() && !traceMask[index]) {
+              continue;
+            }
+            const glm::vec2 ndc = (glm::vec2(x, y) + 0.5f) / glm::vec2(imageDims) * 2.f - 1.f;
+            glm::vec3 origin, dir;
+            camera.getRay(ndc, aspect, origin, dir);
+
+            // Slab test against the volume box
+            const glm::vec3 inv = 1.f / dir;
+            const glm::vec3 t0 = (-boxMax - origin) * inv, t1 = (boxMax - origin) * inv;
+            const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+            const float tEnter = std::max({tNear.x, tNear.y, tNear.z, 0.f});
+            const float tExit = std::min({tFar.x, tFar.y, tFar.z});
+
+            // Samples sit at tEnter + k * dt whichever spans are marched, so
+            // skipping leaves the image unchanged. Steps of 2^level * dt stay
+            // on that lattice and within their span.
+            glm::vec4 color(0.f);
+            float depthSum = 0.f;
+            if (tEnter < tExit) {
+              const glm::vec3 voxelOrigin = origin * toVoxel + voxelOffset;
+              const glm::vec3 voxelDir = dir * toVoxel;
+              tileRays++;
+              float next = 0.f, front = -1.f;
+              tileCellSteps += forEachSpan(voxelOrigin, voxelDir, tEnter, tExit,
+                                           [&](float s0, float s1, bool homogeneous) {
+                // Spans of differing homogeneity share their boundary. Segments
+                // start at the previous sample, or at the first one after a skip.
+                float k = std::max(std::ceil((s0 - tEnter) / dt), next);
+                if (k > next) {
+                  front = -1.f;
+                }
+                while (color.a < settings.opacityThreshold) {
+                  const float t = tEnter + k * dt;
+                  if (t > s1) {
+                    break;
+                  }
+                  int level = homogeneous ? maxLevel : getDistanceLevel(t);
+                  while (level > 0 && t + static_cast<float>(1 << level) * dt > s1) {
+                    level--;
+                  }
+                  const glm::vec3 p = voxelOrigin + t * voxelDir;
+                  const float back = toTable(sampler.sample(p));
+                  glm::vec4 c = settings.preintegrate ? segments.lookup(front < 0.f ? back : front, back)
+                                                      : classify(back, level);
+                  front = back;
+                  if (settings.shading && c.a > 0.f) {
+                    c = shade(sampler, p, dir, c);
+                  }
+                  depthSum += (1.f - color.a) * c.a * t;
+                  color += (1.f - color.a) * c;
+                  tileSamples++;
+                  k += static_cast<float>(1 << level);
+                }
+                next = k;
+              });
+            }
+
+            image[index] = packColor(glm::vec3(color) + (1.f - color.a) * settings.background);
+            if (!depth.empty()) {
+              depth[index] = color.a > 1e-3f ? depthSum / color.a : tEnter < tExit ? 0.5f * (tEnter + tExit) : -1.f;
+            }
+          }
+        }
+      }
+      sampler.release();
+      samples.fetch_add(tileSamples, std::memory_order_relaxed);
+      rays.fetch_add(tileRays, std::memory_order_relaxed);
+      cellSteps.fetch_add(tileCellSteps, std::memory_order_relaxed);
+    });
+    stats.samples = samples.load();
+    stats.rays = rays.load();
+    stats.cellSteps = cellSteps.load();
+    stats.tiles = static_cast<size_t>(tiles.x) * tiles.y;
+    stats.utilization = schedule.getUtilization();
+    stats.steals = schedule.steals;
+  }
+
+  template <typename MakeSampler, typename ForEachMajorant>
+  void RayMarcher::tracePaths(const Camera &camera, MakeSampler &&makeSampler, ForEachMajorant &&forEachMajorant) {
+    // Paths are traced in world space and sampled in voxel space, as rays are
+    // marched; distances along them are world units
+    const glm::vec3 boxMax = 0.5f * extent;
+    const glm::vec3 toVoxel = glm::vec3(dims) / extent;
+    const glm::vec3 voxelOffset = 0.5f * glm::vec3(dims) - 0.5f;
+    const float aspect = imageAspect;
+    auto clipBox = [&](glm::vec3 origin, glm::vec3 dir, float &tEnter, float &tExit) {
+      const glm::vec3 inv = 1.f / dir;
+      const glm::vec3 t0 = (-boxMax - origin) * inv, t1 = (boxMax - origin) * inv;
+      const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+      tEnter = std::max({tNear.x, tNear.y, tNear.z, 0.f});
+      tExit = std::min({tFar.x, tFar.y, tFar.z});
+      return tEnter < tExit;
+    };
+
+    // Albedo and extinction per unit length per table entry, opacity
+    // clamped so that extinction stays finite
+    constexpr float maxAlpha = 1.f - 1e-6f;
+    const int size = TransferFunction::tableSize;
+    std::vector<glm::vec4> medium(size);
+    for (int i = 0; i < size; i++) {
+      const glm::vec4 c = transferFunction.getTable()[i];
+      medium[i] = glm::vec4(glm::clamp(glm::vec3(c), 0.f, 1.f),
+                            -std::log(1.f - glm::clamp(c.a, 0.f, maxAlpha)) / referenceLength);
+    }
+    const float valueScale = (size - 1) / std::max(valueRange.y - valueRange.x, 1e-20f);
+    auto getMedium = [&](float v) {
+      const float x = glm::clamp((v - valueRange.x) * valueScale, 0.f, float(size - 1));
+      const int i = std::min(static_cast<int>(x), size - 2);
+      return glm::mix(medium[i], medium[i + 1], x - static_cast<float>(i));
+    };
+
+    // Delta tracking: tentative collisions at the majorant's rate, each a
+    // real one with probability extinction / majorant. Returns the distance
+    // to the first real collision, or -1 when the ray leaves before one.
+    auto track = [&](auto &sampler, PathRandom &random, size_t &samples, glm::vec3 origin, glm::vec3 dir, float tMax,
+                     glm::vec4 &hit) {
+      const glm::vec3 voxelOrigin = origin * toVoxel + voxelOffset, voxelDir = dir * toVoxel;
+      float collision = -1.f;
+      forEachMajorant(voxelOrigin, voxelDir, 0.f, tMax, [&](float t0, float t1, float majorant) {
+        for (float t = t0;;) {
+          t -= std::log(1.f - random.uniform()) / majorant;
+          if (t >= t1) {
+            return true;
+          }
+          const glm::vec4 m = getMedium(sampler.sample(voxelOrigin + t * voxelDir));
+          samples++;
+          if (random.uniform() * majorant < m.a) {
+            collision = t;
+            hit = m;
+            return false;
+          }
+        }
+      });
+      return collision;
+    };
+
+    // Ratio tracking: transmittance as the product of the null collision
+    // probabilities at the tentative collisions, ended by Russian roulette
+    // once it falls below 0.1
+    auto transmit = [&](auto &sampler, PathRandom &random, size_t &samples, glm::vec3 origin, glm::vec3 dir,
+                        float tMax) {
+      const glm::vec3 voxelOrigin = origin * toVoxel + voxelOffset, voxelDir = dir * toVoxel;
+      float transmittance = 1.f;
+      forEachMajorant(voxelOrigin, voxelDir, 0.f, tMax, [&](float t0, float t1, float majorant) {
+        for (float t = t0;;) {
+          t -= std::log(1.f - random.uniform()) / majorant;
+          if (t >= t1) {
+            return true;
+          }
+          const float kappa = getMedium(sampler.sample(voxelOrigin + t * voxelDir)).a;
+          samples++;
+          transmittance *= std::max(1.f - kappa / majorant, 0.f);
+          if (transmittance < 0.1f) {
+            if (random.uniform() < 0.5f) {
+              transmittance = 0.f;
+              return false;
+            }
+            transmittance *= 2.f;
+          }
+        }
+      });
+      return transmittance;
+    };
+
+    // Every pixel has its own random stream and every pass its own seed, so
+    // the image is the same whichever thread traces which tile
+    const glm::vec3 toLight = glm::normalize(settings.lightDirection);
+    const float g = glm::clamp(settings.anisotropy, -0.99f, 0.99f);
+    const uint64_t seed = (static_cast<uint64_t>(pathPasses) + 1) * 0x9e3779b97f4a7c15ull;
+    const float passes = static_cast<float>(pathPasses + 1);
+    const glm::ivec2 tiles = getTileCount();
+    std::atomic<size_t> samples(0), rays(0);
+    const ParallelStats schedule = pool.parallelFor(0, tileOrder.size(), 1, [&](size_t first, size_t last) {
+      auto sampler = makeSampler();
+      size_t tileSamples = 0, tileRays = 0;
+      for (size_t tile = first; tile < last && !isCancelled(); tile++) {
+        glm::ivec2 lo, hi;
+        getTileBounds(tile, lo, hi);
+        for (int y = lo.y; y < hi.y; y++) {
+          for (int x = lo.x; x < hi.x; x++) {
+            const size_t index = static_cast<size_t>(y) * imageDims.x + x;
+            PathRandom random(index, seed);
+            const glm::vec2 jitter(random.uniform(), random.uniform());
+            const glm::vec2 ndc = (glm::vec2(x, y) + jitter) / glm::vec2(imageDims) * 2.f - 1.f;
+            glm::vec3 origin, dir;
+            camera.getRay(ndc, aspect, origin, dir);
+
+            // Scatter until the path leaves the volume, with next event
+            // estimation of the light at every collision
+            glm::vec3 radiance(0.f), throughput(1.f);
+            for (int bounce = 0;; bounce++) {
+              float tEnter, tExit;
+              glm::vec4 hit;
+              tileRays++;
+              const float t = clipBox(origin, dir, tEnter, tExit)
+                                  ? track(sampler, random, tileSamples, origin + tEnter * dir, dir, tExit - tEnter, hit)
+                                  : -1.f;
+              if (t < 0.f) {
+                radiance += throughput * (bounce == 0 ? settings.background : settings.environment);
+                break;
+              }
+              origin += (tEnter + t) * dir;
+              throughput *= glm::vec3(hit);
+              if (clipBox(origin, toLight, tEnter, tExit)) {
+                tileRays++;
+                radiance += throughput * settings.lightIntensity * evalHenyeyGreenstein(glm::dot(dir, toLight), g) *
+                            transmit(sampler, random, tileSamples, origin, toLight, tExit);
+              }
+              if (bounce + 1 >= settings.maxBounces) {
+                break;
+              }
+
+              // Russian roulette on the throughput after the first bounces
+              if (bounce >= 2) {
+                const float survival = std::min(std::max({throughput.r, throughput.g, throughput.b}), 0.95f);
+                if (random.uniform() >= survival) {
+                  break;
+                }
+                throughput /= survival;
+              }
+              const float u1 = random.uniform();
+              dir = sampleHenyeyGreenstein(dir, g, u1, random.uniform());
+            }
+            accumulation[index] += radiance;
+            image[index] = packColor(accumulation[index] / passes);
+          }
+        }
+      }
+      sampler.release();
+      samples.fetch_add(tileSamples, std::memory_order_relaxed);
+      rays.fetch_add(tileRays, std::memory_order_relaxed);
+    });
+    stats.samples = samples.load();
+    stats.rays = rays.load();
+    stats.tiles = static_cast<size_t>(tiles.x) * tiles.y;
+    stats.utilization = schedule.getUtilization();
+    stats.steals = schedule.steals;
+  }
+
+  void RayMarcher::renderPaths(const Camera &camera) {
+    // Passes accumulate while nothing the image depends on changes
+    const glm::mat4 view = camera.getProjectionMatrix(imageAspect, 1.f, 2.f) * camera.getViewMatrix();
+    if (!pathsValid || view != pathView || accumulation.size() != image.size()) {
+      accumulation.assign(image.size(), glm::vec3(0.f));
+      pathPasses = 0;
+      pathView = view;
+      pathsValid = true;
+      if (!macrocells.isEmpty()) {
+        macrocells.buildMajorants(transferFunction, valueRange, referenceLength);
+      }
+    }
+    stats.pathPasses = pathPasses;
+    if (pathPasses >= settings.maxPathPasses) {
+      return;
+    }
+
+    // Per macrocell majorants for dense, Morton and bricked volumes; one for
+    // the whole transfer function within the occupied spans of sparse ones,
+    // or over the whole box without macrocells
+    float globalMajorant = 0.f;
+    for (const glm::vec4 &c : transferFunction.getTable()) {
+      globalMajorant = std::max(globalMajorant, -std::log(1.f - glm::clamp(c.a, 0.f, 1.f - 1e-6f)) / referenceLength);
+    }
+    const MacrocellGrid *cells = settings.skipEmptySpace && macrocells.hasMajorants() ? &macrocells : nullptr;
+    auto boxMajorants = [cells, globalMajorant](glm::vec3 origin, glm::vec3 dir, float t0, float t1, auto &&f) {
+      if (cells) {
+        cells->forEachMajorant(origin, dir, t0, t1, f);
+      } else if (globalMajorant > 0.f) {
+        f(t0, t1, globalMajorant);
+      }
+    };
+    visitVoxelType(type, [&](auto t) {
+      using T = decltype(t);
+      if (sparseVolume) {
+        tracePaths(camera, [&] {
+          return SparseSampler<T>(*sparseVolume);
+        }, [&](glm::vec3 origin, glm::vec3 dir, float t0, float t1, auto &&f) {
+          bool more = globalMajorant > 0.f;
+          sparseVolume->forEachSpan(origin, dir, t0, t1, [&](float s0, float s1) {
+            more = more && f(s0, s1, globalMajorant);
+          });
+        });
+      } else if (brickCache) {
+        tracePaths(camera, [&] {
+          return BrickSampler<T>(*brickCache);
+        }, boxMajorants);
+      } else if (mortonVolume) {
+        tracePaths(camera, [&] {
+          return DenseSampler<T, MortonLayout>(reinterpret_cast<const T *>(mortonVolume->getData()),
+                                               mortonVolume->getLayout());
+        }, boxMajorants);
+      } else {
+        tracePaths(camera, [&] {
+          return DenseSampler<T>(denseVolume);
+        }, boxMajorants);
+      }
+    });
+
+    // A cancelled pass left some pixels without a path; start over next time
+    if (isCancelled()) {
+      pathsValid = false;
+    } else {
+      pathPasses++;
+    }
+    stats.pathPasses = pathPasses;
+  }
+
+  void RayMarcher::updateMacrocells() {
+    // Sparse volumes skip through their own tree
+    if (!settings.skipEmptySpace || !hasVolume() || sparseVolume) {
+      return;
+    }
+    if (macrocells.isEmpty()) {
+      if (brickCache) {
+        macrocells = MacrocellGrid(brickCache->getVolume());
+      } else if (mortonVolume) {
+        macrocells = MacrocellGrid(pool, *mortonVolume);
+      } else {
+        macrocells = MacrocellGrid(pool, denseVolume);
+      }
+      macrocells.classify(transferFunction, valueRange);
+    }
+
+    // Transfer function edits clear the distances
+    if (settings.leapEmptySpace && !macrocells.hasDistances()) {
+      macrocells.buildDistances(pool);
+    }
+  }
+
+  void RayMarcher::updateGradients() {
+    // Dropped when the budget no longer admits them, kept while shading is
+    // merely off
+    if (!settings.precomputeGradients || (denseVolume.isEmpty() && !mortonVolume) ||
+        GradientVolume::getMemorySize(dims) > settings.gradientBudget) {
+      gradients = GradientVolume();
+      return;
+    }
+    if (settings.shading && gradients.isEmpty()) {
+      gradients = mortonVolume ? GradientVolume(pool, *mortonVolume) : GradientVolume(pool, denseVolume);
+    }
+  }
+
+  void RayMarcher::updateLight() {
+    // Kept while shadows are merely off; resampled for another scale
+    if (!settings.shading || !settings.shadows || !hasVolume()) {
+      return;
+    }
+    int scale = 1;
+    while (scale < settings.lightScale && scale < 64) {
+      scale *= 2;
+    }
+    if (light.isEmpty() || light.getScale() != scale) {
+      const float valueScale = (TransferFunction::tableSize - 1) / std::max(valueRange.y - valueRange.x, 1e-20f);
+      auto toTable = [&](float v) {
+        return glm::clamp((v - valueRange.x) * valueScale, 0.f, float(TransferFunction::tableSize - 1));
+      };
+      const glm::vec3 spacing = extent / glm::vec3(dims);
+      visitVoxelType(type, [&](auto t) {
+        using T = decltype(t);
+        if (sparseVolume) {
+          light = LightVolume(pool, dims, spacing, scale, [&] { return SparseSampler<T>(*sparseVolume); }, toTable);
+        } else if (brickCache) {
+          light = LightVolume(pool, dims, spacing, scale, [&] { return BrickSampler<T>(*brickCache); }, toTable);
+        } else if (mortonVolume) {
+          light = LightVolume(pool, dims, spacing, scale, [&] {
+            return DenseSampler<T, MortonLayout>(reinterpret_cast<const T *>(mortonVolume->getData()),
+                                                 mortonVolume->getLayout());
+          }, toTable);
+        } else {
+          light = LightVolume(pool, dims, spacing, scale, [&] { return DenseSampler<T>(denseVolume); }, toTable);
+        }
+      });
+    }
+    stats.lightSlices = light.update(pool, transferFunction, referenceLength, settings.lightDirection);
+  }
+
+  bool RayMarcher::canUsePackets() const {
+    // Gathers address voxels with 32 bit indices, pairs along x need dims >= 2
+    return settings.isa != SimdIsa::Scalar && !settings.shading && !denseVolume.isEmpty() &&
+           std::min({dims.x, dims.y, dims.z}) >= 2 && denseVolume.getVoxelCount() <= INT32_MAX;
+  }
+
+  void RayMarcher::renderPackets(const Camera &camera) {
+    const float dt = getStepLength();
+    const float aspect = imageAspect;
+    const std::vector<glm::vec4> table = getClassification(dt);
+    std::vector<float> channels[4];
+    for (int c = 0; c < 4; c++) {
+      for (const auto &entry : table) {
+        channels[c].push_back(entry[c]);
+      }
+    }
+    const MacrocellGrid *cells = settings.skipEmptySpace && !macrocells.isEmpty() ? &macrocells : nullptr;
+
+    PacketFrame frame;
+    frame.data = denseVolume.data;
+    frame.voxelType = static_cast<int>(denseVolume.type);
+    frame.fixedPoint = settings.fixedPoint ? 1 : 0;
+    frame.maxPairOffset = static_cast<int>(std::min<size_t>(denseVolume.getSize() - 4, INT32_MAX));
+    glm::vec3 forward, right, up;
+    camera.getBasis(aspect, forward, right, up);
+    const glm::vec3 eye = camera.getPosition();
+    for (int c = 0; c < 3; c++) {
+      frame.dims[c] = dims[c];
+      frame.boxMax[c] = 0.5f * extent[c];
+      frame.toVoxel[c] = dims[c] / extent[c];
+      frame.voxelOffset[c] = 0.5f * dims[c] - 0.5f;
+      frame.eye[c] = eye[c];
+      frame.forward[c] = forward[c];
+      frame.right[c] = right[c];
+      frame.up[c] = up[c];
+      frame.background[c] = settings.background[c];
+    }
+    frame.dt = dt;
+    frame.valueScale = (TransferFunction::tableSize - 1) / std::max(valueRange.y - valueRange.x, 1e-20f);
+    frame.valueOffset = -valueRange.x * frame.valueScale;
+    for (int c = 0; c < 4; c++) {
+      frame.table[c] = channels[c].data();
+    }
+    frame.tableSize = TransferFunction::tableSize;
+    for (int c = 0; c < 4; c++) {
+      frame.segmentTable[c] = settings.preintegrate ? preintegrated[getStepScaleLevel()].getChannel(c) : nullptr;
+    }
+    frame.opacityThreshold = settings.opacityThreshold;
+    frame.maxStepLevel = getMaxStepLevel();
+    frame.stepDistance = settings.stepDistance;
+    frame.occupancy = cells ? cells->getOccupancy() : nullptr;
+    frame.distances = cells && settings.leapEmptySpace ? cells->getDistances() : nullptr;
+    frame.ranges = cells ? reinterpret_cast<const float *>(cells->getRanges()) : nullptr;
+    frame.maxSpread = getMaxSpread();
+    frame.cellSize = static_cast<float>(macrocells.getCellSize());
+    for (int c = 0; c < 3; c++) {
+      frame.cellGrid[c] = macrocells.getGrid()[c];
+    }
+    frame.imageDims[0] = imageDims.x;
+    frame.imageDims[1] = imageDims.y;
+    frame.image = image.data();
+    frame.traceMask = traceMask.empty() ? nullptr : traceMask.data();
+    frame.depth = depth.empty() ? nullptr : depth.data();
+
+    const glm::ivec2 tiles = getTileCount();
+    std::atomic<size_t> samples(0), rays(0), cellSteps(0);
+    const ParallelStats schedule = pool.parallelFor(0, tileOrder.size(), 1, [&](size_t first, size_t last) {
+      PacketCounts tileCounts = {0, 0, 0};
+      for (size_t tile = first; tile < last && !isCancelled(); tile++) {
+        glm::ivec2 lo, hi;
+        getTileBounds(tile, lo, hi);
+        const PacketCounts counts = marchPackets(settings.isa, frame, lo.x, lo.y, hi.x, hi.y);
+        tileCounts.samples += counts.samples;
+        tileCounts.rays += counts.rays;
+        tileCounts.cellSteps += counts.cellSteps;
+      }
+      samples.fetch_add(tileCounts.samples, std::memory_order_relaxed);
+      rays.fetch_add(tileCounts.rays, std::memory_order_relaxed);
+      cellSteps.fetch_add(tileCounts.cellSteps, std::memory_order_relaxed);
+    });
+    stats.samples = samples.load();
+    stats.rays = rays.load();
+    stats.cellSteps = cellSteps.load();
+    stats.tiles = static_cast<size_t>(tiles.x) * tiles.y;
+    stats.utilization = schedule.getUtilization();
+    stats.steals = schedule.steals;
+  }
+
+  void RayMarcher::reprojectHistory(const Camera &camera) {
+    const size_t pixels = image.size();
+    depth.assign(pixels, -1.f);
+    age.assign(pixels, 0);
+    traceMask.clear();
+    stats.reusedPixels = 0;
+    if (!historyValid || historyDims != imageDims) {
+      return;
+    }
+
+    // Splat every history pixel with a depth into the pixel its point now
+    // lands in. Keys hold the new distance, whose bits order as the positive
+    // float does, above the source pixel, so the smallest key is the nearest
+    // point; the farthest is kept to find pixels where surfaces meet.
+    constexpr uint64_t noKey = UINT64_MAX;
+    std::vector<std::atomic<uint64_t>> nearest(pixels);
+    std::vector<std::atomic<uint32_t>> farthest(pixels);
+    pool.parallelFor(0, pixels, size_t(1) << 16, [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; i++) {
+        nearest[i].store(noKey, std::memory_order_relaxed);
+        farthest[i].store(0, std::memory_order_relaxed);
+      }
+    });
+    glm::vec3 forward, right, up;
+    camera.getBasis(imageAspect, forward, right, up);
+    const glm::vec3 eye = camera.getPosition();
+    const glm::vec2 planeScale(1.f / glm::dot(right, right), 1.f / glm::dot(up, up));
+    glm::vec3 historyForward, historyRight, historyUp;
+    historyCamera.getBasis(imageAspect, historyForward, historyRight, historyUp);
+    const glm::vec3 historyEye = historyCamera.getPosition();
+    pool.parallelFor(0, static_cast<size_t>(imageDims.y), 16, [&](size_t first, size_t last) {
+      for (int y = static_cast<int>(first); y < static_cast<int>(last); y++) {
+        for (int x = 0; x < imageDims.x; x++) {
+          const size_t i = static_cast<size_t>(y) * imageDims.x + x;
+          if (historyDepth[i] < 0.f) {
+            continue;
+          }
+          const glm::vec2 historyNdc = (glm::vec2(x, y) + 0.5f) / glm::vec2(imageDims) * 2.f - 1.f;
+          const glm::vec3 dir = glm::normalize(historyForward + historyNdc.x * historyRight + historyNdc.y * historyUp);
+          const glm::vec3 v = historyEye + historyDepth[i] * dir - eye;
+          const float s = glm::dot(v, forward);
+          if (s <= 0.f) {
+            continue;
+          }
+          const glm::vec2 ndc = glm::vec2(glm::dot(v, right), glm::dot(v, up)) * planeScale / s;
+          const glm::vec2 q = (ndc + 1.f) * 0.5f * glm::vec2(imageDims);
+          if (!(q.x >= 0.f && q.y >= 0.f && q.x < imageDims.x && q.y < imageDims.y)) {
+            continue;
+          }
+          const size_t target = static_cast<size_t>(q.y) * imageDims.x + static_cast<size_t>(q.x);
+          const float distance = glm::length(v);
+          uint32_t bits;
+          std::memcpy(&bits, &distance, sizeof(bits));
+          const uint64_t key = static_cast<uint64_t>(bits) << 32 | i;
+          uint64_t current = nearest[target].load(std::memory_order_relaxed);
+          while (key < current && !nearest[target].compare_exchange_weak(current, key, std::memory_order_relaxed)) {
+          }
+          uint32_t far = farthest[target].load(std::memory_order_relaxed);
+          while (bits > far && !farthest[target].compare_exchange_weak(far, bits, std::memory_order_relaxed)) {
+          }
+        }
+      }
+    });
+
+    // Pixels without a splat, where splats or neighbours disagree in depth,
+    // in this frame's rows of the refresh pattern or reused for too long are
+    // traced. The pattern refreshes every 16th row, in bit reversed order so
+    // consecutive frames lie far apart, as whole rows keep packets full.
+    // With the view unchanged only pixels traced in the last frame stay.
+    static constexpr uint8_t refreshOrder[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+    constexpr uint8_t maxAge = 16;
+    const uint32_t slot = historyFrame % 16;
+    const bool still = camera.getViewMatrix() == historyCamera.getViewMatrix();
+    const float tolerance = settings.reprojectionTolerance;
+    auto getNearest = [&](size_t i) {
+      const uint64_t key = nearest[i].load(std::memory_order_relaxed);
+      const uint32_t bits = static_cast<uint32_t>(key >> 32);
+      float distance;
+      std::memcpy(&distance, &bits, sizeof(distance));
+      return key == noKey ? -1.f : distance;
+    };
+    traceMask.assign(pixels, 1);
+    std::atomic<size_t> reused(0);
+    pool.parallelFor(0, static_cast<size_t>(imageDims.y), 16, [&](size_t first, size_t last) {
+      size_t rowsReused = 0;
+      for (int y = static_cast<int>(first); y < static_cast<int>(last); y++) {
+        for (int x = 0; x < imageDims.x; x++) {
+          const size_t i = static_cast<size_t>(y) * imageDims.x + x;
+          const float near = getNearest(i);
+          if (near < 0.f) {
+            continue;
+          }
+          const uint32_t source = static_cast<uint32_t>(nearest[i].load(std::memory_order_relaxed));
+          const uint32_t farBits = farthest[i].load(std::memory_order_relaxed);
+          float far;
+          std::memcpy(&far, &farBits, sizeof(far));
+          bool reject = still ? historyAge[source] > 0
+                              : far - near > tolerance * near || refreshOrder[y & 15] == slot ||
+                                historyAge[source] + 1 >= maxAge;
+          const size_t neighbours[4] = {x > 0 ? i - 1 : i, x + 1 < imageDims.x ? i + 1 : i,
+                                        y > 0 ? i - imageDims.x : i, y + 1 < imageDims.y ? i + imageDims.x : i};
+          for (int n = 0; n < 4 && !reject; n++) {
+            const float other = getNearest(neighbours[n]);
+            reject = other >= 0.f && std::abs(other - near) > tolerance * near;
+          }
+          if (reject) {
+            continue;
+          }
+          image[i] = historyImage[source];
+          depth[i] = near;
+          age[i] = static_cast<uint8_t>(still ? historyAge[source] : historyAge[source] + 1);
+          traceMask[i] = 0;
+          rowsReused++;
+        }
+      }
+      reused.fetch_add(rowsReused, std::memory_order_relaxed);
+    });
+    stats.reusedPixels = reused.load();
+  }
+
+  void RayMarcher::updateHistory(const Camera &camera) {
+    // Pixels a cancelled frame skipped keep a depth of -1, like rays missing
+    // the box, so they are never reprojected
+    stats.stalePixels = static_cast<size_t>(std::count_if(age.begin(), age.end(), [](uint8_t a) {
+      return a > 0;
+    }));
+    historyImage = image;
+    historyDepth.swap(depth);
+    historyAge.swap(age);
+    historyCamera = camera;
+    historyDims = imageDims;
+    historyValid = true;
+    historyFrame++;
+    depth.clear();
+    traceMask.clear();
+  }
+
+  void RayMarcher::march(const Camera &camera) {
+    updateTileOrder();
+    if (settings.preintegrate) {
+      stats.preintegratedEntries += preintegrated[getStepScaleLevel()].update(pool, transferFunction, referenceLength, getStepLength());
+    }
+
+    // Occupied macrocells, or the whole box, for dense, Morton and bricked
+    // volumes; occupied spans for sparse ones
+    const MacrocellGrid *cells = settings.skipEmptySpace && !macrocells.isEmpty() ? &macrocells : nullptr;
+    const bool leap = settings.leapEmptySpace;
+    const float maxSpread = getMaxSpread();
+    auto boxSpans = [cells, leap, maxSpread](glm::vec3 origin, glm::vec3 dir, float t0, float t1, auto &&f) {
+      if (!cells) {
+        f(t0, t1, false);
+        return size_t(0);
+      }
+      return cells->forEachSpan(origin, dir, t0, t1, leap, maxSpread, f);
+    };
+    if (canUsePackets()) {
+      renderPackets(camera);
+    } else {
+      visitVoxelType(type, [&](auto t) {
+        using T = decltype(t);
+        if (sparseVolume) {
+          renderTiles(camera, [&] {
+            return SparseSampler<T>(*sparseVolume);
+          }, [&](glm::vec3 origin, glm::vec3 dir, float t0, float t1, auto &&f) {
+            sparseVolume->forEachSpan(origin, dir, t0, t1, [&](float s0, float s1) {
+              f(s0, s1, false);
+            });
+            return size_t(0);
+          });
+        } else if (brickCache) {
+          renderTiles(camera, [&] {
+            return BrickSampler<T>(*brickCache);
+          }, boxSpans);
+        } else if (mortonVolume) {
+          renderTiles(camera, [&] {
+            return DenseSampler<T, MortonLayout>(reinterpret_cast<const T *>(mortonVolume->getData()),
+                                                 mortonVolume->getLayout());
+          }, boxSpans);
+        } else {
+          renderTiles(camera, [&] {
+            return DenseSampler<T>(denseVolume);
+          }, boxSpans);
+        }
+      });
+    }
+  }
+
+  void RayMarcher::renderFoveated(const Camera &camera, glm::ivec2 fullDims) {
+    // Periphery: one ray per 2^level pixel square with steps as much longer,
+    // keeping depth so the upsampling does not blend across edges
+    const int level = getPeripheryLevel();
+    imageDims = (fullDims + (1 << level) - 1) / (1 << level);
+    stepScale = static_cast<float>(1 << level);
+    image.resize(static_cast<size_t>(imageDims.x) * imageDims.y);
+    depth.assign(image.size(), -1.f);
+    march(camera);
+    peripheryDims = imageDims;
+    std::swap(image, peripheryImage);
+    peripheryDepth.swap(depth);
+    depth.clear();
+    const RenderStats periphery = stats;
+
+    // Focus: full density within the focus circle and the band where it
+    // blends into the periphery, one periphery pixel wide. Pixels outside are
+    // left as they are; the present pass upsamples the periphery there.
+    imageDims = fullDims;
+    stepScale = 1.f;
+    image.resize(static_cast<size_t>(imageDims.x) * imageDims.y);
+    const glm::vec2 center = settings.focus * glm::vec2(fullDims);
+    const float radius = std::max(settings.focusRadius, 0.f) * static_cast<float>(fullDims.y);
+    const float band = static_cast<float>(1 << level);
+    traceMask.assign(image.size(), 0);
+    pool.parallelFor(0, static_cast<size_t>(fullDims.y), 16, [&](size_t first, size_t last) {
+      for (int y = static_cast<int>(first); y < static_cast<int>(last); y++) {
+        for (int x = 0; x < fullDims.x; x++) {
+          const float distance = glm::length(glm::vec2(x, y) + 0.5f - center);
+          traceMask[static_cast<size_t>(y) * fullDims.x + x] = distance < radius + band;
+        }
+      }
+    });
+    march(camera);
+    traceMask.clear();
+
+    stats.samples += periphery.samples;
+    stats.rays += periphery.rays;
+    stats.cellSteps += periphery.cellSteps;
+    stats.steals += periphery.steals;
+  }
+
+  std::vector<uint32_t> RayMarcher::composeFoveated() const {
+    std::vector<uint32_t> frame = image;
+    if (peripheryImage.empty()) {
+      return frame;
+    }
+    const glm::ivec2 fullDims = imageDims;
+    const glm::vec2 center = settings.focus * glm::vec2(fullDims);
+    const float radius = std::max(settings.focusRadius, 0.f) * static_cast<float>(fullDims.y);
+    const float band = static_cast<float>(1 << getPeripheryLevel());
+
+    // Bilinear upsampling, leaving out periphery samples whose depth differs
+    // from that of the nearest one by more than upsampleTolerance of it, as
+    // quad_foveated.frag does. Taps are found per row and column, and colors
+    // blended in fixed point with weights out of 256, red and blue in one word.
+    struct Tap {
+      int i0, i1;
+      float f;
+    };
+    auto getTaps = [](int full, int periphery) {
+      std::vector<Tap> taps(full);
+      const float scale = static_cast<float>(periphery) / full;
+      for (int x = 0; x < full; x++) {
+        const float p = (static_cast<float>(x) + 0.5f) * scale - 0.5f;
+        const int i0 = glm::clamp(static_cast<int>(std::floor(p)), 0, periphery - 1);
+        taps[x] = {i0, std::min(i0 + 1, periphery - 1), glm::clamp(p - static_cast<float>(i0), 0.f, 1.f)};
+      }
+      return taps;
+    };
+    const std::vector<Tap> columns = getTaps(fullDims.x, peripheryDims.x), rows = getTaps(fullDims.y, peripheryDims.y);
+    auto blend = [](const uint32_t *colors, const int *weights, int n) {
+      uint32_t rb = 0x00800080u, g = 0x00008000u;
+      for (int k = 0; k < n; k++) {
+        rb += (colors[k] & 0x00ff00ffu) * static_cast<uint32_t>(weights[k]);
+        g += (colors[k] & 0x0000ff00u) * static_cast<uint32_t>(weights[k]);
+      }
+      return ((rb >> 8) & 0x00ff00ffu) | ((g >> 8) & 0x0000ff00u) | 0xff000000u;
+    };
+    const float tolerance = settings.upsampleTolerance;
+    pool.parallelFor(0, static_cast<size_t>(fullDims.y), 16, [&](size_t first, size_t last) {
+      for (int y = static_cast<int>(first); y < static_cast<int>(last); y++) {
+        const Tap &row = rows[y];
+        const size_t row0 = static_cast<size_t>(row.i0) * peripheryDims.x;
+        const size_t row1 = static_cast<size_t>(row.i1) * peripheryDims.x;
+        const float dy = static_cast<float>(y) + 0.5f - center.y;
+        for (int x = 0; x < fullDims.x; x++) {
+          const float dx = static_cast<float>(x) + 0.5f - center.x;
+          const float distance2 = dx * dx + dy * dy;
+          if (distance2 <= radius * radius) {
+            continue;
+          }
+          const Tap &column = columns[x];
+          const size_t samples[4] = {row0 + column.i0, row0 + column.i1, row1 + column.i0, row1 + column.i1};
+          float weights[4] = {(1.f - column.f) * (1.f - row.f), column.f * (1.f - row.f),
+                              (1.f - column.f) * row.f, column.f * row.f};
+          const int nearest = static_cast<int>(std::max_element(weights, weights + 4) - weights);
+          const float reference = peripheryDepth[samples[nearest]];
+          float sum = 0.f;
+          for (int k = 0; k < 4; k++) {
+            const float d = peripheryDepth[samples[k]];
+            if ((d < 0.f) != (reference < 0.f) || std::abs(d - reference) > tolerance * std::max(reference, 0.f)) {
+              weights[k] = 0.f;
+            }
+            sum += weights[k];
+          }
+          const uint32_t colors[4] = {peripheryImage[samples[0]], peripheryImage[samples[1]], peripheryImage[samples[2]],
+                                      peripheryImage[samples[3]]};
+          int fixed[4];
+          int total = 0;
+          for (int k = 0; k < 4; k++) {
+            fixed[k] = static_cast<int>(weights[k] / sum * 256.f);
+            total += fixed[k];
+          }
+          fixed[nearest] += 256 - total;
+          uint32_t color = blend(colors, fixed, 4);
+
+          // Across the band the traced focus fades into the periphery
+          const size_t i = static_cast<size_t>(y) * fullDims.x + x;
+          if (distance2 < (radius + band) * (radius + band)) {
+            const int w = static_cast<int>((std::sqrt(distance2) - radius) / band * 256.f + 0.5f);
+            const uint32_t pair[2] = {frame[i], color};
+            const int pairWeights[2] = {256 - w, w};
+            color = blend(pair, pairWeights, 2);
+          }
+          frame[i] = color;
+        }
+      }
+    });
+    return frame;
+  }
+
+  void RayMarcher::render(const Camera &camera, glm::ivec2 dims, int coarseLevel, const std::atomic<bool> *cancel) {
+    auto start = std::chrono::high_resolution_clock::now();
+    const int level = settings.pathTrace ? 0 : glm::clamp(coarseLevel, 0, maxCoarseLevel);
+    const glm::ivec2 fullDims = glm::max(dims, glm::ivec2(1));
+    imageDims = (fullDims + (1 << level) - 1) / (1 << level);
+    imageAspect = static_cast<float>(fullDims.x) / fullDims.y;
+    stepScale = static_cast<float>(1 << level);
+    this->cancel = cancel;
+    image.resize(static_cast<size_t>(imageDims.x) * imageDims.y);
+    stats = RenderStats();
+
+    updateMacrocells();
+    updateGradients();
+    stats.precomputedGradients = settings.shading && !gradients.isEmpty();
+    updateLight();
+    const bool foveated = settings.foveated && !settings.pathTrace && level == 0 && hasVolume();
+    if (!foveated) {
+      peripheryImage.clear();
+      peripheryDepth.clear();
+    }
+    const bool temporal = settings.temporalReuse && !settings.pathTrace && !foveated && level == 0 && hasVolume();
+    if (temporal) {
+      reprojectHistory(camera);
+    }
+    if (!hasVolume()) {
+      std::fill(image.begin(), image.end(), packColor(settings.background));
+    } else if (settings.pathTrace) {
+      updateTileOrder();
+      renderPaths(camera);
+    } else if (foveated) {
+      renderFoveated(camera, fullDims);
+    } else {
+      march(camera);
+    }
+    if (temporal) {
+      updateHistory(camera);
+    }
+    if (level > 0) {
+      expandCoarseImage(fullDims, level);
+    }
+    stats.coarseLevel = level;
+    stats.cancelled = isCancelled();
+    stepScale = 1.f;
+    this->cancel = nullptr;
+    stats.time = std::chrono::duration<double, std::milli>(
+                     std::chrono::high_resolution_clock::now() - start).count();
+  }
+
+  const std::vector<uint32_t> &RayMarcher::getImage() const {
+    return image;
+  }
+
+  glm::ivec2 RayMarcher::getImageDims() const {
+    return imageDims;
+  }
+
+  const std::vector<uint32_t> &RayMarcher::getPeripheryImage() const {
+    return peripheryImage;
+  }
+
+  const std::vector<float> &RayMarcher::getPeripheryDepth() const {
+    return peripheryDepth;
+  }
+
+  glm::ivec2 RayMarcher::getPeripheryDims() const {
+    return peripheryDims;
+  }
+
+  int RayMarcher::getPeripheryLevel() const {
+    return glm::clamp(settings.peripheryLevel, 1, maxCoarseLevel);
+  }
+
+  const RenderSettings &RayMarcher::getSettings() const {
+    return settings;
+  }
+
+  const TransferFunction &RayMarcher::getTransferFunction() const {
+    return transferFunction;
+  }
+
+  RenderStats RayMarcher::getStats() const {
+    return stats;
+  }
+
+  const MacrocellGrid &RayMarcher::getMacrocells() const {
+    return macrocells;
+  }
+} // namespace CUDAVol
@@ -0,0 +1,144 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_packet.cpp
+
+  Packet ray marching definition: instruction set detection and dispatch.
+
+  November 2019
+*/
+
+#include "ray_packet.h"
+#include <iostream>
+#include <stdexcept>
+
+#ifdef CUDAVOL_HAS_PACKETS
+#include <cpuid.h>
+#endif
+
+namespace CUDAVol {
+#ifdef CUDAVOL_HAS_PACKETS
+  PacketCounts marchPacketsSse4(const PacketFrame &frame, int x0, int y0, int x1, int y1);
+  PacketCounts marchPacketsAvx2(const PacketFrame &frame, int x0, int y0, int x1, int y1);
+  PacketCounts marchPacketsAvx512(const PacketFrame &frame, int x0, int y0, int x1, int y1);
+
+  static SimdIsa querySimdIsa() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+      return SimdIsa::Scalar;
+    }
+
+    // AVX state must also be enabled by the OS, see XCR0
+    const bool osxsave = ecx & bit_OSXSAVE;
+    const bool fma = ecx & bit_FMA;
+    uint64_t xcr0 = 0;
+    if (osxsave) {
+      uint32_t lo, hi;
+      __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+      xcr0 = (static_cast<uint64_t>(hi) << 32) | lo;
+    }
+    const bool ymm = (xcr0 & 0x6) == 0x6;
+    const bool zmm = (xcr0 & 0xe6) == 0xe6;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+      return SimdIsa::Sse4;
+    }
+    if (zmm && fma && (ebx & bit_AVX512F)) {
+      return SimdIsa::Avx512;
+    } else if (ymm && fma && (ebx & bit_AVX2)) {
+      return SimdIsa::Avx2;
+    }
+    return SimdIsa::Sse4;
+  }
+#endif
+
+  SimdIsa detectSimdIsa() {
+#ifdef CUDAVOL_HAS_PACKETS
+    static const SimdIsa isa = querySimdIsa();
+    return isa;
+#else
+    return SimdIsa::Scalar;
+#endif
+  }
+
+  SimdIsa parseSimdIsa(const std::string &str) {
+    if (str == "scalar") {
+      return SimdIsa::Scalar;
+    } else if (str == "sse4") {
+      return SimdIsa::Sse4;
+    } else if (str == "avx2") {
+      return SimdIsa::Avx2;
+    } else if (str == "avx512") {
+      return SimdIsa::Avx512;
+    }
+    std::cerr << "Unknown instruction set " << str << ", expected scalar, sse4, avx2 or avx512"
+              << std::endl;
+    throw std::runtime_error("parseSimdIsa: unknown instruction set");
+  }
+
+  const char *toString(SimdIsa isa) {
+    switch (isa) {
+    case SimdIsa::Sse4:
+      return "sse4";
+    case SimdIsa::Avx2:
+      return "avx2";
+    case SimdIsa::Avx512:
+      return "avx512";
+    default:
+      return "scalar";
+    }
+  }
+
+  int getPacketWidth(SimdIsa isa) {
+    switch (isa) {
+    case SimdIsa::Sse4:
+      return 4;
+    case SimdIsa::Avx2:
+      return 8;
+    case SimdIsa::Avx512:
+      return 16;
+    default:
+      return 1;
+    }
+  }
+
+  PacketCounts marchPackets(SimdIsa isa, const PacketFrame &frame, int x0, int y0, int x1, int y1) {
+    if (static_cast<int>(isa) > static_cast<int>(detectSimdIsa())) {
+      std::cerr << "Instruction set " << toString(isa) << " is not supported here, best is "
+                << toString(detectSimdIsa()) << std::endl;
+      throw std::runtime_error("marchPackets: unsupported instruction set");
+    }
+    switch (isa) {
+#ifdef CUDAVOL_HAS_PACKETS
+    case SimdIsa::Sse4:
+      return marchPacketsSse4(frame, x0, y0, x1, y1);
+    case SimdIsa::Avx2:
+      return marchPacketsAvx2(frame, x0, y0, x1, y1);
+    case SimdIsa::Avx512:
+      return marchPacketsAvx512(frame, x0, y0, x1, y1);
+#endif
+    default:
+      std::cerr << "No packet kernel for " << toString(isa) << std::endl;
+      throw std::runtime_error("marchPackets: no kernel");
+    }
+  }
+} // namespace CUDAVol
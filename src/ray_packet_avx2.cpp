@@ -0,0 +1,126 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_packet_avx2.cpp
+
+  Packet ray marching kernel for AVX2 and FMA, 8 rays per register. Compiled
+  with -mavx2 -mfma and only called after CPUID confirmed support.
+
+  November 2019
+*/
+
+#include "ray_packet_kernel.h"
+#include <immintrin.h>
+
+namespace CUDAVol {
+  namespace {
+    struct Avx2 {
+      static constexpr int width = 8;
+      using F = __m256;
+      using I = __m256i;
+      using M = __m256;
+
+      static F set(float v) { return _mm256_set1_ps(v); }
+      static I seti(int v) { return _mm256_set1_epi32(v); }
+      static F laneIndex() { return _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f); }
+      static F add(F a, F b) { return _mm256_add_ps(a, b); }
+      static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+      static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+      static F div(F a, F b) { return _mm256_div_ps(a, b); }
+      static F min(F a, F b) { return _mm256_min_ps(a, b); }
+      static F max(F a, F b) { return _mm256_max_ps(a, b); }
+      static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+      static F lerp(F a, F b, F t) { return _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a); }
+      static I toInt(F a) { return _mm256_cvttps_epi32(a); }
+      static F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+      static I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+      static I subi(I a, I b) { return _mm256_sub_epi32(a, b); }
+      template <int n>
+      static I slli(I a) { return _mm256_slli_epi32(a, n); }
+      template <int n>
+      static I srai(I a) { return _mm256_srai_epi32(a, n); }
+      static I muli(I a, I b) { return _mm256_mullo_epi32(a, b); }
+      static I mini(I a, I b) { return _mm256_min_epi32(a, b); }
+      static M lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+      static M le(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+      static M andm(M a, M b) { return _mm256_and_ps(a, b); }
+      static bool any(M m) { return _mm256_movemask_ps(m) != 0; }
+      static int count(M m) { return __builtin_popcount(_mm256_movemask_ps(m)); }
+      static F select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+      static F load(const float *src) { return _mm256_load_ps(src); }
+      static void store(float *dst, F a) { _mm256_store_ps(dst, a); }
+
+      static M firstLanes(int n) {
+        return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n),
+                                                      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+      }
+
+      static F gather(const float *table, I i) { return _mm256_i32gather_ps(table, i, 4); }
+
+      // Voxels index and index + 1; 8 and 16 bit neighbours share one 32 bit gather
+      template <typename T>
+      static void loadPair(const PacketFrame &fr, I index, F &lo, F &hi) {
+        const int *base = reinterpret_cast<const int *>(fr.data);
+        if constexpr (sizeof(T) == 4) {
+          const float *data = reinterpret_cast<const float *>(fr.data);
+          lo = _mm256_i32gather_ps(data, index, 4);
+          hi = _mm256_i32gather_ps(data, _mm256_add_epi32(index, _mm256_set1_epi32(1)), 4);
+        } else if constexpr (sizeof(T) == 2) {
+          const I g = _mm256_i32gather_epi32(base, index, 2);
+          lo = _mm256_cvtepi32_ps(_mm256_and_si256(g, _mm256_set1_epi32(0xffff)));
+          hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(g, 16));
+        } else {
+          // Gathers near the end of the data start earlier and shift down
+          const I offset = _mm256_min_epi32(index, _mm256_set1_epi32(fr.maxPairOffset));
+          const I g = _mm256_srlv_epi32(_mm256_i32gather_epi32(base, offset, 1),
+                                        _mm256_slli_epi32(_mm256_sub_epi32(index, offset), 3));
+          lo = _mm256_cvtepi32_ps(_mm256_and_si256(g, _mm256_set1_epi32(0xff)));
+          hi = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(g, 8), _mm256_set1_epi32(0xff)));
+        }
+      }
+
+      // Voxels index and index + 1 interpolated along x, with 256 - w and w
+      // in the 16 bit halves of weights; the value times 256. madd multiplies
+      // signed halves, so 16 bit voxels are biased into range and back.
+      template <typename T>
+      static I lerpPairFixed(const PacketFrame &fr, I index, I weights) {
+        const int *base = reinterpret_cast<const int *>(fr.data);
+        if constexpr (sizeof(T) == 2) {
+          const I g = _mm256_xor_si256(_mm256_i32gather_epi32(base, index, 2), _mm256_set1_epi32(0x80008000));
+          return _mm256_add_epi32(_mm256_madd_epi16(g, weights), _mm256_set1_epi32(0x8000 << 8));
+        } else {
+          const I offset = _mm256_min_epi32(index, _mm256_set1_epi32(fr.maxPairOffset));
+          const I g = _mm256_srlv_epi32(_mm256_i32gather_epi32(base, offset, 1),
+                                        _mm256_slli_epi32(_mm256_sub_epi32(index, offset), 3));
+          const I pair = _mm256_or_si256(_mm256_and_si256(g, _mm256_set1_epi32(0xff)),
+                                         _mm256_slli_epi32(_mm256_and_si256(g, _mm256_set1_epi32(0xff00)), 8));
+          return _mm256_madd_epi16(pair, weights);
+        }
+      }
+    };
+  } // namespace
+
+  PacketCounts marchPacketsAvx2(const PacketFrame &frame, int x0, int y0, int x1, int y1) {
+    return marchPacketTile<Avx2>(frame, x0, y0, x1, y1);
+  }
+} // namespace CUDAVol
@@ -0,0 +1,132 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_packet_avx512.cpp
+
+  Packet ray marching kernel for AVX-512F, 16 rays per register. Compiled with
+  -mavx512f and only called after CPUID confirmed support.
+
+  November 2019
+*/
+
+#include "ray_packet_kernel.h"
+#include <immintrin.h>
+
+// GCC's AVX-512 intrinsics start from an undefined register, which it then
+// reports as maybe uninitialized wherever they are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+namespace CUDAVol {
+  namespace {
+    struct Avx512 {
+      static constexpr int width = 16;
+      using F = __m512;
+      using I = __m512i;
+      using M = __mmask16;
+
+      static F set(float v) { return _mm512_set1_ps(v); }
+      static I seti(int v) { return _mm512_set1_epi32(v); }
+      static F laneIndex() {
+        return _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f);
+      }
+      static F add(F a, F b) { return _mm512_add_ps(a, b); }
+      static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+      static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+      static F div(F a, F b) { return _mm512_div_ps(a, b); }
+      static F min(F a, F b) { return _mm512_min_ps(a, b); }
+      static F max(F a, F b) { return _mm512_max_ps(a, b); }
+      static F sqrt(F a) { return _mm512_sqrt_ps(a); }
+      static F lerp(F a, F b, F t) { return _mm512_fmadd_ps(t, _mm512_sub_ps(b, a), a); }
+      static I toInt(F a) { return _mm512_cvttps_epi32(a); }
+      static F toFloat(I a) { return _mm512_cvtepi32_ps(a); }
+      static I addi(I a, I b) { return _mm512_add_epi32(a, b); }
+      static I subi(I a, I b) { return _mm512_sub_epi32(a, b); }
+      template <int n>
+      static I slli(I a) { return _mm512_slli_epi32(a, n); }
+      template <int n>
+      static I srai(I a) { return _mm512_srai_epi32(a, n); }
+      static I muli(I a, I b) { return _mm512_mullo_epi32(a, b); }
+      static I mini(I a, I b) { return _mm512_min_epi32(a, b); }
+      static M lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+      static M le(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+      static M andm(M a, M b) { return static_cast<M>(a & b); }
+      static bool any(M m) { return m != 0; }
+      static int count(M m) { return __builtin_popcount(m); }
+      static F select(M m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+      static F load(const float *src) { return _mm512_load_ps(src); }
+      static void store(float *dst, F a) { _mm512_store_ps(dst, a); }
+      static M firstLanes(int n) { return static_cast<M>((1u << n) - 1); }
+
+      static F gather(const float *table, I i) { return _mm512_i32gather_ps(i, table, 4); }
+
+      // Voxels index and index + 1; 8 and 16 bit neighbours share one 32 bit gather
+      template <typename T>
+      static void loadPair(const PacketFrame &fr, I index, F &lo, F &hi) {
+        if constexpr (sizeof(T) == 4) {
+          lo = _mm512_i32gather_ps(index, fr.data, 4);
+          hi = _mm512_i32gather_ps(_mm512_add_epi32(index, _mm512_set1_epi32(1)), fr.data, 4);
+        } else if constexpr (sizeof(T) == 2) {
+          const I g = _mm512_i32gather_epi32(index, fr.data, 2);
+          lo = _mm512_cvtepi32_ps(_mm512_and_si512(g, _mm512_set1_epi32(0xffff)));
+          hi = _mm512_cvtepi32_ps(_mm512_srli_epi32(g, 16));
+        } else {
+          // Gathers near the end of the data start earlier and shift down
+          const I offset = _mm512_min_epi32(index, _mm512_set1_epi32(fr.maxPairOffset));
+          const I g = _mm512_srlv_epi32(_mm512_i32gather_epi32(offset, fr.data, 1),
+                                        _mm512_slli_epi32(_mm512_sub_epi32(index, offset), 3));
+          lo = _mm512_cvtepi32_ps(_mm512_and_si512(g, _mm512_set1_epi32(0xff)));
+          hi = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(g, 8), _mm512_set1_epi32(0xff)));
+        }
+      }
+
+      // Voxels index and index + 1 interpolated along x, with 256 - w and w
+      // in the 16 bit halves of weights; the value times 256. The 16 bit
+      // multiply-add needs AVX-512BW, so pairs are weighted on 32 bit lanes.
+      template <typename T>
+      static I lerpPairFixed(const PacketFrame &fr, I index, I weights) {
+        I lo, hi;
+        if constexpr (sizeof(T) == 2) {
+          const I g = _mm512_i32gather_epi32(index, fr.data, 2);
+          lo = _mm512_and_si512(g, _mm512_set1_epi32(0xffff));
+          hi = _mm512_srli_epi32(g, 16);
+        } else {
+          const I offset = _mm512_min_epi32(index, _mm512_set1_epi32(fr.maxPairOffset));
+          const I g = _mm512_srlv_epi32(_mm512_i32gather_epi32(offset, fr.data, 1),
+                                        _mm512_slli_epi32(_mm512_sub_epi32(index, offset), 3));
+          lo = _mm512_and_si512(g, _mm512_set1_epi32(0xff));
+          hi = _mm512_and_si512(_mm512_srli_epi32(g, 8), _mm512_set1_epi32(0xff));
+        }
+        return _mm512_add_epi32(_mm512_slli_epi32(lo, 8),
+                                _mm512_mullo_epi32(_mm512_sub_epi32(hi, lo), _mm512_srli_epi32(weights, 16)));
+      }
+    };
+  } // namespace
+
+  PacketCounts marchPacketsAvx512(const PacketFrame &frame, int x0, int y0, int x1, int y1) {
+    return marchPacketTile<Avx512>(frame, x0, y0, x1, y1);
+  }
+} // namespace CUDAVol
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,116 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  ray_packet_sse4.cpp
+
+  Packet ray marching kernel for SSE4.1, 4 rays per register. Without gather
+  instructions, lanes are loaded one by one. Compiled with -msse4.1 and only
+  called after CPUID confirmed support.
+
+  November 2019
+*/
+
+#include "ray_packet_kernel.h"
+#include <smmintrin.h>
+
+namespace CUDAVol {
+  namespace {
+    struct Sse4 {
+      static constexpr int width = 4;
+      using F = __m128;
+      using I = __m128i;
+      using M = __m128;
+
+      static F set(float v) { return _mm_set1_ps(v); }
+      static I seti(int v) { return _mm_set1_epi32(v); }
+      static F laneIndex() { return _mm_setr_ps(0.f, 1.f, 2.f, 3.f); }
+      static F add(F a, F b) { return _mm_add_ps(a, b); }
+      static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+      static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+      static F div(F a, F b) { return _mm_div_ps(a, b); }
+      static F min(F a, F b) { return _mm_min_ps(a, b); }
+      static F max(F a, F b) { return _mm_max_ps(a, b); }
+      static F sqrt(F a) { return _mm_sqrt_ps(a); }
+      static F lerp(F a, F b, F t) { return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))); }
+      static I toInt(F a) { return _mm_cvttps_epi32(a); }
+      static F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+      static I addi(I a, I b) { return _mm_add_epi32(a, b); }
+      static I subi(I a, I b) { return _mm_sub_epi32(a, b); }
+      template <int n>
+      static I slli(I a) { return _mm_slli_epi32(a, n); }
+      template <int n>
+      static I srai(I a) { return _mm_srai_epi32(a, n); }
+      static I muli(I a, I b) { return _mm_mullo_epi32(a, b); }
+      static I mini(I a, I b) { return _mm_min_epi32(a, b); }
+      static M lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+      static M le(F a, F b) { return _mm_cmple_ps(a, b); }
+      static M andm(M a, M b) { return _mm_and_ps(a, b); }
+      static bool any(M m) { return _mm_movemask_ps(m) != 0; }
+      static int count(M m) { return __builtin_popcount(_mm_movemask_ps(m)); }
+      static F select(M m, F a, F b) { return _mm_blendv_ps(b, a, m); }
+      static F load(const float *src) { return _mm_load_ps(src); }
+      static void store(float *dst, F a) { _mm_store_ps(dst, a); }
+
+      static M firstLanes(int n) {
+        return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(n), _mm_setr_epi32(0, 1, 2, 3)));
+      }
+
+      static F gather(const float *table, I i) {
+        alignas(16) int index[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(index), i);
+        return _mm_setr_ps(table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+      }
+
+      template <typename T>
+      static void loadPair(const PacketFrame &fr, I index, F &lo, F &hi) {
+        const T *data = reinterpret_cast<const T *>(fr.data);
+        alignas(16) int i[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(i), index);
+        lo = _mm_setr_ps(static_cast<float>(data[i[0]]), static_cast<float>(data[i[1]]),
+                         static_cast<float>(data[i[2]]), static_cast<float>(data[i[3]]));
+        hi = _mm_setr_ps(static_cast<float>(data[i[0] + 1]), static_cast<float>(data[i[1] + 1]),
+                         static_cast<float>(data[i[2] + 1]), static_cast<float>(data[i[3] + 1]));
+      }
+
+      // Voxels index and index + 1 interpolated along x, with 256 - w and w
+      // in the 16 bit halves of weights; the value times 256. madd multiplies
+      // signed halves, so 16 bit voxels are biased into range and back.
+      template <typename T>
+      static I lerpPairFixed(const PacketFrame &fr, I index, I weights) {
+        const T *data = reinterpret_cast<const T *>(fr.data);
+        constexpr int bias = sizeof(T) == 2 ? 0x8000 : 0;
+        alignas(16) int i[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(i), index);
+        auto pair = [&](int j) {
+          return static_cast<int>(static_cast<uint32_t>(data[j] ^ bias) | static_cast<uint32_t>(data[j + 1] ^ bias) << 16);
+        };
+        const I packed = _mm_setr_epi32(pair(i[0]), pair(i[1]), pair(i[2]), pair(i[3]));
+        return _mm_add_epi32(_mm_madd_epi16(packed, weights), _mm_set1_epi32(bias << 8));
+      }
+    };
+  } // namespace
+
+  PacketCounts marchPacketsSse4(const PacketFrame &frame, int x0, int y0, int x1, int y1) {
+    return marchPacketTile<Sse4>(frame, x0, y0, x1, y1);
+  }
+} // namespace CUDAVol
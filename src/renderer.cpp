@@ -29,17 +29,40 @@
 */
 
 #include "renderer.h"
+#include "mip_builder.h"
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <numeric>
 #include <string>
 
 const std::string shaderDirectory = std::string(DATA_DIR) + "/shaders/";
 
 namespace CUDAVol {
-  Renderer::Renderer(const Window &window)
-    : window(window),
-      windowDrawPrg(shaderDirectory + "quad_passthrough.vert",
-                    shaderDirectory + "quad_passthrough.frag") {
+  Renderer::Renderer(const Window &window, ThreadPool &pool)
+    : windowDrawPrg(shaderDirectory + "quad_passthrough.vert",
+                    shaderDirectory + "quad_passthrough.frag"),
+      foveatedDrawPrg(shaderDirectory + "quad_passthrough.vert",
+                      shaderDirectory + "quad_foveated.frag"),
+      textureDims(0),
+      foveatedFrame(false),
+      window(window),
+      pool(pool),
+      valueRange(0.f, 1.f),
+      sparseVolume(nullptr),
+      brickedLevels(nullptr),
+      brickedLevel(0),
+      cacheBytes(0),
+      rayMarcher(pool),
+      cursor(0.0),
+      focusKeyDown(false),
+      shownLevel(-1),
+      shownView(0.f),
+      shownDims(0) {
     // Define screen filling quad vertices
     std::array<GLfloat, 8> quad = {-1.f, 1.f, -1.f, -1.f, 1.f, 1.f, 1.f, -1.f};
 
@@ -64,19 +87,294 @@ namespace CUDAVol {
     // Clean up
     glBindVertexArray(0);
     glDeleteBuffers(1, &quadVBO);
+
+    // Define texture receiving ray marched frames, sized on first upload
+    glGenTextures(1, &frameTexture);
+    glBindTexture(GL_TEXTURE_2D, frameTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Define textures receiving the periphery of foveated frames, fetched
+    // per texel
+    glGenTextures(2, peripheryTextures);
+    for (GLuint texture : peripheryTextures) {
+      glBindTexture(GL_TEXTURE_2D, texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Quad samples texture unit 0, the periphery units 1 and 2
+    windowDrawPrg.beginUse();
+    glUniform1i(glGetUniformLocation(windowDrawPrg.getObject(), "source_texture_in"), 0);
+    windowDrawPrg.endUse();
+    foveatedDrawPrg.beginUse();
+    glUniform1i(glGetUniformLocation(foveatedDrawPrg.getObject(), "source_texture_in"), 0);
+    glUniform1i(glGetUniformLocation(foveatedDrawPrg.getObject(), "periphery_texture_in"), 1);
+    glUniform1i(glGetUniformLocation(foveatedDrawPrg.getObject(), "periphery_depth_in"), 2);
+    foveatedDrawPrg.endUse();
   }
 
   Renderer::~Renderer() {
+    stopRefinement();
+    glDeleteTextures(1, &frameTexture);
+    glDeleteTextures(2, peripheryTextures);
     glDeleteVertexArrays(1, &quadVAO);
   }
 
+  void Renderer::restartRefinement() {
+    stopRefinement();
+    shownLevel = -1;
+  }
+
+  void Renderer::stopRefinement() {
+    // Tiles already started finish, the rest are skipped; the image shown
+    // stays that of the last completed pass
+    if (refinement.valid()) {
+      refinementCancel->store(true);
+      refinement.get();
+    }
+  }
+
+  void Renderer::uploadImage() {
+    const glm::ivec2 imageDims = rayMarcher.getImageDims();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frameTexture);
+    if (imageDims != textureDims) {
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, imageDims.x, imageDims.y, 0, GL_RGBA,
+                   GL_UNSIGNED_INT_8_8_8_8_REV, rayMarcher.getImage().data());
+      textureDims = imageDims;
+    } else {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, imageDims.x, imageDims.y, GL_RGBA,
+                      GL_UNSIGNED_INT_8_8_8_8_REV, rayMarcher.getImage().data());
+    }
+
+    // A foveated frame brings its periphery and the focus it was traced
+    // for; the present pass upsamples the periphery around the focus
+    const std::vector<uint32_t> &periphery = rayMarcher.getPeripheryImage();
+    foveatedFrame = !periphery.empty();
+    if (foveatedFrame) {
+      const glm::ivec2 peripheryDims = rayMarcher.getPeripheryDims();
+      glBindTexture(GL_TEXTURE_2D, peripheryTextures[0]);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, peripheryDims.x, peripheryDims.y, 0, GL_RGBA,
+                   GL_UNSIGNED_INT_8_8_8_8_REV, periphery.data());
+      glBindTexture(GL_TEXTURE_2D, peripheryTextures[1]);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, peripheryDims.x, peripheryDims.y, 0, GL_RED, GL_FLOAT,
+                   rayMarcher.getPeripheryDepth().data());
+      glBindTexture(GL_TEXTURE_2D, frameTexture);
+
+      const RenderSettings &settings = rayMarcher.getSettings();
+      const GLuint object = foveatedDrawPrg.getObject();
+      foveatedDrawPrg.beginUse();
+      glUniform2f(glGetUniformLocation(object, "focus_center"), settings.focus.x * imageDims.x,
+                  settings.focus.y * imageDims.y);
+      glUniform1f(glGetUniformLocation(object, "focus_radius"), std::max(settings.focusRadius, 0.f) * imageDims.y);
+      glUniform1f(glGetUniformLocation(object, "blend_band"), static_cast<float>(1 << rayMarcher.getPeripheryLevel()));
+      glUniform1f(glGetUniformLocation(object, "upsample_tolerance"), settings.upsampleTolerance);
+      foveatedDrawPrg.endUse();
+    }
+  }
+
+  void Renderer::resetVolume(glm::ivec3 dims, VoxelType type, glm::vec3 spacing) {
+    restartRefinement();
+
+    // Reframe the camera only for a new volume, not for the next timestep
+    if (dims != volume.dims) {
+      camera.frame(glm::vec3(dims) * spacing);
+    }
+    volume = VolumeView();
+    volume.dims = dims;
+    volume.type = type;
+    volume.spacing = spacing;
+    rayMarcher.clearVolume();
+    sparseVolume = nullptr;
+    brickedLevels = nullptr;
+    brickPrefetcher.reset();
+    brickCache.reset();
+  }
+
+  void Renderer::setVolume(const VolumeView &volume) {
+    // View only; the owner of the underlying Volume must outlive the renderer.
+    // Timesteps of a series keep the first one's value range so that colors
+    // stay comparable.
+    if (volume.dims != this->volume.dims || volume.type != this->volume.type) {
+      valueRange = computeValueRange(pool, volume);
+    }
+    resetVolume(volume.dims, volume.type, volume.spacing);
+    this->volume = volume;
+    if (!volume.isEmpty()) {
+      rayMarcher.setVolume(volume, valueRange);
+    }
+  }
+
+  void Renderer::setVolume(const std::vector<BrickedVolume> &levels, size_t cacheBytes) {
+    // Out-of-core; bricks of the level matching the zoom are decoded on demand
+    // into a fixed budget
+    const BrickedVolume &volume = levels.front();
+    resetVolume(volume.getDims(), volume.getType(), volume.getSpacing());
+    valueRange = volume.getValueRange();
+    brickedLevels = &levels;
+    this->cacheBytes = cacheBytes;
+    useLevel(selectLevel());
+  }
+
+  void Renderer::setVolume(const SparseVolume &volume) {
+    // Sparse tree, sampled in place and skipped where it holds only background
+    resetVolume(volume.getDims(), volume.getType(), volume.getSpacing());
+    valueRange = volume.getValueRange();
+    sparseVolume = &volume;
+    rayMarcher.setVolume(volume, valueRange);
+  }
+
+  void Renderer::setTransferFunction(const TransferFunction &transferFunction) {
+    restartRefinement();
+    rayMarcher.setTransferFunction(transferFunction);
+  }
+
+  void Renderer::setSettings(const RenderSettings &settings) {
+    restartRefinement();
+    rayMarcher.setSettings(settings);
+  }
+
+  size_t Renderer::selectLevel() const {
+    // Footprint of a pixel at the volume center, in full resolution voxels
+    const float pixelSize = 2.f * camera.getDistance() * std::tan(0.5f * camera.getFieldOfView()) /
+                            std::max(window.getFramebufferDims().y, 1);
+    const glm::vec3 spacing = volume.spacing;
+    return static_cast<size_t>(selectMipLevel(pixelSize / std::min({spacing.x, spacing.y, spacing.z}),
+                                              static_cast<int>(brickedLevels->size())));
+  }
+
+  void Renderer::useLevel(size_t level) {
+    // One level resident at a time, each with the full budget
+    const BrickedVolume &volume = (*brickedLevels)[level];
+    restartRefinement();
+    rayMarcher.clearVolume();
+    brickPrefetcher.reset();
+    brickCache = std::make_unique<BrickCache>(volume, cacheBytes);
+    brickPrefetcher = std::make_unique<BrickPrefetcher>(*brickCache, pool);
+    brickedLevel = level;
+
+    // Warm the cache with the bricks nearest the volume center
+    std::vector<uint32_t> bricks(volume.getBrickCount());
+    std::iota(bricks.begin(), bricks.end(), 0);
+    auto center = glm::vec3(volume.getBrickGrid() - 1) * 0.5f;
+    auto distance = [&](uint32_t i) {
+      auto d = glm::vec3(volume.getBrickCoord(i)) - center;
+      return glm::dot(d, d);
+    };
+    size_t count = std::min(bricks.size(), brickCache->getCapacity());
+    std::partial_sort(bricks.begin(), bricks.begin() + count, bricks.end(),
+                      [&](uint32_t a, uint32_t b) { return distance(a) < distance(b); });
+    bricks.resize(count);
+    brickPrefetcher->request(bricks);
+
+    // Opacity stays defined per full resolution voxel on every level
+    const glm::vec3 spacing = this->volume.spacing;
+    rayMarcher.setVolume(*brickCache, valueRange, std::min({spacing.x, spacing.y, spacing.z}));
+  }
+
+  void Renderer::handleInput() {
+    // Left drag orbits, right drag zooms
+    GLFWwindow *object = window.getObject();
+    glm::dvec2 position;
+    glfwGetCursorPos(object, &position.x, &position.y);
+    const glm::vec2 delta = glm::vec2(position - cursor) / static_cast<float>(std::max(window.getWindowDims().y, 1));
+    cursor = position;
+    if (glfwGetMouseButton(object, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+      camera.orbit(-3.f * delta.x, 3.f * delta.y);
+    } else if (glfwGetMouseButton(object, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+      camera.zoom(std::exp(2.f * delta.y));
+    }
+
+    // F toggles variable rate rendering, its focus following the cursor
+    RenderSettings settings = rayMarcher.getSettings();
+    const bool focusKey = glfwGetKey(object, GLFW_KEY_F) == GLFW_PRESS;
+    bool changed = focusKey && !focusKeyDown;
+    focusKeyDown = focusKey;
+    settings.foveated = settings.foveated != changed;
+    if (settings.foveated && (changed || delta != glm::vec2(0.f))) {
+      const glm::vec2 windowDims = glm::max(glm::vec2(window.getWindowDims()), glm::vec2(1.f));
+      settings.focus = glm::vec2(position.x / windowDims.x, 1.0 - position.y / windowDims.y);
+      changed = true;
+    }
+    if (changed) {
+      setSettings(settings);
+    }
+  }
+
   void Renderer::update() {
     auto frameDims = window.getFramebufferDims();
+    handleInput();
+
+    // Any change of view restarts refinement at the coarsest level
+    if (frameDims != shownDims || camera.getViewMatrix() != shownView) {
+      restartRefinement();
+    }
+
+    // Collect finished brick reads; never waits on disk
+    if (brickPrefetcher) {
+      brickPrefetcher->update();
+    }
+
+    // Switch mip level when zooming changed the footprint of a pixel
+    if (brickedLevels && selectLevel() != brickedLevel) {
+      useLevel(selectLevel());
+    }
+
+    // Ray march on the CPU and upload the frame: the coarsest level right
+    // away, then each finer one as its pass completes in the background,
+    // until full quality. Path tracing starts at full resolution and keeps
+    // adding passes of one path per pixel instead; temporal reuse starts at
+    // full resolution from the previous frame and retraces the reused
+    // pixels in one pass; variable rate frames are final.
+    const RenderSettings &settings = rayMarcher.getSettings();
+    if (shownLevel < 0) {
+      shownLevel = settings.pathTrace || settings.temporalReuse || settings.foveated
+                       ? 0
+                       : std::clamp(settings.refinementLevels, 0, RayMarcher::maxCoarseLevel);
+      rayMarcher.render(camera, frameDims, shownLevel);
+      shownView = camera.getViewMatrix();
+      shownDims = frameDims;
+      uploadImage();
+    } else if (refinement.valid() && refinement.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      refinement.get();
+      if (shownLevel > 0) {
+        shownLevel--;
+      }
+      uploadImage();
+    }
+    auto hasMorePasses = [&] {
+      const RenderStats stats = rayMarcher.getStats();
+      return settings.pathTrace ? stats.pathPasses < settings.maxPathPasses
+                                : settings.temporalReuse && stats.stalePixels > 0;
+    };
+    if (!refinement.valid() && (shownLevel > 0 || hasMorePasses())) {
+      // The pass gets its own copy of the camera, which input keeps moving
+      refinementCancel = std::make_shared<std::atomic<bool>>(false);
+      refinement = pool.submit([this, view = camera, dims = shownDims, level = std::max(shownLevel - 1, 0),
+                                cancel = refinementCancel] {
+        rayMarcher.render(view, dims, level, cancel.get());
+      });
+    }
+    const Program &drawPrg = foveatedFrame ? foveatedDrawPrg : windowDrawPrg;
+    if (foveatedFrame) {
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, peripheryTextures[0]);
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_2D, peripheryTextures[1]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frameTexture);
 
     // Prepare for drawing
     glViewport(0, 0, frameDims.x, frameDims.y);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    windowDrawPrg.beginUse();
+    drawPrg.beginUse();
 
     // Draw screen quad
     glBindVertexArray(quadVAO);
@@ -84,6 +382,11 @@ namespace CUDAVol {
     glBindVertexArray(0);
 
     // Clean up drawing
-    windowDrawPrg.endUse();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    drawPrg.endUse();
+  }
+
+  const RayMarcher &Renderer::getRayMarcher() const {
+    return rayMarcher;
   }
-} // namespace CUDAVol
\ No newline at end of file
+} // namespace CUDAVol
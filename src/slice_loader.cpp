@@ -0,0 +1,545 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  slice_loader.cpp
+
+  Slice stack loader definition. TIFF decoding is built in (baseline strips,
+  uncompressed/PackBits/Deflate); PNG decoding requires libpng.
+
+  November 2019
+*/
+
+#include "slice_loader.h"
+#include "bounded_queue.h"
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#ifdef CUDAVOL_HAS_PNG
+#include <png.h>
+#endif
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::high_resolution_clock;
+
+namespace CUDAVol {
+  // Single channel slice in host byte order
+  struct DecodedSlice {
+    size_t index = 0;
+    int width = 0;
+    int height = 0;
+    int bits = 8;
+    bool isFloat = false;
+    bool isSigned = false;
+    std::vector<std::byte> pixels;
+  };
+
+  struct EncodedSlice {
+    size_t index = 0;
+    std::vector<std::byte> bytes;
+  };
+
+  [[noreturn]] static void fail(const std::string &filePath, const std::string &msg) {
+    std::cerr << "Error loading slice " << filePath << ": " << msg << std::endl;
+    throw std::runtime_error("SliceLoader: " + msg);
+  }
+
+  static double elapsed(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  static std::string lower(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return str;
+  }
+
+  static std::vector<std::byte> readFile(const std::string &filePath) {
+    std::ifstream ifs(filePath, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!ifs.is_open()) {
+      fail(filePath, "cannot open file");
+    }
+    std::vector<std::byte> bytes(static_cast<size_t>(ifs.tellg()));
+    ifs.seekg(0);
+    ifs.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+    if (!ifs) {
+      fail(filePath, "short read");
+    }
+    return bytes;
+  }
+
+  static DecodedSlice decodeTiff(const std::string &filePath, const std::vector<std::byte> &bytes) {
+    const auto *data = reinterpret_cast<const uint8_t *>(bytes.data());
+    const size_t size = bytes.size();
+    if (size < 8 || !((data[0] == 'I' && data[1] == 'I') || (data[0] == 'M' && data[1] == 'M'))) {
+      fail(filePath, "not a TIFF file");
+    }
+    const bool big = data[0] == 'M';
+    auto u16 = [&](size_t i) -> uint32_t {
+      if (i + 2 > size) fail(filePath, "truncated TIFF");
+      return big ? (data[i] << 8 | data[i + 1]) : (data[i] | data[i + 1] << 8);
+    };
+    auto u32 = [&](size_t i) -> uint32_t {
+      return big ? (u16(i) << 16 | u16(i + 2)) : (u16(i) | u16(i + 2) << 16);
+    };
+    if (u16(2) != 42) {
+      fail(filePath, "BigTIFF is not supported");
+    }
+
+    // Read the tags we care about from the first image file directory
+    std::map<uint32_t, std::vector<uint32_t>> tags;
+    auto tag = [&](uint32_t id) -> std::vector<uint32_t> & { return tags[id]; };
+    std::vector<uint32_t> ids = {256, 257, 258, 259, 273, 277, 278, 279, 284, 317, 339};
+    size_t ifd = u32(4);
+    uint32_t entries = u16(ifd);
+    for (uint32_t e = 0; e < entries; e++) {
+      size_t entry = ifd + 2 + e * 12;
+      uint32_t id = u16(entry), type = u16(entry + 2), count = u32(entry + 4);
+      if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+        continue;
+      }
+      size_t typeSize = type == 3 ? 2 : type == 4 ? 4 : 1;
+      size_t values = count * typeSize <= 4 ? entry + 8 : u32(entry + 8);
+      auto &v = tag(id);
+      v.resize(count);
+      for (uint32_t i = 0; i < count; i++) {
+        size_t at = values + i * typeSize;
+        v[i] = type == 3 ? u16(at) : type == 4 ? u32(at) : (at < size ? data[at] : 0);
+      }
+    }
+    auto get = [&](uint32_t id, uint32_t fallback) {
+      return tag(id).empty() ? fallback : tag(id)[0];
+    };
+
+    DecodedSlice slice;
+    slice.width = static_cast<int>(get(256, 0));
+    slice.height = static_cast<int>(get(257, 0));
+    slice.bits = static_cast<int>(get(258, 8));
+    const uint32_t compression = get(259, 1);
+    const uint32_t samples = get(277, 1);
+    const uint32_t rowsPerStrip = std::min<uint32_t>(get(278, slice.height), slice.height);
+    const uint32_t predictor = get(317, 1);
+    const uint32_t format = get(339, 1);
+    slice.isFloat = format == 3;
+    slice.isSigned = format == 2;
+
+    if (slice.width <= 0 || slice.height <= 0 || tag(273).empty()) {
+      fail(filePath, "unsupported TIFF layout (tiled or missing strips)");
+    } else if (get(284, 1) != 1 && samples > 1) {
+      fail(filePath, "planar TIFF layout is not supported");
+    } else if (slice.bits != 8 && slice.bits != 16 && slice.bits != 32) {
+      fail(filePath, "unsupported bit depth " + std::to_string(slice.bits));
+    } else if (compression != 1 && compression != 8 && compression != 32946 &&
+               compression != 32773) {
+      fail(filePath, "unsupported compression " + std::to_string(compression) +
+                         " (only none, Deflate and PackBits)");
+    }
+
+    // Decode strips into interleaved rows
+    const size_t sampleBytes = slice.bits / 8;
+    const size_t rowBytes = slice.width * samples * sampleBytes;
+    std::vector<uint8_t> raw(rowBytes * slice.height);
+    const auto &offsets = tag(273), &counts = tag(279);
+    for (size_t s = 0; s < offsets.size(); s++) {
+      size_t dstOffset = s * rowsPerStrip * rowBytes;
+      if (dstOffset >= raw.size()) {
+        break;
+      }
+      size_t dstSize = std::min(raw.size() - dstOffset, rowsPerStrip * rowBytes);
+      size_t srcSize = s < counts.size() ? counts[s] : dstSize;
+      if (offsets[s] + srcSize > size) {
+        fail(filePath, "strip beyond end of file");
+      }
+      const uint8_t *src = data + offsets[s];
+      uint8_t *dst = raw.data() + dstOffset;
+
+      if (compression == 1) {
+        std::memcpy(dst, src, std::min(srcSize, dstSize));
+      } else if (compression == 32773) {
+        size_t i = 0, o = 0;
+        while (i < srcSize && o < dstSize) {
+          int8_t n = static_cast<int8_t>(src[i++]);
+          if (n >= 0) {
+            size_t len = std::min<size_t>(n + 1, std::min(dstSize - o, srcSize - i));
+            std::memcpy(dst + o, src + i, len);
+            i += len;
+            o += len;
+          } else if (n != -128 && i < srcSize) {
+            size_t len = std::min<size_t>(1 - n, dstSize - o);
+            std::memset(dst + o, src[i++], len);
+            o += len;
+          }
+        }
+      } else {
+        uLongf outSize = static_cast<uLongf>(dstSize);
+        int ret = uncompress(dst, &outSize, src, static_cast<uLong>(srcSize));
+        if (ret != Z_OK && !(ret == Z_BUF_ERROR && outSize == dstSize)) {
+          fail(filePath, "corrupt Deflate strip");
+        }
+      }
+    }
+
+    // Byte order first, so the predictor works on host order samples
+    if (big && sampleBytes > 1) {
+      for (size_t i = 0; i < raw.size(); i += sampleBytes) {
+        std::reverse(raw.begin() + i, raw.begin() + i + sampleBytes);
+      }
+    }
+    if (predictor == 2 && !slice.isFloat) {
+      for (int y = 0; y < slice.height; y++) {
+        uint8_t *row = raw.data() + y * rowBytes;
+        for (size_t x = samples; x < static_cast<size_t>(slice.width) * samples; x++) {
+          if (sampleBytes == 1) {
+            row[x] += row[x - samples];
+          } else if (sampleBytes == 2) {
+            uint16_t a, b;
+            std::memcpy(&a, row + x * 2, 2);
+            std::memcpy(&b, row + (x - samples) * 2, 2);
+            a += b;
+            std::memcpy(row + x * 2, &a, 2);
+          }
+        }
+      }
+    }
+
+    if (samples == 1) {
+      slice.pixels.resize(raw.size());
+      std::memcpy(slice.pixels.data(), raw.data(), raw.size());
+      return slice;
+    }
+
+    // Reduce RGB(A) to the mean of its color channels
+    const size_t channels = std::min<uint32_t>(samples, 3);
+    const size_t count = static_cast<size_t>(slice.width) * slice.height;
+    slice.pixels.resize(count * sampleBytes);
+    auto reduce = [&](auto zero) {
+      using T = decltype(zero);
+      for (size_t i = 0; i < count; i++) {
+        double sum = 0.0;
+        for (size_t c = 0; c < channels; c++) {
+          T v;
+          std::memcpy(&v, raw.data() + (i * samples + c) * sizeof(T), sizeof(T));
+          sum += v;
+        }
+        T v = static_cast<T>(sum / channels);
+        std::memcpy(slice.pixels.data() + i * sizeof(T), &v, sizeof(T));
+      }
+    };
+    if (slice.isFloat) {
+      reduce(0.f);
+    } else if (sampleBytes == 1) {
+      reduce(uint8_t(0));
+    } else if (sampleBytes == 2) {
+      reduce(uint16_t(0));
+    } else {
+      reduce(uint32_t(0));
+    }
+    return slice;
+  }
+
+#ifdef CUDAVOL_HAS_PNG
+  static DecodedSlice decodePng(const std::string &filePath, const std::vector<std::byte> &bytes) {
+    struct Reader {
+      const std::vector<std::byte> *bytes;
+      size_t offset;
+    } reader{&bytes, 8};
+
+    if (bytes.size() < 8 || png_sig_cmp(reinterpret_cast<png_const_bytep>(bytes.data()), 0, 8)) {
+      fail(filePath, "not a PNG file");
+    }
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png ? png_create_info_struct(png) : nullptr;
+    if (!info) {
+      png_destroy_read_struct(&png, nullptr, nullptr);
+      fail(filePath, "libpng initialization failed");
+    }
+
+    DecodedSlice slice;
+    std::vector<png_bytep> rows;
+    if (setjmp(png_jmpbuf(png))) {
+      png_destroy_read_struct(&png, &info, nullptr);
+      fail(filePath, "corrupt PNG");
+    }
+
+    png_set_read_fn(png, &reader, [](png_structp p, png_bytep out, png_size_t n) {
+      auto r = static_cast<Reader *>(png_get_io_ptr(p));
+      if (r->offset + n > r->bytes->size()) {
+        png_error(p, "truncated");
+      }
+      std::memcpy(out, r->bytes->data() + r->offset, n);
+      r->offset += n;
+    });
+    png_set_sig_bytes(png, 8);
+    png_read_info(png, info);
+
+    // Normalize to single channel 8 or 16 bit samples in host byte order
+    const int colorType = png_get_color_type(png, info);
+    if (colorType == PNG_COLOR_TYPE_PALETTE) {
+      png_set_palette_to_rgb(png);
+    }
+    if (colorType == PNG_COLOR_TYPE_GRAY && png_get_bit_depth(png, info) < 8) {
+      png_set_expand_gray_1_2_4_to_8(png);
+    }
+    if (colorType & PNG_COLOR_MASK_ALPHA) {
+      png_set_strip_alpha(png);
+    }
+    if (colorType & PNG_COLOR_MASK_COLOR || colorType == PNG_COLOR_TYPE_PALETTE) {
+      png_set_rgb_to_gray_fixed(png, 1, -1, -1);
+    }
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && png_get_bit_depth(png, info) == 16) {
+      png_set_swap(png);
+    }
+    png_read_update_info(png, info);
+
+    slice.width = static_cast<int>(png_get_image_width(png, info));
+    slice.height = static_cast<int>(png_get_image_height(png, info));
+    slice.bits = png_get_bit_depth(png, info);
+    const size_t rowBytes = png_get_rowbytes(png, info);
+    slice.pixels.resize(rowBytes * slice.height);
+    rows.resize(slice.height);
+    for (int y = 0; y < slice.height; y++) {
+      rows[y] = reinterpret_cast<png_bytep>(slice.pixels.data() + y * rowBytes);
+    }
+    png_read_image(png, rows.data());
+    png_destroy_read_struct(&png, &info, nullptr);
+    return slice;
+  }
+#endif
+
+  static DecodedSlice decode(const std::string &filePath, const std::vector<std::byte> &bytes) {
+    auto ext = lower(fs::path(filePath).extension().string());
+    if (ext == ".tif" || ext == ".tiff") {
+      return decodeTiff(filePath, bytes);
+    }
+#ifdef CUDAVOL_HAS_PNG
+    if (ext == ".png") {
+      return decodePng(filePath, bytes);
+    }
+#endif
+    fail(filePath, "unsupported slice format '" + ext + "'");
+  }
+
+  template <typename S, typename D>
+  static void convertSlice(const DecodedSlice &slice, std::byte *dst) {
+    const auto *s = reinterpret_cast<const S *>(slice.pixels.data());
+    auto *d = reinterpret_cast<D *>(dst);
+    const size_t count = static_cast<size_t>(slice.width) * slice.height;
+    for (size_t i = 0; i < count; i++) {
+      d[i] = static_cast<D>(s[i]);
+    }
+  }
+
+  template <typename D>
+  static void convertSlice(const DecodedSlice &slice, std::byte *dst) {
+    if (slice.isFloat) {
+      convertSlice<float, D>(slice, dst);
+    } else if (slice.bits == 8) {
+      slice.isSigned ? convertSlice<int8_t, D>(slice, dst) : convertSlice<uint8_t, D>(slice, dst);
+    } else if (slice.bits == 16) {
+      slice.isSigned ? convertSlice<int16_t, D>(slice, dst) : convertSlice<uint16_t, D>(slice, dst);
+    } else {
+      slice.isSigned ? convertSlice<int32_t, D>(slice, dst) : convertSlice<uint32_t, D>(slice, dst);
+    }
+  }
+
+  static VoxelType getVoxelType(const DecodedSlice &slice) {
+    if (!slice.isFloat && !slice.isSigned && slice.bits == 8) {
+      return VoxelType::UInt8;
+    } else if (!slice.isFloat && !slice.isSigned && slice.bits == 16) {
+      return VoxelType::UInt16;
+    }
+    return VoxelType::Float32;
+  }
+
+  SliceLoader::SliceLoader(unsigned readThreads,
+                           unsigned decodeThreads,
+                           unsigned convertThreads,
+                           size_t queueCapacity)
+    : readThreads(std::max(1u, readThreads)),
+      decodeThreads(decodeThreads),
+      convertThreads(convertThreads),
+      queueCapacity(queueCapacity) {
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    if (this->decodeThreads == 0) {
+      this->decodeThreads = hw;
+    }
+    if (this->convertThreads == 0) {
+      this->convertThreads = std::max(1u, hw / 4);
+    }
+    if (this->queueCapacity == 0) {
+      this->queueCapacity = 2 * this->decodeThreads;
+    }
+  }
+
+  Volume SliceLoader::load(const std::string &directory, glm::vec3 spacing) {
+    std::vector<std::string> filePaths;
+    for (const auto &entry : fs::directory_iterator(resolveVolumePath(directory))) {
+      auto ext = lower(entry.path().extension().string());
+      if (entry.is_regular_file() && (ext == ".png" || ext == ".tif" || ext == ".tiff")) {
+        filePaths.push_back(entry.path().string());
+      }
+    }
+    std::sort(filePaths.begin(), filePaths.end(), naturalLess);
+    if (filePaths.empty()) {
+      fail(directory, "no .png/.tif/.tiff slices found");
+    }
+    return load(filePaths, spacing);
+  }
+
+  Volume SliceLoader::load(const std::vector<std::string> &filePaths, glm::vec3 spacing) {
+    timings = SliceTimings();
+    const auto start = Clock::now();
+    if (filePaths.empty()) {
+      fail("", "empty slice list");
+    }
+
+    // First slice determines dimensions and voxel type of the whole stack
+    const DecodedSlice first = decode(filePaths[0], readFile(filePaths[0]));
+    const glm::ivec3 dims(first.width, first.height, static_cast<int>(filePaths.size()));
+    const VoxelType type = getVoxelType(first);
+    Volume volume(dims, type, spacing);
+    std::byte *dst = volume.getMutableData();
+    const size_t sliceBytes = static_cast<size_t>(dims.x) * dims.y * getVoxelSize(type);
+
+    BoundedQueue<EncodedSlice> encoded(queueCapacity);
+    BoundedQueue<DecodedSlice> decoded(queueCapacity);
+    std::atomic<size_t> nextSlice{0};
+    std::atomic<unsigned> activeReaders{readThreads}, activeDecoders{decodeThreads};
+    std::atomic<int64_t> readNs{0}, decodeNs{0}, convertNs{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto abort = [&]() {
+      {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      encoded.cancel();
+      decoded.cancel();
+    };
+    auto busy = [](std::atomic<int64_t> &counter, Clock::time_point since) {
+      counter += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < readThreads; i++) {
+      threads.emplace_back([&]() {
+        try {
+          size_t z;
+          while ((z = nextSlice.fetch_add(1)) < filePaths.size()) {
+            auto t = Clock::now();
+            EncodedSlice item{z, readFile(filePaths[z])};
+            busy(readNs, t);
+            if (!encoded.push(std::move(item))) {
+              break;
+            }
+          }
+        } catch (...) {
+          abort();
+        }
+        if (--activeReaders == 0) {
+          encoded.close();
+        }
+      });
+    }
+    for (unsigned i = 0; i < decodeThreads; i++) {
+      threads.emplace_back([&]() {
+        try {
+          EncodedSlice item;
+          while (encoded.pop(item)) {
+            auto t = Clock::now();
+            DecodedSlice slice = decode(filePaths[item.index], item.bytes);
+            slice.index = item.index;
+            item.bytes = std::vector<std::byte>();
+            busy(decodeNs, t);
+            if (slice.width != dims.x || slice.height != dims.y) {
+              fail(filePaths[item.index], "slice dimensions differ from first slice");
+            }
+            if (!decoded.push(std::move(slice))) {
+              break;
+            }
+          }
+        } catch (...) {
+          abort();
+        }
+        if (--activeDecoders == 0) {
+          decoded.close();
+        }
+      });
+    }
+    for (unsigned i = 0; i < convertThreads; i++) {
+      threads.emplace_back([&]() {
+        try {
+          DecodedSlice slice;
+          while (decoded.pop(slice)) {
+            // Converting straight into the destination slice is the placement
+            auto t = Clock::now();
+            std::byte *out = dst + slice.index * sliceBytes;
+            switch (type) {
+            case VoxelType::UInt8:
+              convertSlice<uint8_t>(slice, out);
+              break;
+            case VoxelType::UInt16:
+              convertSlice<uint16_t>(slice, out);
+              break;
+            case VoxelType::Float32:
+              convertSlice<float>(slice, out);
+              break;
+            }
+            busy(convertNs, t);
+          }
+        } catch (...) {
+          abort();
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    timings.read = readNs / 1e6;
+    timings.decode = decodeNs / 1e6;
+    timings.convert = convertNs / 1e6;
+    timings.total = elapsed(start);
+    return volume;
+  }
+
+  const SliceTimings &SliceLoader::getTimings() const {
+    return timings;
+  }
+} // namespace CUDAVol
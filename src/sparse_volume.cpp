@@ -0,0 +1,347 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  sparse_volume.cpp
+
+  Sparse volume class definition.
+
+  November 2019
+*/
+
+#include "sparse_volume.h"
+#include <algorithm>
+#include <bitset>
+
+namespace CUDAVol {
+  static void fillValues(VoxelType type, std::byte *dst, size_t count, float value) {
+    visitVoxelType(type, [&](auto t) {
+      using T = decltype(t);
+      std::fill_n(reinterpret_cast<T *>(dst), count, static_cast<T>(value));
+    });
+  }
+
+  SparseVolume::SparseVolume()
+    : dims(0), shift(0), type(VoxelType::Float32), spacing(1.f), background(0.f), rootGrid(0) {}
+
+  SparseVolume::SparseVolume(glm::ivec3 dims,
+                             VoxelType type,
+                             glm::vec3 spacing,
+                             float background,
+                             glm::ivec3 shift)
+    : dims(dims),
+      shift(shift),
+      type(type),
+      spacing(spacing),
+      background(background),
+      rootGrid((dims + shift + nodeDim - 1) / nodeDim) {
+    const size_t rootCount = static_cast<size_t>(rootGrid.x) * rootGrid.y * rootGrid.z;
+    rootNodes.assign(rootCount, noChild);
+    rootTiles.assign(rootCount, background);
+    rootActive.assign(rootCount, 0);
+  }
+
+  size_t SparseVolume::getRootIndex(glm::ivec3 q) const {
+    const glm::ivec3 c = q / nodeDim;
+    return c.x + rootGrid.x * (static_cast<size_t>(c.y) + rootGrid.y * static_cast<size_t>(c.z));
+  }
+
+  size_t SparseVolume::getSlotIndex(glm::ivec3 q) {
+    const glm::ivec3 l = (q >> leafLog2) & ((1 << nodeLog2) - 1);
+    return l.x + (l.y << nodeLog2) + (l.z << (2 * nodeLog2));
+  }
+
+  uint32_t SparseVolume::getNode(glm::ivec3 q) {
+    const size_t r = getRootIndex(q);
+    if (rootNodes[r] == noChild) {
+      Node &node = nodes.emplace_back();
+      std::fill_n(node.leaves, nodeSlots, noChild);
+      std::fill_n(node.tiles, nodeSlots, rootTiles[r]);
+      std::fill_n(node.activeTiles, nodeSlots / 64, rootActive[r] ? ~uint64_t(0) : 0);
+      rootNodes[r] = static_cast<uint32_t>(nodes.size() - 1);
+    }
+    return rootNodes[r];
+  }
+
+  SparseVolume SparseVolume::fromDense(ThreadPool &pool, const VolumeView &volume, float background) {
+    SparseVolume result(volume.dims, volume.type, volume.spacing, background);
+    const glm::ivec3 grid = (volume.dims + leafDim - 1) / leafDim;
+    const size_t leafCount = static_cast<size_t>(grid.x) * grid.y * grid.z;
+    auto leafOrigin = [&](size_t i) {
+      return glm::ivec3(i % grid.x, (i / grid.x) % grid.y, i / (size_t(grid.x) * grid.y)) * leafDim;
+    };
+
+    visitVoxelType(volume.type, [&](auto t) {
+      using T = decltype(t);
+      const T *src = volume.as<T>();
+      const glm::ivec3 d = volume.dims;
+      auto forEachVoxel = [&](glm::ivec3 origin, auto &&f) {
+        const glm::ivec3 end = glm::min(origin + leafDim, d);
+        for (int z = origin.z; z < end.z; z++) {
+          for (int y = origin.y; y < end.y; y++) {
+            const T *row = src + (static_cast<size_t>(z) * d.y + y) * d.x;
+            for (int x = origin.x; x < end.x; x++) {
+              f(glm::ivec3(x, y, z) - origin, row[x]);
+            }
+          }
+        }
+      };
+
+      // Find occupied leaves in parallel, allocate them in order, then fill in parallel
+      std::vector<uint8_t> occupied(leafCount);
+      pool.parallelFor(0, leafCount, 64, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+          bool any = false;
+          forEachVoxel(leafOrigin(i), [&](glm::ivec3, T v) {
+            any |= static_cast<float>(v) != background;
+          });
+          occupied[i] = any;
+        }
+      });
+
+      std::vector<std::pair<size_t, uint32_t>> leaves;
+      for (size_t i = 0; i < leafCount; i++) {
+        if (occupied[i]) {
+          leaves.emplace_back(i, result.addLeaf(leafOrigin(i)));
+        }
+      }
+
+      pool.parallelFor(0, leaves.size(), 64, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+          T *dst = reinterpret_cast<T *>(result.getLeafData(leaves[i].second));
+          uint64_t *mask = result.getLeafMask(leaves[i].second);
+          forEachVoxel(leafOrigin(leaves[i].first), [&](glm::ivec3 l, T v) {
+            const int n = l.x + leafDim * (l.y + leafDim * l.z);
+            dst[n] = v;
+            if (static_cast<float>(v) != background) {
+              mask[n / 64] |= uint64_t(1) << (n % 64);
+            }
+          });
+        }
+      });
+    });
+    return result;
+  }
+
+  uint32_t SparseVolume::addLeaf(glm::ivec3 origin) {
+    Node &node = nodes[getNode(origin)];
+    const size_t slot = getSlotIndex(origin);
+    if (node.leaves[slot] == noChild) {
+      const size_t voxelSize = getVoxelSize(type);
+      const bool active = node.activeTiles[slot / 64] >> (slot % 64) & 1;
+      node.leaves[slot] = static_cast<uint32_t>(leafMasks.size() / (leafVoxels / 64));
+      leafData.resize(leafData.size() + leafVoxels * voxelSize);
+      fillValues(type, leafData.data() + leafData.size() - leafVoxels * voxelSize, leafVoxels,
+                 node.tiles[slot]);
+      leafMasks.resize(leafMasks.size() + leafVoxels / 64, active ? ~uint64_t(0) : 0);
+    }
+    return node.leaves[slot];
+  }
+
+  void SparseVolume::setLeafTile(glm::ivec3 origin, float value, bool active) {
+    Node &node = nodes[getNode(origin)];
+    const size_t slot = getSlotIndex(origin);
+    node.leaves[slot] = noChild;
+    node.tiles[slot] = value;
+    if (active) {
+      node.activeTiles[slot / 64] |= uint64_t(1) << (slot % 64);
+    } else {
+      node.activeTiles[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    }
+  }
+
+  void SparseVolume::setNodeTile(glm::ivec3 origin, float value, bool active) {
+    const size_t r = getRootIndex(origin);
+    rootNodes[r] = noChild;
+    rootTiles[r] = value;
+    rootActive[r] = active;
+  }
+
+  std::byte *SparseVolume::getLeafData(uint32_t leaf) {
+    return leafData.data() + static_cast<size_t>(leaf) * leafVoxels * getVoxelSize(type);
+  }
+
+  uint64_t *SparseVolume::getLeafMask(uint32_t leaf) {
+    return leafMasks.data() + static_cast<size_t>(leaf) * (leafVoxels / 64);
+  }
+
+  bool SparseVolume::isOccupied(glm::ivec3 cell, int size) const {
+    const glm::ivec3 q = cell * size;
+    if (q.x < 0 || q.y < 0 || q.z < 0 || q.x >= rootGrid.x * nodeDim || q.y >= rootGrid.y * nodeDim ||
+        q.z >= rootGrid.z * nodeDim) {
+      return false;
+    }
+    const size_t r = getRootIndex(q);
+    if (rootNodes[r] == noChild) {
+      return rootActive[r] || rootTiles[r] != background;
+    } else if (size == nodeDim) {
+      return true;
+    }
+    const Node &node = nodes[rootNodes[r]];
+    const size_t slot = getSlotIndex(q);
+    return node.leaves[slot] != noChild || (node.activeTiles[slot / 64] >> (slot % 64) & 1) ||
+           node.tiles[slot] != background;
+  }
+
+  bool SparseVolume::isNearOccupied(glm::ivec3 cell, int size) const {
+    if (isOccupied(cell, size)) {
+      return true;
+    }
+    for (int z = -1; z <= 1; z++) {
+      for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+          if ((x || y || z) && isOccupied(cell + glm::ivec3(x, y, z), size)) {
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+  const std::byte *SparseVolume::probeLeaf(glm::ivec3 q, float &tile) const {
+    const size_t r = getRootIndex(q);
+    if (rootNodes[r] == noChild) {
+      tile = rootTiles[r];
+      return nullptr;
+    }
+    const Node &node = nodes[rootNodes[r]];
+    const size_t slot = getSlotIndex(q);
+    if (node.leaves[slot] == noChild) {
+      tile = node.tiles[slot];
+      return nullptr;
+    }
+    return leafData.data() + static_cast<size_t>(node.leaves[slot]) * leafVoxels * getVoxelSize(type);
+  }
+
+  float SparseVolume::getValue(glm::ivec3 p) const {
+    const glm::ivec3 q = p + shift;
+    float tile = 0.f;
+    const std::byte *leaf = probeLeaf(q, tile);
+    if (!leaf) {
+      return tile;
+    }
+    const glm::ivec3 l = q & (leafDim - 1);
+    const int n = l.x + leafDim * (l.y + leafDim * l.z);
+    return visitVoxelType(type, [&](auto t) {
+      using T = decltype(t);
+      return static_cast<float>(reinterpret_cast<const T *>(leaf)[n]);
+    });
+  }
+
+  bool SparseVolume::isActive(glm::ivec3 p) const {
+    const glm::ivec3 q = p + shift;
+    const size_t r = getRootIndex(q);
+    if (rootNodes[r] == noChild) {
+      return rootActive[r];
+    }
+    const Node &node = nodes[rootNodes[r]];
+    const size_t slot = getSlotIndex(q);
+    if (node.leaves[slot] == noChild) {
+      return node.activeTiles[slot / 64] >> (slot % 64) & 1;
+    }
+    const glm::ivec3 l = q & (leafDim - 1);
+    const int n = l.x + leafDim * (l.y + leafDim * l.z);
+    return leafMasks[static_cast<size_t>(node.leaves[slot]) * (leafVoxels / 64) + n / 64] >> (n % 64) & 1;
+  }
+
+  glm::ivec3 SparseVolume::getDims() const {
+    return dims;
+  }
+
+  glm::ivec3 SparseVolume::getShift() const {
+    return shift;
+  }
+
+  VoxelType SparseVolume::getType() const {
+    return type;
+  }
+
+  glm::vec3 SparseVolume::getSpacing() const {
+    return spacing;
+  }
+
+  float SparseVolume::getBackground() const {
+    return background;
+  }
+
+  glm::vec2 SparseVolume::getValueRange() const {
+    // Over stored leaf values, tiles and background
+    glm::vec2 range(background);
+    auto add = [&](float v) {
+      range = glm::vec2(std::min(range.x, v), std::max(range.y, v));
+    };
+    visitVoxelType(type, [&](auto t) {
+      using T = decltype(t);
+      const T *values = reinterpret_cast<const T *>(leafData.data());
+      for (size_t i = 0, n = getLeafCount() * leafVoxels; i < n; i++) {
+        add(static_cast<float>(values[i]));
+      }
+    });
+    for (size_t r = 0; r < rootNodes.size(); r++) {
+      if (rootNodes[r] == noChild) {
+        add(rootTiles[r]);
+        continue;
+      }
+      const Node &node = nodes[rootNodes[r]];
+      for (int slot = 0; slot < nodeSlots; slot++) {
+        if (node.leaves[slot] == noChild) {
+          add(node.tiles[slot]);
+        }
+      }
+    }
+    return range;
+  }
+
+  size_t SparseVolume::getNodeCount() const {
+    return nodes.size();
+  }
+
+  size_t SparseVolume::getLeafCount() const {
+    return leafMasks.size() / (leafVoxels / 64);
+  }
+
+  size_t SparseVolume::getActiveVoxelCount() const {
+    size_t count = 0;
+    for (uint64_t word : leafMasks) {
+      count += std::bitset<64>(word).count();
+    }
+    for (size_t r = 0; r < rootNodes.size(); r++) {
+      if (rootNodes[r] != noChild) {
+        const Node &node = nodes[rootNodes[r]];
+        for (size_t slot = 0; slot < nodeSlots; slot++) {
+          count += node.leaves[slot] == noChild && (node.activeTiles[slot / 64] >> (slot % 64) & 1)
+                       ? leafVoxels
+                       : 0;
+        }
+      } else if (rootActive[r]) {
+        count += static_cast<size_t>(nodeDim) * nodeDim * nodeDim;
+      }
+    }
+    return count;
+  }
+
+  size_t SparseVolume::getMemorySize() const {
+    return nodes.size() * sizeof(Node) + leafData.size() + leafMasks.size() * sizeof(uint64_t) +
+           rootNodes.size() * (sizeof(uint32_t) + sizeof(float) + sizeof(uint8_t));
+  }
+} // namespace CUDAVol
@@ -0,0 +1,74 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  temporal_format.cpp
+
+  Temporal volume file format definitions.
+
+  November 2019
+*/
+
+#include "temporal_format.h"
+#include <type_traits>
+
+namespace CUDAVol {
+  template <typename T>
+  using DeltaType = std::conditional_t<std::is_floating_point_v<T>, uint32_t, T>;
+
+  void encodeDelta(VoxelType type,
+                   const std::byte *current,
+                   const std::byte *previous,
+                   std::byte *delta,
+                   size_t count) {
+    visitVoxelType(type, [&](auto t) {
+      using T = decltype(t);
+      using D = DeltaType<T>;
+      auto c = reinterpret_cast<const D *>(current);
+      auto p = reinterpret_cast<const D *>(previous);
+      auto d = reinterpret_cast<D *>(delta);
+      for (size_t i = 0; i < count; i++) {
+        if constexpr (std::is_floating_point_v<T>) {
+          d[i] = c[i] ^ p[i];
+        } else {
+          d[i] = static_cast<D>(c[i] - p[i]);
+        }
+      }
+    });
+  }
+
+  void applyDelta(VoxelType type, const std::byte *delta, std::byte *voxels, size_t count) {
+    visitVoxelType(type, [&](auto t) {
+      using T = decltype(t);
+      using D = DeltaType<T>;
+      auto d = reinterpret_cast<const D *>(delta);
+      auto v = reinterpret_cast<D *>(voxels);
+      for (size_t i = 0; i < count; i++) {
+        if constexpr (std::is_floating_point_v<T>) {
+          v[i] ^= d[i];
+        } else {
+          v[i] = static_cast<D>(v[i] + d[i]);
+        }
+      }
+    });
+  }
+} // namespace CUDAVol
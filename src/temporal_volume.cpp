@@ -0,0 +1,279 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  temporal_volume.cpp
+
+  Temporal volume class definition.
+
+  November 2019
+*/
+
+#include "temporal_volume.h"
+#include "glm/common.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace CUDAVol {
+  [[noreturn]] static void fail(const std::string &filePath, const std::string &msg) {
+    std::cerr << "Error reading temporal volume " << filePath << ": " << msg << std::endl;
+    throw std::runtime_error("TemporalVolume: " + msg);
+  }
+
+  static void preadAll(int fd, std::byte *dst, size_t size, uint64_t offset, const std::string &filePath) {
+    while (size > 0) {
+      auto n = pread(fd, dst, size, static_cast<off_t>(offset));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n <= 0) {
+        fail(filePath, "short read");
+      }
+      dst += n;
+      size -= static_cast<size_t>(n);
+      offset += static_cast<uint64_t>(n);
+    }
+  }
+
+  // Whether grid covers dims with bricks of brickSize, with no brick left over
+  static bool isGridConsistent(const int32_t dims[3], uint32_t brickSize, const int32_t grid[3], uint32_t count) {
+    for (int i = 0; i < 3; i++) {
+      if (grid[i] != (static_cast<int64_t>(dims[i]) + brickSize - 1) / brickSize) {
+        return false;
+      }
+    }
+    return static_cast<size_t>(grid[0]) * grid[1] * grid[2] == count;
+  }
+
+  TemporalVolume::TemporalVolume(ThreadPool &pool, const std::string &filePath)
+    : pool(pool), fd(-1), filePath(resolveVolumePath(filePath)), header(), decodedBricks(0) {
+    fd = open(this->filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fail(this->filePath, std::strerror(errno));
+    }
+
+    try {
+      preadAll(fd, reinterpret_cast<std::byte *>(&header), sizeof(header), 0, this->filePath);
+      if (std::memcmp(header.magic, "CVTEMPO", 8) != 0) {
+        fail(this->filePath, "not a temporal volume");
+      } else if (header.version != TemporalFileHeader::currentVersion) {
+        fail(this->filePath, "unsupported version " + std::to_string(header.version));
+      } else if (header.voxelType > static_cast<uint32_t>(VoxelType::Float32)) {
+        fail(this->filePath, "unknown voxel type " + std::to_string(header.voxelType));
+      } else if (header.codec > static_cast<uint32_t>(BrickCodec::Zstd)) {
+        fail(this->filePath, "unknown codec " + std::to_string(header.codec));
+      } else if (!isCodecAvailable(static_cast<BrickCodec>(header.codec))) {
+        fail(this->filePath, std::string("codec ") +
+                                 toString(static_cast<BrickCodec>(header.codec)) +
+                                 " is not compiled in");
+      } else if (header.dims[0] <= 0 || header.dims[1] <= 0 || header.dims[2] <= 0) {
+        fail(this->filePath, "invalid dimensions");
+      } else if (header.brickSize == 0) {
+        fail(this->filePath, "invalid brick size");
+      } else if (!isGridConsistent(header.dims, header.brickSize, header.brickGrid, header.brickCount)) {
+        fail(this->filePath, "inconsistent brick grid");
+      }
+
+      frames.resize(header.timestepCount);
+      preadAll(fd, reinterpret_cast<std::byte *>(frames.data()),
+               frames.size() * sizeof(TemporalFrame), header.tableOffset, this->filePath);
+      if (frames.empty() || !(frames[0].flags & TemporalFrame::keyframe)) {
+        fail(this->filePath, "first timestep is not a keyframe");
+      }
+      for (const auto &frame : frames) {
+        if (frame.indexOffset < frame.offset) {
+          fail(this->filePath, "frame index precedes its bricks");
+        }
+      }
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  }
+
+  TemporalVolume::~TemporalVolume() {
+    close(fd);
+  }
+
+  void TemporalVolume::applyFrame(size_t timestep, Volume &volume, std::vector<uint8_t> *changed) {
+    const auto &frame = frames.at(timestep);
+    const size_t brickCount = header.brickCount;
+    const glm::ivec3 dims = getDims(), grid = getBrickGrid();
+    const int brickSize = getBrickSize();
+    const size_t voxelSize = getVoxelSize(getType());
+
+    // Index and bricks of a frame are adjacent; fetch both in one read
+    const size_t maskBytes = getMaskWords(brickCount) * sizeof(uint64_t);
+    const size_t indexBytes = maskBytes + frame.changed * sizeof(uint32_t);
+    std::vector<std::byte> bytes(frame.indexOffset - frame.offset + indexBytes);
+    preadAll(fd, bytes.data(), bytes.size(), frame.offset, filePath);
+    const std::byte *index = bytes.data() + (frame.indexOffset - frame.offset);
+
+    struct StoredBrick {
+      uint32_t brick;
+      uint32_t size;
+      size_t offset;
+    };
+    std::vector<StoredBrick> stored;
+    stored.reserve(frame.changed);
+    size_t payload = 0;
+    for (size_t word = 0; word < getMaskWords(brickCount); word++) {
+      uint64_t bits;
+      std::memcpy(&bits, index + word * sizeof(uint64_t), sizeof(bits));
+      for (; bits != 0; bits &= bits - 1) {
+        const size_t brick = word * 64 + __builtin_ctzll(bits);
+        uint32_t size;
+        if (brick >= brickCount || stored.size() == frame.changed) {
+          fail(filePath, "corrupt index in timestep " + std::to_string(timestep));
+        }
+        std::memcpy(&size, index + maskBytes + stored.size() * sizeof(uint32_t), sizeof(size));
+        stored.push_back({static_cast<uint32_t>(brick), size, payload});
+        payload += size;
+      }
+    }
+    if (payload != frame.indexOffset - frame.offset) {
+      fail(filePath, "corrupt index in timestep " + std::to_string(timestep));
+    }
+
+    // Bricks are disjoint, so they decode and apply independently
+    const bool keyframe = frame.flags & TemporalFrame::keyframe;
+    std::byte *voxels = volume.getMutableData();
+    pool.parallelFor(0, stored.size(), 4, [&](size_t begin, size_t end) {
+      std::vector<std::byte> delta;
+      for (size_t i = begin; i < end; i++) {
+        const auto &s = stored[i];
+        const glm::ivec3 brick(s.brick % grid.x, (s.brick / grid.x) % grid.y,
+                               s.brick / (size_t(grid.x) * grid.y));
+        const glm::ivec3 origin = brick * brickSize;
+        const glm::ivec3 extent = glm::min(dims - origin, glm::ivec3(brickSize));
+        const size_t rowBytes = extent.x * voxelSize;
+        delta.resize(rowBytes * extent.y * extent.z);
+        if (s.size == 0) {
+          // All zero; a no-op for deltas, but a keyframe brick still gets cleared
+          if (!keyframe) {
+            continue;
+          }
+          std::fill(delta.begin(), delta.end(), std::byte(0));
+        } else if (!decompressBrick(getCodec(), bytes.data() + s.offset, s.size, delta.data(), delta.size())) {
+          fail(filePath, "corrupt brick " + std::to_string(s.brick) + " in timestep " +
+                             std::to_string(timestep));
+        }
+
+        const std::byte *src = delta.data();
+        for (int z = 0; z < extent.z; z++) {
+          for (int y = 0; y < extent.y; y++, src += rowBytes) {
+            std::byte *dst = voxels + ((static_cast<size_t>(origin.z + z) * dims.y + origin.y + y) *
+                                           dims.x + origin.x) * voxelSize;
+            if (keyframe) {
+              std::memcpy(dst, src, rowBytes);
+            } else {
+              applyDelta(getType(), src, dst, extent.x);
+            }
+          }
+        }
+      }
+    });
+
+    decodedBricks.fetch_add(stored.size(), std::memory_order_relaxed);
+    if (changed) {
+      changed->resize(brickCount);
+      for (const auto &s : stored) {
+        (*changed)[s.brick] = 1;
+      }
+    }
+  }
+
+  void TemporalVolume::load(size_t timestep, size_t previous, Volume &volume) {
+    // Decode into the buffer's own storage once it has the right shape
+    if (volume.getDims() != getDims() || volume.getType() != getType() ||
+        !volume.getMutableData()) {
+      volume = Volume(getDims(), getType(), getSpacing());
+      previous = noTimestep;
+    }
+
+    size_t first = getKeyframe(timestep);
+    if (previous != noTimestep && previous < timestep && previous >= first) {
+      first = previous + 1;
+    }
+    for (size_t t = first; t <= timestep; t++) {
+      applyFrame(t, volume);
+    }
+  }
+
+  size_t TemporalVolume::getTimestepCount() const {
+    return frames.size();
+  }
+
+  size_t TemporalVolume::getKeyframe(size_t timestep) const {
+    while (timestep > 0 && !isKeyframe(timestep)) {
+      timestep--;
+    }
+    return timestep;
+  }
+
+  bool TemporalVolume::isKeyframe(size_t timestep) const {
+    return frames.at(timestep).flags & TemporalFrame::keyframe;
+  }
+
+  size_t TemporalVolume::getChangedBricks(size_t timestep) const {
+    return frames.at(timestep).changed;
+  }
+
+  size_t TemporalVolume::getDecodedBricks() const {
+    return decodedBricks.load();
+  }
+
+  glm::ivec3 TemporalVolume::getDims() const {
+    return glm::ivec3(header.dims[0], header.dims[1], header.dims[2]);
+  }
+
+  glm::ivec3 TemporalVolume::getBrickGrid() const {
+    return glm::ivec3(header.brickGrid[0], header.brickGrid[1], header.brickGrid[2]);
+  }
+
+  int TemporalVolume::getBrickSize() const {
+    return static_cast<int>(header.brickSize);
+  }
+
+  size_t TemporalVolume::getBrickCount() const {
+    return header.brickCount;
+  }
+
+  VoxelType TemporalVolume::getType() const {
+    return static_cast<VoxelType>(header.voxelType);
+  }
+
+  glm::vec3 TemporalVolume::getSpacing() const {
+    return glm::vec3(header.spacing[0], header.spacing[1], header.spacing[2]);
+  }
+
+  BrickCodec TemporalVolume::getCodec() const {
+    return static_cast<BrickCodec>(header.codec);
+  }
+
+  const std::string &TemporalVolume::getFilePath() const {
+    return filePath;
+  }
+} // namespace CUDAVol
@@ -0,0 +1,205 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  temporal_writer.cpp
+
+  Temporal writer class definition.
+
+  November 2019
+*/
+
+#include "temporal_writer.h"
+#include "glm/common.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace CUDAVol {
+  struct EncodedBrick {
+    std::vector<std::byte> data;
+    bool changed;
+  };
+
+  // Copies the part of a brick inside the volume into a contiguous buffer
+  static void extractBrick(const std::byte *src,
+                           glm::ivec3 dims,
+                           size_t voxelSize,
+                           glm::ivec3 origin,
+                           glm::ivec3 extent,
+                           std::byte *dst) {
+    const size_t rowBytes = extent.x * voxelSize;
+    for (int z = 0; z < extent.z; z++) {
+      for (int y = 0; y < extent.y; y++) {
+        const size_t voxel = (static_cast<size_t>(origin.z + z) * dims.y + origin.y + y) * dims.x + origin.x;
+        std::memcpy(dst, src + voxel * voxelSize, rowBytes);
+        dst += rowBytes;
+      }
+    }
+  }
+
+  TemporalWriter::TemporalWriter(ThreadPool &pool,
+                                 const std::string &filePath,
+                                 int brickSize,
+                                 int keyframeInterval,
+                                 BrickCodec codec,
+                                 int level)
+    : pool(pool),
+      filePath(filePath),
+      ofs(filePath, std::ios::out | std::ios::binary | std::ios::trunc),
+      brickSize(brickSize),
+      keyframeInterval(keyframeInterval),
+      codec(codec),
+      level(level),
+      header(),
+      offset(sizeof(TemporalFileHeader)) {
+    if (brickSize < 1 || keyframeInterval < 1) {
+      std::cerr << "Invalid brick size " << brickSize << " or keyframe interval "
+                << keyframeInterval << std::endl;
+      throw std::runtime_error("TemporalWriter: invalid parameters");
+    }
+    if (!ofs.is_open()) {
+      std::cerr << "Error opening " << filePath << " for writing" << std::endl;
+      throw std::runtime_error("TemporalWriter: open failed");
+    }
+    ofs.seekp(static_cast<std::streamoff>(offset));
+  }
+
+  size_t TemporalWriter::append(const VolumeView &volume) {
+    if (frames.empty()) {
+      const glm::ivec3 grid = (volume.dims + brickSize - 1) / brickSize;
+      const size_t brickCount = static_cast<size_t>(grid.x) * grid.y * grid.z;
+      if (brickCount > std::numeric_limits<uint32_t>::max()) {
+        std::cerr << "Too many bricks for " << filePath << std::endl;
+        throw std::runtime_error("TemporalWriter: too many bricks");
+      }
+      std::memcpy(header.magic, "CVTEMPO", 8);
+      header.version = TemporalFileHeader::currentVersion;
+      header.voxelType = static_cast<uint32_t>(volume.type);
+      for (int i = 0; i < 3; i++) {
+        header.dims[i] = volume.dims[i];
+        header.spacing[i] = volume.spacing[i];
+        header.brickGrid[i] = grid[i];
+      }
+      header.brickSize = static_cast<uint32_t>(brickSize);
+      header.codec = static_cast<uint32_t>(codec);
+      header.brickCount = static_cast<uint32_t>(brickCount);
+      header.keyframeInterval = static_cast<uint32_t>(keyframeInterval);
+      previous = Volume(volume.dims, volume.type, volume.spacing);
+    } else if (volume.dims != previous.getDims() || volume.type != previous.getType()) {
+      std::cerr << "Timestep " << frames.size() << " of " << filePath
+                << " differs in size or type from the first" << std::endl;
+      throw std::runtime_error("TemporalWriter: timestep mismatch");
+    }
+
+    const glm::ivec3 grid(header.brickGrid[0], header.brickGrid[1], header.brickGrid[2]);
+    const size_t brickCount = header.brickCount;
+    const size_t voxelSize = getVoxelSize(volume.type);
+    const size_t maxBrickBytes = static_cast<size_t>(brickSize) * brickSize * brickSize * voxelSize;
+    const bool keyframe = frames.size() % keyframeInterval == 0;
+
+    TemporalFrame frame = {offset, 0, 0, keyframe ? TemporalFrame::keyframe : 0};
+    std::vector<uint64_t> mask(getMaskWords(brickCount), 0);
+    std::vector<uint32_t> sizes;
+
+    // Compare and encode in batches so memory stays bounded, write each batch in order
+    const size_t batchSize = 4 * static_cast<size_t>(pool.getThreadCount());
+    std::vector<EncodedBrick> batch(batchSize);
+    for (size_t first = 0; first < brickCount; first += batchSize) {
+      const size_t last = std::min(brickCount, first + batchSize);
+      pool.parallelFor(first, last, 1, [&](size_t begin, size_t end) {
+        std::vector<std::byte> current(maxBrickBytes), prior(maxBrickBytes), delta(maxBrickBytes);
+        for (size_t i = begin; i < end; i++) {
+          const glm::ivec3 brick(i % grid.x, (i / grid.x) % grid.y, i / (size_t(grid.x) * grid.y));
+          const glm::ivec3 origin = brick * brickSize;
+          const glm::ivec3 extent = glm::min(volume.dims - origin, glm::ivec3(brickSize));
+          const size_t bytes = static_cast<size_t>(extent.x) * extent.y * extent.z * voxelSize;
+          auto &encoded = batch[i - first];
+          extractBrick(volume.data, volume.dims, voxelSize, origin, extent, current.data());
+          if (keyframe) {
+            std::memcpy(delta.data(), current.data(), bytes);
+            encoded.changed = true;
+          } else {
+            extractBrick(previous.getData(), volume.dims, voxelSize, origin, extent, prior.data());
+            encoded.changed = std::memcmp(current.data(), prior.data(), bytes) != 0;
+            if (encoded.changed) {
+              encodeDelta(volume.type, current.data(), prior.data(), delta.data(), bytes / voxelSize);
+            }
+          }
+          const bool zero = std::all_of(delta.begin(), delta.begin() + bytes,
+                                        [](std::byte b) { return b == std::byte(0); });
+          encoded.data = !encoded.changed || zero
+                             ? std::vector<std::byte>()
+                             : compressBrick(codec, delta.data(), bytes, level);
+        }
+      });
+
+      for (size_t i = first; i < last; i++) {
+        auto &encoded = batch[i - first];
+        if (!encoded.changed) {
+          continue;
+        }
+        mask[i / 64] |= uint64_t(1) << (i % 64);
+        sizes.push_back(static_cast<uint32_t>(encoded.data.size()));
+        ofs.write(reinterpret_cast<const char *>(encoded.data.data()), encoded.data.size());
+        offset += encoded.data.size();
+        encoded.data = std::vector<std::byte>();
+      }
+    }
+
+    // Index follows the frame's bricks
+    frame.indexOffset = offset;
+    frame.changed = static_cast<uint32_t>(sizes.size());
+    ofs.write(reinterpret_cast<const char *>(mask.data()), mask.size() * sizeof(uint64_t));
+    ofs.write(reinterpret_cast<const char *>(sizes.data()), sizes.size() * sizeof(uint32_t));
+    offset += mask.size() * sizeof(uint64_t) + sizes.size() * sizeof(uint32_t);
+    frames.push_back(frame);
+    if (!ofs) {
+      std::cerr << "Error writing " << filePath << std::endl;
+      throw std::runtime_error("TemporalWriter: write failed");
+    }
+
+    // Keep this timestep to diff the next one against
+    const size_t sliceBytes = static_cast<size_t>(volume.dims.x) * volume.dims.y * voxelSize;
+    std::byte *dst = previous.getMutableData();
+    pool.parallelFor(0, volume.dims.z, 16, [&](size_t begin, size_t end) {
+      std::memcpy(dst + begin * sliceBytes, volume.data + begin * sliceBytes, (end - begin) * sliceBytes);
+    });
+    return sizes.size();
+  }
+
+  size_t TemporalWriter::finish() {
+    header.timestepCount = static_cast<uint32_t>(frames.size());
+    header.tableOffset = offset;
+    ofs.write(reinterpret_cast<const char *>(frames.data()), frames.size() * sizeof(TemporalFrame));
+    ofs.seekp(0);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.close();
+    if (!ofs) {
+      std::cerr << "Error writing " << filePath << std::endl;
+      throw std::runtime_error("TemporalWriter: write failed");
+    }
+    return static_cast<size_t>(offset + frames.size() * sizeof(TemporalFrame));
+  }
+} // namespace CUDAVol
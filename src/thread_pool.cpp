@@ -0,0 +1,273 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  thread_pool.cpp
+
+  Thread pool definition.
+
+  November 2019
+*/
+
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+
+namespace CUDAVol {
+  namespace {
+    using Clock = std::chrono::high_resolution_clock;
+
+    // Pool and index of the worker running on this thread, if any
+    thread_local const ThreadPool *currentPool = nullptr;
+    thread_local size_t currentWorker = 0;
+
+    // Chunk ranges [lo, hi) packed into one word, so owner and thieves
+    // claim chunks with a single compare and swap
+    uint64_t packRange(size_t lo, size_t hi) {
+      return static_cast<uint64_t>(lo) | static_cast<uint64_t>(hi) << 32;
+    }
+
+    size_t getLo(uint64_t range) {
+      return static_cast<size_t>(range & UINT32_MAX);
+    }
+
+    size_t getHi(uint64_t range) {
+      return static_cast<size_t>(range >> 32);
+    }
+  } // namespace
+
+  double ParallelStats::getUtilization() const {
+    return time > 0.0 && participants > 0 ? std::min(busyTime / (time * participants), 1.0) : 0.0;
+  }
+
+  ThreadPool::ThreadPool(unsigned threadCount) : pending(0), stopping(false) {
+    if (threadCount == 0) {
+      threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threadCount; i++) {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    workers.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; i++) {
+      workers.emplace_back(&ThreadPool::work, this, static_cast<size_t>(i));
+    }
+  }
+
+  ThreadPool::~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    condition.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  void ThreadPool::enqueue(std::function<void()> task) {
+    // Workers push onto their own deque, anyone else onto the shared one
+    // Counted before it is queued, so pending never drops below zero
+    if (currentPool == this) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+      }
+      Queue &queue = *queues[currentWorker];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    } else {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+      pending++;
+    }
+    condition.notify_one();
+  }
+
+  bool ThreadPool::pop(size_t worker, std::function<void()> &task) {
+    // Own deque newest first, for locality, then the shared deque, then the
+    // oldest task of another worker
+    {
+      Queue &own = *queues[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        pending--;
+        return true;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!tasks.empty()) {
+        task = std::move(tasks.front());
+        tasks.pop_front();
+        pending--;
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+      Queue &victim = *queues[(worker + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        pending--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void ThreadPool::work(size_t worker) {
+    currentPool = this;
+    currentWorker = worker;
+    while (true) {
+      std::function<void()> task;
+      if (pop(worker, task)) {
+        task();
+        continue;
+      }
+
+      // Queued tasks are counted under the mutex, so no wakeup is lost
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this] { return stopping || pending.load() > 0; });
+      if (pending.load() == 0) {
+        return;
+      }
+    }
+  }
+
+  ParallelStats ThreadPool::parallelFor(size_t begin,
+                                        size_t end,
+                                        size_t grain,
+                                        const std::function<void(size_t, size_t)> &f) {
+    ParallelStats stats;
+    if (begin >= end) {
+      return stats;
+    }
+
+    // Chunk indices must fit half a word
+    grain = std::max<size_t>({grain, 1, (end - begin) / UINT32_MAX + 1});
+    const size_t chunkCount = (end - begin + grain - 1) / grain;
+    const size_t participants = std::min<size_t>(workers.size(), chunkCount - 1) + 1;
+
+    // Shared between participants; helpers that start after all chunks are
+    // claimed return immediately, so the state must outlive this call
+    struct State {
+      std::unique_ptr<std::atomic<uint64_t>[]> ranges;
+      std::atomic<size_t> done{0};
+      std::atomic<size_t> steals{0};
+      std::atomic<int64_t> busy{0};           // Nanoseconds
+      std::mutex mutex;
+      std::condition_variable condition;
+      std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+    state->ranges.reset(new std::atomic<uint64_t>[participants]);
+    for (size_t p = 0; p < participants; p++) {
+      state->ranges[p].store(packRange(chunkCount * p / participants, chunkCount * (p + 1) / participants));
+    }
+
+    // Owners take chunks from the front of their range; once it is empty
+    // they steal the back half of the largest one left, until none is
+    auto steal = [state, participants](size_t self) {
+      while (true) {
+        size_t victim = participants, most = 0;
+        uint64_t range = 0;
+        for (size_t p = 0; p < participants; p++) {
+          const uint64_t r = state->ranges[p].load();
+          if (p != self && getLo(r) < getHi(r) && getHi(r) - getLo(r) > most) {
+            victim = p;
+            most = getHi(r) - getLo(r);
+            range = r;
+          }
+        }
+        if (victim == participants) {
+          return false;
+        }
+        const size_t split = getHi(range) - (most + 1) / 2;
+        if (state->ranges[victim].compare_exchange_strong(range, packRange(getLo(range), split))) {
+          state->ranges[self].store(packRange(split, getHi(range)));
+          state->steals.fetch_add(1);
+          return true;
+        }
+      }
+    };
+
+    auto run = [state, begin, end, grain, chunkCount, steal, &f](size_t self) {
+      std::atomic<uint64_t> &own = state->ranges[self];
+      while (true) {
+        uint64_t range = own.load();
+        while (getLo(range) < getHi(range) &&
+               !own.compare_exchange_weak(range, packRange(getLo(range) + 1, getHi(range)))) {
+        }
+        if (getLo(range) >= getHi(range)) {
+          if (!steal(self)) {
+            return;
+          }
+          continue;
+        }
+
+        const size_t first = begin + getLo(range) * grain;
+        const auto start = Clock::now();
+        try {
+          f(first, std::min(end, first + grain));
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (!state->error) {
+            state->error = std::current_exception();
+          }
+        }
+        state->busy.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        if (state->done.fetch_add(1) + 1 == chunkCount) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->condition.notify_all();
+        }
+      }
+    };
+
+    // Caller participates, so this cannot deadlock when called from a worker
+    const auto start = Clock::now();
+    for (size_t p = 1; p < participants; p++) {
+      enqueue([run, p] { run(p); });
+    }
+    run(0);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->condition.wait(lock, [&] { return state->done.load() == chunkCount; });
+    if (state->error) {
+      std::rethrow_exception(state->error);
+    }
+    stats.time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    stats.busyTime = state->busy.load() / 1e6;
+    stats.participants = static_cast<unsigned>(participants);
+    stats.chunks = chunkCount;
+    stats.steals = state->steals.load();
+    return stats;
+  }
+
+  unsigned ThreadPool::getThreadCount() const {
+    return static_cast<unsigned>(workers.size());
+  }
+} // namespace CUDAVol
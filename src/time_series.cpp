@@ -0,0 +1,225 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  time_series.cpp
+
+  Time series class definition.
+
+  November 2019
+*/
+
+#include "time_series.h"
+#include "volume_reader.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+namespace CUDAVol {
+  class FileTimestepSource : public TimestepSource {
+  private:
+    ThreadPool &pool;
+    std::vector<std::string> filePaths;
+
+  public:
+    FileTimestepSource(ThreadPool &pool, const std::vector<std::string> &filePaths)
+      : pool(pool), filePaths(filePaths) {
+      if (filePaths.empty()) {
+        std::cerr << "Time series needs at least one timestep" << std::endl;
+        throw std::runtime_error("TimestepSource: no timesteps");
+      }
+    }
+
+    void load(size_t timestep, size_t, Volume &volume) override {
+      // Files are independent; the previous timestep's mapping is dropped
+      volume = VolumeReader(pool).read(filePaths[timestep]);
+    }
+
+    size_t getTimestepCount() const override {
+      return filePaths.size();
+    }
+  };
+
+  std::unique_ptr<TimestepSource> TimestepSource::openFiles(
+      ThreadPool &pool, const std::vector<std::string> &filePaths) {
+    return std::make_unique<FileTimestepSource>(pool, filePaths);
+  }
+
+  std::unique_ptr<TimestepSource> TimestepSource::openDirectory(ThreadPool &pool,
+                                                                const std::string &directory) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> filePaths;
+    for (const auto &entry : fs::directory_iterator(resolveVolumePath(directory))) {
+      auto ext = entry.path().extension().string();
+      std::transform(ext.begin(), ext.end(), ext.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (entry.is_regular_file() &&
+          (ext == ".nrrd" || ext == ".nhdr" || ext == ".mhd" || ext == ".mha")) {
+        filePaths.push_back(entry.path().string());
+      }
+    }
+    std::sort(filePaths.begin(), filePaths.end(), naturalLess);
+    if (filePaths.empty()) {
+      std::cerr << "No .nrrd/.nhdr/.mhd/.mha timesteps found in " << directory << std::endl;
+      throw std::runtime_error("TimestepSource: no timesteps");
+    }
+    return openFiles(pool, filePaths);
+  }
+
+  TimeSeries::TimeSeries(ThreadPool &pool, std::unique_ptr<TimestepSource> source, int lookahead)
+    : pool(pool),
+      source(std::move(source)),
+      front(0),
+      timestep(0),
+      loads(0) {
+    // No point decoding further ahead than there are other timesteps
+    const size_t count = std::max<size_t>(this->source->getTimestepCount(), 2);
+    buffers = std::vector<Buffer>(std::clamp<size_t>(lookahead, 1, count - 1) + 1);
+    seek(0);
+  }
+
+  TimeSeries::~TimeSeries() {
+    // Loads refer to the buffers; let them finish
+    for (auto &buffer : buffers) {
+      if (buffer.pending.valid()) {
+        buffer.pending.wait();
+      }
+    }
+  }
+
+  void TimeSeries::schedule(Buffer &buffer, size_t timestep) {
+    const size_t previous = buffer.timestep;
+    buffer.target = timestep;
+    buffer.pending = pool.submit([this, &buffer, timestep, previous]() {
+      auto start = std::chrono::high_resolution_clock::now();
+      source->load(timestep, previous, buffer.volume);
+      auto end = std::chrono::high_resolution_clock::now();
+      return std::chrono::duration<double, std::milli>(end - start).count();
+    });
+  }
+
+  void TimeSeries::collect(Buffer &buffer, bool wait) {
+    if (!buffer.pending.valid() ||
+        (!wait && buffer.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)) {
+      return;
+    }
+    try {
+      double time = buffer.pending.get();
+      stats.loadTime += (time - stats.loadTime) / static_cast<double>(++loads);
+      buffer.timestep = buffer.target;
+    } catch (...) {
+      // Contents are undefined after a failed load
+      buffer.timestep = TimestepSource::noTimestep;
+      buffer.target = TimestepSource::noTimestep;
+      throw;
+    }
+  }
+
+  void TimeSeries::prefetch() {
+    const size_t count = source->getTimestepCount();
+    for (size_t i = 1; i < buffers.size() && i < count; i++) {
+      const size_t wanted = (timestep + i) % count;
+      auto isWanted = [&](const Buffer &b) { return b.target == wanted; };
+      if (std::any_of(buffers.begin(), buffers.end(), isWanted)) {
+        continue;
+      }
+
+      // Reuse a buffer holding a timestep that is behind us
+      for (size_t b = 0; b < buffers.size(); b++) {
+        auto distance = (buffers[b].target - timestep + count) % count;
+        if (b != front && !buffers[b].pending.valid() &&
+            (buffers[b].target == TimestepSource::noTimestep || distance >= buffers.size())) {
+          schedule(buffers[b], wanted);
+          break;
+        }
+      }
+    }
+  }
+
+  void TimeSeries::seek(size_t timestep) {
+    if (timestep >= source->getTimestepCount()) {
+      std::cerr << "Timestep " << timestep << " out of range" << std::endl;
+      throw std::runtime_error("TimeSeries: timestep out of range");
+    }
+    for (auto &buffer : buffers) {
+      collect(buffer, true);
+    }
+
+    // Show the buffer already holding it, or load into the current one
+    auto it = std::find_if(buffers.begin(), buffers.end(),
+                           [&](const Buffer &b) { return b.timestep == timestep; });
+    if (it == buffers.end()) {
+      it = buffers.begin() + front;
+      schedule(*it, timestep);
+      collect(*it, true);
+    }
+    front = static_cast<size_t>(it - buffers.begin());
+    this->timestep = timestep;
+    prefetch();
+  }
+
+  bool TimeSeries::advance(const std::function<void()> &beforeSwap) {
+    const size_t count = source->getTimestepCount();
+    if (count < 2) {
+      return false;
+    }
+    const size_t next = (timestep + 1) % count;
+    for (size_t b = 0; b < buffers.size(); b++) {
+      if (b == front || buffers[b].target != next) {
+        continue;
+      }
+      collect(buffers[b], false);
+      if (buffers[b].timestep != next) {
+        break;
+      }
+      if (beforeSwap) {
+        beforeSwap();
+      }
+      front = b;
+      timestep = next;
+      stats.swaps++;
+      prefetch();
+      return true;
+    }
+    stats.stalls++;
+    return false;
+  }
+
+  const Volume &TimeSeries::getCurrent() const {
+    return buffers[front].volume;
+  }
+
+  size_t TimeSeries::getTimestep() const {
+    return timestep;
+  }
+
+  size_t TimeSeries::getTimestepCount() const {
+    return source->getTimestepCount();
+  }
+
+  PlaybackStats TimeSeries::getStats() const {
+    return stats;
+  }
+} // namespace CUDAVol
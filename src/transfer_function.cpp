@@ -0,0 +1,75 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  transfer_function.cpp
+
+  Transfer function definition.
+
+  November 2019
+*/
+
+#include "transfer_function.h"
+#include <iostream>
+#include <utility>
+#include <stdexcept>
+
+namespace CUDAVol {
+  TransferFunction::TransferFunction()
+    : TransferFunction({{0.f, glm::vec4(0.f)},
+                        {0.15f, glm::vec4(0.f)},
+                        {0.3f, glm::vec4(0.9f, 0.5f, 0.3f, 0.02f)},
+                        {0.6f, glm::vec4(1.f, 0.9f, 0.8f, 0.2f)},
+                        {1.f, glm::vec4(1.f, 1.f, 1.f, 0.8f)}}) {}
+
+  TransferFunction::TransferFunction(std::vector<ControlPoint> points)
+    : points(std::move(points)), table(tableSize) {
+    if (this->points.empty()) {
+      std::cerr << "Transfer function needs at least one control point" << std::endl;
+      throw std::runtime_error("TransferFunction: no control points");
+    }
+    std::stable_sort(this->points.begin(), this->points.end(),
+                     [](const ControlPoint &a, const ControlPoint &b) { return a.value < b.value; });
+
+    // Constant beyond the first and last point, linear in between
+    size_t j = 0;
+    for (int i = 0; i < tableSize; i++) {
+      const float v = static_cast<float>(i) / (tableSize - 1);
+      while (j + 1 < this->points.size() && this->points[j + 1].value < v) {
+        j++;
+      }
+      const ControlPoint &a = this->points[j];
+      const ControlPoint &b = this->points[std::min(j + 1, this->points.size() - 1)];
+      const float span = b.value - a.value;
+      const float f = span > 0.f ? glm::clamp((v - a.value) / span, 0.f, 1.f) : (v < a.value ? 0.f : 1.f);
+      table[i] = glm::mix(a.color, b.color, f);
+    }
+  }
+
+  const std::vector<ControlPoint> &TransferFunction::getControlPoints() const {
+    return points;
+  }
+
+  const std::vector<glm::vec4> &TransferFunction::getTable() const {
+    return table;
+  }
+} // namespace CUDAVol
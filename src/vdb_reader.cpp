@@ -0,0 +1,466 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  vdb_reader.cpp
+
+  VDB reader definition.
+
+  November 2019
+*/
+
+#include "vdb_reader.h"
+#include <zlib.h>
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace CUDAVol {
+  // Format constants, see openvdb/io/io.h and openvdb/io/Compression.h
+  static constexpr int64_t vdbMagic = 0x56444220;
+  static constexpr uint32_t minFileVersion = 222;
+  static constexpr uint32_t compressZip = 0x1;
+  static constexpr uint32_t compressActiveMask = 0x2;
+  static constexpr uint32_t compressBlosc = 0x4;
+
+  // Per node layout of inactive values under active mask compression
+  enum MaskMetadata : int8_t {
+    NoMaskOrInactiveVals = 0,
+    NoMaskAndMinusBg = 1,
+    NoMaskAndOneInactiveVal = 2,
+    MaskAndNoInactiveVals = 3,
+    MaskAndOneInactiveVal = 4,
+    MaskAndTwoInactiveVals = 5,
+    NoMaskAndAllVals = 6
+  };
+
+  // Node sizes of the 5-4-3 tree, as log2 of the side in children / voxels
+  static constexpr int upperLog2 = 5, lowerLog2 = 4, leafLog2 = 3;
+  static constexpr int lowerTotal = lowerLog2 + leafLog2;
+  static constexpr int upperTotal = upperLog2 + lowerTotal;
+
+  struct VdbLeaf {
+    glm::ivec3 origin;
+    uint64_t mask[8];
+    float values[512];     // z fastest, as stored
+  };
+
+  struct VdbTile {
+    glm::ivec3 origin;
+    int size;
+    float value;
+    bool active;
+  };
+
+  class VdbStream {
+  private:
+    std::ifstream ifs;
+    std::string filePath;
+
+  public:
+    uint32_t compression = 0;
+    size_t valueSize = 4;      // Bytes per stored value: 8 double, 4 float, 2 half
+    size_t fullSize = 4;       // Bytes per value outside node buffers
+    float background = 0.f;
+
+    VdbStream(const std::string &filePath)
+      : ifs(filePath, std::ios::in | std::ios::binary), filePath(filePath) {
+      if (!ifs.is_open()) {
+        fail("cannot open file");
+      }
+    }
+
+    [[noreturn]] void fail(const std::string &msg) const {
+      std::cerr << "Error reading VDB file " << filePath << ": " << msg << std::endl;
+      throw std::runtime_error("readVdb: " + msg);
+    }
+
+    void read(void *dst, size_t size) {
+      if (!ifs.read(reinterpret_cast<char *>(dst), static_cast<std::streamsize>(size))) {
+        fail("unexpected end of file");
+      }
+    }
+
+    template <typename T>
+    T read() {
+      T value;
+      read(&value, sizeof(T));
+      return value;
+    }
+
+    std::string readString() {
+      std::string str(read<uint32_t>(), '\0');
+      read(str.data(), str.size());
+      return str;
+    }
+
+    void seek(int64_t offset) {
+      ifs.seekg(offset);
+    }
+
+    void skip(int64_t size) {
+      ifs.seekg(size, std::ios::cur);
+    }
+
+    std::vector<uint64_t> readMask(size_t bits) {
+      std::vector<uint64_t> mask(bits / 64);
+      read(mask.data(), mask.size() * sizeof(uint64_t));
+      return mask;
+    }
+
+    // MetaMap: count, then name, type name and size-prefixed value per entry
+    void skipMetadata() {
+      for (uint32_t i = 0, n = read<uint32_t>(); i < n; i++) {
+        readString();
+        readString();
+        skip(read<uint32_t>());
+      }
+    }
+
+    static float toFloat(const std::byte *src, size_t size) {
+      if (size == 8) {
+        double d;
+        std::memcpy(&d, src, 8);
+        return static_cast<float>(d);
+      } else if (size == 4) {
+        float f;
+        std::memcpy(&f, src, 4);
+        return f;
+      }
+
+      // IEEE half
+      uint16_t h;
+      std::memcpy(&h, src, 2);
+      const uint32_t sign = (h & 0x8000u) << 16, exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+      uint32_t bits;
+      if (exponent == 0x1f) {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+      } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+      } else if (mantissa == 0) {
+        bits = sign;
+      } else {
+        float f = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -f : f;
+      }
+      float f;
+      std::memcpy(&f, &bits, 4);
+      return f;
+    }
+
+    float readFullValue() {
+      std::byte bytes[8];
+      read(bytes, fullSize);
+      return toFloat(bytes, fullSize);
+    }
+
+    // io::readData: raw or zlib payload of count values
+    void readValues(float *dst, size_t count) {
+      std::vector<std::byte> bytes(count * valueSize);
+      if (compression & compressBlosc) {
+        fail("Blosc compression is not supported, re-save with zip compression");
+      } else if (compression & compressZip) {
+        const int64_t zipped = read<int64_t>();
+        if (zipped <= 0) {
+          // Stored raw where compression did not pay off
+          if (static_cast<size_t>(-zipped) != bytes.size()) {
+            fail("unexpected uncompressed buffer size");
+          }
+          read(bytes.data(), bytes.size());
+        } else {
+          std::vector<std::byte> src(static_cast<size_t>(zipped));
+          read(src.data(), src.size());
+          uLongf size = static_cast<uLongf>(bytes.size());
+          if (uncompress(reinterpret_cast<Bytef *>(bytes.data()), &size,
+                         reinterpret_cast<const Bytef *>(src.data()),
+                         static_cast<uLong>(src.size())) != Z_OK ||
+              size != bytes.size()) {
+            fail("corrupt zip buffer");
+          }
+        }
+      } else {
+        read(bytes.data(), bytes.size());
+      }
+      for (size_t i = 0; i < count; i++) {
+        dst[i] = toFloat(bytes.data() + i * valueSize, valueSize);
+      }
+    }
+
+    // io::readCompressedValues: node values, possibly without inactive ones
+    void readNodeValues(float *dst, size_t count, const std::vector<uint64_t> &valueMask) {
+      const int8_t metadata = read<int8_t>();
+      float inactive1 = background;
+      float inactive0 = metadata == NoMaskOrInactiveVals ? background : -background;
+      if (metadata == NoMaskAndOneInactiveVal || metadata == MaskAndOneInactiveVal ||
+          metadata == MaskAndTwoInactiveVals) {
+        inactive0 = readFullValue();
+        if (metadata == MaskAndTwoInactiveVals) {
+          inactive1 = readFullValue();
+        }
+      }
+      std::vector<uint64_t> selection;
+      if (metadata == MaskAndNoInactiveVals || metadata == MaskAndOneInactiveVal ||
+          metadata == MaskAndTwoInactiveVals) {
+        selection = readMask(count);
+      }
+
+      size_t stored = count;
+      if ((compression & compressActiveMask) && metadata != NoMaskAndAllVals) {
+        stored = 0;
+        for (uint64_t word : valueMask) {
+          stored += std::bitset<64>(word).count();
+        }
+      }
+      if (stored == count) {
+        readValues(dst, count);
+        return;
+      }
+
+      std::vector<float> values(stored);
+      readValues(values.data(), stored);
+      for (size_t i = 0, j = 0; i < count; i++) {
+        if (valueMask[i / 64] >> (i % 64) & 1) {
+          dst[i] = values[j++];
+        } else {
+          dst[i] = !selection.empty() && (selection[i / 64] >> (i % 64) & 1) ? inactive1 : inactive0;
+        }
+      }
+    }
+  };
+
+  // Child n of an internal node lies at its local (x, y, z), z fastest
+  static glm::ivec3 getLocalCoord(size_t n, int log2) {
+    const int mask = (1 << log2) - 1;
+    return glm::ivec3(static_cast<int>(n >> (2 * log2)), static_cast<int>(n >> log2) & mask,
+                      static_cast<int>(n) & mask);
+  }
+
+  static void readTransform(VdbStream &s, glm::dvec3 &voxelSize) {
+    const std::string type = s.readString();
+    double v[18];
+    if (type == "ScaleMap" || type == "UniformScaleMap") {
+      s.read(v, 15 * sizeof(double));
+      voxelSize = glm::dvec3(v[0], v[1], v[2]);
+    } else if (type == "ScaleTranslateMap" || type == "UniformScaleTranslateMap") {
+      s.read(v, 18 * sizeof(double));
+      voxelSize = glm::dvec3(v[3], v[4], v[5]);
+    } else if (type == "TranslationMap") {
+      s.read(v, 3 * sizeof(double));
+      voxelSize = glm::dvec3(1.0);
+    } else if (type == "AffineMap" || type == "UnitaryMap") {
+      // Row-major, row vectors; rows 0-2 are the images of the index axes
+      double m[16];
+      s.read(m, sizeof(m));
+      for (int i = 0; i < 3; i++) {
+        voxelSize[i] = std::sqrt(m[4 * i] * m[4 * i] + m[4 * i + 1] * m[4 * i + 1] +
+                                 m[4 * i + 2] * m[4 * i + 2]);
+      }
+    } else {
+      s.fail("unsupported transform " + type);
+    }
+  }
+
+  SparseVolume readVdb(const std::string &filePath, const std::string &gridName) {
+    VdbStream s(resolveVolumePath(filePath));
+
+    // Archive header
+    if (s.read<int64_t>() != vdbMagic) {
+      s.fail("not a VDB file");
+    }
+    const uint32_t version = s.read<uint32_t>();
+    if (version < minFileVersion) {
+      s.fail("file format version " + std::to_string(version) + " is older than " +
+             std::to_string(minFileVersion));
+    }
+    s.read<uint32_t>();  // Library major version
+    s.read<uint32_t>();  // Library minor version
+    if (!s.read<char>()) {
+      s.fail("streamed archives without grid offsets are not supported");
+    }
+    s.skip(36);          // UUID
+    s.skipMetadata();
+
+    // Grid descriptors are interleaved with the grids; each ends where the next begins
+    struct Descriptor {
+      std::string name, type;
+      bool half;
+      int64_t gridPos, blockPos;
+    };
+    Descriptor grid = {};
+    bool found = false;
+    for (int32_t i = 0, n = s.read<int32_t>(); i < n && !found; i++) {
+      Descriptor d;
+      d.name = s.readString();
+      d.name = d.name.substr(0, d.name.find('\x1e'));
+      d.type = s.readString();
+      d.half = d.type.size() > 10 && d.type.compare(d.type.size() - 10, 10, "_HalfFloat") == 0;
+      if (d.half) {
+        d.type.resize(d.type.size() - 10);
+      }
+      const bool instance = !s.readString().empty();
+      d.gridPos = s.read<int64_t>();
+      d.blockPos = s.read<int64_t>();
+      const int64_t endPos = s.read<int64_t>();
+
+      const bool supported = (d.type == "Tree_float_5_4_3" || d.type == "Tree_double_5_4_3") && !instance;
+      if (gridName.empty() ? supported : d.name == gridName) {
+        if (!supported) {
+          s.fail("grid " + d.name + " of type " + d.type + " is not supported");
+        }
+        grid = d;
+        found = true;
+      }
+      s.seek(endPos);
+    }
+    if (!found) {
+      s.fail(gridName.empty() ? "no float or double grid" : "no grid named " + gridName);
+    }
+
+    // Grid header: compression, metadata, transform
+    s.seek(grid.gridPos);
+    s.compression = s.read<uint32_t>();
+    s.fullSize = grid.type == "Tree_double_5_4_3" ? 8 : 4;
+    s.valueSize = grid.half ? 2 : s.fullSize;
+    s.skipMetadata();
+    glm::dvec3 voxelSize(1.0);
+    readTransform(s, voxelSize);
+
+    // Topology: root tiles and children, upper and lower internal nodes, leaf masks
+    std::vector<VdbLeaf> leaves;
+    std::vector<VdbTile> tiles;
+    if (s.read<int32_t>() != 1) {
+      s.fail("unsupported buffer count");
+    }
+    s.background = s.readFullValue();
+    const uint32_t rootTiles = s.read<uint32_t>();
+    const uint32_t rootChildren = s.read<uint32_t>();
+    for (uint32_t i = 0; i < rootTiles; i++) {
+      glm::ivec3 origin;
+      s.read(&origin, sizeof(origin));
+      float value = s.readFullValue();
+      bool active = s.read<char>() != 0;
+      tiles.push_back({origin, 1 << upperTotal, value, active});
+    }
+
+    std::vector<float> values(size_t(1) << (3 * upperLog2));
+    auto readInternal = [&](auto &self, glm::ivec3 origin, int log2, int childTotal) -> void {
+      const size_t count = size_t(1) << (3 * log2);
+      const auto childMask = s.readMask(count);
+      const auto valueMask = s.readMask(count);
+      s.readNodeValues(values.data(), count, valueMask);
+      for (size_t n = 0; n < count; n++) {
+        const bool active = valueMask[n / 64] >> (n % 64) & 1;
+        if (!(childMask[n / 64] >> (n % 64) & 1) && (active || values[n] != s.background)) {
+          tiles.push_back({origin + (getLocalCoord(n, log2) << childTotal), 1 << childTotal, values[n], active});
+        }
+      }
+      for (size_t n = 0; n < count; n++) {
+        if (!(childMask[n / 64] >> (n % 64) & 1)) {
+          continue;
+        }
+        const glm::ivec3 child = origin + (getLocalCoord(n, log2) << childTotal);
+        if (log2 == upperLog2) {
+          self(self, child, lowerLog2, leafLog2);
+        } else {
+          VdbLeaf &leaf = leaves.emplace_back();
+          leaf.origin = child;
+          s.read(leaf.mask, sizeof(leaf.mask));
+        }
+      }
+    };
+    for (uint32_t i = 0; i < rootChildren; i++) {
+      glm::ivec3 origin;
+      s.read(&origin, sizeof(origin));
+      readInternal(readInternal, origin, upperLog2, lowerTotal);
+    }
+
+    // Leaf buffers follow in the same order
+    s.seek(grid.blockPos);
+    for (auto &leaf : leaves) {
+      const auto mask = s.readMask(512);
+      s.readNodeValues(leaf.values, 512, mask);
+    }
+
+    // Bounds of leaves and active tiles, in index space
+    glm::ivec3 lo(std::numeric_limits<int>::max()), hi(std::numeric_limits<int>::min());
+    for (const auto &leaf : leaves) {
+      lo = glm::min(lo, leaf.origin);
+      hi = glm::max(hi, leaf.origin + (1 << leafLog2));
+    }
+    for (const auto &tile : tiles) {
+      if (tile.active) {
+        lo = glm::min(lo, tile.origin);
+        hi = glm::max(hi, tile.origin + tile.size);
+      }
+    }
+    if (leaves.empty() && lo.x > hi.x) {
+      s.fail("grid " + grid.name + " is empty");
+    }
+
+    // Align tree coordinates to lower nodes so leaves and tiles map one to one
+    const glm::ivec3 base = (lo >> lowerTotal) << lowerTotal;
+    SparseVolume volume(hi - lo, VoxelType::Float32, glm::vec3(voxelSize), s.background, lo - base);
+    const glm::ivec3 treeEnd = hi - base;
+    auto inside = [&](glm::ivec3 q) {
+      return q.x >= 0 && q.y >= 0 && q.z >= 0 && q.x < treeEnd.x && q.y < treeEnd.y && q.z < treeEnd.z;
+    };
+    for (const auto &tile : tiles) {
+      // Split coarse tiles into the lower node sized tiles we keep
+      const int step = std::min(tile.size, SparseVolume::nodeDim);
+      for (int z = 0; z < tile.size; z += step) {
+        for (int y = 0; y < tile.size; y += step) {
+          for (int x = 0; x < tile.size; x += step) {
+            const glm::ivec3 q = tile.origin + glm::ivec3(x, y, z) - base;
+            if (!inside(q)) {
+              continue;
+            } else if (step == SparseVolume::nodeDim) {
+              volume.setNodeTile(q, tile.value, tile.active);
+            } else {
+              volume.setLeafTile(q, tile.value, tile.active);
+            }
+          }
+        }
+      }
+    }
+    for (const auto &leaf : leaves) {
+      const uint32_t index = volume.addLeaf(leaf.origin - base);
+      float *dst = reinterpret_cast<float *>(volume.getLeafData(index));
+      uint64_t *mask = volume.getLeafMask(index);
+      std::fill_n(mask, 8, 0);
+      for (int n = 0; n < 512; n++) {
+        // VDB leaves are z fastest, ours x fastest
+        const int m = (n >> 6) + ((n >> 3) & 7) * 8 + (n & 7) * 64;
+        dst[m] = leaf.values[n];
+        if (leaf.mask[n / 64] >> (n % 64) & 1) {
+          mask[m / 64] |= uint64_t(1) << (m % 64);
+        }
+      }
+    }
+    return volume;
+  }
+} // namespace CUDAVol
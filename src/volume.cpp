@@ -0,0 +1,178 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  volume.cpp
+
+  Volume definition.
+
+  November 2019
+*/
+
+#include "volume.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+namespace CUDAVol {
+  size_t getVoxelSize(VoxelType type) {
+    switch (type) {
+    case VoxelType::UInt8:
+      return 1;
+    case VoxelType::UInt16:
+      return 2;
+    case VoxelType::Float32:
+      return 4;
+    }
+    return 0;
+  }
+
+  VoxelType parseVoxelType(const std::string &str) {
+    if (str == "uint8" || str == "uchar" || str == "unsigned char") {
+      return VoxelType::UInt8;
+    } else if (str == "uint16" || str == "ushort" || str == "unsigned short") {
+      return VoxelType::UInt16;
+    } else if (str == "float32" || str == "float") {
+      return VoxelType::Float32;
+    }
+    std::cerr << "Unsupported voxel type " << str << std::endl;
+    throw std::runtime_error("parseVoxelType: unsupported type");
+  }
+
+  const char *toString(VoxelType type) {
+    switch (type) {
+    case VoxelType::UInt8:
+      return "uint8";
+    case VoxelType::UInt16:
+      return "uint16";
+    case VoxelType::Float32:
+      return "float32";
+    }
+    return "unknown";
+  }
+
+  std::string resolveVolumePath(const std::string &filePath) {
+    namespace fs = std::filesystem;
+    if (fs::path(filePath).is_absolute() || fs::exists(filePath)) {
+      return filePath;
+    }
+    if (auto p = fs::path(DATA_DIR) / "volumes" / filePath; fs::exists(p)) {
+      return p.string();
+    }
+    return filePath;
+  }
+
+  bool naturalLess(const std::string &a, const std::string &b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+      if (std::isdigit(static_cast<unsigned char>(a[i])) &&
+          std::isdigit(static_cast<unsigned char>(b[j]))) {
+        size_t ie = i, je = j;
+        while (ie < a.size() && std::isdigit(static_cast<unsigned char>(a[ie]))) ie++;
+        while (je < b.size() && std::isdigit(static_cast<unsigned char>(b[je]))) je++;
+        auto na = a.substr(i, ie - i), nb = b.substr(j, je - j);
+        na.erase(0, std::min(na.find_first_not_of('0'), na.size()));
+        nb.erase(0, std::min(nb.find_first_not_of('0'), nb.size()));
+        if (na.size() != nb.size()) {
+          return na.size() < nb.size();
+        } else if (na != nb) {
+          return na < nb;
+        }
+        i = ie;
+        j = je;
+      } else {
+        if (a[i] != b[j]) {
+          return a[i] < b[j];
+        }
+        i++;
+        j++;
+      }
+    }
+    return a.size() - i < b.size() - j;
+  }
+
+  Volume::Volume()
+    : offset(0), dims(0), type(VoxelType::UInt8), spacing(1.f) {}
+
+  Volume::Volume(const std::string &filePath,
+                 glm::ivec3 dims,
+                 VoxelType type,
+                 glm::vec3 spacing,
+                 size_t headerSize,
+                 MemoryMap::Access access)
+    : storage(resolveVolumePath(filePath), access),
+      offset(headerSize),
+      dims(dims),
+      type(type),
+      spacing(spacing) {
+    // Mapping is lazy, so the only validation we can afford is on size
+    if (offset + getSize() > storage.getSize()) {
+      std::cerr << "Volume " << filePath << " is " << storage.getSize()
+                << " bytes, expected at least " << offset + getSize()
+                << " for " << dims.x << "x" << dims.y << "x" << dims.z << " "
+                << toString(type) << std::endl;
+      throw std::runtime_error("Volume: file too small");
+    }
+  }
+
+  Volume::Volume(glm::ivec3 dims, VoxelType type, glm::vec3 spacing)
+    : storage(VolumeView{nullptr, dims, type, spacing}.getSize()),
+      offset(0),
+      dims(dims),
+      type(type),
+      spacing(spacing) {}
+
+  void Volume::advise(MemoryMap::Access access) const {
+    storage.advise(access, offset, getSize());
+  }
+
+  VolumeView Volume::getView() const {
+    return {getData(), dims, type, spacing};
+  }
+
+  const std::byte *Volume::getData() const {
+    return storage.getData() ? storage.getData() + offset : nullptr;
+  }
+
+  std::byte *Volume::getMutableData() {
+    return storage.isWritable() ? storage.getMutableData() + offset : nullptr;
+  }
+
+  glm::ivec3 Volume::getDims() const {
+    return dims;
+  }
+
+  VoxelType Volume::getType() const {
+    return type;
+  }
+
+  glm::vec3 Volume::getSpacing() const {
+    return spacing;
+  }
+
+  size_t Volume::getSize() const {
+    return static_cast<size_t>(dims.x) * static_cast<size_t>(dims.y) *
+           static_cast<size_t>(dims.z) * getVoxelSize(type);
+  }
+} // namespace CUDAVol
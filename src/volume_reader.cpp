@@ -0,0 +1,634 @@
+/*
+  Copyright (c) 2019 Mark van de Ruit
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  #############################################################################
+
+  volume_reader.cpp
+
+  Volume reader definition.
+
+  November 2019
+*/
+
+#include "volume_reader.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::high_resolution_clock;
+
+namespace CUDAVol {
+  // Element types as found on disk; anything the renderer cannot consume
+  // directly is converted to Float32
+  enum class ElementType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+  struct VolumeHeader {
+    glm::ivec3 dims = glm::ivec3(0);
+    glm::vec3 spacing = glm::vec3(1.f);
+    ElementType elementType = ElementType::UInt8;
+    bool bigEndian = false;
+    bool compressed = false;
+    std::string dataFile;
+    int64_t dataOffset = 0; // -1 means payload sits at the end of dataFile
+    int64_t compressedSize = -1;
+  };
+
+  static double elapsed(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  static std::string trim(const std::string &str) {
+    auto begin = str.find_first_not_of(" \t\r\n");
+    auto end = str.find_last_not_of(" \t\r\n");
+    return begin == std::string::npos ? "" : str.substr(begin, end - begin + 1);
+  }
+
+  static std::string lower(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return str;
+  }
+
+  [[noreturn]] static void fail(const std::string &filePath, const std::string &msg) {
+    std::cerr << "Error reading volume " << filePath << ": " << msg << std::endl;
+    throw std::runtime_error("VolumeReader: " + msg);
+  }
+
+  static size_t getElementSize(ElementType type) {
+    switch (type) {
+    case ElementType::Int8:
+    case ElementType::UInt8:
+      return 1;
+    case ElementType::Int16:
+    case ElementType::UInt16:
+      return 2;
+    case ElementType::Int32:
+    case ElementType::UInt32:
+    case ElementType::Float32:
+      return 4;
+    case ElementType::Float64:
+      return 8;
+    }
+    return 0;
+  }
+
+  static VoxelType getVoxelType(ElementType type) {
+    switch (type) {
+    case ElementType::UInt8:
+      return VoxelType::UInt8;
+    case ElementType::UInt16:
+      return VoxelType::UInt16;
+    default:
+      return VoxelType::Float32;
+    }
+  }
+
+  static bool isHostBigEndian() {
+    return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+  }
+
+  static bool needsConversion(const VolumeHeader &header) {
+    bool swap = header.bigEndian != isHostBigEndian() &&
+                getElementSize(header.elementType) > 1;
+    bool native = header.elementType == ElementType::UInt8 ||
+                  header.elementType == ElementType::UInt16 ||
+                  header.elementType == ElementType::Float32;
+    return swap || !native;
+  }
+
+  static std::vector<std::string> split(const std::string &str) {
+    std::vector<std::string> tokens;
+    std::istringstream iss(str);
+    for (std::string token; iss >> token;) {
+      tokens.push_back(token);
+    }
+    return tokens;
+  }
+
+  static glm::ivec3 parseDims(const std::string &filePath, const std::string &value) {
+    auto tokens = split(value);
+    if (tokens.size() != 3) {
+      fail(filePath, "only 3D volumes are supported, got sizes '" + value + "'");
+    }
+    return glm::ivec3(std::stoi(tokens[0]), std::stoi(tokens[1]), std::stoi(tokens[2]));
+  }
+
+  static std::string resolveDataFile(const std::string &headerPath,
+                                     const std::string &dataFile) {
+    fs::path p(dataFile);
+    return p.is_absolute() ? dataFile : (fs::path(headerPath).parent_path() / p).string();
+  }
+
+  static VolumeHeader parseNrrd(const std::string &filePath) {
+    std::ifstream ifs(filePath, std::ios::in | std::ios::binary);
+    if (!ifs.is_open()) {
+      fail(filePath, "cannot open file");
+    }
+
+    std::string line;
+    if (!std::getline(ifs, line) || line.compare(0, 4, "NRRD") != 0) {
+      fail(filePath, "missing NRRD magic");
+    }
+
+    VolumeHeader header;
+    header.dataFile = filePath;
+    bool endianGiven = false;
+    int lineSkip = 0;
+    while (std::getline(ifs, line)) {
+      line = trim(line);
+      if (line.empty()) {
+        break; // End of header, attached data follows
+      }
+      if (line[0] == '#' || line.find(":=") != std::string::npos) {
+        continue; // Comments and key/value pairs
+      }
+
+      auto sep = line.find(':');
+      if (sep == std::string::npos) {
+        continue;
+      }
+      auto field = lower(trim(line.substr(0, sep)));
+      auto value = trim(line.substr(sep + 1));
+
+      if (field == "dimension") {
+        if (std::stoi(value) != 3) {
+          fail(filePath, "only 3D volumes are supported, got dimension " + value);
+        }
+      } else if (field == "sizes") {
+        header.dims = parseDims(filePath, value);
+      } else if (field == "type") {
+        auto t = lower(value);
+        if (t == "signed char" || t == "int8" || t == "int8_t") {
+          header.elementType = ElementType::Int8;
+        } else if (t == "uchar" || t == "unsigned char" || t == "uint8" || t == "uint8_t") {
+          header.elementType = ElementType::UInt8;
+        } else if (t == "short" || t == "short int" || t == "signed short" ||
+                   t == "signed short int" || t == "int16" || t == "int16_t") {
+          header.elementType = ElementType::Int16;
+        } else if (t == "ushort" || t == "unsigned short" || t == "unsigned short int" ||
+                   t == "uint16" || t == "uint16_t") {
+          header.elementType = ElementType::UInt16;
+        } else if (t == "int" || t == "signed int" || t == "int32" || t == "int32_t") {
+          header.elementType = ElementType::Int32;
+        } else if (t == "uint" || t == "unsigned int" || t == "uint32" || t == "uint32_t") {
+          header.elementType = ElementType::UInt32;
+        } else if (t == "float") {
+          header.elementType = ElementType::Float32;
+        } else if (t == "double") {
+          header.elementType = ElementType::Float64;
+        } else {
+          fail(filePath, "unsupported type '" + value + "'");
+        }
+      } else if (field == "endian") {
+        header.bigEndian = lower(value) == "big";
+        endianGiven = true;
+      } else if (field == "encoding") {
+        auto e = lower(value);
+        if (e == "gzip" || e == "gz") {
+          header.compressed = true;
+        } else if (e != "raw") {
+          fail(filePath, "unsupported encoding '" + value + "'");
+        }
+      } else if (field == "spacings") {
+        auto tokens = split(value);
+        for (size_t i = 0; i < std::min<size_t>(3, tokens.size()); i++) {
+          if (lower(tokens[i]) != "nan") {
+            header.spacing[i] = std::stof(tokens[i]);
+          }
+        }
+      } else if (field == "space directions") {
+        // Spacing is the length of each axis direction vector
+        std::istringstream iss(value);
+        for (int i = 0; i < 3; i++) {
+          std::string vec;
+          if (!(iss >> vec) || vec == "none") {
+            continue;
+          }
+          std::replace(vec.begin(), vec.end(), '(', ' ');
+          std::replace(vec.begin(), vec.end(), ')', ' ');
+          std::replace(vec.begin(), vec.end(), ',', ' ');
+          float len = 0.f;
+          for (const auto &c : split(vec)) {
+            len += std::stof(c) * std::stof(c);
+          }
+          header.spacing[i] = std::sqrt(len);
+        }
+      } else if (field == "data file" || field == "datafile") {
+        if (value.compare(0, 4, "LIST") == 0 || split(value).size() > 1) {
+          fail(filePath, "multi-file NRRD data is not supported");
+        }
+        header.dataFile = resolveDataFile(filePath, value);
+      } else if (field == "byte skip" || field == "byteskip") {
+        header.dataOffset = std::stoll(value);
+      } else if (field == "line skip" || field == "lineskip") {
+        lineSkip = std::stoi(value);
+      }
+    }
+
+    if (!endianGiven && getElementSize(header.elementType) > 1 && !header.compressed &&
+        header.dataFile == filePath) {
+      header.bigEndian = isHostBigEndian();
+    }
+
+    // Attached payload starts right after the blank line ending the header
+    size_t lineOffset = 0;
+    if (header.dataFile == filePath) {
+      lineOffset = static_cast<size_t>(ifs.tellg());
+    } else if (lineSkip > 0) {
+      std::ifstream dfs(header.dataFile, std::ios::in | std::ios::binary);
+      for (int i = 0; i < lineSkip && std::getline(dfs, line); i++) {
+      }
+      lineOffset = static_cast<size_t>(dfs.tellg());
+    }
+
+    // Byte skip applies to the decoded stream for compressed data; only -1
+    // (payload at end of file) is meaningful there, and only for raw data
+    if (header.compressed) {
+      if (header.dataOffset != 0) {
+        fail(filePath, "byte skip on compressed data is not supported");
+      }
+      header.dataOffset = static_cast<int64_t>(lineOffset);
+    } else if (header.dataOffset >= 0) {
+      header.dataOffset += static_cast<int64_t>(lineOffset);
+    }
+    return header;
+  }
+
+  static VolumeHeader parseMhd(const std::string &filePath) {
+    std::ifstream ifs(filePath, std::ios::in | std::ios::binary);
+    if (!ifs.is_open()) {
+      fail(filePath, "cannot open file");
+    }
+
+    VolumeHeader header;
+    std::string line;
+    while (std::getline(ifs, line)) {
+      auto sep = line.find('=');
+      if (sep == std::string::npos) {
+        continue;
+      }
+      auto key = trim(line.substr(0, sep));
+      auto value = trim(line.substr(sep + 1));
+
+      if (key == "NDims") {
+        if (std::stoi(value) != 3) {
+          fail(filePath, "only 3D volumes are supported, got NDims " + value);
+        }
+      } else if (key == "DimSize") {
+        header.dims = parseDims(filePath, value);
+      } else if (key == "ElementType") {
+        if (value == "MET_CHAR") {
+          header.elementType = ElementType::Int8;
+        } else if (value == "MET_UCHAR") {
+          header.elementType = ElementType::UInt8;
+        } else if (value == "MET_SHORT") {
+          header.elementType = ElementType::Int16;
+        } else if (value == "MET_USHORT") {
+          header.elementType = ElementType::UInt16;
+        } else if (value == "MET_INT" || value == "MET_LONG") {
+          header.elementType = ElementType::Int32;
+        } else if (value == "MET_UINT" || value == "MET_ULONG") {
+          header.elementType = ElementType::UInt32;
+        } else if (value == "MET_FLOAT") {
+          header.elementType = ElementType::Float32;
+        } else if (value == "MET_DOUBLE") {
+          header.elementType = ElementType::Float64;
+        } else {
+          fail(filePath, "unsupported ElementType " + value);
+        }
+      } else if (key == "ElementNumberOfChannels") {
+        if (std::stoi(value) != 1) {
+          fail(filePath, "multi-channel volumes are not supported");
+        }
+      } else if (key == "ElementSpacing" || (key == "ElementSize" && header.spacing == glm::vec3(1.f))) {
+        auto tokens = split(value);
+        for (size_t i = 0; i < std::min<size_t>(3, tokens.size()); i++) {
+          header.spacing[i] = std::stof(tokens[i]);
+        }
+      } else if (key == "BinaryDataByteOrderMSB" || key == "ElementByteOrderMSB") {
+        header.bigEndian = lower(value) == "true";
+      } else if (key == "CompressedData") {
+        header.compressed = lower(value) == "true";
+      } else if (key == "CompressedDataSize") {
+        header.compressedSize = std::stoll(value);
+      } else if (key == "HeaderSize") {
+        header.dataOffset = std::stoll(value);
+      } else if (key == "ElementDataFile") {
+        // Always the last field; LOCAL means the payload follows in this file
+        if (value == "LOCAL") {
+          header.dataFile = filePath;
+          header.dataOffset = static_cast<int64_t>(ifs.tellg());
+        } else if (value.compare(0, 4, "LIST") == 0 || value.find('%') != std::string::npos) {
+          fail(filePath, "multi-file MetaImage data is not supported");
+        } else {
+          header.dataFile = resolveDataFile(filePath, value);
+        }
+        break;
+      }
+    }
+
+    if (header.dataFile.empty()) {
+      fail(filePath, "missing ElementDataFile");
+    }
+    return header;
+  }
+
+  template <typename S, typename D>
+  static void convertRange(const std::byte *src, std::byte *dst, size_t first, size_t last, bool swap) {
+    auto s = reinterpret_cast<const S *>(src);
+    auto d = reinterpret_cast<D *>(dst);
+    for (size_t i = first; i < last; i++) {
+      S v;
+      std::memcpy(&v, s + i, sizeof(S));
+      if (swap) {
+        auto bytes = reinterpret_cast<unsigned char *>(&v);
+        std::reverse(bytes, bytes + sizeof(S));
+      }
+      d[i] = static_cast<D>(v);
+    }
+  }
+
+  static void convert(ThreadPool &pool,
+                      const VolumeHeader &header,
+                      const std::byte *src,
+                      std::byte *dst) {
+    const bool swap = header.bigEndian != isHostBigEndian();
+    const size_t count = static_cast<size_t>(header.dims.x) * header.dims.y * header.dims.z;
+    pool.parallelFor(0, count, 1 << 20, [&](size_t first, size_t last) {
+      switch (header.elementType) {
+      case ElementType::Int8:
+        convertRange<int8_t, float>(src, dst, first, last, false);
+        break;
+      case ElementType::UInt8:
+        convertRange<uint8_t, uint8_t>(src, dst, first, last, false);
+        break;
+      case ElementType::Int16:
+        convertRange<int16_t, float>(src, dst, first, last, swap);
+        break;
+      case ElementType::UInt16:
+        convertRange<uint16_t, uint16_t>(src, dst, first, last, swap);
+        break;
+      case ElementType::Int32:
+        convertRange<int32_t, float>(src, dst, first, last, swap);
+        break;
+      case ElementType::UInt32:
+        convertRange<uint32_t, float>(src, dst, first, last, swap);
+        break;
+      case ElementType::Float32:
+        convertRange<float, float>(src, dst, first, last, swap);
+        break;
+      case ElementType::Float64:
+        convertRange<double, float>(src, dst, first, last, swap);
+        break;
+      }
+    });
+  }
+
+  // Reads [offset, offset + size) of a file into memory with parallel preads
+  static MemoryMap readPayload(ThreadPool &pool,
+                               const std::string &filePath,
+                               size_t offset,
+                               size_t size) {
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fail(filePath, "cannot open data file");
+    }
+    MemoryMap buffer(size);
+    std::byte *dst = buffer.getMutableData();
+    try {
+      pool.parallelFor(0, size, 8 << 20, [&](size_t first, size_t last) {
+        while (first < last) {
+          auto n = pread(fd, dst + first, last - first, static_cast<off_t>(offset + first));
+          if (n <= 0) {
+            fail(filePath, "short read on data file");
+          }
+          first += static_cast<size_t>(n);
+        }
+      });
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+    return buffer;
+  }
+
+  struct GzipBlock {
+    size_t srcOffset, srcSize, dstOffset, dstSize;
+  };
+
+  // Splits a BGZF-style stream (concatenated gzip members that each carry
+  // their compressed size in a 'BC' extra subfield) into independently
+  // decodable blocks. Returns false for any other gzip or zlib stream.
+  static bool splitGzipBlocks(const std::byte *src, size_t size, std::vector<GzipBlock> &blocks) {
+    auto u8 = [&](size_t i) { return static_cast<uint32_t>(src[i]); };
+    auto u16 = [&](size_t i) { return u8(i) | (u8(i + 1) << 8); };
+    auto u32 = [&](size_t i) { return u16(i) | (u16(i + 2) << 16); };
+
+    size_t offset = 0, dstOffset = 0;
+    while (offset < size) {
+      // Member header: ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2)
+      if (offset + 18 > size || u8(offset) != 0x1f || u8(offset + 1) != 0x8b ||
+          u8(offset + 2) != 8 || !(u8(offset + 3) & 4)) {
+        return false;
+      }
+      size_t xlen = u16(offset + 10), blockSize = 0;
+      for (size_t x = offset + 12; x + 4 <= offset + 12 + xlen && x + 4 <= size;) {
+        size_t slen = u16(x + 2);
+        if (u8(x) == 'B' && u8(x + 1) == 'C' && slen == 2) {
+          blockSize = u16(x + 4) + 1;
+        }
+        x += 4 + slen;
+      }
+      if (blockSize == 0 || offset + blockSize > size) {
+        return false;
+      }
+
+      // ISIZE trailer gives the decoded size, so output offsets are known
+      // without decoding anything
+      size_t dstSize = u32(offset + blockSize - 4);
+      blocks.push_back({offset, blockSize, dstOffset, dstSize});
+      offset += blockSize;
+      dstOffset += dstSize;
+    }
+    return !blocks.empty();
+  }
+
+  static bool inflateInto(const std::byte *src, size_t srcSize, std::byte *dst, size_t dstSize) {
+    z_stream stream{};
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) { // Detect gzip or zlib header
+      return false;
+    }
+
+    const size_t maxChunk = 1u << 30; // avail_in/out are 32 bit
+    size_t in = 0, out = 0;
+    int ret = Z_OK;
+    while (out < dstSize) {
+      if (stream.avail_in == 0 && in < srcSize) {
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<std::byte *>(src + in));
+        stream.avail_in = static_cast<uInt>(std::min(maxChunk, srcSize - in));
+        in += stream.avail_in;
+      }
+      stream.next_out = reinterpret_cast<Bytef *>(dst + out);
+      stream.avail_out = static_cast<uInt>(std::min(maxChunk, dstSize - out));
+      uInt availOut = stream.avail_out;
+      ret = inflate(&stream, Z_NO_FLUSH);
+      out += availOut - stream.avail_out;
+
+      if (ret == Z_STREAM_END) {
+        // Concatenated gzip members decode as one stream
+        if (out < dstSize && (stream.avail_in > 0 || in < srcSize)) {
+          inflateReset(&stream);
+          continue;
+        }
+        break;
+      } else if (ret != Z_OK && !(ret == Z_BUF_ERROR && stream.avail_in == 0 && in < srcSize)) {
+        break;
+      }
+    }
+    inflateEnd(&stream);
+    return out == dstSize;
+  }
+
+  static void inflateParallel(ThreadPool &pool,
+                              const std::string &filePath,
+                              const std::byte *src,
+                              size_t srcSize,
+                              std::byte *dst,
+                              size_t dstSize) {
+    std::vector<GzipBlock> blocks;
+    if (splitGzipBlocks(src, srcSize, blocks)) {
+      if (blocks.back().dstOffset + blocks.back().dstSize != dstSize) {
+        fail(filePath, "compressed block sizes do not match volume size");
+      }
+      pool.parallelFor(0, blocks.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+          const auto &b = blocks[i];
+          if (!inflateInto(src + b.srcOffset, b.srcSize, dst + b.dstOffset, b.dstSize)) {
+            fail(filePath, "corrupt compressed block");
+          }
+        }
+      });
+    } else if (!inflateInto(src, srcSize, dst, dstSize)) {
+      // A single deflate stream has no restart points, so it decodes on one
+      // core; write blocked gzip (e.g. bgzip) to decode in parallel
+      fail(filePath, "corrupt or truncated compressed data");
+    }
+  }
+
+  VolumeReader::VolumeReader(ThreadPool &pool) : pool(pool) {}
+
+  Volume VolumeReader::read(const std::string &filePath) {
+    timings = ReadTimings();
+    const auto path = resolveVolumePath(filePath);
+    const auto ext = lower(fs::path(path).extension().string());
+
+    VolumeHeader header;
+    if (ext == ".nrrd" || ext == ".nhdr") {
+      header = parseNrrd(path);
+    } else if (ext == ".mhd" || ext == ".mha") {
+      header = parseMhd(path);
+    } else {
+      fail(path, "unrecognized extension '" + ext + "'");
+    }
+    if (header.dims.x <= 0 || header.dims.y <= 0 || header.dims.z <= 0) {
+      fail(path, "missing or invalid dimensions");
+    }
+
+    const auto type = getVoxelType(header.elementType);
+    const size_t dataSize = static_cast<size_t>(header.dims.x) * header.dims.y *
+                            header.dims.z * getElementSize(header.elementType);
+    std::error_code ec;
+    const size_t fileSize = fs::file_size(header.dataFile, ec);
+    if (ec) {
+      fail(header.dataFile, "cannot stat data file");
+    }
+
+    // Raw payload: map it; in the common case that is all we need to do
+    if (!header.compressed) {
+      size_t offset = header.dataOffset < 0 ? fileSize - std::min(fileSize, dataSize)
+                                            : static_cast<size_t>(header.dataOffset);
+      auto start = Clock::now();
+      if (!needsConversion(header)) {
+        Volume volume(header.dataFile, header.dims, type, header.spacing, offset,
+                      MemoryMap::Access::WillNeed);
+        timings.read = elapsed(start);
+        return volume;
+      }
+
+      MemoryMap raw(header.dataFile, MemoryMap::Access::Sequential);
+      if (offset + dataSize > raw.getSize()) {
+        fail(header.dataFile, "file too small for volume dimensions");
+      }
+      Volume volume(header.dims, type, header.spacing);
+      timings.read = elapsed(start);
+
+      start = Clock::now();
+      convert(pool, header, raw.getData() + offset, volume.getMutableData());
+      timings.convert = elapsed(start);
+      return volume;
+    }
+
+    // Compressed payload: read, inflate, then convert if needed
+    auto start = Clock::now();
+    size_t offset = std::max<int64_t>(header.dataOffset, 0);
+    if (offset > fileSize) {
+      fail(header.dataFile, "data offset beyond end of file");
+    }
+    size_t srcSize = header.compressedSize > 0
+                         ? std::min<size_t>(header.compressedSize, fileSize - offset)
+                         : fileSize - offset;
+    auto payload = readPayload(pool, header.dataFile, offset, srcSize);
+    timings.read = elapsed(start);
+
+    start = Clock::now();
+    Volume volume(header.dims, type, header.spacing);
+    const bool convertAfter = needsConversion(header);
+    MemoryMap staging(convertAfter ? dataSize : 0);
+    std::byte *dst = convertAfter ? staging.getMutableData() : volume.getMutableData();
+    inflateParallel(pool, header.dataFile, payload.getData(), srcSize, dst, dataSize);
+    payload = MemoryMap();
+    timings.inflate = elapsed(start);
+
+    if (convertAfter) {
+      start = Clock::now();
+      convert(pool, header, staging.getData(), volume.getMutableData());
+      timings.convert = elapsed(start);
+    }
+    return volume;
+  }
+
+  const ReadTimings &VolumeReader::getTimings() const {
+    return timings;
+  }
+} // namespace CUDAVol